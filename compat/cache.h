@@ -0,0 +1,25 @@
+/*
+ * Minimal stand-in for git's cache.h, for building the importer outside
+ * of the git tree.  Only parse_date() is needed, and only for the ISO
+ * 8601 UTC dates svn writes into its dumps.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "git-compat-util.h"
+
+static inline int parse_date(const char *date, char *out, int maxlen)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(date, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+		   &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	return snprintf(out, maxlen, "%lu +0000", (unsigned long)timegm(&tm));
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Minimal stand-in for git's git-compat-util.h, for building the
+ * importer outside of the git tree.
+ */
+
+#ifndef GIT_COMPAT_UTIL_H
+#define GIT_COMPAT_UTIL_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GNUC__
+#define NORETURN __attribute__((__noreturn__))
+#define MAYBE_UNUSED __attribute__((__unused__))
+#else
+#define NORETURN
+#define MAYBE_UNUSED
+#endif
+
+static inline NORETURN void die(const char *err, ...)
+{
+	va_list params;
+	fputs("fatal: ", stderr);
+	va_start(params, err);
+	vfprintf(stderr, err, params);
+	va_end(params);
+	fputc('\n', stderr);
+	exit(128);
+}
+
+static inline NORETURN void die_errno(const char *err, ...)
+{
+	char msg[1024];
+	int errno_save = errno;
+	va_list params;
+	va_start(params, err);
+	vsnprintf(msg, sizeof(msg), err, params);
+	va_end(params);
+	die("%s: %s", msg, strerror(errno_save));
+}
+
+static inline void *xmalloc(size_t size)
+{
+	void *ret = malloc(size);
+	if (!ret && !size)
+		ret = malloc(1);
+	if (!ret)
+		die("Out of memory, malloc failed");
+	return ret;
+}
+
+static inline void *xcalloc(size_t nmemb, size_t size)
+{
+	void *ret = calloc(nmemb, size);
+	if (!ret && (!nmemb || !size))
+		ret = calloc(1, 1);
+	if (!ret)
+		die("Out of memory, calloc failed");
+	return ret;
+}
+
+static inline void *xrealloc(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret && !size)
+		ret = realloc(ptr, 1);
+	if (!ret)
+		die("Out of memory, realloc failed");
+	return ret;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Minimal stand-in for git's strbuf.h, for building the importer
+ * outside of the git tree.  Only the calls the importer makes are
+ * provided, with the same semantics as git's.
+ */
+
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include "git-compat-util.h"
+
+struct strbuf {
+	size_t alloc;
+	size_t len;
+	char *buf;
+};
+
+static char strbuf_slopbuf[1];
+#define STRBUF_INIT  { 0, 0, strbuf_slopbuf }
+
+static inline void strbuf_grow(struct strbuf *sb, size_t extra)
+{
+	if (sb->len + extra + 1 <= sb->alloc)
+		return;
+	if (!sb->alloc)
+		sb->buf = NULL;
+	sb->alloc = (sb->len + extra + 1 + 16) * 3 / 2;
+	sb->buf = xrealloc(sb->buf, sb->alloc);
+}
+
+static inline void strbuf_init(struct strbuf *sb, size_t hint)
+{
+	sb->alloc = sb->len = 0;
+	sb->buf = strbuf_slopbuf;
+	if (hint)
+		strbuf_grow(sb, hint);
+}
+
+static inline void strbuf_setlen(struct strbuf *sb, size_t len)
+{
+	sb->len = len;
+	sb->buf[len] = '\0';
+}
+
+#define strbuf_reset(sb)  strbuf_setlen(sb, 0)
+
+static inline void strbuf_release(struct strbuf *sb)
+{
+	if (sb->alloc)
+		free(sb->buf);
+	strbuf_init(sb, 0);
+}
+
+static inline void strbuf_add(struct strbuf *sb, const void *data, size_t len)
+{
+	strbuf_grow(sb, len);
+	memcpy(sb->buf + sb->len, data, len);
+	sb->len += len;
+	sb->buf[sb->len] = '\0';
+}
+
+static inline void strbuf_addstr(struct strbuf *sb, const char *s)
+{
+	strbuf_add(sb, s, strlen(s));
+}
+
+static inline void strbuf_addch(struct strbuf *sb, int c)
+{
+	strbuf_grow(sb, 1);
+	sb->buf[sb->len++] = c;
+	sb->buf[sb->len] = '\0';
+}
+
+#ifdef __GNUC__
+__attribute__((format (printf, 2, 3)))
+#endif
+static inline void strbuf_addf(struct strbuf *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	strbuf_grow(sb, 64);
+	va_start(ap, fmt);
+	len = vsnprintf(sb->buf + sb->len, sb->alloc - sb->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		die("your vsnprintf is broken");
+	if ((size_t)len >= sb->alloc - sb->len) {
+		strbuf_grow(sb, len);
+		va_start(ap, fmt);
+		len = vsnprintf(sb->buf + sb->len, sb->alloc - sb->len, fmt, ap);
+		va_end(ap);
+	}
+	sb->len += len;
+}
+
+#endif
@@ -4,6 +4,85 @@
 #include "svn_ra.h"
 
 #include "delta_editor.h"
+#include "fast_export.h"
+#include "repo_tree.h"
+#include "string_pool.h"
+
+/*
+ * The callbacks apply the replayed changes to the repo_tree of the
+ * active commit.  Text deltas are applied against the base text of a
+ * file, which is fetched through a separate session since the replay
+ * session is busy; the resulting full text is written out as a blob
+ * once the file is closed.
+ */
+
+struct dir_baton {
+	const char *path;
+	/* Where the directory comes from, NULL for new ones */
+	const char *base_path;
+	svn_revnum_t base_revision;
+};
+
+struct file_baton {
+	const char *path;
+	const char *base_path;
+	svn_revnum_t base_revision;
+	apr_pool_t *pool;
+	uint32_t mode;
+	int added, copied, mode_changed;
+	svn_stringbuf_t *text;
+};
+
+static svn_ra_session_t *base_session = NULL;
+static svn_revnum_t active_revision = 0;
+static uint32_t path_seq[REPO_MAX_PATH_DEPTH];
+static uint32_t src_seq[REPO_MAX_PATH_DEPTH];
+
+void delta_editor_init(svn_ra_session_t *session)
+{
+	base_session = session;
+}
+
+void delta_editor_start(svn_revnum_t revision)
+{
+	active_revision = revision;
+}
+
+static uint32_t *path_to_seq(const char *path, uint32_t *seq, apr_pool_t *pool)
+{
+	pool_tok_seq(REPO_MAX_PATH_DEPTH, seq, "/", apr_pstrdup(pool, path));
+	return seq;
+}
+
+/* Copy sources are absolute, session paths are not */
+static const char *relative_path(const char *path)
+{
+	while (*path == '/')
+		path++;
+	return path;
+}
+
+/* Copies can only come from trees the importer has committed */
+static svn_error_t *check_copy_source(const char *path, svn_revnum_t revision)
+{
+	if (!repo_has_revision(revision))
+		return svn_error_createf(SVN_ERR_FS_NO_SUCH_REVISION, NULL,
+		                         "Copy source %s@%ld is not in the "
+		                         "imported history", path, revision);
+	return SVN_NO_ERROR;
+}
+
+static const char *child_base_path(struct dir_baton *parent,
+                                   const char *path, apr_pool_t *pool)
+{
+	const char *name = strrchr(path, '/');
+	if (!parent->base_path)
+		return NULL;
+	name = name ? name + 1 : path;
+	if (!*parent->base_path)
+		return apr_pstrdup(pool, name);
+	return apr_pstrcat(pool, parent->base_path, "/", name, NULL);
+}
 
 svn_error_t *set_target_revision(void *edit_baton,
                                  svn_revnum_t target_revision,
@@ -16,12 +95,18 @@ svn_error_t *set_target_revision(void *edit_baton,
 svn_error_t *open_root(void *edit_baton, svn_revnum_t base_revision,
                        apr_pool_t *dir_pool, void **root_baton)
 {
+	struct dir_baton *db = apr_pcalloc(dir_pool, sizeof(*db));
+	db->path = "";
+	db->base_path = "";
+	db->base_revision = active_revision - 1;
+	*root_baton = db;
 	return SVN_NO_ERROR;
 }
 
 svn_error_t *delete_entry(const char *path, svn_revnum_t revision,
                           void *parent_baton, apr_pool_t *pool)
 {
+	repo_delete(path_to_seq(path, path_seq, pool));
 	return SVN_NO_ERROR;
 }
 
@@ -30,6 +115,20 @@ svn_error_t *add_directory(const char *path, void *parent_baton,
                            svn_revnum_t copyfrom_revision,
                            apr_pool_t *dir_pool, void **child_baton)
 {
+	struct dir_baton *db = apr_pcalloc(dir_pool, sizeof(*db));
+	db->path = apr_pstrdup(dir_pool, path);
+	path_to_seq(path, path_seq, dir_pool);
+	if (copyfrom_path && SVN_IS_VALID_REVNUM(copyfrom_revision)) {
+		SVN_ERR(check_copy_source(copyfrom_path, copyfrom_revision));
+		db->base_path = apr_pstrdup(dir_pool, relative_path(copyfrom_path));
+		db->base_revision = copyfrom_revision;
+		repo_copy(copyfrom_revision,
+		          path_to_seq(db->base_path, src_seq, dir_pool), path_seq);
+	} else {
+		db->base_path = NULL;
+		repo_add(path_seq, REPO_MODE_DIR, 0);
+	}
+	*child_baton = db;
 	return SVN_NO_ERROR;
 }
 
@@ -38,6 +137,12 @@ svn_error_t *open_directory(const char *path, void *parent_baton,
                             svn_revnum_t base_revision,
                             apr_pool_t *dir_pool, void **child_baton)
 {
+	struct dir_baton *parent = parent_baton;
+	struct dir_baton *db = apr_pcalloc(dir_pool, sizeof(*db));
+	db->path = apr_pstrdup(dir_pool, path);
+	db->base_path = child_base_path(parent, path, dir_pool);
+	db->base_revision = parent->base_revision;
+	*child_baton = db;
 	return SVN_NO_ERROR;
 }
 
@@ -63,6 +168,21 @@ svn_error_t *add_file(const char *path, void *parent_baton,
                       svn_revnum_t copyfrom_revision,
                       apr_pool_t *file_pool, void **file_baton)
 {
+	struct file_baton *fb = apr_pcalloc(file_pool, sizeof(*fb));
+	fb->path = apr_pstrdup(file_pool, path);
+	fb->pool = file_pool;
+	fb->added = 1;
+	fb->mode = REPO_MODE_BLB;
+	if (copyfrom_path && SVN_IS_VALID_REVNUM(copyfrom_revision)) {
+		SVN_ERR(check_copy_source(copyfrom_path, copyfrom_revision));
+		fb->base_path = apr_pstrdup(file_pool, relative_path(copyfrom_path));
+		fb->base_revision = copyfrom_revision;
+		fb->copied = 1;
+		fb->mode = repo_copy(copyfrom_revision,
+		                     path_to_seq(fb->base_path, src_seq, file_pool),
+		                     path_to_seq(path, path_seq, file_pool));
+	}
+	*file_baton = fb;
 	return SVN_NO_ERROR;
 }
 
@@ -70,6 +190,13 @@ svn_error_t *open_file(const char *path, void *parent_baton,
                        svn_revnum_t base_revision, apr_pool_t *file_pool,
                        void **file_baton)
 {
+	struct dir_baton *parent = parent_baton;
+	struct file_baton *fb = apr_pcalloc(file_pool, sizeof(*fb));
+	fb->path = apr_pstrdup(file_pool, path);
+	fb->pool = file_pool;
+	fb->base_path = child_base_path(parent, path, file_pool);
+	fb->base_revision = parent->base_revision;
+	*file_baton = fb;
 	return SVN_NO_ERROR;
 }
 
@@ -79,6 +206,23 @@ svn_error_t *apply_textdelta(void *file_baton,
                              svn_txdelta_window_handler_t *handler,
                              void **handler_baton)
 {
+	struct file_baton *fb = file_baton;
+	svn_stream_t *source;
+
+	if (fb->base_path && (fb->copied || !fb->added)) {
+		svn_stringbuf_t *base = svn_stringbuf_create("", fb->pool);
+		SVN_ERR(svn_ra_get_file(base_session, fb->base_path,
+		                        fb->base_revision,
+		                        svn_stream_from_stringbuf(base, fb->pool),
+		                        NULL, NULL, fb->pool));
+		source = svn_stream_from_stringbuf(base, fb->pool);
+	} else {
+		source = svn_stream_empty(fb->pool);
+	}
+
+	fb->text = svn_stringbuf_create("", fb->pool);
+	svn_txdelta_apply(source, svn_stream_from_stringbuf(fb->text, fb->pool),
+	                  NULL, fb->path, fb->pool, handler, handler_baton);
 	return SVN_NO_ERROR;
 }
 
@@ -86,12 +230,40 @@ svn_error_t *change_file_prop(void *file_baton, const char *name,
                               const svn_string_t *value,
                               apr_pool_t *pool)
 {
+	struct file_baton *fb = file_baton;
+	if (!strcmp(name, SVN_PROP_EXECUTABLE)) {
+		fb->mode = value ? REPO_MODE_EXE : REPO_MODE_BLB;
+		fb->mode_changed = 1;
+	} else if (!strcmp(name, SVN_PROP_SPECIAL)) {
+		fb->mode = value ? REPO_MODE_LNK : REPO_MODE_BLB;
+		fb->mode_changed = 1;
+	}
 	return SVN_NO_ERROR;
 }
 
 svn_error_t *close_file(void *file_baton, const char *text_checksum,
                         apr_pool_t *pool)
 {
+	struct file_baton *fb = file_baton;
+	uint32_t mark;
+
+	/* New empty files are added without a textdelta */
+	if (fb->added && !fb->copied && !fb->text)
+		fb->text = svn_stringbuf_create("", fb->pool);
+	mark = fb->text ? next_blob_mark() : 0;
+
+	path_to_seq(fb->path, path_seq, pool);
+	if (fb->added && !fb->copied) {
+		repo_add(path_seq, fb->mode, mark);
+	} else if (fb->mode_changed) {
+		repo_modify(path_seq, fb->mode, mark);
+	} else if (mark) {
+		fb->mode = repo_replace(path_seq, mark);
+	}
+
+	if (mark)
+		fast_export_blob_data(fb->mode, mark, fb->text->len,
+		                      fb->text->data);
 	return SVN_NO_ERROR;
 }
 
@@ -6,6 +6,9 @@
 #include "svn_client.h"
 #include "svn_ra.h"
 
+void delta_editor_init(svn_ra_session_t *session);
+void delta_editor_start(svn_revnum_t revision);
+
 svn_error_t *set_target_revision(void *edit_baton,
                                  svn_revnum_t target_revision,
                                  apr_pool_t *pool);
@@ -4,6 +4,7 @@
  */
 
 #include "git-compat-util.h"
+#include "strbuf.h"
 
 #include "fast_export.h"
 #include "line_buffer.h"
@@ -14,20 +15,19 @@
 
 static uint32_t first_commit_done;
 
-void fast_export_delete(uint32_t depth, uint32_t *path)
+void fast_export_delete(uint32_t depth, uint32_t *path, struct strbuf *out)
 {
-	putchar('D');
-	putchar(' ');
-	pool_print_seq(depth, path, '/', stdout);
-	putchar('\n');
+	strbuf_addstr(out, "D ");
+	pool_print_seq(depth, path, '/', out);
+	strbuf_addch(out, '\n');
 }
 
 void fast_export_modify(uint32_t depth, uint32_t *path, uint32_t mode,
-						uint32_t mark)
+						uint32_t mark, struct strbuf *out)
 {
-	printf("M %06o :%d ", mode, mark);
-	pool_print_seq(depth, path, '/', stdout);
-	putchar('\n');
+	strbuf_addf(out, "M %06o :%d ", mode, mark);
+	pool_print_seq(depth, path, '/', out);
+	strbuf_addch(out, '\n');
 }
 
 static char gitsvnline[MAX_GITSVN_LINE_LEN];
@@ -61,14 +61,26 @@ void fast_export_commit(uint32_t revision, uint32_t author, char *log,
 	printf("progress Imported commit %d.\n\n", revision);
 }
 
-void fast_export_blob(uint32_t mode, uint32_t mark, uint32_t len)
+void fast_export_blob(uint32_t mode, uint32_t mark, uint64_t len)
 {
 	if (mode == REPO_MODE_LNK) {
 		/* svn symlink blobs start with "link " */
 		buffer_skip_bytes(5);
 		len -= 5;
 	}
-	printf("blob\nmark :%d\ndata %d\n", mark, len);
+	printf("blob\nmark :%d\ndata %"PRIu64"\n", mark, len);
 	buffer_copy_bytes(len);
 	fputc('\n', stdout);
 }
+
+void fast_export_blob_data(uint32_t mode, uint32_t mark, uint64_t len,
+                           const char *data)
+{
+	if (mode == REPO_MODE_LNK && len >= 5) {
+		data += 5;
+		len -= 5;
+	}
+	printf("blob\nmark :%d\ndata %"PRIu64"\n", mark, len);
+	fwrite(data, 1, len, stdout);
+	fputc('\n', stdout);
+}
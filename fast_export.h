@@ -2,13 +2,18 @@
 #define FAST_EXPORT_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 
-void fast_export_delete(uint32_t depth, uint32_t *path);
+struct strbuf;
+
+void fast_export_delete(uint32_t depth, uint32_t *path, struct strbuf *out);
 void fast_export_modify(uint32_t depth, uint32_t *path, uint32_t mode,
-                        uint32_t mark);
+                        uint32_t mark, struct strbuf *out);
 void fast_export_commit(uint32_t revision, uint32_t author, char *log,
                         uint32_t uuid, uint32_t url, unsigned long timestamp);
-void fast_export_blob(uint32_t mode, uint32_t mark, uint32_t len);
+void fast_export_blob(uint32_t mode, uint32_t mark, uint64_t len);
+void fast_export_blob_data(uint32_t mode, uint32_t mark, uint64_t len,
+                           const char *data);
 
 #endif
@@ -12,7 +12,7 @@
 #define COPY_BUFFER_LEN 4096
 
 /* Create memory pool for char sequence of known length */
-obj_pool_gen(blob, char, 4096);
+obj_pool_gen(blob, char, obj_pool_large_t, 4096);
 
 static char line_buffer[LINE_BUFFER_LEN];
 static char byte_buffer[COPY_BUFFER_LEN];
@@ -48,7 +48,7 @@ char *buffer_read_line(void)
 
 	end = memchr(line_buffer, '\n', line_buffer_len);
 	while (line_buffer_len < LINE_BUFFER_LEN - 1 &&
-	       !feof(infile) && ferror(infile) && NULL == end) {
+	       !feof(infile) && !ferror(infile) && NULL == end) {
 		n_read = fread(&line_buffer[line_buffer_len], 1,
 			       LINE_BUFFER_LEN - 1 - line_buffer_len,
 			       infile);
@@ -92,7 +92,7 @@ char *buffer_read_string(uint32_t len)
 	return s;
 }
 
-void buffer_copy_bytes(uint32_t len)
+void buffer_copy_bytes(uint64_t len)
 {
 	uint32_t in;
 	if (line_buffer_len > line_len) {
@@ -111,7 +111,7 @@ void buffer_copy_bytes(uint32_t len)
 	}
 }
 
-void buffer_skip_bytes(uint32_t len)
+void buffer_skip_bytes(uint64_t len)
 {
 	uint32_t in;
 	if (line_buffer_len > line_len) {
@@ -8,6 +8,18 @@
 
 #include "git-compat-util.h"
 
+/*
+ * Offset type for pools whose total size can grow past 4 GB, i.e. the
+ * character pools holding strings, log messages and property values.
+ * Building with -DOBJ_POOL_64BIT widens these offsets to 64 bits; the
+ * default keeps the 32-bit layout, which packs more entries per cache line.
+ */
+#ifdef OBJ_POOL_64BIT
+typedef uint64_t obj_pool_large_t;
+#else
+typedef uint32_t obj_pool_large_t;
+#endif
+
 /*
  * The obj_pool_gen() macro generates a type-specific memory pool
  * implementation.
@@ -16,18 +28,25 @@
  *
  *   pre              : Prefix for generated functions (ex: string_).
  *   obj_t            : Type for treap data structure (ex: char).
+ *   offset_t         : Type for offsets into the pool (ex: uint32_t).
  *   intial_capacity  : The initial size of the memory pool (ex: 4096).
  *
+ * The offset type is also available as pre##_off_t, so that structures
+ * and treaps referring into the pool can use the same width.
+ *
+ * pre##_rewrite() replaces the backing file with the current contents of
+ * the pool, for offline passes that move or drop committed objects.
  */
-#define obj_pool_gen(pre, obj_t, initial_capacity) \
+#define obj_pool_gen(pre, obj_t, offset_t, initial_capacity) \
+typedef offset_t pre##_off_t; \
 static struct { \
-	uint32_t committed; \
-	uint32_t size; \
-	uint32_t capacity; \
+	offset_t committed; \
+	offset_t size; \
+	offset_t capacity; \
 	obj_t *base; \
 	FILE *file; \
 } pre##_pool = { 0, 0, 0, NULL, NULL}; \
-static void pre##_init(void) \
+static MAYBE_UNUSED void pre##_init(void) \
 { \
 	struct stat st; \
 	pre##_pool.file = fopen(#pre ".bin", "a+"); \
@@ -39,11 +58,13 @@ static void pre##_init(void) \
 	if (pre##_pool.capacity < initial_capacity) \
 		pre##_pool.capacity = initial_capacity; \
 	pre##_pool.base = malloc(pre##_pool.capacity * sizeof(obj_t)); \
-	fread(pre##_pool.base, sizeof(obj_t), pre##_pool.size, pre##_pool.file); \
+	if (fread(pre##_pool.base, sizeof(obj_t), pre##_pool.size, \
+		  pre##_pool.file) != pre##_pool.size) \
+		die_errno("cannot read " #pre ".bin"); \
 } \
-static uint32_t pre##_alloc(uint32_t count) \
+static MAYBE_UNUSED offset_t pre##_alloc(offset_t count) \
 { \
-	uint32_t offset; \
+	offset_t offset; \
 	if (pre##_pool.size + count > pre##_pool.capacity) { \
 		while (pre##_pool.size + count > pre##_pool.capacity) \
 			if (pre##_pool.capacity) \
@@ -57,30 +78,46 @@ static uint32_t pre##_alloc(uint32_t count) \
 	pre##_pool.size += count; \
 	return offset; \
 } \
-static void pre##_free(uint32_t count) \
+static MAYBE_UNUSED void pre##_free(offset_t count) \
 { \
 	pre##_pool.size -= count; \
 } \
-static uint32_t pre##_offset(obj_t *obj) \
+static MAYBE_UNUSED offset_t pre##_offset(obj_t *obj) \
 { \
 	return obj == NULL ? ~0 : obj - pre##_pool.base; \
 } \
-static obj_t *pre##_pointer(uint32_t offset) \
+static MAYBE_UNUSED obj_t *pre##_pointer(offset_t offset) \
 { \
 	return offset >= pre##_pool.size ? NULL : &pre##_pool.base[offset]; \
 } \
-static void pre##_commit(void) \
+static MAYBE_UNUSED void pre##_commit(void) \
 { \
 	pre##_pool.committed += fwrite(pre##_pool.base + pre##_pool.committed, \
 		sizeof(obj_t), pre##_pool.size - pre##_pool.committed, \
 		pre##_pool.file); \
 } \
-static void pre##_reset(void) \
+static MAYBE_UNUSED int pre##_rewrite(void) \
 { \
-	if (pre##_pool.base) { \
-		free(pre##_pool.base); \
-		fclose(pre##_pool.file); \
+	FILE *file = fopen(#pre ".bin.new", "w"); \
+	if (!file) \
+		return -1; \
+	if (fwrite(pre##_pool.base, sizeof(obj_t), pre##_pool.size, file) != \
+	    pre##_pool.size) { \
+		fclose(file); \
+		return -1; \
 	} \
+	if (fclose(file) || rename(#pre ".bin.new", #pre ".bin")) \
+		return -1; \
+	fclose(pre##_pool.file); \
+	pre##_pool.file = fopen(#pre ".bin", "a+"); \
+	pre##_pool.committed = pre##_pool.size; \
+	return 0; \
+} \
+static MAYBE_UNUSED void pre##_reset(void) \
+{ \
+	free(pre##_pool.base); \
+	if (pre##_pool.file) \
+		fclose(pre##_pool.file); \
 	pre##_pool.base = NULL; \
 	pre##_pool.size = 0; \
 	pre##_pool.capacity = 0; \
@@ -4,6 +4,7 @@
  */
 
 #include "git-compat-util.h"
+#include "strbuf.h"
 
 #include "string_pool.h"
 #include "repo_tree.h"
@@ -12,6 +13,10 @@
 
 #include "trp.h"
 
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
 struct repo_dirent {
 	uint32_t name_offset;
 	struct trp_node children;
@@ -28,14 +33,21 @@ struct repo_commit {
 };
 
 /* Generate memory pools for commit, dir and dirent */
-obj_pool_gen(commit, struct repo_commit, 4096);
-obj_pool_gen(dir, struct repo_dir, 4096);
-obj_pool_gen(dirent, struct repo_dirent, 4096);
+obj_pool_gen(commit, struct repo_commit, uint32_t, 4096);
+obj_pool_gen(dir, struct repo_dir, uint32_t, 4096);
+obj_pool_gen(dirent, struct repo_dirent, uint32_t, 4096);
 
-static int repo_dirent_name_cmp(const void *a, const void *b);
+static inline int repo_dirent_name_cmp(const struct repo_dirent *a,
+                                       const struct repo_dirent *b)
+{
+	uint32_t a_offset = a->name_offset;
+	uint32_t b_offset = b->name_offset;
+	return (a_offset > b_offset) - (a_offset < b_offset);
+}
 
 /* Build a Treap from the node_s structure (a trp_node w/ offset) */
-trp_gen(static, dirent_, struct repo_dirent, children, dirent, repo_dirent_name_cmp);
+trp_gen(static, dirent_, struct trp_root, struct repo_dirent, children, dirent,
+        repo_dirent_name_cmp);
 
 static uint32_t active_commit;
 static uint32_t _mark;
@@ -50,17 +62,10 @@ static struct repo_dir *repo_commit_root_dir(struct repo_commit *commit)
 	return dir_pointer(commit->root_dir_offset);
 }
 
-static struct repo_dirent *repo_first_dirent(struct repo_dir *dir)
+int repo_has_revision(uint32_t revision)
 {
-	return dirent_first(&dir->entries);
-}
-
-static int repo_dirent_name_cmp(const void *a, const void *b)
-{
-	const struct repo_dirent *dirent1 = a, *dirent2 = b;
-	uint32_t a_offset = dirent1->name_offset;
-	uint32_t b_offset = dirent2->name_offset;
-	return (a_offset > b_offset) - (a_offset < b_offset);
+	return revision < active_commit &&
+	       repo_commit_root_dir(commit_pointer(revision)) != NULL;
 }
 
 static int repo_dirent_is_dir(struct repo_dirent *dirent)
@@ -87,6 +92,29 @@ static struct repo_dir *repo_clone_dir(struct repo_dir *orig_dir)
 	return dir_pointer(new_o);
 }
 
+/*
+ * Dirs of the active commit resolved and cloned by the last write:
+ * dir[i] is reached from the root through path[0..i), for i <= len.
+ * Nodes of one revision tend to share long prefixes, so lookups resume
+ * from the longest matching prefix instead of the root.  A len of ~0
+ * means the root has not been cloned in this revision yet.
+ */
+static struct {
+	uint32_t len;
+	uint32_t path[REPO_MAX_PATH_DEPTH];
+	uint32_t dir[REPO_MAX_PATH_DEPTH];
+} dir_cache = { ~0 };
+
+/* Number of leading components of path, bar the last, found in the cache. */
+static uint32_t repo_dir_cache_match(uint32_t *path)
+{
+	uint32_t i = 0;
+	while (i < dir_cache.len && ~path[i] && ~path[i + 1] &&
+	       path[i] == dir_cache.path[i])
+		i++;
+	return i;
+}
+
 static struct repo_dirent *repo_read_dirent(uint32_t revision, uint32_t *path)
 {
 	uint32_t name = 0;
@@ -94,6 +122,16 @@ static struct repo_dirent *repo_read_dirent(uint32_t revision, uint32_t *path)
 	struct repo_dir *dir = NULL;
 	struct repo_dirent *dirent = NULL;
 	dir = repo_commit_root_dir(commit_pointer(revision));
+	if (!dir) {
+		fprintf(stderr, "Tree of revision %d was compacted away\n", revision);
+		dirent_free(1);
+		return NULL;
+	}
+	if (revision == active_commit && ~dir_cache.len) {
+		name = repo_dir_cache_match(path);
+		dir = dir_pointer(dir_cache.dir[name]);
+		path += name;
+	}
 	while (~(name = *path++)) {
 		key->name_offset = name;
 		dirent = dirent_search(&dir->entries, key);
@@ -109,15 +147,21 @@ static void
 repo_write_dirent(uint32_t *path, uint32_t mode, uint32_t content_offset,
                   uint32_t del)
 {
-	uint32_t name, revision, dir_o = ~0, parent_dir_o = ~0;
+	uint32_t name, depth, revision, dir_o = ~0, parent_dir_o = ~0;
 	struct repo_dir *dir;
 	struct repo_dirent *key;
 	struct repo_dirent *dirent = NULL;
 	revision = active_commit;
-	dir = repo_commit_root_dir(commit_pointer(revision));
-	dir = repo_clone_dir(dir);
-	commit_pointer(revision)->root_dir_offset = dir_offset(dir);
-	while (~(name = *path++)) {
+	if (!~dir_cache.len) {
+		dir = repo_commit_root_dir(commit_pointer(revision));
+		dir = repo_clone_dir(dir);
+		commit_pointer(revision)->root_dir_offset = dir_offset(dir);
+		dir_cache.dir[0] = dir_offset(dir);
+		dir_cache.len = 0;
+	}
+	depth = repo_dir_cache_match(path);
+	dir = dir_pointer(dir_cache.dir[depth]);
+	while (~(name = path[depth])) {
 		parent_dir_o = dir_offset(dir);
 
 		key = dirent_pointer(dirent_alloc(1));
@@ -149,7 +193,11 @@ repo_write_dirent(uint32_t *path, uint32_t mode, uint32_t content_offset,
 		dir = repo_dir_from_dirent(dirent);
 		dir = repo_clone_dir(dir);
 		dirent->content_offset = dir_offset(dir);
+		dir_cache.path[depth] = name;
+		dir_cache.dir[++depth] = dir_offset(dir);
 	}
+	/* The last component is overwritten (or deleted) below. */
+	dir_cache.len = depth ? depth - 1 : 0;
 	if (dirent == NULL)
 		return;
 	dirent->mode = mode;
@@ -203,83 +251,265 @@ void repo_delete(uint32_t *path)
 	repo_write_dirent(path, 0, 0, 1);
 }
 
-static void repo_git_add_r(uint32_t depth, uint32_t *path, struct repo_dir *dir);
+/*
+ * When more than one diff thread is configured, changed subtrees at
+ * this depth are diffed as separate tasks.  Committed dirs and dirents
+ * are never modified, so tasks only read the pools; each task prints
+ * into its own buffer and the buffers are written out in the order the
+ * serial walk would have produced them.  Threads are only started when
+ * enough subtrees have changed to make up for their start-up cost;
+ * otherwise the tasks are diffed in order, straight to stdout.
+ */
+#define REPO_DIFF_TASK_DEPTH 2
+#define REPO_DIFF_MIN_TASKS 8
+#define REPO_MAX_DIFF_THREADS 32
+#define REPO_DIFF_FLUSH_SIZE 8192
+
+struct repo_diff_chunk {
+	struct strbuf out;
+	/* Task description; path is NULL for chunks of plain output. */
+	uint32_t depth;
+	uint32_t *path;
+	struct repo_dir *dir1;
+	struct repo_dir *dir2;
+};
+
+static struct {
+	struct repo_diff_chunk **chunks;
+	uint32_t nr, alloc;
+	uint32_t tasks, next;
+	int active;
+} diff_queue;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t diff_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static uint32_t diff_threads = 1;
+
+/* Output that needs no reordering, flushed to stdout as it grows. */
+static struct strbuf diff_stdout = STRBUF_INIT;
+
+static void repo_git_add_r(struct strbuf **out, uint32_t depth,
+                           uint32_t *path, struct repo_dir *dir);
+static void repo_diff_r(struct strbuf **out, uint32_t depth, uint32_t *path,
+                        struct repo_dir *dir1, struct repo_dir *dir2);
+
+static void repo_diff_flush(struct strbuf *out, size_t limit)
+{
+	if (out != &diff_stdout || out->len < limit)
+		return;
+	fwrite(out->buf, 1, out->len, stdout);
+	strbuf_reset(out);
+}
+
+static struct repo_diff_chunk *repo_diff_chunk_new(void)
+{
+	struct repo_diff_chunk *chunk = xcalloc(1, sizeof(*chunk));
+	strbuf_init(&chunk->out, 0);
+	if (diff_queue.nr == diff_queue.alloc) {
+		diff_queue.alloc = diff_queue.alloc ? 2 * diff_queue.alloc : 64;
+		diff_queue.chunks = xrealloc(diff_queue.chunks,
+			diff_queue.alloc * sizeof(*diff_queue.chunks));
+	}
+	diff_queue.chunks[diff_queue.nr++] = chunk;
+	return chunk;
+}
+
+/* Diff (or add, if dir1 is NULL) a subtree, queueing it when possible. */
+static void repo_diff_subtree(struct strbuf **out, uint32_t depth,
+                              uint32_t *path, struct repo_dir *dir1,
+                              struct repo_dir *dir2)
+{
+	struct repo_diff_chunk *task;
+	if (!diff_queue.active || depth != REPO_DIFF_TASK_DEPTH) {
+		if (dir1)
+			repo_diff_r(out, depth, path, dir1, dir2);
+		else
+			repo_git_add_r(out, depth, path, dir2);
+		return;
+	}
+	task = repo_diff_chunk_new();
+	task->depth = depth;
+	task->path = xmalloc(REPO_MAX_PATH_DEPTH * sizeof(*task->path));
+	memcpy(task->path, path, depth * sizeof(*task->path));
+	task->dir1 = dir1;
+	task->dir2 = dir2;
+	diff_queue.tasks++;
+	*out = &repo_diff_chunk_new()->out;
+}
 
-static void repo_git_add(uint32_t depth, uint32_t *path, struct repo_dirent *dirent)
+static void repo_git_add(struct strbuf **out, uint32_t depth,
+                         uint32_t *path, struct repo_dirent *dirent)
 {
 	if (repo_dirent_is_dir(dirent)) {
-		repo_git_add_r(depth, path, repo_dir_from_dirent(dirent));
+		repo_diff_subtree(out, depth, path, NULL,
+		                  repo_dir_from_dirent(dirent));
 	} else {
-		fast_export_modify(depth, path, dirent->mode, dirent->content_offset);
+		fast_export_modify(depth, path, dirent->mode,
+		                   dirent->content_offset, *out);
+		repo_diff_flush(*out, REPO_DIFF_FLUSH_SIZE);
 	}
 }
 
-static void repo_git_add_r(uint32_t depth, uint32_t *path, struct repo_dir *dir)
+static void repo_git_add_r(struct strbuf **out, uint32_t depth,
+                           uint32_t *path, struct repo_dir *dir)
 {
-	struct repo_dirent *de = repo_first_dirent(dir);
+	struct dirent_iter it;
+	struct repo_dirent *de = dirent_iter_first(&it, &dir->entries);
 	while (de) {
 		path[depth] = de->name_offset;
-		repo_git_add(depth + 1, path, de);
-		de = dirent_next(&dir->entries, de);
+		repo_git_add(out, depth + 1, path, de);
+		de = dirent_iter_next(&it);
 	}
 }
 
-static void repo_diff_r(uint32_t depth, uint32_t *path, struct repo_dir *dir1,
-                        struct repo_dir *dir2)
+static void repo_diff_r(struct strbuf **out, uint32_t depth, uint32_t *path,
+                        struct repo_dir *dir1, struct repo_dir *dir2)
 {
+	struct dirent_iter it1, it2;
 	struct repo_dirent *de1, *de2;
-	de1 = repo_first_dirent(dir1);
-	de2 = repo_first_dirent(dir2);
+	de1 = dirent_iter_first(&it1, &dir1->entries);
+	de2 = dirent_iter_first(&it2, &dir2->entries);
 
 	while (de1 && de2) {
 		if (de1->name_offset < de2->name_offset) {
 			path[depth] = de1->name_offset;
-			fast_export_delete(depth + 1, path);
-			de1 = dirent_next(&dir1->entries, de1);
+			fast_export_delete(depth + 1, path, *out);
+			repo_diff_flush(*out, REPO_DIFF_FLUSH_SIZE);
+			de1 = dirent_iter_next(&it1);
 			continue;
 		} else if (de1->name_offset > de2->name_offset) {
 			path[depth] = de2->name_offset;
-			repo_git_add(depth + 1, path, de2);
-			de2 = dirent_next(&dir2->entries, de2);
+			repo_git_add(out, depth + 1, path, de2);
+			de2 = dirent_iter_next(&it2);
 			continue;
 		}
 		path[depth] = de1->name_offset;
 		if (de1->mode != de2->mode ||
 		    de1->content_offset != de2->content_offset) {
 			if (repo_dirent_is_dir(de1) && repo_dirent_is_dir(de2)) {
-				repo_diff_r(depth + 1, path,
-				            repo_dir_from_dirent(de1),
-				            repo_dir_from_dirent(de2));
+				repo_diff_subtree(out, depth + 1, path,
+				                  repo_dir_from_dirent(de1),
+				                  repo_dir_from_dirent(de2));
 			} else {
 				if (repo_dirent_is_dir(de1) != repo_dirent_is_dir(de2)) {
-					fast_export_delete(depth + 1, path);
+					fast_export_delete(depth + 1, path, *out);
 				}
-				repo_git_add(depth + 1, path, de2);
+				repo_git_add(out, depth + 1, path, de2);
 			}
 		}
-		de1 = dirent_next(&dir1->entries, de1);
-		de2 = dirent_next(&dir2->entries, de2);
+		de1 = dirent_iter_next(&it1);
+		de2 = dirent_iter_next(&it2);
 	}
 	while (de1) {
 		path[depth] = de1->name_offset;
-		fast_export_delete(depth + 1, path);
-		de1 = dirent_next(&dir1->entries, de1);
+		fast_export_delete(depth + 1, path, *out);
+		repo_diff_flush(*out, REPO_DIFF_FLUSH_SIZE);
+		de1 = dirent_iter_next(&it1);
 	}
 	while (de2) {
 		path[depth] = de2->name_offset;
-		repo_git_add(depth + 1, path, de2);
-		de2 = dirent_next(&dir2->entries, de2);
+		repo_git_add(out, depth + 1, path, de2);
+		de2 = dirent_iter_next(&it2);
 	}
 }
 
+static void repo_diff_task(struct repo_diff_chunk *task, struct strbuf *out)
+{
+	if (task->dir1)
+		repo_diff_r(&out, task->depth, task->path,
+		            task->dir1, task->dir2);
+	else
+		repo_git_add_r(&out, task->depth, task->path, task->dir2);
+}
+
+#ifndef NO_PTHREADS
+static struct repo_diff_chunk *repo_diff_next_task(void)
+{
+	struct repo_diff_chunk *chunk = NULL;
+	pthread_mutex_lock(&diff_queue_lock);
+	while (!chunk && diff_queue.next < diff_queue.nr) {
+		chunk = diff_queue.chunks[diff_queue.next++];
+		if (!chunk->path)
+			chunk = NULL;
+	}
+	pthread_mutex_unlock(&diff_queue_lock);
+	return chunk;
+}
+
+static void *repo_diff_worker(void *unused)
+{
+	struct repo_diff_chunk *task;
+	while ((task = repo_diff_next_task()))
+		repo_diff_task(task, &task->out);
+	return NULL;
+}
+#endif
+
+static void repo_diff_run_tasks(void)
+{
+	uint32_t i, nr_threads = 0;
+#ifndef NO_PTHREADS
+	pthread_t threads[REPO_MAX_DIFF_THREADS];
+	while (diff_queue.tasks >= REPO_DIFF_MIN_TASKS &&
+	       nr_threads + 1 < diff_threads &&
+	       nr_threads + 1 < diff_queue.tasks &&
+	       !pthread_create(&threads[nr_threads], NULL,
+	                       repo_diff_worker, NULL))
+		nr_threads++;
+	if (nr_threads) {
+		repo_diff_worker(NULL);
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+	}
+#endif
+	for (i = 0; i < diff_queue.nr; i++) {
+		struct repo_diff_chunk *chunk = diff_queue.chunks[i];
+		fwrite(chunk->out.buf, 1, chunk->out.len, stdout);
+		if (!nr_threads && chunk->path) {
+			repo_diff_task(chunk, &diff_stdout);
+			repo_diff_flush(&diff_stdout, 0);
+		}
+		strbuf_release(&chunk->out);
+		free(chunk->path);
+		free(chunk);
+	}
+	diff_queue.nr = diff_queue.tasks = diff_queue.next = 0;
+}
+
+void repo_set_diff_threads(uint32_t threads)
+{
+#ifdef NO_PTHREADS
+	threads = 1;
+#endif
+	if (threads < 1)
+		threads = 1;
+	if (threads > REPO_MAX_DIFF_THREADS)
+		threads = REPO_MAX_DIFF_THREADS;
+	diff_threads = threads;
+}
+
 static uint32_t path_stack[REPO_MAX_PATH_DEPTH];
 
 void repo_diff(uint32_t r1, uint32_t r2)
 {
-	repo_diff_r(0,
+	struct strbuf *out = &diff_stdout;
+	if (diff_threads > 1) {
+		out = &repo_diff_chunk_new()->out;
+		diff_queue.active = 1;
+	}
+	repo_diff_r(&out,
+	            0,
 	            path_stack,
 	            repo_commit_root_dir(commit_pointer(r1)),
 	            repo_commit_root_dir(commit_pointer(r2)));
+	if (diff_queue.active) {
+		repo_diff_run_tasks();
+		diff_queue.active = 0;
+	} else {
+		repo_diff_flush(out, 0);
+	}
 }
 
 void repo_commit(uint32_t revision, uint32_t author, char *log, uint32_t uuid,
@@ -293,6 +523,117 @@ void repo_commit(uint32_t revision, uint32_t author, char *log, uint32_t uuid,
 	active_commit = commit_alloc(1);
 	commit_pointer(active_commit)->root_dir_offset =
 		commit_pointer(active_commit - 1)->root_dir_offset;
+	dir_cache.len = ~0;
+}
+
+static struct {
+	uint32_t *dir_map;
+	uint32_t *dir_start;
+	uint32_t *name_map;
+	struct repo_dirent *entries;
+	uint32_t nr_dirs, nr_entries, alloc_entries;
+} compact;
+
+/* Number the dirs reachable from dir_o in depth-first order. */
+static void repo_compact_mark(uint32_t dir_o)
+{
+	struct dirent_iter it;
+	struct repo_dirent *de;
+	uint32_t i, first, last;
+	if (dir_o >= dir_pool.size || ~compact.dir_map[dir_o])
+		return;
+	compact.dir_map[dir_o] = compact.nr_dirs;
+	compact.dir_start[compact.nr_dirs++] = first = compact.nr_entries;
+	de = dirent_iter_first(&it, &dir_pointer(dir_o)->entries);
+	for (; de; de = dirent_iter_next(&it)) {
+		if (compact.nr_entries == compact.alloc_entries) {
+			compact.alloc_entries = compact.alloc_entries ?
+				2 * compact.alloc_entries : 4096;
+			compact.entries = xrealloc(compact.entries,
+				compact.alloc_entries * sizeof(*compact.entries));
+		}
+		compact.entries[compact.nr_entries++] = *de;
+		compact.name_map[de->name_offset] = 1;
+	}
+	last = compact.nr_entries;
+	for (i = first; i < last; i++)
+		if (repo_dirent_is_dir(&compact.entries[i]))
+			repo_compact_mark(compact.entries[i].content_offset);
+}
+
+/*
+ * Offline garbage collection of the dir, dirent and string pools.  Only
+ * the trees of revision 0, the latest revision and the given copy source
+ * revisions are kept; they are rewritten in depth-first order.  String
+ * entries keep their relative order, so treaps and diffs are unchanged.
+ */
+int repo_compact(uint32_t nr_revs, uint32_t *revs)
+{
+	uint32_t i, j, old_dirs;
+	unsigned char *keep;
+	struct repo_dirent *de;
+	int ret;
+
+	pool_init();
+	commit_init();
+	dir_init();
+	dirent_init();
+	if (!commit_pool.size) {
+		repo_reset();
+		return 0;
+	}
+	keep = xcalloc(commit_pool.size, 1);
+	keep[0] = keep[commit_pool.size - 1] = 1;
+	for (i = 0; i < nr_revs; i++)
+		if (revs[i] < commit_pool.size)
+			keep[revs[i]] = 1;
+
+	old_dirs = dir_pool.size;
+	compact.dir_map = xmalloc(old_dirs * sizeof(uint32_t));
+	memset(compact.dir_map, 0xff, old_dirs * sizeof(uint32_t));
+	compact.dir_start = xmalloc((old_dirs + 1) * sizeof(uint32_t));
+	compact.name_map = xcalloc(pool_count(), sizeof(uint32_t));
+	for (i = 0; i < commit_pool.size; i++)
+		if (keep[i])
+			repo_compact_mark(commit_pointer(i)->root_dir_offset);
+	compact.dir_start[compact.nr_dirs] = compact.nr_entries;
+	/*
+	 * Commits whose tree is dropped are left without a root dir (~0),
+	 * so that repo_read_dirent() reports copies from them as compacted
+	 * away instead of silently copying an empty tree.
+	 */
+	for (i = 0; i < commit_pool.size; i++)
+		commit_pointer(i)->root_dir_offset =
+			keep[i] && commit_pointer(i)->root_dir_offset < old_dirs ?
+			compact.dir_map[commit_pointer(i)->root_dir_offset] : ~0;
+
+	ret = pool_compact(compact.name_map);
+	dir_pool.size = dir_pool.committed = 0;
+	dirent_pool.size = dirent_pool.committed = 0;
+	for (i = 0; i < compact.nr_dirs; i++) {
+		dir_pointer(dir_alloc(1))->entries.trp_root = ~0;
+		for (j = compact.dir_start[i]; j < compact.dir_start[i + 1]; j++) {
+			de = dirent_pointer(dirent_alloc(1));
+			*de = compact.entries[j];
+			de->name_offset = compact.name_map[de->name_offset];
+			if (repo_dirent_is_dir(de) &&
+			    de->content_offset < old_dirs)
+				de->content_offset =
+					compact.dir_map[de->content_offset];
+			dirent_insert(&dir_pointer(i)->entries, de);
+		}
+	}
+	if (commit_rewrite() || dir_rewrite() || dirent_rewrite())
+		ret = -1;
+
+	free(keep);
+	free(compact.dir_map);
+	free(compact.dir_start);
+	free(compact.name_map);
+	free(compact.entries);
+	memset(&compact, 0, sizeof(compact));
+	repo_reset();
+	return ret;
 }
 
 static void mark_init(void)
@@ -324,10 +665,12 @@ void repo_init() {
 	active_commit = commit_alloc(1);
 	commit_pointer(active_commit)->root_dir_offset =
 		commit_pointer(active_commit - 1)->root_dir_offset;
+	dir_cache.len = ~0;
 }
 
 void repo_reset(void)
 {
+	dir_cache.len = ~0;
 	pool_reset();
 	commit_reset();
 	dir_reset();
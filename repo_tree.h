@@ -12,6 +12,7 @@
 #define REPO_MAX_PATH_DEPTH 1000
 
 uint32_t next_blob_mark(void);
+int repo_has_revision(uint32_t revision);
 uint32_t repo_copy(uint32_t revision, uint32_t *src, uint32_t *dst);
 void repo_add(uint32_t *path, uint32_t mode, uint32_t blob_mark);
 uint32_t repo_replace(uint32_t *path, uint32_t blob_mark);
@@ -19,8 +20,10 @@ void repo_modify(uint32_t *path, uint32_t mode, uint32_t blob_mark);
 void repo_delete(uint32_t *path);
 void repo_commit(uint32_t revision, uint32_t author, char *log, uint32_t uuid,
                  uint32_t url, long unsigned timestamp);
+void repo_set_diff_threads(uint32_t threads);
 void repo_diff(uint32_t r1, uint32_t r2);
 void repo_init(void);
+int repo_compact(uint32_t nr_revs, uint32_t *revs);
 void repo_reset(void);
 
 #endif
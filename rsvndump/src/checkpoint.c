@@ -0,0 +1,257 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: checkpoint.c
+ *      desc: Saving and restoring the dumping state
+ *
+ *      A checkpoint consists of a state file and additional files that are
+ *      copied into the checkpoint directory. The state file is a sequence
+ *      of integers, strings and raw data; its layout is defined by the
+ *      modules writing to it. New state files are written to a temporary
+ *      file first and renamed once they are complete. All numbers are
+ *      stored in host byte order.
+ */
+
+
+#include <svn_pools.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "main.h"
+#include "utils.h"
+
+#include "checkpoint.h"
+
+
+/* Identifier of checkpoint state files */
+#define CHECKPOINT_MAGIC "RCP1"
+#define CHECKPOINT_MAGIC_LEN 4
+
+/* Name of the state file */
+#define CHECKPOINT_STATE "state"
+
+/* String length that marks a NULL string */
+#define CHECKPOINT_NULL ((apr_uint32_t)-1)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* An open checkpoint */
+struct checkpoint_t {
+	apr_pool_t        *pool;
+	const char        *dir;
+	const char        *path;
+	const char        *temp_path; /* Only set when writing */
+	apr_file_t        *file;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new checkpoint in the given directory. A previous checkpoint
+   in the directory is replaced once the new one is committed */
+svn_error_t *checkpoint_create(checkpoint_t **cp, const char *dir, apr_pool_t *pool)
+{
+	apr_status_t status;
+	checkpoint_t *c = apr_pcalloc(pool, sizeof(checkpoint_t));
+
+	c->pool = svn_pool_create(pool);
+	c->dir = apr_pstrdup(c->pool, dir);
+	c->path = apr_psprintf(c->pool, "%s/%s", dir, CHECKPOINT_STATE);
+	c->temp_path = apr_psprintf(c->pool, "%s/%s.tmp", dir, CHECKPOINT_STATE);
+
+	apr_dir_make(dir, APR_OS_DEFAULT, c->pool);
+	if ((status = apr_file_open(&c->file, c->temp_path, APR_CREATE | APR_TRUNCATE | APR_WRITE | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, c->pool)) || (status = apr_file_write_full(c->file, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN, NULL))) {
+		svn_error_t *err = svn_error_createf(status, utils_apr_error(status), _("Unable to create checkpoint in %s"), dir);
+		svn_pool_destroy(c->pool);
+		return err;
+	}
+
+	*cp = c;
+	return SVN_NO_ERROR;
+}
+
+
+/* Opens the checkpoint in the given directory for reading */
+svn_error_t *checkpoint_open(checkpoint_t **cp, const char *dir, apr_pool_t *pool)
+{
+	char magic[CHECKPOINT_MAGIC_LEN];
+	apr_status_t status;
+	checkpoint_t *c = apr_pcalloc(pool, sizeof(checkpoint_t));
+
+	c->pool = svn_pool_create(pool);
+	c->dir = apr_pstrdup(c->pool, dir);
+	c->path = apr_psprintf(c->pool, "%s/%s", dir, CHECKPOINT_STATE);
+	c->temp_path = NULL;
+
+	if ((status = apr_file_open(&c->file, c->path, APR_READ | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, c->pool)) || (status = apr_file_read_full(c->file, magic, CHECKPOINT_MAGIC_LEN, NULL))) {
+		svn_error_t *err = svn_error_createf(status, utils_apr_error(status), _("Unable to open checkpoint in %s"), dir);
+		svn_pool_destroy(c->pool);
+		return err;
+	}
+	if (memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN)) {
+		svn_pool_destroy(c->pool);
+		return svn_error_createf(SVN_ERR_INCORRECT_PARAMS, NULL, _("%s does not contain a valid checkpoint"), dir);
+	}
+
+	*cp = c;
+	return SVN_NO_ERROR;
+}
+
+
+/* Finishes writing a checkpoint */
+svn_error_t *checkpoint_commit(checkpoint_t *cp)
+{
+	apr_status_t status;
+
+	if ((status = apr_file_close(cp->file))) {
+		cp->file = NULL;
+		return utils_apr_error(status);
+	}
+	cp->file = NULL;
+	if ((status = apr_file_rename(cp->temp_path, cp->path, cp->pool))) {
+		return utils_apr_error(status);
+	}
+	DEBUG_MSG("checkpoint: committed %s\n", cp->path);
+	return SVN_NO_ERROR;
+}
+
+
+/* Closes a checkpoint without committing it */
+void checkpoint_close(checkpoint_t *cp)
+{
+	if (cp->file != NULL) {
+		apr_file_close(cp->file);
+		if (cp->temp_path != NULL) {
+			apr_file_remove(cp->temp_path, cp->pool);
+		}
+	}
+	svn_pool_destroy(cp->pool);
+}
+
+
+/* Writes an integer to a checkpoint */
+svn_error_t *checkpoint_write_int(checkpoint_t *cp, apr_int64_t value)
+{
+	return checkpoint_write_data(cp, &value, sizeof(apr_int64_t));
+}
+
+
+/* Writes a string (which may be NULL) to a checkpoint */
+svn_error_t *checkpoint_write_string(checkpoint_t *cp, const char *str)
+{
+	apr_uint32_t len = (str != NULL ? strlen(str) : CHECKPOINT_NULL);
+
+	SVN_ERR(checkpoint_write_data(cp, &len, sizeof(apr_uint32_t)));
+	if (str != NULL) {
+		SVN_ERR(checkpoint_write_data(cp, str, len));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes raw data to a checkpoint */
+svn_error_t *checkpoint_write_data(checkpoint_t *cp, const void *data, apr_size_t len)
+{
+	apr_status_t status;
+
+	if (len > 0 && (status = apr_file_write_full(cp->file, data, len, NULL))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads an integer from a checkpoint */
+svn_error_t *checkpoint_read_int(checkpoint_t *cp, apr_int64_t *value)
+{
+	return checkpoint_read_data(cp, value, sizeof(apr_int64_t));
+}
+
+
+/* Reads a string (which may be NULL) from a checkpoint */
+svn_error_t *checkpoint_read_string(checkpoint_t *cp, const char **str, apr_pool_t *pool)
+{
+	apr_uint32_t len;
+	char *buffer;
+
+	SVN_ERR(checkpoint_read_data(cp, &len, sizeof(apr_uint32_t)));
+	if (len == CHECKPOINT_NULL) {
+		*str = NULL;
+		return SVN_NO_ERROR;
+	}
+
+	buffer = apr_palloc(pool, len + 1);
+	SVN_ERR(checkpoint_read_data(cp, buffer, len));
+	buffer[len] = '\0';
+	*str = buffer;
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads raw data from a checkpoint */
+svn_error_t *checkpoint_read_data(checkpoint_t *cp, void *data, apr_size_t len)
+{
+	apr_status_t status;
+
+	if (len > 0 && (status = apr_file_read_full(cp->file, data, len, NULL))) {
+		if (APR_STATUS_IS_EOF(status)) {
+			return svn_error_createf(SVN_ERR_INCORRECT_PARAMS, NULL, _("Checkpoint in %s is truncated"), cp->dir);
+		}
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Copies a file into the checkpoint directory, using the given name, and
+   returns the path of the copy */
+svn_error_t *checkpoint_add_file(checkpoint_t *cp, const char *path, const char *name, const char **copy, apr_pool_t *pool)
+{
+	apr_status_t status;
+
+	*copy = checkpoint_file_path(cp, name, pool);
+
+	/* Files of a resumed checkpoint may already be in place */
+	if (!strcmp(path, *copy)) {
+		return SVN_NO_ERROR;
+	}
+	if ((status = apr_file_copy(path, *copy, APR_FILE_SOURCE_PERMS, pool))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns the path of a file that has been added to the checkpoint */
+const char *checkpoint_file_path(checkpoint_t *cp, const char *name, apr_pool_t *pool)
+{
+	return apr_psprintf(pool, "%s/%s", cp->dir, name);
+}
@@ -0,0 +1,75 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: checkpoint.h
+ *      desc: Saving and restoring the dumping state
+ */
+
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+
+typedef struct checkpoint_t checkpoint_t;
+
+
+/* Creates a new checkpoint in the given directory. A previous checkpoint
+   in the directory is replaced once the new one is committed */
+extern svn_error_t *checkpoint_create(checkpoint_t **cp, const char *dir, apr_pool_t *pool);
+
+/* Opens the checkpoint in the given directory for reading */
+extern svn_error_t *checkpoint_open(checkpoint_t **cp, const char *dir, apr_pool_t *pool);
+
+/* Finishes writing a checkpoint */
+extern svn_error_t *checkpoint_commit(checkpoint_t *cp);
+
+/* Closes a checkpoint without committing it */
+extern void checkpoint_close(checkpoint_t *cp);
+
+/* Writes an integer to a checkpoint */
+extern svn_error_t *checkpoint_write_int(checkpoint_t *cp, apr_int64_t value);
+
+/* Writes a string (which may be NULL) to a checkpoint */
+extern svn_error_t *checkpoint_write_string(checkpoint_t *cp, const char *str);
+
+/* Writes raw data to a checkpoint */
+extern svn_error_t *checkpoint_write_data(checkpoint_t *cp, const void *data, apr_size_t len);
+
+/* Reads an integer from a checkpoint */
+extern svn_error_t *checkpoint_read_int(checkpoint_t *cp, apr_int64_t *value);
+
+/* Reads a string (which may be NULL) from a checkpoint */
+extern svn_error_t *checkpoint_read_string(checkpoint_t *cp, const char **str, apr_pool_t *pool);
+
+/* Reads raw data from a checkpoint */
+extern svn_error_t *checkpoint_read_data(checkpoint_t *cp, void *data, apr_size_t len);
+
+/* Copies a file into the checkpoint directory, using the given name, and
+   returns the path of the copy */
+extern svn_error_t *checkpoint_add_file(checkpoint_t *cp, const char *path, const char *name, const char **copy, apr_pool_t *pool);
+
+/* Returns the path of a file that has been added to the checkpoint */
+extern const char *checkpoint_file_path(checkpoint_t *cp, const char *name, apr_pool_t *pool);
+
+
+#endif
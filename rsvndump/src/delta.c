@@ -33,6 +33,8 @@
 #include <apr_md5.h>
 
 #include "main.h"
+#include "checkpoint.h"
+#include "deltify.h"
 #include "dump.h"
 #include "list.h"
 #include "log.h"
@@ -40,6 +42,8 @@
 #include "property.h"
 #include "rhash.h"
 #include "session.h"
+#include "store.h"
+#include "timing.h"
 #include "utils.h"
 
 #include "delta.h"
@@ -49,7 +53,14 @@
  #define SVN_REPOS_DUMPFILE_TEXT_CONTENT_MD5 SVN_REPOS_DUMPFILE_TEXT_CONTENT_CHECKSUM
 #endif
 
-#define ERRBUFFER_SIZE 512
+/* Memory that may be used for property sets before spilling them to disk */
+#define PROPERTY_MEMORY_BUDGET (16 * 1024 * 1024)
+
+/* Maximum size of a svndiff that is kept in memory */
+#define DELTA_MEMORY_LIMIT (1024 * 1024)
+
+/* Buffer size for copying contents from and to checkpoints */
+#define CHECKPOINT_BUFFER_SIZE (64 * 1024)
 
 
 /*---------------------------------------------------------------------------*/
@@ -69,23 +80,35 @@ typedef enum {
 typedef struct {
 	session_t         *session;
 	dump_options_t    *opts;
-	list_t            *logs;
+	list_t            *revnums;
 	log_revision_t    *log_revision;
 	apr_pool_t        *revision_pool;
 	apr_hash_t        *dumped_entries;
 	svn_revnum_t      local_revnum;
 	void              *root_node;
+	deltify_t         *deltify;
 } de_baton_t;
 
 
+/* Baton for writing a svndiff */
+typedef struct {
+	svn_stringbuf_t   *buffer;
+	store_entry_t     *entry;
+	svn_stream_t      *spill;
+	apr_pool_t        *pool;
+} de_delta_writer_t;
+
+
 /* Node baton */
 typedef struct {
 	de_baton_t        *de_baton;
 	apr_pool_t        *pool;
 	char              *path;
-	char              *filename;
-	char              *old_filename;
-	char              *delta_filename;
+	store_entry_t     *content;
+	store_entry_t     *old_content;
+	store_entry_t     *delta_content;
+	svn_stringbuf_t   *delta_buffer;
+	int               deltify_index;
 	char              action;
 	svn_node_kind_t   kind;
 	apr_hash_t        *properties;
@@ -98,6 +121,7 @@ typedef struct {
 	char              applied_delta;
 	char              dump_needed;
 	char              props_changed;
+	char              props_loaded;
 	void              *parent;
 	apr_array_header_t *children;
 } de_node_baton_t;
@@ -111,18 +135,14 @@ typedef struct {
 /*
  * If the dump output is not using deltas, we need to keep a local copy of
  * every file in the repository. The delta_hash hash defines a mapping of
- * repository paths to temporary files for this purpose. The prop_hash
- * defines a mapping from repository files to temporary files filled
- * with file/directory properties. The md5_hash is used to store the md5-sums
- * of the file contents.
+ * repository paths to entries of the content store for this purpose. The prop_hash
+ * defines a mapping from repository paths to (shared) property sets. The
+ * md5_hash is used to store the md5-sums of the file contents.
  */
 static char hashes_created = 0;
 static rhash_t *delta_hash = NULL;
 static rhash_t *prop_hash = NULL;
 static rhash_t *md5_hash = NULL;
-#ifdef USE_TIMING
- static float tm_de_apply_textdelta = 0.0f;
-#endif
 
 
 /*---------------------------------------------------------------------------*/
@@ -134,6 +154,39 @@ static rhash_t *md5_hash = NULL;
 static svn_error_t *delta_dump_node(de_node_baton_t *node);
 
 
+/* Creates the global hashes and opens the content store if needed */
+static void delta_create_hashes(session_t *session, dump_options_t *options)
+{
+	if (!hashes_created) {
+		apr_pool_t *hash_pool = svn_pool_create(session->pool);
+
+		md5_hash = rhash_make(hash_pool, APR_MD5_DIGESTSIZE);
+		delta_hash = rhash_make(hash_pool, sizeof(store_entry_t));
+		prop_hash = rhash_make(hash_pool, sizeof(property_set_t *));
+		store_open(options->temp_dir, hash_pool);
+		property_sets_init(options->temp_dir, PROPERTY_MEMORY_BUDGET, hash_pool);
+
+		hashes_created = 1;
+	}
+}
+
+
+/* Releases a stored content that is being removed from delta_hash */
+static void delta_release_content(void *val)
+{
+#ifndef DUMP_DEBUG
+	store_release((store_entry_t *)val);
+#endif
+}
+
+
+/* Releases a property set that is being removed from prop_hash */
+static void delta_release_set(void *val)
+{
+	property_set_release(*(property_set_t **)val);
+}
+
+
 /* Creates a new node baton */
 static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *parent)
 {
@@ -143,14 +196,17 @@ static de_node_baton_t *delta_create_node(const char *path, de_node_baton_t *par
 	node->de_baton = parent->de_baton;
 	node->properties = apr_hash_make(node->pool);
 	node->del_properties = apr_hash_make(node->pool);
-	node->filename = NULL;
-	node->old_filename = NULL;
-	node->delta_filename = NULL;
+	node->content = NULL;
+	node->old_content = NULL;
+	node->delta_content = NULL;
+	node->delta_buffer = NULL;
+	node->deltify_index = -1;
 	node->cp_info = parent->cp_info;
 	node->copyfrom_path = NULL;
 	node->applied_delta = 0;
 	node->dump_needed = 0;
 	node->props_changed = 0;
+	node->props_loaded = 0;
 	node->parent = parent;
 	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
 	memset(node->md5sum, 0x00, sizeof(node->md5sum));
@@ -171,14 +227,17 @@ static de_node_baton_t *delta_create_node_no_parent(const char *path, de_baton_t
 	node->de_baton = de_baton;
 	node->properties = apr_hash_make(node->pool);
 	node->del_properties = apr_hash_make(node->pool);
-	node->filename = NULL;
-	node->old_filename = NULL;
-	node->delta_filename = NULL;
+	node->content = NULL;
+	node->old_content = NULL;
+	node->delta_content = NULL;
+	node->delta_buffer = NULL;
+	node->deltify_index = -1;
 	node->cp_info = CPI_NONE;
 	node->copyfrom_path = NULL;
 	node->applied_delta = 0;
 	node->dump_needed = 0;
 	node->props_changed = 0;
+	node->props_loaded = 0;
 	node->parent = NULL;
 	node->children = apr_array_make(node->pool, 0, (sizeof(de_node_baton_t *)));
 	memset(node->md5sum, 0x00, sizeof(node->md5sum));
@@ -193,7 +252,7 @@ static void delta_mark_node(de_node_baton_t *node)
 	de_baton_t *de_baton = node->de_baton;
 	apr_hash_set(de_baton->dumped_entries, apr_pstrdup(de_baton->revision_pool, node->path), APR_HASH_KEY_STRING, de_baton /* The value doesn't matter */);
 	if (node->kind == svn_node_file) {
-		rhash_set(md5_hash, node->path, APR_HASH_KEY_STRING, node->md5sum, APR_MD5_DIGESTSIZE);
+		rhash_set(md5_hash, node->path, node->md5sum);
 		DEBUG_MSG("md5_hash += %s : %s\n", node->path, svn_md5_digest_to_cstring(node->md5sum, node->pool));
 	}
 	node->dump_needed = 0;
@@ -208,15 +267,20 @@ static void delta_mark_node(de_node_baton_t *node)
 }
 
 
-/* Writes the properties of a node to a temporary file */
+/* Saves the properties of a node */
 static svn_error_t *delta_write_properties(de_node_baton_t *node)
 {
-	char *filename;
-	apr_file_t *file = NULL;
-	apr_status_t status;
+	property_set_t **old, *set;
 	apr_hash_index_t *hi;
-	dump_options_t *opts = node->de_baton->opts;
-	apr_pool_t *pool = svn_pool_create(node->pool);
+	svn_error_t *err;
+	apr_pool_t *pool;
+
+	/* Nothing to do if the properties have been loaded and not changed */
+	if (node->props_loaded && !node->props_changed) {
+		return SVN_NO_ERROR;
+	}
+
+	pool = svn_pool_create(node->pool);
 
 	/* Remove the properties that have been deleted from the hash */
 	for (hi = apr_hash_first(pool, node->del_properties); hi; hi = apr_hash_next(hi)) {
@@ -226,69 +290,49 @@ static svn_error_t *delta_write_properties(de_node_baton_t *node)
 		apr_hash_set(node->properties, key, APR_HASH_KEY_STRING, NULL);
 	}
 
-	/* We don't need to save anything if there are no properties */
-	if (apr_hash_count(node->properties) == 0) {
-		rhash_set(prop_hash, node->path, APR_HASH_KEY_STRING, NULL, 0);
+	if ((err = property_set_intern(&set, node->properties, pool))) {
 		svn_pool_destroy(pool);
-		return SVN_NO_ERROR;
+		return err;
 	}
 
-	/* Create a new temporary file */
-	filename = apr_psprintf(node->pool, "%s/XXXXXX", opts->temp_dir);
-	status = apr_file_mktemp(&file, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL, pool);
-	if (status) {
-		apr_pool_t *epool = svn_pool_create(NULL);
-		char *errbuf = apr_palloc(epool, ERRBUFFER_SIZE);
-		svn_pool_destroy(pool);
-		return svn_error_create(status, NULL, apr_strerror(status, errbuf, ERRBUFFER_SIZE));
+	/* Replace the previous set */
+	old = rhash_get(prop_hash, node->path);
+	if (old != NULL) {
+		property_set_release(*old);
+	}
+	if (set != NULL) {
+		rhash_set(prop_hash, node->path, &set);
+	} else {
+		rhash_set(prop_hash, node->path, NULL);
 	}
-
-	property_hash_write(node->properties, file, pool);
-	apr_file_close(file);
-
-	rhash_set(prop_hash, node->path, APR_HASH_KEY_STRING, filename, RHASH_VAL_STRING);
 
 	svn_pool_destroy(pool);
 	return SVN_NO_ERROR;
 }
 
 
-/* Loads the properties of a node to a temporary file */
+/* Loads the previous properties of a node */
 static svn_error_t *delta_load_properties(de_node_baton_t *node)
 {
-	char *filename;
-	apr_file_t *file = NULL;
-	apr_status_t status;
-	apr_pool_t *pool = svn_pool_create(node->pool);
+	property_set_t **set = rhash_get(prop_hash, node->path);
 
-	filename = rhash_get(prop_hash, node->path, APR_HASH_KEY_STRING);
-	if (filename == NULL) {
+	node->props_loaded = 1;
+	if (set == NULL) {
 		/* No properties is ok, too */
-		svn_pool_destroy(pool);
 		return SVN_NO_ERROR;
 	}
+	return property_set_load(*set, node->properties, node->pool);
+}
 
-	status = apr_file_open(&file, filename, APR_READ, 0600, pool);
-	if (status) {
-		apr_pool_t *epool = svn_pool_create(NULL);
-		char *errbuf = apr_palloc(epool, ERRBUFFER_SIZE);
-		svn_pool_destroy(pool);
-		return svn_error_create(status, NULL, apr_strerror(status, errbuf, ERRBUFFER_SIZE));
-	}
 
-	if (property_hash_load(node->properties, file, node->pool)) {
-		apr_file_close(file);
-		DEBUG_MSG("ERROR reading from %s\n", filename);
-		return svn_error_create(1, NULL, "Error reading properties file");
+/* Drops the saved properties of a path */
+static void delta_release_properties(const char *path)
+{
+	property_set_t **set = rhash_get(prop_hash, path);
+	if (set != NULL) {
+		property_set_release(*set);
+		rhash_set(prop_hash, path, NULL);
 	}
-	apr_file_close(file);
-
-	/* Delete the old file if it exists */
-	apr_file_remove(filename, pool);
-	rhash_set(prop_hash, node->path, APR_HASH_KEY_STRING, NULL, 0);
-
-	svn_pool_destroy(pool);
-	return SVN_NO_ERROR;
 }
 
 
@@ -328,7 +372,7 @@ static char delta_check_copy(de_node_baton_t *node)
 	if (((opts->flags & DF_INCREMENTAL) || (opts->start <= node->copyfrom_revision)) && !strncmp(session->prefix, node->copyfrom_path, strlen(session->prefix))) {
 		svn_revnum_t rev;
 
-		rev = delta_get_local_copyfrom_rev(node->copyfrom_revision, opts, node->de_baton->logs, node->de_baton->local_revnum);
+		rev = delta_get_local_copyfrom_rev(node->copyfrom_revision, opts, node->de_baton->revnums, node->de_baton->local_revnum);
 		if (rev > 0) {
 			node->copyfrom_rev_local = rev;
 			node->cp_info = CPI_COPY;
@@ -394,7 +438,7 @@ static void delta_propagate_copy(de_node_baton_t *parent, de_node_baton_t *child
 		return;
 	}
 
-	revision = delta_get_local_copyfrom_rev(parent->copyfrom_revision, parent->de_baton->opts, parent->de_baton->logs, parent->de_baton->local_revnum);
+	revision = delta_get_local_copyfrom_rev(parent->copyfrom_revision, parent->de_baton->opts, parent->de_baton->revnums, parent->de_baton->local_revnum);
 
 	/* Check the old parent relationship */
 	check_pool = svn_pool_create(child->pool);
@@ -409,75 +453,105 @@ static void delta_propagate_copy(de_node_baton_t *parent, de_node_baton_t *child
 }
 
 
-/* Deltifies a node, i.e. generates a svndiff that can be dumped */
+/* Stream callback: writes svndiff data to memory, or to the content
+   store once the data gets too large */
+static svn_error_t *delta_write_fn(void *baton, const char *data, apr_size_t *len)
+{
+	de_delta_writer_t *writer = (de_delta_writer_t *)baton;
+
+	if (writer->spill == NULL && writer->buffer->len + *len > DELTA_MEMORY_LIMIT) {
+		apr_size_t buffered = writer->buffer->len;
+		SVN_ERR(store_write_stream(&writer->spill, writer->entry, writer->pool));
+		SVN_ERR(svn_stream_write(writer->spill, writer->buffer->data, &buffered));
+		svn_stringbuf_setempty(writer->buffer);
+	}
+
+	if (writer->spill != NULL) {
+		return svn_stream_write(writer->spill, data, len);
+	}
+	svn_stringbuf_appendbytes(writer->buffer, data, *len);
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback: finishes a svndiff */
+static svn_error_t *delta_close_fn(void *baton)
+{
+	de_delta_writer_t *writer = (de_delta_writer_t *)baton;
+	if (writer->spill != NULL) {
+		return svn_stream_close(writer->spill);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Deltifies a node, i.e. generates a svndiff that can be dumped. Small
+   deltas are kept in node->delta_buffer, larger ones are written to
+   node->delta_content */
 static svn_error_t *delta_deltify_node(de_node_baton_t *node)
 {
 	svn_txdelta_stream_t *stream;
 	svn_txdelta_window_handler_t handler;
 	void *handler_baton;
 	svn_stream_t *source, *target, *dest;
-	apr_file_t *source_file = NULL, *target_file = NULL, *dest_file = NULL;
-	dump_options_t *opts = node->de_baton->opts;
+	de_delta_writer_t *writer;
 	apr_pool_t *pool = svn_pool_create(node->pool);
 	svn_error_t *err;
 
-	DEBUG_MSG("delta_deltify_node(%s): %s -> %s\n", node->path, node->old_filename, node->filename);
-
-	/* Open source and target */
-	apr_file_open(&target_file, node->filename, APR_READ, 0600, pool);
-	target = svn_stream_from_aprfile2(target_file, FALSE, pool);
-	if (node->old_filename) {
-		apr_file_open(&source_file, node->old_filename, APR_READ, 0600, pool);
-		source = svn_stream_from_aprfile2(source_file, FALSE, pool);
-	} else {
-		source = svn_stream_empty(pool);
-	}
-
-	/* Open temporary output file */
-	node->delta_filename = apr_psprintf(node->pool, "%s/XXXXXX", opts->temp_dir);
-	apr_file_mktemp(&dest_file, node->delta_filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL, pool);
-	dest = svn_stream_from_aprfile2(dest_file, FALSE, pool);
+	DEBUG_MSG("delta_deltify_node(%s)\n", node->path);
 
-	DEBUG_MSG("delta_deltify_node(%s): writing to %s\n", node->path, node->delta_filename);
+	/*
+	 * Open source and target. The previous content has already been
+	 * released in de_close_file(), so the delta is always against the
+	 * empty stream.
+	 */
+	target = store_read_stream(node->content, pool);
+	source = svn_stream_empty(pool);
+
+	/* Open output */
+	writer = apr_palloc(pool, sizeof(de_delta_writer_t));
+	writer->buffer = svn_stringbuf_create("", node->pool);
+	writer->entry = apr_pcalloc(node->pool, sizeof(store_entry_t));
+	writer->spill = NULL;
+	writer->pool = pool;
+	dest = svn_stream_create(writer, pool);
+	svn_stream_set_write(dest, delta_write_fn);
+	svn_stream_set_close(dest, delta_close_fn);
 
 	/* Produce delta in svndiff format */
 	svn_txdelta(&stream, source, target, pool);
 	svn_txdelta_to_svndiff2(&handler, &handler_baton, dest, 0, pool);
 
 	err = svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+	if (writer->spill != NULL) {
+		node->delta_content = writer->entry;
+	} else {
+		node->delta_buffer = writer->buffer;
+	}
 	svn_pool_destroy(pool);
 	return err;
 }
 
 
-/* Dumps the contents of a file to stdout */
-static svn_error_t *delta_cat_file(apr_pool_t *pool, const char *path)
+/* Collects the contents of file nodes whose svndiffs can be generated
+   in advance, in dumping order. Copies are skipped, since their contents
+   often don't need to be dumped at all */
+static void delta_collect_deltify(de_node_baton_t *node, apr_array_header_t *entries)
 {
-	svn_error_t *err;
-	apr_status_t status;
-	apr_file_t *in_file = NULL;
-	svn_stream_t *in, *out;
-
-	status = apr_file_open(&in_file, path, APR_READ, 0600, pool);
-	if (status) {
-		apr_pool_t *epool = svn_pool_create(NULL);
-		char *errbuf = apr_palloc(epool, ERRBUFFER_SIZE);
-		return svn_error_create(status, NULL, apr_strerror(status, errbuf, ERRBUFFER_SIZE));
-	}
-	in = svn_stream_from_aprfile2(in_file, FALSE, pool);
-	if ((err = svn_stream_for_stdout(&out, pool))) {
-		svn_stream_close(in);
-		return err;
+	int i;
+
+	if (node->copyfrom_path != NULL) {
+		return;
 	}
 
-	/* Write contents */
-	if ((err = svn_stream_copy(in, out, pool))) {
-		svn_stream_close(in);
-		return err;
+	if ((node->action != 'D') && (node->kind == svn_node_file) && node->applied_delta && node->dump_needed && (node->content != NULL)) {
+		node->deltify_index = entries->nelts;
+		APR_ARRAY_PUSH(entries, const store_entry_t *) = node->content;
 	}
 
-	err = svn_stream_close(in);
-	return SVN_NO_ERROR;
+	for (i = 0; i < node->children->nelts; i++) {
+		delta_collect_deltify(APR_ARRAY_IDX(node->children, i, de_node_baton_t *), entries);
+	}
 }
 
 
@@ -629,7 +703,7 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 		/* Maybe we don't need to dump the contents */
 		if ((node->action == 'A') && (node->kind == svn_node_file)) {
-			unsigned char *prev_md5 = rhash_get(md5_hash, copyfrom_path, APR_HASH_KEY_STRING);
+			unsigned char *prev_md5 = rhash_get(md5_hash, copyfrom_path);
 			if (prev_md5 && !memcmp(node->md5sum, prev_md5, APR_MD5_DIGESTSIZE)) {
 				DEBUG_MSG("md5sum matches\n");
 				dump_content = 0;
@@ -657,7 +731,15 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	/* Deltify? */
 	if (dump_content && (opts->flags & DF_USE_DELTAS)) {
 		svn_error_t *err;
-		if ((err = delta_deltify_node(node))) {
+		if ((de_baton->deltify != NULL) && (node->deltify_index >= 0)) {
+			err = deltify_get(&node->delta_buffer, de_baton->deltify, node->deltify_index, node->pool);
+			node->deltify_index = -1;
+			if (err) {
+				return err;
+			}
+		}
+		/* Svndiffs that are too large are generated here */
+		if ((node->delta_buffer == NULL) && (err = delta_deltify_node(node))) {
 			return err;
 		}
 	}
@@ -665,12 +747,14 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 #ifdef DUMP_DEBUG
 	/* Dump some extra debug info */
 	if (dump_content) {
-		printf("Debug-filename: %s\n", node->filename);
-		if (node->old_filename) {
-			printf("Debug-old-filename: %s\n", node->old_filename);
+		printf("Debug-content: %d:%ld+%ld\n", node->content->pack, (long)node->content->offset, (long)node->content->length);
+		if (node->old_content) {
+			printf("Debug-old-content: %d:%ld+%ld\n", node->old_content->pack, (long)node->old_content->offset, (long)node->old_content->length);
 		}
-		if (opts->flags & DF_USE_DELTAS) {
-			printf("Debug-delta-filename: %s\n", node->delta_filename);
+		if (node->delta_content) {
+			printf("Debug-delta-content: %d:%ld+%ld\n", node->delta_content->pack, (long)node->delta_content->offset, (long)node->delta_content->length);
+		} else if (node->delta_buffer) {
+			printf("Debug-delta-content: memory+%ld\n", (long)node->delta_buffer->len);
 		}
 	}
 #endif
@@ -713,13 +797,12 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 
 	/* Dump content size */
 	if (dump_content) {
-		char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
-		apr_finfo_t *info = apr_pcalloc(node->pool, sizeof(apr_finfo_t));
-		if (apr_stat(info, fpath, APR_FINFO_SIZE, node->pool) != APR_SUCCESS) {
-			DEBUG_MSG("delta_dump_node: FATAL: cannot stat %s\n", node->filename);
-			return svn_error_create(1, NULL, apr_psprintf(session->pool, "Cannot stat %s", node->filename));
+		if (node->delta_buffer != NULL) {
+			content_len = (unsigned long)node->delta_buffer->len;
+		} else {
+			store_entry_t *entry = (opts->flags & DF_USE_DELTAS) ? node->delta_content : node->content;
+			content_len = (unsigned long)entry->length;
 		}
-		content_len = (unsigned long)info->size;
 
 		if (opts->flags & DF_USE_DELTAS) {
 			printf("%s: true\n", SVN_REPOS_DUMPFILE_TEXT_DELTA);
@@ -731,6 +814,7 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 		}
 	}
 	printf("%s: %lu\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, (unsigned long)prop_len+content_len);
+	TIMING_COUNT(TM_OUTPUT_BYTES, prop_len + content_len);
 
 	/* Dump properties */
 	if (dump_props) {
@@ -757,21 +841,22 @@ static svn_error_t *delta_dump_node(de_node_baton_t *node)
 	}
 
 	/* Dump content */
-	if (dump_content) {
+	if (dump_content && node->delta_buffer != NULL) {
+		fwrite(node->delta_buffer->data, 1, node->delta_buffer->len, stdout);
+		node->delta_buffer = NULL;
+	} else if (dump_content) {
 		svn_error_t *err;
 		apr_pool_t *pool = svn_pool_create(node->pool);
-		const char *fpath = (opts->flags & DF_USE_DELTAS) ? node->delta_filename : node->filename;
+		const store_entry_t *entry = (opts->flags & DF_USE_DELTAS) ? node->delta_content : node->content;
 
-		fflush(stdout);
-		if ((err = delta_cat_file(pool, fpath))) {
+		if ((err = store_dump(entry, stdout, pool))) {
 			return err;
 		}
-		fflush(stdout);
 
 		svn_pool_destroy(pool);
 #ifndef DUMP_DEBUG
 		if (opts->flags & DF_USE_DELTAS) {
-			apr_file_remove(node->delta_filename, node->pool);
+			store_release(node->delta_content);
 		}
 #endif
 	}
@@ -841,9 +926,6 @@ static svn_error_t *de_open_root(void *edit_baton, svn_revnum_t base_revision, a
 	de_baton->root_node = node;
 
 	*root_baton = node;
-#ifdef USE_TIMING
-	tm_de_apply_textdelta = 0.0f;
-#endif
 	return SVN_NO_ERROR;
 }
 
@@ -853,8 +935,6 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 {
 	de_node_baton_t *node;
 	de_node_baton_t *parent = (de_node_baton_t *)parent_baton;
-	apr_hash_index_t *hi;
-	int pathlen;
 
 	DEBUG_MSG("de_delete_entry(%s@%ld)\n", path, revision);
 
@@ -870,42 +950,9 @@ static svn_error_t *de_delete_entry(const char *path, svn_revnum_t revision, voi
 #endif
 
 	/* This node might be a directory, so clear the data of all children */
-	pathlen = strlen(node->path);
-	for (hi = rhash_first(pool, delta_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *filename;
-		rhash_this(hi, (const void **)(void *)&npath, NULL, (void **)(void *)&filename);
-		/* TODO: This is a small hack to make sure the node is a directory */
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-#ifndef DUMP_DEBUG
-			apr_file_remove(filename, node->pool);
-#endif
-			DEBUG_MSG("deleting %s from delta_hash\n", npath);
-			rhash_set(delta_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
-	}
-	for (hi = rhash_first(pool, prop_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *filename;
-		rhash_this(hi, (const void **)(void *)&npath, NULL, (void **)(void *)&filename);
-		/* TODO: This is a small hack to make sure the node is a directory */
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-#ifndef DUMP_DEBUG
-			apr_file_remove(filename, node->pool);
-#endif
-			DEBUG_MSG("deleting %s from prop_hash\n", npath);
-			rhash_set(prop_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
-	}
-	for (hi = rhash_first(pool, md5_hash); hi; hi = rhash_next(hi)) {
-		const char *npath;
-		char *md5sum;
-		rhash_this(hi, (const void **)(void *)&npath, NULL, (void **)(void *)&md5sum);
-		if (!strncmp(node->path, npath, pathlen) && (npath[pathlen] == '/')) {
-			DEBUG_MSG("deleting %s from md5_hash\n", npath);
-			rhash_set(md5_hash, npath, APR_HASH_KEY_STRING, NULL, 0);
-		}
-	}
+	rhash_remove_children(delta_hash, node->path, delta_release_content);
+	rhash_remove_children(prop_hash, node->path, delta_release_set);
+	rhash_remove_children(md5_hash, node->path, NULL);
 
 	return SVN_NO_ERROR;
 }
@@ -1103,44 +1150,32 @@ static svn_error_t *de_open_file(const char *path, void *parent_baton, svn_revnu
 /* Subversion delta editor callback */
 static svn_error_t *de_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
 {
-	apr_file_t *src_file = NULL, *dest_file = NULL;
 	svn_stream_t *src_stream, *dest_stream;
 	de_node_baton_t *node = (de_node_baton_t *)file_baton;
-	dump_options_t *opts = node->de_baton->opts;
-#ifdef USE_TIMING
-	stopwatch_t watch = stopwatch_create();
-#endif
-	char *filename;
+	store_entry_t *old_content;
+	svn_error_t *err;
 
 	DEBUG_MSG("de_apply_textdelta(%s)\n", node->path);
 
-	/* Create a new temporary file to write to */
-	node->filename = apr_psprintf(node->pool, "%s/XXXXXX", opts->temp_dir);
-	apr_file_mktemp(&dest_file, node->filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL, pool);
-	dest_stream = svn_stream_from_aprfile2(dest_file, FALSE, pool);
+	/* Create a new store entry to write to */
+	node->content = apr_pcalloc(node->pool, sizeof(store_entry_t));
+	if ((err = store_write_stream(&dest_stream, node->content, pool))) {
+		return err;
+	}
 
 	/* Update the local copy */
-	filename = rhash_get(delta_hash, node->path, APR_HASH_KEY_STRING);
-	if (filename == NULL) {
+	old_content = rhash_get(delta_hash, node->path);
+	if (old_content == NULL) {
 		src_stream = svn_stream_empty(pool);
 	} else {
-		apr_file_open(&src_file, filename, APR_READ, 0600, pool);
-		src_stream = svn_stream_from_aprfile2(src_file, FALSE, pool);
+		node->old_content = apr_pmemdup(node->pool, old_content, sizeof(store_entry_t));
+		src_stream = store_read_stream(node->old_content, pool);
 	}
 
 	svn_txdelta_apply(src_stream, dest_stream, node->md5sum, node->path, pool, handler, handler_baton);
 
-	node->old_filename = apr_pstrdup(node->pool, filename);
-	rhash_set(delta_hash, node->path, APR_HASH_KEY_STRING, node->filename, RHASH_VAL_STRING);
-
-	DEBUG_MSG("applied delta: %s -> %s\n", node->old_filename, node->filename);
-
 	node->applied_delta = 1;
 	node->dump_needed = 1;
-
-#ifdef USE_TIMING
-	tm_de_apply_textdelta += stopwatch_elapsed(&watch);
-#endif
 	return SVN_NO_ERROR;
 }
 
@@ -1174,10 +1209,14 @@ static svn_error_t *de_close_file(void *file_baton, const char *text_checksum, a
 {
 	de_node_baton_t *node = (de_node_baton_t *)file_baton;
 
-	/* Remove the old file if neccessary */
+	/* The new content is complete now, so it can replace the old one */
+	if (node->content) {
+		rhash_set(delta_hash, node->path, node->content);
+		DEBUG_MSG("applied delta: %s (%ld bytes)\n", node->path, (long)node->content->length);
+	}
 #ifndef DUMP_DEBUG
-	if (node->old_filename) {
-		apr_file_remove(node->old_filename, pool);
+	if (node->old_content) {
+		store_release(node->old_content);
 	}
 #endif
 
@@ -1198,11 +1237,28 @@ static svn_error_t *de_absent_file(const char *path, void *parent_baton, apr_poo
 static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 {
 	de_baton_t *de_baton = (de_baton_t *)edit_baton;
+	dump_options_t *opts = de_baton->opts;
 	apr_hash_index_t *hi;
 	svn_error_t *err;
 
+	/* Generate the svndiffs of the files in this revision concurrently */
+	if ((opts->flags & DF_USE_DELTAS) && !(opts->flags & DF_DRY_RUN) && (opts->delta_jobs > 0)) {
+		apr_array_header_t *entries = apr_array_make(pool, 0, sizeof(const store_entry_t *));
+		delta_collect_deltify((de_node_baton_t *)de_baton->root_node, entries);
+		if (entries->nelts > 1) {
+			if (deltify_start(&de_baton->deltify, opts->delta_jobs, (const store_entry_t **)entries->elts, entries->nelts, DELTA_MEMORY_LIMIT, pool)) {
+				de_baton->deltify = NULL;
+			}
+		}
+	}
+
 	/* Recursively dump all nodes touched by this revision */
-	if ((err = delta_dump_node_recursive((de_node_baton_t *)de_baton->root_node))) {
+	err = delta_dump_node_recursive((de_node_baton_t *)de_baton->root_node);
+	if (de_baton->deltify != NULL) {
+		deltify_stop(de_baton->deltify);
+		de_baton->deltify = NULL;
+	}
+	if (err) {
 		return err;
 	}
 
@@ -1217,14 +1273,15 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		apr_hash_this(hi, (const void **)(void *)&path, NULL, (void **)(void *)&log);
 		DEBUG_MSG("Checking %s (%c)\n", path, log->action);
 		if (log->action == 'D') {
-			/* We can unlink a possible temporary file now */
-			char *filename = rhash_get(delta_hash, path, APR_HASH_KEY_STRING);
-			if (filename) {
+			/* We can release a possible local copy now */
+			store_entry_t *entry = rhash_get(delta_hash, path);
+			if (entry) {
 #ifndef DUMP_DEBUG
-				apr_file_remove(filename, pool);
+				store_release(entry);
 #endif
-				rhash_set(delta_hash, path, APR_HASH_KEY_STRING, NULL, 0);
+				rhash_set(delta_hash, path, NULL);
 			}
+			delta_release_properties(path);
 
 			if (apr_hash_get(de_baton->dumped_entries, path, APR_HASH_KEY_STRING) == NULL) {
 				de_node_baton_t *node = delta_create_node_no_parent(path, de_baton, pool);
@@ -1239,10 +1296,8 @@ static svn_error_t *de_close_edit(void *edit_baton, apr_pool_t *pool)
 		}
 	}
 
-#ifdef USE_TIMING
-	DEBUG_MSG("apply_text_delta: %f seconds\n", tm_de_apply_textdelta);
-#endif
-	return SVN_NO_ERROR;
+	/* Reclaim space of contents that have been replaced or deleted */
+	return store_compact(delta_hash, pool);
 }
 
 
@@ -1279,9 +1334,10 @@ const char *delta_get_local_copyfrom_path(const char *prefix, const char *path)
 
 
 /* Determines the local copyfrom_revision number */
-svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t *opts, list_t *logs, svn_revnum_t local_revnum)
+svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t *opts, list_t *revnums, svn_revnum_t local_revnum)
 {
-	svn_revnum_t rev;
+	svn_revnum_t *revs = (svn_revnum_t *)revnums->elements;
+	int lo = 0, hi = revnums->size;
 
 	/* If we sync the revision numbers, the original one is correct */
 	if (opts->flags & DF_KEEP_REVNUMS) {
@@ -1291,36 +1347,31 @@ svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t
 	DEBUG_MSG("local_revnum = %ld\n", local_revnum);
 
 	/*
-	 * Loop backwards through the revision list, starting at the previous
-	 * revision ,in order to find the best matching revision for the copy.
+	 * Search for the last dumped revision that is not newer than the
+	 * copy source. If it doesn't match exactly, the source revision has
+	 * not been dumped as we've just missed it. Therefore, simply use this
+	 * revision (since the copy source has not been dumped, the node
+	 * contents haven't changed between this revision and the original one).
 	 * NOTE: This algorithm assumes that list indexes are equal to their
-	 * respective local revision numbers. This is ensured in dump()
+	 * respective local revision numbers and that the global revisions are
+	 * ascending. This is ensured in dump()
 	 */
-	rev = logs->size-1;
-	while (--rev >= 0) {
-		log_revision_t *logrev = ((log_revision_t *)logs->elements) + rev;
-		DEBUG_MSG("node->copyfrom = %ld, logrev->revision = %ld, rev = %ld\n",  original, logrev->revision, rev);
-		if (original == logrev->revision) {
-			/* This is ideal, there's an exact match */
-			DEBUG_MSG("-> equal, using %ld\n", rev);
-			break;
-		} else if (logrev->revision < original)  {
-			/* The revision in question has not been dumped as we've just
-			   missed it. Therefore, simply use this revision (since
-			   node->copyfrom_revision has not been dumped, the node contents
-			   haven't changed between this revision and
-			   node->copyfrom_revision) */
-			DEBUG_MSG("-> smaller , using %ld\n", rev);
-			break;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (revs[mid] <= original) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
 
-	return rev;
+	DEBUG_MSG("node->copyfrom = %ld, using %ld\n", original, (svn_revnum_t)(lo - 1));
+	return (svn_revnum_t)(lo - 1);
 }
 
 
 /* Sets up a delta editor for dumping a revision */
-void delta_setup_editor(session_t *session, dump_options_t *options, list_t *logs, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool)
+void delta_setup_editor(session_t *session, dump_options_t *options, list_t *revnums, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool)
 {
 	de_baton_t *baton;
 
@@ -1345,23 +1396,178 @@ void delta_setup_editor(session_t *session, dump_options_t *options, list_t *log
 	baton = apr_palloc(pool, sizeof(de_baton_t));
 	baton->session = session;
 	baton->opts = options;
-	baton->logs = logs;
+	baton->revnums = revnums;
 	baton->log_revision = log_revision;
 	baton->local_revnum = local_revnum;
+	baton->deltify = NULL;
 	baton->revision_pool = svn_pool_create(pool);
 	baton->dumped_entries = apr_hash_make(baton->revision_pool);
 	*editor_baton = baton;
 
+#ifdef USE_TIMING
+	timing_wrap_editor(editor, editor_baton, pool);
+#endif
+
 	/* Create global hashes if needed */
+	delta_create_hashes(session, options);
+}
+
+
+/* Saves the local copies of file contents, md5-sums and properties to a
+   checkpoint */
+svn_error_t *delta_save(checkpoint_t *cp, apr_pool_t *pool)
+{
+	rhash_index_t *hi;
+	apr_pool_t *subpool = svn_pool_create(pool);
+	char *buffer = apr_palloc(pool, CHECKPOINT_BUFFER_SIZE);
+
 	if (!hashes_created) {
-		apr_pool_t *hash_pool = svn_pool_create(session->pool);
+		SVN_ERR(checkpoint_write_int(cp, 0));
+		SVN_ERR(checkpoint_write_int(cp, 0));
+		return checkpoint_write_int(cp, 0);
+	}
 
-		md5_hash = rhash_make(hash_pool);
-		delta_hash = rhash_make(hash_pool);
-		prop_hash = rhash_make(hash_pool);
-		
-		hashes_created = 1;
+	/* File contents */
+	SVN_ERR(checkpoint_write_int(cp, rhash_count(delta_hash)));
+	for (hi = rhash_first(pool, delta_hash); hi; hi = rhash_next(hi)) {
+		const char *path;
+		store_entry_t *entry;
+		svn_stream_t *stream;
+		apr_off_t remaining;
+		rhash_this(hi, &path, (void **)(void *)&entry);
+
+		SVN_ERR(checkpoint_write_string(cp, path));
+		SVN_ERR(checkpoint_write_int(cp, entry->length));
+		stream = store_read_stream(entry, subpool);
+		for (remaining = entry->length; remaining > 0; ) {
+			apr_size_t len = (remaining > CHECKPOINT_BUFFER_SIZE ? CHECKPOINT_BUFFER_SIZE : (apr_size_t)remaining);
+			SVN_ERR(svn_stream_read(stream, buffer, &len));
+			if (len == 0) {
+				return svn_error_createf(SVN_ERR_INCORRECT_PARAMS, NULL, _("Stored content of %s is truncated"), path);
+			}
+			SVN_ERR(checkpoint_write_data(cp, buffer, len));
+			remaining -= len;
+		}
+		svn_pool_clear(subpool);
+	}
+
+	/* MD5-sums */
+	SVN_ERR(checkpoint_write_int(cp, rhash_count(md5_hash)));
+	for (hi = rhash_first(pool, md5_hash); hi; hi = rhash_next(hi)) {
+		const char *path;
+		unsigned char *md5sum;
+		rhash_this(hi, &path, (void **)(void *)&md5sum);
+
+		SVN_ERR(checkpoint_write_string(cp, path));
+		SVN_ERR(checkpoint_write_data(cp, md5sum, APR_MD5_DIGESTSIZE));
 	}
+
+	/* Properties */
+	SVN_ERR(checkpoint_write_int(cp, rhash_count(prop_hash)));
+	for (hi = rhash_first(pool, prop_hash); hi; hi = rhash_next(hi)) {
+		const char *path;
+		property_set_t **set;
+		apr_hash_t *props = apr_hash_make(subpool);
+		apr_hash_index_t *phi;
+		rhash_this(hi, &path, (void **)(void *)&set);
+
+		SVN_ERR(property_set_load(*set, props, subpool));
+		SVN_ERR(checkpoint_write_string(cp, path));
+		SVN_ERR(checkpoint_write_int(cp, apr_hash_count(props)));
+		for (phi = apr_hash_first(subpool, props); phi; phi = apr_hash_next(phi)) {
+			const char *key;
+			svn_string_t *value;
+			apr_hash_this(phi, (const void **)(void *)&key, NULL, (void **)(void *)&value);
+
+			SVN_ERR(checkpoint_write_string(cp, key));
+			SVN_ERR(checkpoint_write_int(cp, value->len));
+			SVN_ERR(checkpoint_write_data(cp, value->data, value->len));
+		}
+		svn_pool_clear(subpool);
+	}
+
+	svn_pool_destroy(subpool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Restores the local copies of file contents, md5-sums and properties
+   from a checkpoint */
+svn_error_t *delta_load(checkpoint_t *cp, session_t *session, dump_options_t *options, apr_pool_t *pool)
+{
+	apr_int64_t i, j, num;
+	apr_pool_t *subpool = svn_pool_create(pool);
+	char *buffer = apr_palloc(pool, CHECKPOINT_BUFFER_SIZE);
+
+	delta_create_hashes(session, options);
+
+	/* File contents */
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		const char *path;
+		apr_int64_t remaining;
+		store_entry_t entry;
+		svn_stream_t *stream;
+
+		SVN_ERR(checkpoint_read_string(cp, &path, subpool));
+		SVN_ERR(checkpoint_read_int(cp, &remaining));
+		SVN_ERR(store_write_stream(&stream, &entry, subpool));
+		while (remaining > 0) {
+			apr_size_t len = (remaining > CHECKPOINT_BUFFER_SIZE ? CHECKPOINT_BUFFER_SIZE : (apr_size_t)remaining);
+			SVN_ERR(checkpoint_read_data(cp, buffer, len));
+			SVN_ERR(svn_stream_write(stream, buffer, &len));
+			remaining -= len;
+		}
+		SVN_ERR(svn_stream_close(stream));
+		rhash_set(delta_hash, path, &entry);
+		svn_pool_clear(subpool);
+	}
+
+	/* MD5-sums */
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		const char *path;
+		unsigned char md5sum[APR_MD5_DIGESTSIZE];
+
+		SVN_ERR(checkpoint_read_string(cp, &path, subpool));
+		SVN_ERR(checkpoint_read_data(cp, md5sum, APR_MD5_DIGESTSIZE));
+		rhash_set(md5_hash, path, md5sum);
+		svn_pool_clear(subpool);
+	}
+
+	/* Properties */
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		const char *path;
+		apr_int64_t nprops;
+		apr_hash_t *props = apr_hash_make(subpool);
+		property_set_t *set;
+
+		SVN_ERR(checkpoint_read_string(cp, &path, subpool));
+		SVN_ERR(checkpoint_read_int(cp, &nprops));
+		for (j = 0; j < nprops; j++) {
+			const char *key;
+			apr_int64_t len;
+			char *data;
+
+			SVN_ERR(checkpoint_read_string(cp, &key, subpool));
+			SVN_ERR(checkpoint_read_int(cp, &len));
+			data = apr_palloc(subpool, (apr_size_t)len + 1);
+			SVN_ERR(checkpoint_read_data(cp, data, (apr_size_t)len));
+			data[len] = '\0';
+			apr_hash_set(props, key, APR_HASH_KEY_STRING, svn_string_ncreate(data, (apr_size_t)len, subpool));
+		}
+
+		SVN_ERR(property_set_intern(&set, props, subpool));
+		if (set != NULL) {
+			rhash_set(prop_hash, path, &set);
+		}
+		svn_pool_clear(subpool);
+	}
+
+	DEBUG_MSG("delta: restored %d contents and %d property sets\n", (int)rhash_count(delta_hash), (int)rhash_count(prop_hash));
+	svn_pool_destroy(subpool);
+	return SVN_NO_ERROR;
 }
 
 
@@ -1369,9 +1575,11 @@ void delta_setup_editor(session_t *session, dump_options_t *options, list_t *log
 void delta_cleanup()
 {
 	if (hashes_created) {
-		rhash_clear(md5_hash);
-		rhash_clear(delta_hash);
-		rhash_clear(prop_hash);
+		rhash_free(md5_hash);
+		rhash_free(delta_hash);
+		rhash_free(prop_hash);
+		store_close();
+		property_sets_free();
 
 		hashes_created = 0;
 	}
@@ -27,6 +27,7 @@
 
 #include <svn_types.h>
 
+#include "checkpoint.h"
 #include "dump.h"
 #include "list.h"
 #include "log.h"
@@ -37,10 +38,18 @@
 const char *delta_get_local_copyfrom_path(const char *prefix, const char *path);
 
 /* Determines the local copyfrom_revision number */
-svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t *opts, list_t *logs, svn_revnum_t local_revnum);
+svn_revnum_t delta_get_local_copyfrom_rev(svn_revnum_t original, dump_options_t *opts, list_t *revnums, svn_revnum_t local_revnum);
 
 /* Sets up a delta editor for dumping a revision */
-extern void delta_setup_editor(session_t *session, dump_options_t *options, list_t *logs, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool);
+extern void delta_setup_editor(session_t *session, dump_options_t *options, list_t *revnums, log_revision_t *log_revision, svn_revnum_t local_revnum, svn_delta_editor_t **editor, void **editor_baton, apr_pool_t *pool);
+
+/* Saves the local copies of file contents, md5-sums and properties to a
+   checkpoint */
+extern svn_error_t *delta_save(checkpoint_t *cp, apr_pool_t *pool);
+
+/* Restores the local copies of file contents, md5-sums and properties
+   from a checkpoint */
+extern svn_error_t *delta_load(checkpoint_t *cp, session_t *session, dump_options_t *options, apr_pool_t *pool);
 
 /* Cleans up global resources */
 extern void delta_cleanup();
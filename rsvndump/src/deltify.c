@@ -0,0 +1,357 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: deltify.c
+ *      desc: Parallel generation of svndiffs
+ *
+ *      The worker threads read the contents through file handles of their
+ *      own and generate the svndiffs in memory. Entries are processed in
+ *      order, and only a limited number of them may be processed ahead of
+ *      the one that has been requested last.
+ */
+
+
+#include <svn_delta.h>
+#include <svn_pools.h>
+
+#include <apr_tables.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "store.h"
+#include "utils.h"
+
+#include "deltify.h"
+
+
+/* Number of entries per thread that may be processed in advance */
+#define ENTRIES_PER_THREAD 4
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Task states */
+typedef enum {
+	DT_PENDING,
+	DT_RUNNING,
+	DT_DONE,
+	DT_FREED
+} dt_state_t;
+
+
+/* A single svndiff to generate */
+typedef struct {
+	store_entry_t     entry;
+	const char        *pack_file;
+	dt_state_t        state;
+	apr_pool_t        *pool;
+	svn_stringbuf_t   *delta;
+	svn_error_t       *err;
+} dt_task_t;
+
+
+/* Baton for writing a svndiff to memory */
+typedef struct {
+	svn_stringbuf_t   *buffer;
+	apr_size_t        limit;
+	char              exceeded;
+} dt_writer_t;
+
+
+/* Deltification state */
+struct deltify_t {
+	apr_pool_t        *pool;
+	int               threads;
+#if APR_HAS_THREADS
+	apr_thread_t      **workers;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+#endif
+	dt_task_t         *tasks;
+	int               num;
+	int               next;      /* Next entry to be processed */
+	int               consumed;  /* Entries before this one are no longer needed */
+	int               depth;
+	apr_size_t        limit;
+	char              stop;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+#if APR_HAS_THREADS
+
+/* Stream callback: writes svndiff data to memory until the limit has
+   been reached */
+static svn_error_t *dt_write_fn(void *baton, const char *data, apr_size_t *len)
+{
+	dt_writer_t *writer = (dt_writer_t *)baton;
+
+	if (writer->buffer->len + *len > writer->limit) {
+		writer->exceeded = 1;
+		return svn_error_create(SVN_ERR_CANCELLED, NULL, NULL);
+	}
+	svn_stringbuf_appendbytes(writer->buffer, data, *len);
+	return SVN_NO_ERROR;
+}
+
+
+/* Generates the svndiff of a task. The delta is always against the empty
+   stream, like in delta_deltify_node() */
+static svn_error_t *dt_run(dt_task_t *task, apr_size_t limit, apr_pool_t *pool)
+{
+	svn_txdelta_stream_t *stream;
+	svn_txdelta_window_handler_t handler;
+	void *handler_baton;
+	svn_stream_t *source, *target, *dest;
+	dt_writer_t *writer;
+	svn_error_t *err;
+
+	SVN_ERR(store_read_stream_private(&target, task->pack_file, &task->entry, pool));
+	source = svn_stream_empty(pool);
+
+	writer = apr_palloc(pool, sizeof(dt_writer_t));
+	writer->buffer = svn_stringbuf_create("", pool);
+	writer->limit = limit;
+	writer->exceeded = 0;
+	dest = svn_stream_create(writer, pool);
+	svn_stream_set_write(dest, dt_write_fn);
+
+	svn_txdelta(&stream, source, target, pool);
+	svn_txdelta_to_svndiff2(&handler, &handler_baton, dest, 0, pool);
+
+	err = svn_txdelta_send_txstream(stream, handler, handler_baton, pool);
+	if (writer->exceeded) {
+		/* The main thread will generate this one */
+		svn_error_clear(err);
+		err = SVN_NO_ERROR;
+	} else if (err == SVN_NO_ERROR) {
+		task->delta = writer->buffer;
+	}
+	svn_error_clear(svn_stream_close(target));
+	return err;
+}
+
+
+/* Frees the result of a task. The mutex must be locked */
+static void dt_free_task(dt_task_t *task)
+{
+	if (task->pool != NULL) {
+		svn_pool_destroy(task->pool);
+		task->pool = NULL;
+	}
+	svn_error_clear(task->err);
+	task->err = SVN_NO_ERROR;
+	task->delta = NULL;
+	task->state = DT_FREED;
+}
+
+
+/* Thread function of a worker */
+static void * APR_THREAD_FUNC dt_worker(apr_thread_t *thread, void *data)
+{
+	deltify_t *dt = (deltify_t *)data;
+
+	while (1) {
+		int i;
+		dt_task_t *task;
+		apr_pool_t *pool;
+		svn_error_t *err;
+
+		/* Claim the next entry that is still needed */
+		apr_thread_mutex_lock(dt->mutex);
+		while (!dt->stop && dt->next < dt->num && dt->next >= dt->consumed + dt->depth) {
+			apr_thread_cond_wait(dt->cond, dt->mutex);
+		}
+		if (dt->next < dt->consumed) {
+			dt->next = dt->consumed;
+		}
+		if (dt->stop || dt->next >= dt->num) {
+			apr_thread_mutex_unlock(dt->mutex);
+			break;
+		}
+		i = dt->next++;
+		task = &dt->tasks[i];
+		task->state = DT_RUNNING;
+		apr_thread_mutex_unlock(dt->mutex);
+
+		pool = svn_pool_create(NULL);
+		err = dt_run(task, dt->limit, pool);
+
+		apr_thread_mutex_lock(dt->mutex);
+		task->pool = pool;
+		task->err = err;
+		task->state = DT_DONE;
+		if (i < dt->consumed) {
+			/* Not needed anymore */
+			dt_free_task(task);
+		}
+		apr_thread_cond_broadcast(dt->cond);
+		apr_thread_mutex_unlock(dt->mutex);
+	}
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts generating svndiffs of the given store entries using a number
+   of threads. Svndiffs larger than limit bytes are not generated */
+char deltify_start(deltify_t **dt, int threads, const store_entry_t **entries, int num, apr_size_t limit, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	int i;
+	apr_status_t status;
+	deltify_t *d = apr_pcalloc(pool, sizeof(deltify_t));
+
+	d->pool = svn_pool_create(pool);
+	d->threads = 0;
+	d->num = num;
+	d->depth = threads * ENTRIES_PER_THREAD;
+	d->limit = limit;
+	d->tasks = apr_pcalloc(d->pool, num * sizeof(dt_task_t));
+	d->workers = apr_pcalloc(d->pool, threads * sizeof(apr_thread_t *));
+
+	/* The pack files are flushed here, before any thread reads them */
+	for (i = 0; i < num; i++) {
+		d->tasks[i].entry = *entries[i];
+		d->tasks[i].pack_file = store_pack_file(entries[i]);
+		d->tasks[i].state = DT_PENDING;
+	}
+
+	if ((status = apr_thread_mutex_create(&d->mutex, APR_THREAD_MUTEX_DEFAULT, d->pool)) || (status = apr_thread_cond_create(&d->cond, d->pool))) {
+		svn_error_t *err = utils_apr_error(status);
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(d->pool);
+		return 1;
+	}
+
+	for (i = 0; i < threads; i++) {
+		if ((status = apr_thread_create(&d->workers[i], NULL, dt_worker, d, d->pool))) {
+			svn_error_t *err = utils_apr_error(status);
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			break;
+		}
+		++d->threads;
+	}
+	DEBUG_MSG("deltify: %d of %d threads started for %d entries\n", d->threads, threads, num);
+	if (d->threads == 0) {
+		svn_pool_destroy(d->pool);
+		return 1;
+	}
+
+	*dt = d;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+
+/* Returns the svndiff of the entry with the given index, waiting for it
+   to be generated if neccessary. The svndiff will be NULL if it exceeded
+   the size limit. Entries with smaller indexes won't be requested
+   afterwards */
+svn_error_t *deltify_get(svn_stringbuf_t **delta, deltify_t *dt, int index, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	int i;
+	dt_task_t *task = &dt->tasks[index];
+	svn_error_t *err;
+#ifdef USE_TIMING
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	apr_thread_mutex_lock(dt->mutex);
+
+	/* Skipped entries are not needed anymore */
+	for (i = dt->consumed; i < index; i++) {
+		if (dt->tasks[i].state == DT_DONE) {
+			dt_free_task(&dt->tasks[i]);
+		}
+	}
+	if (dt->consumed < index) {
+		dt->consumed = index;
+		apr_thread_cond_broadcast(dt->cond);
+	}
+
+	while (task->state != DT_DONE) {
+		apr_thread_cond_wait(dt->cond, dt->mutex);
+	}
+	apr_thread_mutex_unlock(dt->mutex);
+#ifdef USE_TIMING
+	DEBUG_MSG("deltify: waited %f seconds for entry %d\n", stopwatch_elapsed(&watch), index);
+#endif
+
+	*delta = (task->delta != NULL ? svn_stringbuf_dup(task->delta, pool) : NULL);
+	err = task->err;
+	task->err = SVN_NO_ERROR;
+
+	apr_thread_mutex_lock(dt->mutex);
+	dt_free_task(task);
+	dt->consumed = index + 1;
+	apr_thread_cond_broadcast(dt->cond);
+	apr_thread_mutex_unlock(dt->mutex);
+	return err;
+#else
+	*delta = NULL;
+	return SVN_NO_ERROR;
+#endif
+}
+
+
+/* Stops the threads and frees all remaining svndiffs */
+void deltify_stop(deltify_t *dt)
+{
+#if APR_HAS_THREADS
+	int i;
+
+	apr_thread_mutex_lock(dt->mutex);
+	dt->stop = 1;
+	apr_thread_cond_broadcast(dt->cond);
+	apr_thread_mutex_unlock(dt->mutex);
+
+	for (i = 0; i < dt->threads; i++) {
+		apr_status_t retval;
+		apr_thread_join(&retval, dt->workers[i]);
+	}
+	for (i = 0; i < dt->num; i++) {
+		dt_free_task(&dt->tasks[i]);
+	}
+	svn_pool_destroy(dt->pool);
+#endif
+}
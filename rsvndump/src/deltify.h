@@ -0,0 +1,53 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: deltify.h
+ *      desc: Parallel generation of svndiffs
+ */
+
+
+#ifndef DELTIFY_H_
+#define DELTIFY_H_
+
+
+#include <svn_string.h>
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+#include "store.h"
+
+
+typedef struct deltify_t deltify_t;
+
+
+/* Starts generating svndiffs of the given store entries using a number
+   of threads. Svndiffs larger than limit bytes are not generated */
+extern char deltify_start(deltify_t **dt, int threads, const store_entry_t **entries, int num, apr_size_t limit, apr_pool_t *pool);
+
+/* Returns the svndiff of the entry with the given index, waiting for it
+   to be generated if neccessary. The svndiff will be NULL if it exceeded
+   the size limit. Entries with smaller indexes won't be requested
+   afterwards */
+extern svn_error_t *deltify_get(svn_stringbuf_t **delta, deltify_t *dt, int index, apr_pool_t *pool);
+
+/* Stops the threads and frees all remaining svndiffs */
+extern void deltify_stop(deltify_t *dt);
+
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: dirlist.c
+ *      desc: Concurrent listing of repository trees
+ *
+ *      Trees are listed breadth-first. The directories of the current
+ *      level are handed to worker threads in batches, and each worker
+ *      uses a session of its own, so the number of requests in flight is
+ *      bounded by the number of workers. The sessions are only opened
+ *      once a directory actually needs to be fetched.
+ */
+
+
+#include <svn_pools.h>
+#include <svn_ra.h>
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "timing.h"
+#include "utils.h"
+
+#include "dirlist.h"
+
+
+/* Maximum number of directories listed in a single batch */
+#define DIRLIST_BATCH 64
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* A directory entry */
+typedef struct {
+	const char        *name;
+	svn_node_kind_t   kind;
+} dl_entry_t;
+
+
+/* A directory that is being listed */
+typedef struct {
+	const char        *path;
+	apr_array_header_t *entries;
+	svn_error_t       *err;
+} dl_task_t;
+
+
+/* Arguments of a worker thread */
+typedef struct {
+	dirlist_t         *dl;
+	session_t         session;
+	apr_pool_t        *pool;     /* Listings of the current batch */
+} dl_worker_t;
+
+
+/* Lister state */
+struct dirlist_t {
+	apr_pool_t        *pool;
+	session_t         *session;
+	int               jobs;
+	int               workers_started;
+	dl_worker_t       *workers;
+#if APR_HAS_THREADS
+	apr_thread_t      **threads;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+#endif
+	dl_task_t         *tasks;    /* Current batch */
+	int               num;
+	int               next;      /* Next task to be processed */
+	int               done;      /* Number of finished tasks */
+	svn_revnum_t      revnum;
+	char              stop;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Fetches the entries of a single directory */
+static svn_error_t *dl_list(session_t *session, const char *path, svn_revnum_t revnum, apr_array_header_t **entries, apr_pool_t *pool)
+{
+	apr_hash_t *dirents;
+	apr_hash_index_t *hi;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_RA_GET_DIR, err = svn_ra_get_dir2(session->ra, &dirents, NULL, NULL, path, revnum, SVN_DIRENT_KIND, pool));
+	SVN_ERR(err);
+
+	*entries = apr_array_make(pool, apr_hash_count(dirents), sizeof(dl_entry_t));
+	for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi)) {
+		const void *key;
+		void *value;
+		dl_entry_t *entry = apr_array_push(*entries);
+		apr_hash_this(hi, &key, NULL, &value);
+		entry->name = key;
+		entry->kind = ((svn_dirent_t *)value)->kind;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+#if APR_HAS_THREADS
+
+/* Thread function of a worker */
+static void * APR_THREAD_FUNC dl_worker(apr_thread_t *thread, void *data)
+{
+	dl_worker_t *worker = (dl_worker_t *)data;
+	dirlist_t *dl = worker->dl;
+
+	apr_thread_mutex_lock(dl->mutex);
+	while (1) {
+		dl_task_t *task;
+		svn_error_t *err;
+
+		while (!dl->stop && dl->next >= dl->num) {
+			apr_thread_cond_wait(dl->cond, dl->mutex);
+		}
+		if (dl->stop) {
+			break;
+		}
+		task = &dl->tasks[dl->next++];
+		apr_thread_mutex_unlock(dl->mutex);
+
+		err = dl_list(&worker->session, task->path, dl->revnum, &task->entries, worker->pool);
+
+		apr_thread_mutex_lock(dl->mutex);
+		task->err = err;
+		++dl->done;
+		apr_thread_cond_broadcast(dl->cond);
+	}
+	apr_thread_mutex_unlock(dl->mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+/* Starts the worker threads */
+static svn_error_t *dl_start_workers(dirlist_t *dl)
+{
+	int i;
+	apr_status_t status;
+
+	dl->workers = apr_pcalloc(dl->pool, dl->jobs * sizeof(dl_worker_t));
+	dl->threads = apr_pcalloc(dl->pool, dl->jobs * sizeof(apr_thread_t *));
+	if ((status = apr_thread_mutex_create(&dl->mutex, APR_THREAD_MUTEX_DEFAULT, dl->pool)) || (status = apr_thread_cond_create(&dl->cond, dl->pool))) {
+		return utils_apr_error(status);
+	}
+
+	/* The sessions are opened here, so authentication doesn't happen
+	   concurrently */
+	for (i = 0; i < dl->jobs; i++) {
+		dl_worker_t *worker = &dl->workers[dl->workers_started];
+		worker->dl = dl;
+		worker->session = session_copy(dl->session);
+		if (session_open(&worker->session)) {
+			session_free(&worker->session);
+			break;
+		}
+		worker->pool = svn_pool_create(worker->session.pool);
+		if ((status = apr_thread_create(&dl->threads[dl->workers_started], NULL, dl_worker, worker, dl->pool))) {
+			session_free(&worker->session);
+			return utils_apr_error(status);
+		}
+		++dl->workers_started;
+	}
+	DEBUG_MSG("dirlist: %d of %d workers started\n", dl->workers_started, dl->jobs);
+	return SVN_NO_ERROR;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/* Fetches the listings of a batch of directories */
+static svn_error_t *dl_run_batch(dirlist_t *dl, dl_task_t *tasks, int num, svn_revnum_t revnum, apr_pool_t *pool)
+{
+	int i;
+	svn_error_t *err = SVN_NO_ERROR;
+
+#if APR_HAS_THREADS
+	if (dl->workers_started < 0 && dl->jobs > 0 && num > 1) {
+		dl->workers_started = 0;
+		if ((err = dl_start_workers(dl))) {
+			return err;
+		}
+	}
+	if (dl->workers_started > 0 && num > 1) {
+		for (i = 0; i < dl->workers_started; i++) {
+			svn_pool_clear(dl->workers[i].pool);
+		}
+
+		apr_thread_mutex_lock(dl->mutex);
+		dl->tasks = tasks;
+		dl->num = num;
+		dl->next = 0;
+		dl->done = 0;
+		dl->revnum = revnum;
+		apr_thread_cond_broadcast(dl->cond);
+		while (dl->done < num) {
+			apr_thread_cond_wait(dl->cond, dl->mutex);
+		}
+		dl->tasks = NULL;
+		dl->num = 0;
+		dl->next = 0;
+		apr_thread_mutex_unlock(dl->mutex);
+
+		/* Report the first error only */
+		for (i = 0; i < num; i++) {
+			if (err == SVN_NO_ERROR) {
+				err = tasks[i].err;
+			} else {
+				svn_error_clear(tasks[i].err);
+			}
+		}
+		return err;
+	}
+#endif
+
+	for (i = 0; i < num; i++) {
+		SVN_ERR(dl_list(dl->session, tasks[i].path, revnum, &tasks[i].entries, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new directory lister for the given session, which will use
+   up to jobs additional sessions for listing directories concurrently */
+dirlist_t *dirlist_create(session_t *session, int jobs, apr_pool_t *pool)
+{
+	dirlist_t *dl = apr_pcalloc(pool, sizeof(dirlist_t));
+
+	dl->pool = svn_pool_create(pool);
+	dl->session = session;
+#if APR_HAS_THREADS
+	dl->jobs = jobs;
+#else
+	dl->jobs = 0;
+#endif
+	dl->workers_started = -1;
+	return dl;
+}
+
+
+/* Lists the tree below the given directory breadth-first, calling the
+   callback for every entry. Parents are always reported before their
+   children */
+svn_error_t *dirlist_walk(dirlist_t *dl, const char *path, svn_revnum_t revnum, dirlist_callback_t callback, void *baton, apr_pool_t *pool)
+{
+	int pos = 0;
+	apr_array_header_t *queue = apr_array_make(pool, 16, sizeof(const char *));
+	apr_pool_t *batchpool = svn_pool_create(pool);
+	dl_task_t tasks[DIRLIST_BATCH];
+#ifdef USE_TIMING
+	int requests = 0;
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	APR_ARRAY_PUSH(queue, const char *) = path;
+	while (pos < queue->nelts) {
+		int i, batch = queue->nelts - pos;
+		svn_error_t *err;
+		if (batch > DIRLIST_BATCH) {
+			batch = DIRLIST_BATCH;
+		}
+
+		for (i = 0; i < batch; i++) {
+			tasks[i].path = APR_ARRAY_IDX(queue, pos + i, const char *);
+			tasks[i].entries = NULL;
+			tasks[i].err = SVN_NO_ERROR;
+		}
+		if ((err = dl_run_batch(dl, tasks, batch, revnum, batchpool))) {
+			svn_pool_destroy(batchpool);
+			return err;
+		}
+#ifdef USE_TIMING
+		requests += batch;
+#endif
+
+		/* Report the entries and queue the subdirectories */
+		for (i = 0; i < batch; i++) {
+			int j;
+			const char *dir = tasks[i].path;
+			for (j = 0; j < tasks[i].entries->nelts; j++) {
+				dl_entry_t *entry = &APR_ARRAY_IDX(tasks[i].entries, j, dl_entry_t);
+				const char *subpath = apr_psprintf(pool, "%s/%s", dir, entry->name);
+				callback(baton, subpath, entry->kind, batchpool);
+				if (entry->kind == svn_node_dir) {
+					APR_ARRAY_PUSH(queue, const char *) = subpath;
+				}
+			}
+		}
+
+		pos += batch;
+		svn_pool_clear(batchpool);
+	}
+
+	svn_pool_destroy(batchpool);
+#ifdef USE_TIMING
+	DEBUG_MSG("dirlist: listed %s@%ld with %d requests in %f seconds\n", path, revnum, requests, stopwatch_elapsed(&watch));
+#endif
+	return SVN_NO_ERROR;
+}
+
+
+/* Stops the lister and closes the additional sessions */
+void dirlist_free(dirlist_t *dl)
+{
+#if APR_HAS_THREADS
+	int i;
+
+	if (dl->workers_started > 0) {
+		apr_thread_mutex_lock(dl->mutex);
+		dl->stop = 1;
+		apr_thread_cond_broadcast(dl->cond);
+		apr_thread_mutex_unlock(dl->mutex);
+	}
+	for (i = 0; i < dl->workers_started; i++) {
+		apr_status_t retval;
+		apr_thread_join(&retval, dl->threads[i]);
+		session_free(&dl->workers[i].session);
+	}
+#endif
+	svn_pool_destroy(dl->pool);
+}
@@ -0,0 +1,54 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: dirlist.h
+ *      desc: Concurrent listing of repository trees
+ */
+
+
+#ifndef DIRLIST_H_
+#define DIRLIST_H_
+
+
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+#include "session.h"
+
+
+typedef struct dirlist_t dirlist_t;
+
+/* Callback for dirlist_walk(), called for every entry of the tree */
+typedef void (*dirlist_callback_t)(void *baton, const char *path, svn_node_kind_t kind, apr_pool_t *pool);
+
+
+/* Creates a new directory lister for the given session, which will use
+   up to jobs additional sessions for listing directories concurrently */
+extern dirlist_t *dirlist_create(session_t *session, int jobs, apr_pool_t *pool);
+
+/* Lists the tree below the given directory breadth-first, calling the
+   callback for every entry. Parents are always reported before their
+   children */
+extern svn_error_t *dirlist_walk(dirlist_t *dl, const char *path, svn_revnum_t revnum, dirlist_callback_t callback, void *baton, apr_pool_t *pool);
+
+/* Stops the lister and closes the additional sessions */
+extern void dirlist_free(dirlist_t *dl);
+
+
+#endif
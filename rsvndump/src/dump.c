@@ -32,21 +32,68 @@
 #include <apr_pools.h>
 
 #include "main.h"
+#include "checkpoint.h"
 #include "delta.h"
 #include "list.h"
 #include "log.h"
 #include "path_hash.h"
+#include "prefetch.h"
 #include "property.h"
+#include "timing.h"
 #include "utils.h"
 
 #include "dump.h"
 
 
+/* Options that must not change when resuming from a checkpoint */
+#define DUMP_CHECKPOINT_FLAGS (DF_USE_DELTAS | DF_KEEP_REVNUMS)
+
+/* Maximum number of revisions handed to the prefetcher at once */
+#define DUMP_PREFETCH_WINDOW 512
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* State of the dumping loop */
+typedef struct {
+	session_t         *session;
+	dump_options_t    *opts;
+	list_t            *logs;      /* Logs that haven't been dumped yet */
+	list_t            *revnums;   /* Global revisions of the dumped ones */
+	char              logs_fetched;
+	log_queue_t       *log_queue;
+	char              show_local_rev;
+	char              failed;
+	svn_revnum_t      global_rev;
+	svn_revnum_t      local_rev;
+	int               list_idx;
+	apr_pool_t        *revpool;
+} dump_state_t;
+
+
 /*---------------------------------------------------------------------------*/
 /* Static functions                                                          */
 /*---------------------------------------------------------------------------*/
 
 
+/* Releases the first n logs of the list, keeping only their revision
+   numbers for resolving copy sources */
+static void dump_release_logs(list_t *logs, list_t *revnums, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		log_revision_t *log = (log_revision_t *)logs->elements + i;
+		list_append(revnums, &log->revision);
+		log_free(log);
+	}
+	list_shift(logs, n);
+}
+
+
 /* Dumps a revision header using the given properties */
 static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn_revnum_t local_revnum, dump_options_t *opts)
 {
@@ -69,6 +116,7 @@ static void dump_revision_header(apr_pool_t *pool, log_revision_t *revision, svn
 	printf("%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, local_revnum);
 	printf("%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
 	printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
+	TIMING_COUNT(TM_OUTPUT_BYTES, props_length);
 
 	if (props_length > 0) {
 		if (revision->message != NULL) {
@@ -98,6 +146,7 @@ static void dump_padding_revision(apr_pool_t *pool, svn_revnum_t rev)
 	printf("%s: %ld\n", SVN_REPOS_DUMPFILE_REVISION_NUMBER, rev);
 	printf("%s: %d\n", SVN_REPOS_DUMPFILE_PROP_CONTENT_LENGTH, props_length);
 	printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_CONTENT_LENGTH, props_length);
+	TIMING_COUNT(TM_OUTPUT_BYTES, props_length);
 
 	property_dump("svn:log", message);
 	printf(PROPS_END"\n");
@@ -170,7 +219,7 @@ static char dump_do_diff(session_t *session, svn_revnum_t src, svn_revnum_t dest
 		return 1;
 	}
 
-	err = reporter->finish_report(report_baton, subpool);
+	TIMING_CALL(TM_RA_DIFF, err = reporter->finish_report(report_baton, subpool));
 	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
@@ -186,6 +235,383 @@ static char dump_do_diff(session_t *session, svn_revnum_t src, svn_revnum_t dest
 }
 
 
+/* Prepares the dumping of the next revision: fetches its log if
+   neccessary and dumps the revision header. If revision is valid, it
+   has to match the revision of the log */
+static char dump_revision_start(dump_state_t *state, svn_revnum_t revision)
+{
+	dump_options_t *opts = state->opts;
+	list_t *logs = state->logs;
+
+	state->revpool = svn_pool_create(state->session->pool);
+
+	if (state->logs_fetched == 0) {
+		log_revision_t log;
+		if (state->log_queue != NULL) {
+			if (log_queue_next(state->log_queue, &log, state->revpool)) {
+				return 1;
+			}
+		} else if (log_fetch_single(state->session, state->global_rev, opts->end, &log, state->revpool)) {
+			return 1;
+		}
+		list_append(logs, &log);
+		state->list_idx = logs->size-1;
+	} else {
+		++state->list_idx;
+	}
+
+	if (SVN_IS_VALID_REVNUM(revision) && ((log_revision_t *)logs->elements)[state->list_idx].revision != revision) {
+		fprintf(stderr, _("ERROR: Replayed revision %ld does not match log revision %ld\n"), revision, ((log_revision_t *)logs->elements)[state->list_idx].revision);
+		return 1;
+	}
+
+	if ((opts->flags & DF_KEEP_REVNUMS) && !(opts->flags & DF_DRY_RUN)) {
+		/* Padd with empty revisions if neccessary */
+		while (state->local_rev < ((log_revision_t *)logs->elements)[state->list_idx].revision) {
+			dump_padding_revision(state->revpool, state->local_rev);
+			if (opts->verbosity == 0) {
+				fprintf(stderr, _("* Padded revision %ld.\n"), state->local_rev);
+			} else if (opts->verbosity > 0) {
+				fprintf(stderr, _("------ Padded revision %ld <<<\n\n"), state->local_rev);
+			}
+			/* The first revision sets up the user prefix */
+			if (state->local_rev == 1) {
+				dump_create_user_prefix(opts, state->session->pool);
+			}
+			++state->local_rev;
+		}
+	}
+
+	/* Dump the revision header */
+	if (!(opts->flags & DF_DRY_RUN)) {
+		dump_revision_header(state->revpool, (log_revision_t *)logs->elements + state->list_idx, state->local_rev, opts);
+
+		/* The first revision sets up the user prefix */
+		if (state->local_rev == 1) {
+			dump_create_user_prefix(opts, state->session->pool);
+		}
+	}
+
+	if (opts->verbosity > 0) {
+		if (!(opts->flags & DF_DRY_RUN)) {
+			fprintf(stderr, _(">>> Dumping new revision, based on original revision %ld\n"), ((log_revision_t *)logs->elements)[state->list_idx].revision);
+		} else {
+			fprintf(stderr, _("Fetching base revision... "));
+		}
+	}
+	return 0;
+}
+
+
+/* Finishes the dumping of a revision after the delta editor has been driven */
+static char dump_revision_end(dump_state_t *state)
+{
+	dump_options_t *opts = state->opts;
+	log_revision_t *log = (log_revision_t *)state->logs->elements + state->list_idx;
+
+	/* Insert revision into path_hash */
+	if (!(opts->flags & DF_DRY_RUN) || strlen(state->session->prefix) != 0) {
+		if (path_hash_commit(state->session, log, state->local_rev)) {
+			return 1;
+		}
+	}
+#ifdef USE_TIMING
+	timing_revision(log->revision);
+#endif
+
+	if (opts->verbosity == 0 && !(opts->flags & DF_DRY_RUN)) {
+		if (state->show_local_rev) {
+			fprintf(stderr, _("* Dumped revision %ld (local %ld).\n"), log->revision, state->local_rev);
+		} else {
+			fprintf(stderr, _("* Dumped revision %ld.\n"), log->revision);
+		}
+	} else if (opts->verbosity > 0) {
+		if (!(opts->flags & DF_DRY_RUN)) {
+			fprintf(stderr, _("\n------ Dumped revision %ld <<<\n\n"), state->local_rev);
+		} else {
+			fprintf(stderr, _("done\n"));
+		}
+	}
+
+	state->global_rev = log->revision+1;
+	++state->local_rev;
+
+	/*
+	 * The log isn't needed anymore, apart from its revision number. The
+	 * released logs are removed once they make up half of the list, so
+	 * moving the remaining ones doesn't add up.
+	 */
+	list_append(state->revnums, &log->revision);
+	log_free(log);
+	if (2 * (state->list_idx + 1) >= (int)state->logs->size) {
+		list_shift(state->logs, state->list_idx + 1);
+		state->list_idx = -1;
+	}
+
+	/* Make sure no other revisions then the first one
+	   are dumped dry */
+	opts->flags &= ~DF_DRY_RUN;
+
+	apr_pool_destroy(state->revpool);
+	state->revpool = NULL;
+	return 0;
+}
+
+
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5)
+
+/* Checks if the remaining revisions can be dumped using replay requests */
+static char dump_can_replay(dump_state_t *state)
+{
+	/*
+	 * Paths sent by the replay editor drive are not relative to the session
+	 * URL on all servers, so only repository roots are replayed.
+	 */
+	if (state->opts->replay_window <= 0 || strlen(state->session->prefix) > 0) {
+		return 0;
+	}
+#ifdef USE_SINGLEFILE_DUMP
+	if (state->session->file) {
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+
+/* Callback for svn_ra_replay_range(): sets up the delta editor for a revision */
+static svn_error_t *dump_replay_revstart(svn_revnum_t revision, void *replay_baton, const svn_delta_editor_t **editor, void **edit_baton, apr_hash_t *rev_props, apr_pool_t *pool)
+{
+	dump_state_t *state = (dump_state_t *)replay_baton;
+	svn_delta_editor_t *de_editor;
+	log_revision_t *log;
+
+	DEBUG_MSG("replaying revision %ld\n", revision);
+	if (dump_revision_start(state, revision)) {
+		/* The error has already been reported */
+		svn_pool_destroy(state->revpool);
+		state->revpool = NULL;
+		state->failed = 1;
+		return svn_error_create(SVN_ERR_CANCELLED, NULL, NULL);
+	}
+
+	log = (log_revision_t *)state->logs->elements + state->list_idx;
+	delta_setup_editor(state->session, state->opts, state->revnums, log, state->local_rev, &de_editor, edit_baton, state->revpool);
+	*editor = de_editor;
+	return SVN_NO_ERROR;
+}
+
+
+/* Callback for svn_ra_replay_range(): finishes a revision */
+static svn_error_t *dump_replay_revfinish(svn_revnum_t revision, void *replay_baton, const svn_delta_editor_t *editor, void *edit_baton, apr_hash_t *rev_props, apr_pool_t *pool)
+{
+	dump_state_t *state = (dump_state_t *)replay_baton;
+
+	/* The editor drive isn't closed by the RA layer */
+	SVN_ERR(editor->close_edit(edit_baton, pool));
+
+	if (dump_revision_end(state)) {
+		/* The error has already been reported */
+		if (state->revpool != NULL) {
+			svn_pool_destroy(state->revpool);
+			state->revpool = NULL;
+		}
+		state->failed = 1;
+		return svn_error_create(SVN_ERR_CANCELLED, NULL, NULL);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Dumps the remaining revisions by replaying windows of revisions, which
+   needs only a single request per window. Returns -1 if the server doesn't
+   support replaying */
+static int dump_do_replay(dump_state_t *state)
+{
+	svn_error_t *err;
+	apr_pool_t *pool = svn_pool_create(state->session->pool);
+#ifdef USE_TIMING
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	while (state->global_rev <= state->opts->end) {
+		svn_revnum_t start = state->global_rev;
+		svn_revnum_t end = start + state->opts->replay_window - 1;
+		if (end > state->opts->end) {
+			end = state->opts->end;
+		}
+
+		/*
+		 * Using the end revision as the low water mark makes the server
+		 * send copies as plain additions including the full contents,
+		 * just like svn_ra_do_diff() does.
+		 */
+		DEBUG_MSG("replaying %ld:%ld\n", start, end);
+		TIMING_CALL(TM_RA_REPLAY, err = svn_ra_replay_range(state->session->ra, start, end, end, TRUE, dump_replay_revstart, dump_replay_revfinish, state, pool));
+		if (err) {
+			if (err->apr_err == SVN_ERR_RA_NOT_IMPLEMENTED && state->global_rev == start && state->revpool == NULL) {
+				DEBUG_MSG("replaying is not supported, falling back to diffs\n");
+				svn_error_clear(err);
+				svn_pool_destroy(pool);
+				return -1;
+			}
+			if (!state->failed) {
+				utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			}
+			svn_error_clear(err);
+			svn_pool_destroy(pool);
+			return 1;
+		}
+		svn_pool_clear(pool);
+	}
+
+	svn_pool_destroy(pool);
+#ifdef USE_TIMING
+	DEBUG_MSG("dump_do_replay done in %f seconds\n", stopwatch_elapsed(&watch));
+#endif
+	return 0;
+}
+
+#endif /* (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5) */
+
+
+#if APR_HAS_THREADS
+
+/* Checks if the revision logs can be fetched in the background */
+static char dump_can_queue_logs(dump_state_t *state)
+{
+#ifdef USE_SINGLEFILE_DUMP
+	if (state->session->file) {
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+
+/* Checks if the remaining revisions can be dumped using prefetching */
+static char dump_can_prefetch(dump_state_t *state)
+{
+	if (state->opts->jobs <= 0) {
+		return 0;
+	}
+#ifdef USE_SINGLEFILE_DUMP
+	if (state->session->file) {
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+
+/* Dumps the remaining revisions while their diffs are being fetched by
+   additional sessions in the background. The logs are fetched and the
+   prefetcher is restarted for every window of DUMP_PREFETCH_WINDOW
+   revisions */
+static char dump_do_prefetch(dump_state_t *state)
+{
+	dump_options_t *opts = state->opts;
+	list_t *logs = state->logs;
+	prefetch_t *pf;
+	svn_revnum_t *revs;
+	svn_revnum_t next = state->global_rev;
+	char fetch = (state->logs_fetched == 0);
+	int i, num;
+	char ret = 0;
+#ifdef USE_TIMING
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	/* The logs of a window are in the list while it is being dumped */
+	state->logs_fetched = 1;
+
+	revs = malloc(DUMP_PREFETCH_WINDOW * sizeof(svn_revnum_t));
+	while (next <= opts->end) {
+		/* The revisions to fetch must be known in advance */
+		if (fetch) {
+			svn_revnum_t end = next + DUMP_PREFETCH_WINDOW - 1;
+			if (end > opts->end) {
+				end = opts->end;
+			}
+			if (state->log_queue != NULL) {
+				if (log_queue_fetch(state->log_queue, end, logs, state->session->pool)) {
+					ret = 1;
+					break;
+				}
+			} else if (log_fetch_all(state->session, next, end, logs, opts->verbosity)) {
+				ret = 1;
+				break;
+			}
+			next = end + 1;
+		}
+
+		num = logs->size - (state->list_idx + 1);
+		if (num <= 0) {
+			if (fetch) {
+				continue;
+			}
+			break;
+		}
+		if (num > DUMP_PREFETCH_WINDOW) {
+			num = DUMP_PREFETCH_WINDOW;
+		}
+		for (i = 0; i < num; i++) {
+			revs[i] = ((log_revision_t *)logs->elements)[state->list_idx + 1 + i].revision;
+		}
+
+		DEBUG_MSG("prefetching %d revisions using %d jobs\n", num, opts->jobs);
+		if (prefetch_start(&pf, state->session, opts->jobs, state->global_rev - 1, revs, num, opts->temp_dir, state->session->pool)) {
+			ret = 1;
+			break;
+		}
+
+		for (i = 0; i < num; i++) {
+			svn_delta_editor_t *editor;
+			void *editor_baton;
+			log_revision_t *log;
+
+			if (dump_revision_start(state, SVN_INVALID_REVNUM)) {
+				ret = 1;
+				break;
+			}
+			log = (log_revision_t *)logs->elements + state->list_idx;
+			DEBUG_MSG("global = %ld, prefetched = %ld\n", log->revision, revs[i]);
+
+			delta_setup_editor(state->session, opts, state->revnums, log, state->local_rev, &editor, &editor_baton, state->revpool);
+			if (prefetch_next(pf, editor, editor_baton, state->revpool)) {
+				ret = 1;
+				break;
+			}
+
+			if (dump_revision_end(state)) {
+				ret = 1;
+				break;
+			}
+		}
+
+		prefetch_stop(pf);
+		if (ret) {
+			break;
+		}
+		if (next < state->global_rev) {
+			next = state->global_rev;
+		}
+	}
+	free(revs);
+
+	/* Nothing is left to dump */
+	if (ret == 0) {
+		state->global_rev = opts->end + 1;
+	}
+#ifdef USE_TIMING
+	DEBUG_MSG("dump_do_prefetch done in %f seconds\n", stopwatch_elapsed(&watch));
+#endif
+	return ret;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
 /* Determines the correct end revision of a repository */
 static char dump_determine_end(session_t *session, svn_revnum_t *rev)
 {
@@ -193,7 +619,7 @@ static char dump_determine_end(session_t *session, svn_revnum_t *rev)
 	svn_dirent_t *dirent;
 	apr_pool_t *pool = svn_pool_create(session->pool);
 
-	err = svn_ra_stat(session->ra, "",  *rev, &dirent, session->pool);
+	TIMING_CALL(TM_RA_STAT, err = svn_ra_stat(session->ra, "",  *rev, &dirent, session->pool));
 	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
@@ -219,7 +645,7 @@ static svn_node_kind_t dump_check_path(session_t *session, const char *path, svn
 	svn_node_kind_t kind;
 	apr_pool_t *pool = svn_pool_create(session->pool);
 
-	err = svn_ra_check_path(session->ra, path, rev, &kind, pool);
+	TIMING_CALL(TM_RA_CHECK_PATH, err = svn_ra_check_path(session->ra, path, rev, &kind, pool));
 	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
@@ -253,6 +679,134 @@ static char dump_fetch_uuid(session_t *session, const char **uuid)
 }
 
 
+/* Writes the dumping state to a checkpoint */
+static svn_error_t *dump_write_checkpoint(dump_state_t *state, checkpoint_t *cp, apr_pool_t *pool)
+{
+	int i;
+
+	SVN_ERR(checkpoint_write_string(cp, state->session->url));
+	SVN_ERR(checkpoint_write_int(cp, state->opts->flags & DUMP_CHECKPOINT_FLAGS));
+	SVN_ERR(checkpoint_write_int(cp, state->opts->start));
+	SVN_ERR(checkpoint_write_int(cp, state->global_rev));
+	SVN_ERR(checkpoint_write_int(cp, state->local_rev));
+
+	/* Only the revision numbers of the logs are needed for resolving
+	   copy sources later on */
+	SVN_ERR(checkpoint_write_int(cp, state->revnums->size));
+	for (i = 0; i < (int)state->revnums->size; i++) {
+		SVN_ERR(checkpoint_write_int(cp, ((svn_revnum_t *)state->revnums->elements)[i]));
+	}
+
+	SVN_ERR(delta_save(cp, pool));
+	return path_hash_save(cp, pool);
+}
+
+
+/* Saves the dumping state to the checkpoint directory given in the options */
+static char dump_save_checkpoint(dump_state_t *state)
+{
+	checkpoint_t *cp;
+	svn_error_t *err;
+	apr_pool_t *pool = svn_pool_create(state->session->pool);
+
+	if ((err = checkpoint_create(&cp, state->opts->checkpoint, pool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(pool);
+		return 1;
+	}
+	if ((err = dump_write_checkpoint(state, cp, pool)) || (err = checkpoint_commit(cp))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		checkpoint_close(cp);
+		svn_pool_destroy(pool);
+		return 1;
+	}
+
+	checkpoint_close(cp);
+	svn_pool_destroy(pool);
+	return 0;
+}
+
+
+/* Opens the checkpoint that should be resumed and reads the revision
+   numbers from it */
+static char dump_open_checkpoint(session_t *session, dump_options_t *opts, checkpoint_t **cp, svn_revnum_t *global_rev, svn_revnum_t *local_rev)
+{
+	const char *url;
+	apr_int64_t flags, start, global, local;
+	svn_error_t *err;
+
+	if ((err = checkpoint_open(cp, opts->resume, session->pool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return 1;
+	}
+
+	if ((err = checkpoint_read_string(*cp, &url, session->pool)) || (err = checkpoint_read_int(*cp, &flags)) || (err = checkpoint_read_int(*cp, &start)) || (err = checkpoint_read_int(*cp, &global)) || (err = checkpoint_read_int(*cp, &local))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		checkpoint_close(*cp);
+		return 1;
+	}
+
+	if (url == NULL || strcmp(url, session->url)) {
+		fprintf(stderr, _("ERROR: The checkpoint has been created for '%s'\n"), url);
+		checkpoint_close(*cp);
+		return 1;
+	}
+	if (flags != (opts->flags & DUMP_CHECKPOINT_FLAGS)) {
+		fprintf(stderr, _("ERROR: The checkpoint has been created using different --keep-revnums or --deltas options\n"));
+		checkpoint_close(*cp);
+		return 1;
+	}
+
+	/* The original start revision is needed for checking copy sources */
+	opts->start = (svn_revnum_t)start;
+	*global_rev = (svn_revnum_t)global;
+	*local_rev = (svn_revnum_t)local;
+	return 0;
+}
+
+
+/* Reads the revision numbers of the dumped revisions, the local copies
+   and the path hash from a checkpoint */
+static svn_error_t *dump_read_checkpoint(session_t *session, dump_options_t *opts, checkpoint_t *cp, list_t *revnums, apr_pool_t *pool)
+{
+	apr_int64_t i, num;
+
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		apr_int64_t revision;
+		svn_revnum_t revnum;
+		SVN_ERR(checkpoint_read_int(cp, &revision));
+		revnum = (svn_revnum_t)revision;
+		list_append(revnums, &revnum);
+	}
+
+	SVN_ERR(delta_load(cp, session, opts, pool));
+	return path_hash_load(cp, pool);
+}
+
+
+/* Restores the revision numbers of the dumped revisions, the local copies
+   and the path hash from a checkpoint */
+static char dump_load_checkpoint(session_t *session, dump_options_t *opts, checkpoint_t *cp, list_t *revnums)
+{
+	svn_error_t *err;
+	apr_pool_t *pool = svn_pool_create(session->pool);
+
+	if ((err = dump_read_checkpoint(session, opts, cp, revnums, pool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(pool);
+		return 1;
+	}
+
+	svn_pool_destroy(pool);
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* Global functions                                                          */
 /*---------------------------------------------------------------------------*/
@@ -265,12 +819,18 @@ dump_options_t dump_options_create()
 
 	opts.temp_dir = NULL;
 	opts.prefix = NULL;
+	opts.log_cache = NULL;
+	opts.checkpoint = NULL;
+	opts.resume = NULL;
 	opts.verbosity = 0;
 	opts.flags = 0x00;
 	opts.dump_format = 2;
 
 	opts.start = 0;
 	opts.end = -1; /* HEAD */
+	opts.replay_window = 0;
+	opts.jobs = 0;
+	opts.delta_jobs = 0;
 
 	return opts;
 }
@@ -286,11 +846,12 @@ void dump_options_free(dump_options_t *opts)
 /* Start the dumping process, using the given session and options */
 char dump(session_t *session, dump_options_t *opts)
 {
-	list_t logs;
+	list_t logs, revnums;
 	char logs_fetched = 0, ret = 0;
 	char start_mid = 0, show_local_rev = 1;
 	svn_revnum_t global_rev, local_rev = -1;
-	int list_idx;
+	dump_state_t state;
+	checkpoint_t *cp = NULL;
 
 	/* Dumping with deltas requires dump format version 3 */
 	if (opts->flags & DF_USE_DELTAS) {
@@ -311,7 +872,13 @@ char dump(session_t *session, dump_options_t *opts)
 	if (dump_determine_end(session, &opts->end)) {
 		return 1;
 	}
-	if ((opts->start == 0) && (strlen(session->prefix) > 0)) {
+	if (opts->resume != NULL) {
+		/* The history before the checkpoint is known already */
+		if (dump_open_checkpoint(session, opts, &cp, &global_rev, &local_rev)) {
+			return 1;
+		}
+		start_mid = 0;
+	} else if ((opts->start == 0) && (strlen(session->prefix) > 0)) {
 		if (log_get_range(session, &opts->start, &opts->end, opts->verbosity)) {
 			return 1;
 		}
@@ -330,32 +897,65 @@ char dump(session_t *session, dump_options_t *opts)
 	 * will nor work.
 	 */
 	if (session_check_reparent(session, opts->start)) {
+		if (cp != NULL) {
+			checkpoint_close(cp);
+		}
 		return 1;
 	}
 
+	/*
+	 * The logs are consumed while dumping. Afterwards, only their revision
+	 * numbers are kept, indexed by the local revisions.
+	 */
 	logs = list_create(sizeof(log_revision_t));
+	revnums = list_create(sizeof(svn_revnum_t));
 	/*
 	 * delta_check_copy() assumes list indexes and local revisions to be equal,
 	 * so insert a empty revision '0' if a subdirectory is being dumped
 	 */
-	if (strlen(session->prefix) > 0) {
+	if ((strlen(session->prefix) > 0) && (cp == NULL)) {
 		log_revision_t dummy;
 		dummy.revision = 0;
 		dummy.author = NULL;
 		dummy.date = NULL;
 		dummy.message = NULL;
 		dummy.changed_paths = NULL;
+		dummy.pool = NULL;
 		list_append(&logs, &dummy);
 	}
 
-	path_hash_initialize(session->prefix, opts->temp_dir, session->pool);
+	path_hash_initialize(session->prefix, opts->temp_dir, opts->jobs, session->pool);
 
 	/*
 	 * Decide whether the whole repository log should be fetched
 	 * prior to dumping.
 	 */
-	if (start_mid) {
-		if (log_fetch_all(session, 0, opts->end, &logs, opts->verbosity)) {
+	if (cp != NULL) {
+		/* Only the revision numbers of the dumped revisions are restored */
+		char failed = dump_load_checkpoint(session, opts, cp, &revnums);
+		checkpoint_close(cp);
+		if (failed) {
+			list_free(&logs);
+			list_free(&revnums);
+			return 1;
+		}
+		if (global_rev > opts->end) {
+			if (opts->verbosity >= 0) {
+				fprintf(stderr, _("* Nothing to dump after revision %ld.\n"), global_rev - 1);
+			}
+			delta_cleanup();
+			path_hash_cleanup();
+			list_free(&logs);
+			list_free(&revnums);
+			return 0;
+		}
+	} else if (start_mid) {
+		if (opts->log_cache != NULL) {
+			const char *uuid;
+			if (dump_fetch_uuid(session, &uuid) || log_fetch_cached(session, opts->log_cache, uuid, 0, opts->end, &logs, opts->verbosity)) {
+				return 1;
+			}
+		} else if (log_fetch_all(session, 0, opts->end, &logs, opts->verbosity)) {
 			return 1;
 		}
 		logs_fetched = 1;
@@ -386,12 +986,13 @@ char dump(session_t *session, dump_options_t *opts)
 	}
 
 	/* Write dumpfile header */
-	if (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || !start_mid) {
+	if (!(opts->flags & DF_NO_INCREMENTAL_HEADER) || (!start_mid && opts->resume == NULL)) {
 		printf("%s: %d\n\n", SVN_REPOS_DUMPFILE_MAGIC_HEADER, opts->dump_format);
 		if ((opts->prefix == NULL) && (strlen(session->prefix) == 0)) {
 			const char *uuid;
 			if (dump_fetch_uuid(session, &uuid)) {
 				list_free(&logs);
+				list_free(&revnums);
 				return 1;
 			}
 			printf("UUID: %s\n\n", uuid);
@@ -403,13 +1004,18 @@ char dump(session_t *session, dump_options_t *opts)
 		opts->end = ((log_revision_t *)logs.elements)[logs.size-1].revision;
 	}
 
-	/* Pre-dumping initialization */
-	global_rev = opts->start;
-	if (!start_mid) {
+	/*
+	 * Pre-dumping initialization. When resuming, the dumping continues
+	 * right after the last revision of the checkpoint.
+	 */
+	if (opts->resume == NULL && !start_mid) {
+		global_rev = opts->start;
 		local_rev = global_rev == 0 ? 0 : 1;
-		list_idx = 0;
-	} else {
-		list_idx = local_rev-1;
+		dump_release_logs(&logs, &revnums, logs.size);
+	} else if (start_mid) {
+		/* The logs of the previous revisions are in the path hash now */
+		global_rev = opts->start;
+		dump_release_logs(&logs, &revnums, local_rev);
 		if (opts->flags & DF_KEEP_REVNUMS) {
 			local_rev = opts->start;
 		}
@@ -419,54 +1025,43 @@ char dump(session_t *session, dump_options_t *opts)
 		show_local_rev = 0;
 	}
 
+	state.session = session;
+	state.opts = opts;
+	state.logs = &logs;
+	state.revnums = &revnums;
+	state.logs_fetched = logs_fetched;
+	state.log_queue = NULL;
+	state.show_local_rev = show_local_rev;
+	state.failed = 0;
+	state.global_rev = global_rev;
+	state.local_rev = local_rev;
+	state.list_idx = -1;
+	state.revpool = NULL;
+
+#if APR_HAS_THREADS
+	/* Fetch the logs in batches while dumping */
+	if (!logs_fetched && dump_can_queue_logs(&state)) {
+		if (log_queue_start(&state.log_queue, session, state.global_rev, opts->end, session->pool)) {
+			list_free(&logs);
+			list_free(&revnums);
+			return 1;
+		}
+	}
+#endif
+
 	/* Start dumping */
 	do {
 		svn_delta_editor_t *editor;
 		void *editor_baton;
 		svn_revnum_t diff_rev;
-		apr_pool_t *revpool = svn_pool_create(session->pool);
-
-		if (logs_fetched == 0) {
-			log_revision_t log;
-			if (log_fetch_single(session, global_rev, opts->end, &log, revpool)) {
-				ret = 1;
-				break;
-			}
-			list_append(&logs, &log);
-			list_idx = logs.size-1;
-		} else {
-			++list_idx;
-		}
-
-		if ((opts->flags & DF_KEEP_REVNUMS) && !(opts->flags & DF_DRY_RUN)) {
-			/* Padd with empty revisions if neccessary */
-			while (local_rev < ((log_revision_t *)logs.elements)[list_idx].revision) {
-				dump_padding_revision(revpool, local_rev);
-				if (opts->verbosity == 0) {
-					fprintf(stderr, _("* Padded revision %ld.\n"), local_rev);
-				} else if (opts->verbosity > 0) {
-					fprintf(stderr, _("------ Padded revision %ld <<<\n\n"), local_rev);
-				}
-				/* The first revision sets up the user prefix */
-				if (local_rev == 1) {
-					dump_create_user_prefix(opts, session->pool);
-				}
-				++local_rev;
-			}
-		}
-
-		/* Dump the revision header */
-		if (!(opts->flags & DF_DRY_RUN)) {
-			dump_revision_header(revpool, (log_revision_t *)logs.elements + list_idx, local_rev, opts);
 
-			/* The first revision sets up the user prefix */
-			if (local_rev == 1) {
-				dump_create_user_prefix(opts, session->pool);
-			}
+		if (dump_revision_start(&state, SVN_INVALID_REVNUM)) {
+			ret = 1;
+			break;
 		}
 
 		/* Determine the diff base */
-		diff_rev = global_rev - 1;
+		diff_rev = state.global_rev - 1;
 		if (diff_rev < 0) {
 			diff_rev = 0;
 		}
@@ -483,60 +1078,69 @@ char dump(session_t *session, dump_options_t *opts)
 			diff_rev = opts->start;
 #endif
 		}
-		DEBUG_MSG("global = %ld, diff = %ld, start = %ld\n", global_rev, diff_rev, opts->start);
+		DEBUG_MSG("global = %ld, diff = %ld, start = %ld\n", state.global_rev, diff_rev, opts->start);
 
-		if (opts->verbosity > 0) {
-			if (!(opts->flags & DF_DRY_RUN)) {
-				fprintf(stderr, _(">>> Dumping new revision, based on original revision %ld\n"), ((log_revision_t *)logs.elements)[list_idx].revision);
-			} else {
-				fprintf(stderr, _("Fetching base revision... "));
+		/* Setup the delta editor and run a diff */
+		delta_setup_editor(session, opts, &revnums, (log_revision_t *)logs.elements + state.list_idx, state.local_rev, &editor, &editor_baton, state.revpool);
+#if APR_HAS_THREADS
+		if (state.global_rev == opts->start && dump_can_prefetch(&state)) {
+			/* The initial tree is fetched in parallel instead */
+			if (prefetch_tree(session, opts->jobs, ((log_revision_t *)logs.elements)[state.list_idx].revision, opts->temp_dir, editor, editor_baton, state.revpool)) {
+				ret = 1;
+				break;
 			}
+		} else
+#endif
+		if (dump_do_diff(session, diff_rev, ((log_revision_t *)logs.elements)[state.list_idx].revision, (state.global_rev == opts->start), editor, editor_baton, state.revpool)) {
+			ret = 1;
+			break;
 		}
 
-		/* Setup the delta editor and run a diff */
-		delta_setup_editor(session, opts, &logs, (log_revision_t *)logs.elements + list_idx, local_rev, &editor, &editor_baton, revpool);
-		if (dump_do_diff(session, diff_rev, ((log_revision_t *)logs.elements)[list_idx].revision, (global_rev == opts->start), editor, editor_baton, revpool)) {
+		if (dump_revision_end(&state)) {
 			ret = 1;
 			break;
 		}
 
-		/* Insert revision into path_hash */
-		if (!(opts->flags & DF_DRY_RUN) || strlen(session->prefix) != 0) {
-			if (path_hash_commit(session, (log_revision_t *)logs.elements + list_idx, local_rev)) {
+#if APR_HAS_THREADS
+		/* Once the base revision is known, the rest can be prefetched */
+		if (state.global_rev <= opts->end && dump_can_prefetch(&state)) {
+			if (dump_do_prefetch(&state)) {
 				ret = 1;
-				break;
 			}
+			break;
 		}
+#endif
 
-		if (opts->verbosity == 0 && !(opts->flags & DF_DRY_RUN)) {
-			if (show_local_rev) {
-				fprintf(stderr, _("* Dumped revision %ld (local %ld).\n"), ((log_revision_t *)logs.elements)[list_idx].revision, local_rev);
-			} else {
-				fprintf(stderr, _("* Dumped revision %ld.\n"), ((log_revision_t *)logs.elements)[list_idx].revision);
-			}
-		} else if (opts->verbosity > 0) {
-			if (!(opts->flags & DF_DRY_RUN)) {
-				fprintf(stderr, _("\n------ Dumped revision %ld <<<\n\n"), local_rev);
-			} else {
-				fprintf(stderr, _("done\n"));
+#if (SVN_VER_MAJOR == 1) && (SVN_VER_MINOR >= 5)
+		/* Once the base revision is known, the rest can be replayed */
+		if (state.global_rev <= opts->end && dump_can_replay(&state)) {
+			int replayed = dump_do_replay(&state);
+			if (replayed > 0) {
+				ret = 1;
+				break;
+			} else if (replayed < 0) {
+				/* Don't try again */
+				opts->replay_window = 0;
 			}
 		}
-
-		global_rev = ((log_revision_t *)logs.elements)[list_idx].revision+1;
-		++local_rev;
-
-		/* Make sure no other revisions then the first one
-		   are dumped dry */
-		opts->flags &= ~DF_DRY_RUN;
-
-		apr_pool_destroy(revpool);
-	} while (global_rev <= opts->end);
+#endif
+	} while (state.global_rev <= opts->end);
 
 #ifdef DEBUG_PHASH
 	path_hash_test(session);
 #endif
 
+	if (state.log_queue != NULL) {
+		log_queue_stop(state.log_queue);
+	}
+
+	if (ret == 0 && opts->checkpoint != NULL) {
+		ret = dump_save_checkpoint(&state);
+	}
+
 	delta_cleanup();
+	path_hash_cleanup();
 	list_free(&logs);
+	list_free(&revnums);
 	return ret;
 }
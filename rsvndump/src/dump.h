@@ -46,11 +46,17 @@ enum dump_flags {
 typedef struct {
 	char          *temp_dir;
 	char          *prefix;
+	char          *log_cache;
+	char          *checkpoint;
+	char          *resume;
 	svn_revnum_t  start;
 	svn_revnum_t  end;
 	int           verbosity;
 	int           flags;
 	int           dump_format;
+	int           replay_window;
+	int           jobs;
+	int           delta_jobs;
 } dump_options_t;
 
 
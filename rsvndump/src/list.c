@@ -57,19 +57,12 @@ list_t *list_append(list_t *l, void *element)
 {
 	if (l->size >= l->max) {
 		/* Resize, i.e. make the list twice as large */
-		void *t = malloc(l->elsize * l->max);
+		void *t = realloc(l->elements, l->elsize * l->max * 2);
 		if (t == NULL) {
 			return NULL;
 		}
-		memcpy(t, l->elements, l->elsize * l->max);
-		free(l->elements);
+		l->elements = t;
 		l->max *= 2;
-		l->elements = malloc(l->elsize * l->max);
-		if (l->elements == NULL) {
-			return NULL;
-		}
-		memcpy(l->elements, t, l->elsize * (l->max >> 1));
-		free(t);
 	}
 	memcpy((char *)l->elements + (l->elsize * l->size), element, l->elsize);
 	++l->size;
@@ -89,6 +82,18 @@ void list_remove(list_t *l, unsigned int pos)
 }
 
 
+/* Removes the first n elements from the list */
+void list_shift(list_t *l, unsigned int n)
+{
+	if (n >= l->size) {
+		l->size = 0;
+	} else if (n > 0) {
+		memmove(l->elements, (char *)l->elements + n*l->elsize, (l->size-n)*l->elsize);
+		l->size -= n;
+	}
+}
+
+
 /* Sorts the list using a specified sorting function */
 void list_qsort(list_t *l, int (* comparator)(const void *, const void *))
 {
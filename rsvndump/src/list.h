@@ -48,6 +48,9 @@ extern list_t *list_append(list_t *l, void *element);
 /* Removes the element at pos from the list */
 extern void list_remove(list_t *l, unsigned int pos);
 
+/* Removes the first n elements from the list */
+extern void list_shift(list_t *l, unsigned int n);
+
 /* Sorts the list using a specified sorting function */
 extern void list_qsort(list_t *l, int (* comparator)(const void *, const void *));
 
@@ -21,19 +21,53 @@
  */
 
 
+#include <svn_md5.h>
 #include <svn_path.h>
 #include <svn_pools.h>
 #include <svn_ra.h>
 
+#include <apr_file_io.h>
+#include <apr_md5.h>
+#include <apr_strings.h>
 #include <apr_tables.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
 
 #include "main.h"
 #include "list.h"
 #include "session.h"
+#include "timing.h"
+#include "utils.h"
 
 #include "log.h"
 
 
+/* Number of revision logs fetched by a single request of the log queue */
+#define LOG_BATCH_SIZE 512
+
+/* Maximum number of queued revision logs */
+#define LOG_QUEUE_SIZE (2 * LOG_BATCH_SIZE)
+
+/* Number of consecutive revision logs in a list that share a pool */
+#define LOG_CHUNK_SIZE 256
+
+/* Magic number of log cache index files */
+#define LOG_CACHE_MAGIC "RLC1"
+#define LOG_CACHE_MAGIC_LEN 4
+
+/* Size of the log cache index header: magic number, last cached revision
+   and size of the data file */
+#define LOG_CACHE_HEADER_SIZE (LOG_CACHE_MAGIC_LEN + 2 * sizeof(apr_int64_t))
+
+/* String length that marks a NULL string in the log cache */
+#define LOG_CACHE_NULL ((apr_uint32_t)-1)
+
+#define ERRBUFFER_SIZE 512
+
+
 /*---------------------------------------------------------------------------*/
 /* Local data structures                                                     */
 /*---------------------------------------------------------------------------*/
@@ -47,19 +81,134 @@ typedef struct {
 } log_receiver_baton_t;
 
 
-/* A baton for log_receiver_list() */
+/* A list of revision logs that is filled in chunks. The logs of a chunk
+   are allocated from a common pool, which is owned by the last log of the
+   chunk, so the memory can be released while the list is being consumed */
 typedef struct {
 	list_t		*list;
-	session_t	*session;
+	apr_pool_t	*parent;
 	apr_pool_t	*pool;
+	int		count;
+} log_chunks_t;
+
+
+/* A baton for log_receiver_list() */
+typedef struct {
+	log_chunks_t	chunks;
+	session_t	*session;
 } log_receiver_list_baton_t;
 
 
+/* A queued revision log */
+typedef struct {
+	log_revision_t	log;
+	apr_pool_t	*pool;
+} log_queue_entry_t;
+
+
+/* An entry of the log cache index */
+typedef struct {
+	apr_int64_t	revision;
+	apr_int64_t	offset;
+} log_cache_offset_t;
+
+
+/* Persistent revision log cache. The data file contains the revision
+   logs, the index file the offsets of the single revisions. All numbers
+   are stored in host byte order */
+typedef struct {
+	apr_file_t	*data;
+	apr_file_t	*index;
+	svn_revnum_t	last;     /* Last revision that has been cached */
+	apr_off_t	size;     /* Size of the valid data */
+	apr_array_header_t *offsets;
+	int		committed; /* Number of offsets in the index file */
+} log_cache_t;
+
+
+/* A baton for log_receiver_cache() */
+typedef struct {
+	log_chunks_t	*chunks;
+	session_t	*session;
+	log_cache_t	*cache;
+	svn_revnum_t	start;
+} log_receiver_cache_baton_t;
+
+
+/* Revision logs that are fetched in the background */
+struct log_queue_t {
+	apr_pool_t	*pool;
+	session_t	session;
+	svn_revnum_t	start;
+	svn_revnum_t	end;
+#if APR_HAS_THREADS
+	apr_thread_t	*thread;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+#endif
+	log_queue_entry_t *entries;
+	int		first;
+	int		count;
+	char		done;
+	char		stop;
+	svn_error_t	*err;
+};
+
+
 /*---------------------------------------------------------------------------*/
 /* Static functions                                                          */
 /*---------------------------------------------------------------------------*/
 
 
+/* Initializes a chunked list of revision logs */
+static void log_chunks_init(log_chunks_t *chunks, list_t *list, apr_pool_t *parent)
+{
+	chunks->list = list;
+	chunks->parent = parent;
+	chunks->pool = NULL;
+	chunks->count = 0;
+}
+
+
+/* Returns the pool for the next revision log of a chunked list */
+static apr_pool_t *log_chunks_pool(log_chunks_t *chunks)
+{
+	if (chunks->pool == NULL) {
+		chunks->pool = svn_pool_create(chunks->parent);
+		chunks->count = 0;
+	}
+	return chunks->pool;
+}
+
+
+/* Appends a revision log that has been allocated from log_chunks_pool()
+   to a chunked list */
+static void log_chunks_append(log_chunks_t *chunks, log_revision_t *log)
+{
+	log->pool = NULL;
+	if (++chunks->count >= LOG_CHUNK_SIZE) {
+		log->pool = chunks->pool;
+		chunks->pool = NULL;
+	}
+	list_append(chunks->list, log);
+}
+
+
+/* Hands the pool of the last, incomplete chunk over to the last log */
+static void log_chunks_close(log_chunks_t *chunks)
+{
+	if (chunks->pool == NULL) {
+		return;
+	}
+	if (chunks->count > 0) {
+		((log_revision_t *)chunks->list->elements)[chunks->list->size-1].pool = chunks->pool;
+	} else {
+		svn_pool_destroy(chunks->pool);
+	}
+	chunks->pool = NULL;
+}
+
+
 /* Callback for svn_ra_get_log() */
 static svn_error_t *log_receiver(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
 {
@@ -67,6 +216,7 @@ static svn_error_t *log_receiver(void *baton, apr_hash_t *changed_paths, svn_rev
 	log_receiver_baton_t *data = (log_receiver_baton_t *)baton;
 
 	data->log->revision = revision;
+	data->log->pool = NULL;
 	data->log->author = apr_pstrdup(data->pool, author);
 	data->log->date = apr_pstrdup(data->pool, date);
 	data->log->message = apr_pstrdup(data->pool, message);
@@ -130,10 +280,432 @@ static svn_error_t *log_receiver_list(void *baton, apr_hash_t *changed_paths, sv
 
 	receiver_baton.log = &log;
 	receiver_baton.session = data->session;
-	receiver_baton.pool = data->pool;
+	receiver_baton.pool = log_chunks_pool(&data->chunks);
 	log_receiver(&receiver_baton, changed_paths, revision, author, date, message, pool);
-	list_append(data->list, &log);
+	log_chunks_append(&data->chunks, &log);
+
+	return SVN_NO_ERROR;
+}
+
+
+/* Copies a revision log, including its changed paths */
+static void log_copy(log_revision_t *dest, const log_revision_t *src, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	dest->revision = src->revision;
+	dest->pool = NULL;
+	dest->author = (src->author ? apr_pstrdup(pool, src->author) : NULL);
+	dest->date = (src->date ? apr_pstrdup(pool, src->date) : NULL);
+	dest->message = (src->message ? apr_pstrdup(pool, src->message) : NULL);
+	dest->changed_paths = apr_hash_make(pool);
+
+	for (hi = apr_hash_first(pool, src->changed_paths); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		svn_log_changed_path_t *svalue, *dvalue;
+		apr_hash_this(hi, (const void **)(void *)&key, NULL, (void **)(void *)&svalue);
+
+		dvalue = apr_palloc(pool, sizeof(svn_log_changed_path_t));
+		dvalue->action = svalue->action;
+		dvalue->copyfrom_path = (svalue->copyfrom_path ? apr_pstrdup(pool, svalue->copyfrom_path) : NULL);
+		dvalue->copyfrom_rev = svalue->copyfrom_rev;
+		apr_hash_set(dest->changed_paths, apr_pstrdup(pool, key), APR_HASH_KEY_STRING, dvalue);
+	}
+}
+
+
+#if APR_HAS_THREADS
+
+/* Callback for svn_ra_get_log(): appends a revision log to the queue */
+static svn_error_t *log_receiver_queue(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
+{
+	log_queue_t *queue = (log_queue_t *)baton;
+	log_queue_entry_t entry;
+	log_receiver_baton_t receiver_baton;
+
+	/* Each entry lives in a pool of its own, so it can be handed over */
+	entry.pool = svn_pool_create(NULL);
+	receiver_baton.log = &entry.log;
+	receiver_baton.session = &queue->session;
+	receiver_baton.pool = entry.pool;
+	SVN_ERR(log_receiver(&receiver_baton, changed_paths, revision, author, date, message, pool));
+
+	/* Space for the whole batch has been reserved before the request */
+	apr_thread_mutex_lock(queue->mutex);
+	if (queue->stop) {
+		apr_thread_mutex_unlock(queue->mutex);
+		svn_pool_destroy(entry.pool);
+		return svn_error_create(SVN_ERR_CANCELLED, NULL, NULL);
+	}
+	queue->entries[(queue->first + queue->count) % LOG_QUEUE_SIZE] = entry;
+	++queue->count;
+	apr_thread_cond_broadcast(queue->cond);
+	apr_thread_mutex_unlock(queue->mutex);
+
+	queue->start = revision + 1;
+	return SVN_NO_ERROR;
+}
+
+
+/* Thread function of the log queue: fetches revision logs in batches */
+static void * APR_THREAD_FUNC log_queue_worker(apr_thread_t *thread, void *data)
+{
+	log_queue_t *queue = (log_queue_t *)data;
+	apr_pool_t *pool = svn_pool_create(queue->session.pool);
+	apr_array_header_t *paths;
+	svn_error_t *err = SVN_NO_ERROR;
+
+	/* We just need the root */
+	paths = apr_array_make(pool, 1, sizeof (const char *));
+	APR_ARRAY_PUSH(paths, const char *) = svn_path_canonicalize(".", pool);
+
+	while (queue->start <= queue->end) {
+		apr_pool_t *subpool;
+		svn_revnum_t start = queue->start;
+		char stop;
+
+		/* Wait until a whole batch fits into the queue */
+		apr_thread_mutex_lock(queue->mutex);
+		while (!queue->stop && queue->count + LOG_BATCH_SIZE > LOG_QUEUE_SIZE) {
+			apr_thread_cond_wait(queue->cond, queue->mutex);
+		}
+		stop = queue->stop;
+		apr_thread_mutex_unlock(queue->mutex);
+		if (stop) {
+			break;
+		}
+
+		DEBUG_MSG("log_queue: fetching %ld:%ld\n", start, queue->end);
+		subpool = svn_pool_create(pool);
+		TIMING_CALL(TM_RA_LOG, err = svn_ra_get_log(queue->session.ra, paths, start, queue->end, LOG_BATCH_SIZE, TRUE, FALSE, log_receiver_queue, queue, subpool));
+		svn_pool_destroy(subpool);
+		if (err) {
+			break;
+		}
+
+		/* No more revisions in the range */
+		if (queue->start == start) {
+			break;
+		}
+	}
+
+	apr_thread_mutex_lock(queue->mutex);
+	queue->err = err;
+	queue->done = 1;
+	apr_thread_cond_broadcast(queue->cond);
+	apr_thread_mutex_unlock(queue->mutex);
+
+	svn_pool_destroy(pool);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/* Writes a string (which may be NULL) to a log cache file */
+static svn_error_t *log_cache_write_string(apr_file_t *file, const char *str)
+{
+	apr_uint32_t len = (str != NULL ? strlen(str) : LOG_CACHE_NULL);
+	apr_status_t status;
+
+	if ((status = apr_file_write_full(file, &len, sizeof(apr_uint32_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	if (str != NULL && (status = apr_file_write_full(file, str, len, NULL))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a string (which may be NULL) from a log cache file */
+static svn_error_t *log_cache_read_string(apr_file_t *file, const char **str, apr_pool_t *pool)
+{
+	apr_uint32_t len;
+	char *buffer;
+	apr_status_t status;
+
+	if ((status = apr_file_read_full(file, &len, sizeof(apr_uint32_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	if (len == LOG_CACHE_NULL) {
+		*str = NULL;
+		return SVN_NO_ERROR;
+	}
+
+	buffer = apr_palloc(pool, len + 1);
+	if ((status = apr_file_read_full(file, buffer, len, NULL))) {
+		return utils_apr_error(status);
+	}
+	buffer[len] = '\0';
+	*str = buffer;
+	return SVN_NO_ERROR;
+}
+
+
+/* Appends a revision log to the log cache data file */
+static svn_error_t *log_cache_write(log_cache_t *cache, const log_revision_t *log, apr_pool_t *pool)
+{
+	apr_int64_t revision = log->revision;
+	apr_uint32_t num = apr_hash_count(log->changed_paths);
+	apr_hash_index_t *hi;
+	apr_off_t pos = 0;
+	apr_status_t status;
+	log_cache_offset_t *offset;
 
+	if ((status = apr_file_write_full(cache->data, &revision, sizeof(apr_int64_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	SVN_ERR(log_cache_write_string(cache->data, log->author));
+	SVN_ERR(log_cache_write_string(cache->data, log->date));
+	SVN_ERR(log_cache_write_string(cache->data, log->message));
+
+	if ((status = apr_file_write_full(cache->data, &num, sizeof(apr_uint32_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	for (hi = apr_hash_first(pool, log->changed_paths); hi; hi = apr_hash_next(hi)) {
+		const char *path;
+		svn_log_changed_path_t *value;
+		apr_int64_t copyfrom_rev;
+		apr_hash_this(hi, (const void **)(void *)&path, NULL, (void **)(void *)&value);
+
+		copyfrom_rev = value->copyfrom_rev;
+		SVN_ERR(log_cache_write_string(cache->data, path));
+		if ((status = apr_file_putc(value->action, cache->data))) {
+			return utils_apr_error(status);
+		}
+		SVN_ERR(log_cache_write_string(cache->data, value->copyfrom_path));
+		if ((status = apr_file_write_full(cache->data, &copyfrom_rev, sizeof(apr_int64_t), NULL))) {
+			return utils_apr_error(status);
+		}
+	}
+
+	offset = &APR_ARRAY_PUSH(cache->offsets, log_cache_offset_t);
+	offset->revision = log->revision;
+	offset->offset = cache->size;
+
+	if ((status = apr_file_seek(cache->data, APR_CUR, &pos))) {
+		return utils_apr_error(status);
+	}
+	cache->size = pos;
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a revision log from the current position of the log cache data
+   file */
+static svn_error_t *log_cache_read(log_cache_t *cache, log_revision_t *log, apr_pool_t *pool)
+{
+	apr_int64_t revision;
+	apr_uint32_t num, i;
+	apr_status_t status;
+
+	if ((status = apr_file_read_full(cache->data, &revision, sizeof(apr_int64_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	log->revision = (svn_revnum_t)revision;
+	log->pool = NULL;
+	SVN_ERR(log_cache_read_string(cache->data, &log->author, pool));
+	SVN_ERR(log_cache_read_string(cache->data, &log->date, pool));
+	SVN_ERR(log_cache_read_string(cache->data, &log->message, pool));
+	log->changed_paths = apr_hash_make(pool);
+
+	if ((status = apr_file_read_full(cache->data, &num, sizeof(apr_uint32_t), NULL))) {
+		return utils_apr_error(status);
+	}
+	for (i = 0; i < num; i++) {
+		const char *path, *copyfrom_path;
+		char action;
+		apr_int64_t copyfrom_rev;
+		svn_log_changed_path_t *value;
+
+		SVN_ERR(log_cache_read_string(cache->data, &path, pool));
+		if ((status = apr_file_getc(&action, cache->data))) {
+			return utils_apr_error(status);
+		}
+		SVN_ERR(log_cache_read_string(cache->data, &copyfrom_path, pool));
+		if ((status = apr_file_read_full(cache->data, &copyfrom_rev, sizeof(apr_int64_t), NULL))) {
+			return utils_apr_error(status);
+		}
+
+		value = apr_palloc(pool, sizeof(svn_log_changed_path_t));
+		value->action = action;
+		value->copyfrom_path = copyfrom_path;
+		value->copyfrom_rev = (svn_revnum_t)copyfrom_rev;
+		apr_hash_set(log->changed_paths, path, APR_HASH_KEY_STRING, value);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Opens the log cache for the given repository and session prefix. A
+   missing or invalid cache is reset, and data that hasn't been
+   committed completely is discarded */
+static svn_error_t *log_cache_open(log_cache_t **cache, const char *dir, const char *uuid, const char *prefix, apr_pool_t *pool)
+{
+	unsigned char digest[APR_MD5_DIGESTSIZE];
+	const char *base;
+	char header[LOG_CACHE_HEADER_SIZE];
+	apr_int64_t values[2];
+	apr_size_t len = LOG_CACHE_HEADER_SIZE;
+	apr_off_t offset = 0;
+	apr_status_t status;
+	log_cache_t *c = apr_pcalloc(pool, sizeof(log_cache_t));
+
+	apr_dir_make(dir, APR_OS_DEFAULT, pool);
+	apr_md5(digest, prefix, strlen(prefix));
+	base = apr_psprintf(pool, "%s/%s-%s", dir, uuid, svn_md5_digest_to_cstring(digest, pool));
+
+	if ((status = apr_file_open(&c->index, apr_pstrcat(pool, base, ".index", NULL), APR_CREATE | APR_READ | APR_WRITE | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, pool))) {
+		return utils_apr_error(status);
+	}
+	/* Other processes may be using the same cache */
+	if ((status = apr_file_lock(c->index, APR_FLOCK_EXCLUSIVE))) {
+		return utils_apr_error(status);
+	}
+	if ((status = apr_file_open(&c->data, apr_pstrcat(pool, base, ".data", NULL), APR_CREATE | APR_READ | APR_WRITE | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, pool))) {
+		return utils_apr_error(status);
+	}
+
+	c->last = SVN_INVALID_REVNUM;
+	c->size = 0;
+	c->offsets = apr_array_make(pool, 0, sizeof(log_cache_offset_t));
+
+	status = apr_file_read_full(c->index, header, LOG_CACHE_HEADER_SIZE, &len);
+	if (status == APR_SUCCESS && !memcmp(header, LOG_CACHE_MAGIC, LOG_CACHE_MAGIC_LEN)) {
+		log_cache_offset_t entry;
+
+		memcpy(values, header + LOG_CACHE_MAGIC_LEN, sizeof(values));
+		c->last = (svn_revnum_t)values[0];
+		c->size = (apr_off_t)values[1];
+
+		/* Offsets beyond the committed range are skipped */
+		while (apr_file_read_full(c->index, &entry, sizeof(log_cache_offset_t), NULL) == APR_SUCCESS) {
+			if (entry.revision > c->last || entry.offset >= c->size) {
+				break;
+			}
+			APR_ARRAY_PUSH(c->offsets, log_cache_offset_t) = entry;
+		}
+	} else if (status != APR_SUCCESS && !APR_STATUS_IS_EOF(status)) {
+		return utils_apr_error(status);
+	} else {
+		DEBUG_MSG("log_cache: resetting %s\n", base);
+	}
+	c->committed = c->offsets->nelts;
+
+	/* Drop partially written data */
+	if ((status = apr_file_trunc(c->data, c->size))) {
+		return utils_apr_error(status);
+	}
+	offset = LOG_CACHE_HEADER_SIZE + c->committed * sizeof(log_cache_offset_t);
+	if ((status = apr_file_trunc(c->index, offset))) {
+		return utils_apr_error(status);
+	}
+
+	DEBUG_MSG("log_cache: %s contains %d revisions up to %ld\n", base, c->committed, c->last);
+	*cache = c;
+	return SVN_NO_ERROR;
+}
+
+
+/* Appends the cached revision logs of the given range to the list */
+static svn_error_t *log_cache_fetch(log_cache_t *cache, svn_revnum_t start, svn_revnum_t end, log_chunks_t *chunks)
+{
+	int lo = 0, hi = cache->offsets->nelts;
+	apr_off_t offset;
+	apr_status_t status;
+
+	/* Find the first revision in the range */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (APR_ARRAY_IDX(cache->offsets, mid, log_cache_offset_t).revision < start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo >= cache->offsets->nelts) {
+		return SVN_NO_ERROR;
+	}
+
+	offset = (apr_off_t)APR_ARRAY_IDX(cache->offsets, lo, log_cache_offset_t).offset;
+	if ((status = apr_file_seek(cache->data, APR_SET, &offset))) {
+		return utils_apr_error(status);
+	}
+	for (; lo < cache->offsets->nelts; lo++) {
+		log_revision_t log;
+		if (APR_ARRAY_IDX(cache->offsets, lo, log_cache_offset_t).revision > end) {
+			break;
+		}
+		SVN_ERR(log_cache_read(cache, &log, log_chunks_pool(chunks)));
+		log_chunks_append(chunks, &log);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes the new offsets and the header of the log cache index, making
+   the cache valid up to the given revision */
+static svn_error_t *log_cache_commit(log_cache_t *cache, svn_revnum_t last)
+{
+	char header[LOG_CACHE_HEADER_SIZE];
+	apr_int64_t values[2];
+	apr_off_t offset;
+	apr_status_t status;
+
+	/* The data needs to be complete before the index refers to it */
+	if ((status = apr_file_flush(cache->data))) {
+		return utils_apr_error(status);
+	}
+
+	offset = LOG_CACHE_HEADER_SIZE + cache->committed * sizeof(log_cache_offset_t);
+	if ((status = apr_file_seek(cache->index, APR_SET, &offset))) {
+		return utils_apr_error(status);
+	}
+	if (cache->offsets->nelts > cache->committed) {
+		apr_size_t len = (cache->offsets->nelts - cache->committed) * sizeof(log_cache_offset_t);
+		if ((status = apr_file_write_full(cache->index, cache->offsets->elts + cache->committed * sizeof(log_cache_offset_t), len, NULL))) {
+			return utils_apr_error(status);
+		}
+	}
+	if ((status = apr_file_flush(cache->index))) {
+		return utils_apr_error(status);
+	}
+
+	cache->last = last;
+	values[0] = last;
+	values[1] = cache->size;
+	memcpy(header, LOG_CACHE_MAGIC, LOG_CACHE_MAGIC_LEN);
+	memcpy(header + LOG_CACHE_MAGIC_LEN, values, sizeof(values));
+	offset = 0;
+	if ((status = apr_file_seek(cache->index, APR_SET, &offset)) || (status = apr_file_write_full(cache->index, header, LOG_CACHE_HEADER_SIZE, NULL)) || (status = apr_file_flush(cache->index))) {
+		return utils_apr_error(status);
+	}
+	cache->committed = cache->offsets->nelts;
+	return SVN_NO_ERROR;
+}
+
+
+/* Callback for svn_ra_get_log(): writes a revision log to the cache and
+   appends it to the list if it's in the requested range */
+static svn_error_t *log_receiver_cache(void *baton, apr_hash_t *changed_paths, svn_revnum_t revision, const char *author, const char *date, const char *message, apr_pool_t *pool)
+{
+	log_receiver_cache_baton_t *data = (log_receiver_cache_baton_t *)baton;
+	log_revision_t log;
+	log_receiver_baton_t receiver_baton;
+
+	receiver_baton.log = &log;
+	receiver_baton.session = data->session;
+	receiver_baton.pool = pool;
+	SVN_ERR(log_receiver(&receiver_baton, changed_paths, revision, author, date, message, pool));
+	SVN_ERR(log_cache_write(data->cache, &log, pool));
+
+	if (revision >= data->start) {
+		log_revision_t copy;
+		log_copy(&copy, &log, log_chunks_pool(data->chunks));
+		log_chunks_append(data->chunks, &copy);
+	}
 	return SVN_NO_ERROR;
 }
 
@@ -158,14 +730,14 @@ char log_get_range(session_t *session, svn_revnum_t *start, svn_revnum_t *end, i
 	APR_ARRAY_PUSH(paths, const char *) = svn_path_canonicalize(".", subpool);
 
 	list = list_create(sizeof(log_revision_t));
-	baton.list = &list;
+	log_chunks_init(&baton.chunks, &list, subpool);
 	baton.session = session;
-	baton.pool = subpool;
 
 	if (verbosity > 0) {
 		fprintf(stderr, _("Determining start end end revision... "));
 	}
-	if ((err = svn_ra_get_log(session->ra, paths, *start, *end, 0, FALSE, TRUE, log_receiver_list, &baton, subpool))) {
+	TIMING_CALL(TM_RA_LOG, err = svn_ra_get_log(session->ra, paths, *start, *end, 0, FALSE, TRUE, log_receiver_list, &baton, subpool));
+	if (err) {
 		if (verbosity > 0) {
 			fprintf(stderr, "\n");
 		}
@@ -205,7 +777,8 @@ char log_fetch_single(session_t *session, svn_revnum_t rev, svn_revnum_t end, lo
 	baton.session = session;
 	baton.pool = pool;
 
-	if ((err = svn_ra_get_log(session->ra, paths, rev, end, 1, TRUE, FALSE, log_receiver, &baton, subpool))) {
+	TIMING_CALL(TM_RA_LOG, err = svn_ra_get_log(session->ra, paths, rev, end, 1, TRUE, FALSE, log_receiver, &baton, subpool));
+	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
 		svn_pool_destroy(subpool);
@@ -230,15 +803,15 @@ char log_fetch_all(session_t *session, svn_revnum_t start, svn_revnum_t end, lis
 	paths = apr_array_make(pool, 1, sizeof (const char *));
 	APR_ARRAY_PUSH(paths, const char *) = svn_path_canonicalize(".", pool);
 
-	baton.list = list;
+	log_chunks_init(&baton.chunks, list, session->pool);
 	baton.session = session;
-	baton.pool = session->pool;
 
 	if (verbosity > 0) {
 		fprintf(stderr, _("Fetching logs... "));
 	}
 
-	if ((err = svn_ra_get_log(session->ra, paths, start, end, 0, TRUE, FALSE, log_receiver_list, &baton, pool))) {
+	TIMING_CALL(TM_RA_LOG, err = svn_ra_get_log(session->ra, paths, start, end, 0, TRUE, FALSE, log_receiver_list, &baton, pool));
+	if (err) {
 		if (verbosity > 0) {
 			fprintf(stderr, "\n");
 		}
@@ -253,6 +826,202 @@ char log_fetch_all(session_t *session, svn_revnum_t start, svn_revnum_t end, lis
 		fprintf(stderr, _("done\n"));
 	}
 
+	log_chunks_close(&baton.chunks);
 	svn_pool_destroy(pool);
 	return 0;
 }
+
+
+/* Fetches all revision logs for a given revision range, using a persistent
+   cache in the given directory. Only revisions that haven't been cached
+   yet are requested from the repository */
+char log_fetch_cached(session_t *session, const char *cache_dir, const char *uuid, svn_revnum_t start, svn_revnum_t end, list_t *list, int verbosity)
+{
+	svn_error_t *err;
+	log_cache_t *cache;
+	log_chunks_t chunks;
+	apr_pool_t *pool = svn_pool_create(session->pool);
+
+	log_chunks_init(&chunks, list, session->pool);
+	if ((err = log_cache_open(&cache, cache_dir, uuid, session->prefix, pool)) == SVN_NO_ERROR) {
+		err = log_cache_fetch(cache, start, (cache->last < end ? cache->last : end), &chunks);
+	}
+
+	if (err == SVN_NO_ERROR && cache->last < end) {
+		apr_array_header_t *paths;
+		apr_off_t offset = cache->size;
+		apr_status_t status;
+		log_receiver_cache_baton_t baton;
+
+		/* We just need the root */
+		paths = apr_array_make(pool, 1, sizeof (const char *));
+		APR_ARRAY_PUSH(paths, const char *) = svn_path_canonicalize(".", pool);
+
+		baton.chunks = &chunks;
+		baton.session = session;
+		baton.cache = cache;
+		baton.start = start;
+
+		if (verbosity > 0) {
+			fprintf(stderr, _("Fetching logs... "));
+		}
+		if ((status = apr_file_seek(cache->data, APR_SET, &offset))) {
+			err = utils_apr_error(status);
+		} else {
+			TIMING_CALL(TM_RA_LOG, err = svn_ra_get_log(session->ra, paths, cache->last + 1, end, 0, TRUE, FALSE, log_receiver_cache, &baton, pool));
+			if (err == SVN_NO_ERROR) {
+				err = log_cache_commit(cache, end);
+			}
+		}
+		if (verbosity > 0) {
+			fprintf(stderr, (err ? "\n" : _("done\n")));
+		}
+	}
+
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		list_free(list);
+		svn_error_clear(err);
+		svn_pool_destroy(pool);
+		return 1;
+	}
+
+	log_chunks_close(&chunks);
+	svn_pool_destroy(pool);
+	return 0;
+}
+
+
+/* Releases a revision log of a list that has been filled by
+   log_fetch_all(), log_fetch_cached() or log_queue_fetch(). The logs
+   share pools and must be released in the order of the list */
+void log_free(log_revision_t *log)
+{
+	if (log->pool != NULL) {
+		svn_pool_destroy(log->pool);
+		log->pool = NULL;
+	}
+	log->author = NULL;
+	log->date = NULL;
+	log->message = NULL;
+	log->changed_paths = NULL;
+}
+
+
+/* Starts fetching the revision logs of the given range in the background */
+char log_queue_start(log_queue_t **queue, session_t *session, svn_revnum_t start, svn_revnum_t end, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	apr_status_t status;
+	log_queue_t *q = apr_pcalloc(pool, sizeof(log_queue_t));
+
+	q->pool = svn_pool_create(pool);
+	q->start = start;
+	q->end = end;
+	q->entries = apr_palloc(q->pool, LOG_QUEUE_SIZE * sizeof(log_queue_entry_t));
+
+	/* RA sessions can't be shared between threads */
+	q->session = session_copy(session);
+	if (session_open(&q->session)) {
+		session_free(&q->session);
+		svn_pool_destroy(q->pool);
+		return 1;
+	}
+
+	if ((status = apr_thread_mutex_create(&q->mutex, APR_THREAD_MUTEX_DEFAULT, q->pool)) || (status = apr_thread_cond_create(&q->cond, q->pool)) || (status = apr_thread_create(&q->thread, NULL, log_queue_worker, q, q->pool))) {
+		char errbuf[ERRBUFFER_SIZE];
+		fprintf(stderr, _("ERROR: Unable to start log queue: %s\n"), apr_strerror(status, errbuf, ERRBUFFER_SIZE));
+		session_free(&q->session);
+		svn_pool_destroy(q->pool);
+		return 1;
+	}
+
+	*queue = q;
+	return 0;
+#else
+	fprintf(stderr, _("ERROR: Background log fetching is not supported on this platform.\n"));
+	return 1;
+#endif
+}
+
+
+/* Fetches the next revision log from the queue, waiting for it if
+   neccessary */
+char log_queue_next(log_queue_t *queue, log_revision_t *log, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	log_queue_entry_t entry;
+
+	apr_thread_mutex_lock(queue->mutex);
+	while (queue->count == 0 && !queue->done) {
+		apr_thread_cond_wait(queue->cond, queue->mutex);
+	}
+	if (queue->count == 0) {
+		apr_thread_mutex_unlock(queue->mutex);
+		if (queue->err) {
+			utils_handle_error(queue->err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(queue->err);
+			queue->err = SVN_NO_ERROR;
+		} else {
+			fprintf(stderr, _("ERROR: No more revision logs available.\n"));
+		}
+		return 1;
+	}
+	entry = queue->entries[queue->first];
+	queue->first = (queue->first + 1) % LOG_QUEUE_SIZE;
+	--queue->count;
+	apr_thread_cond_broadcast(queue->cond);
+	apr_thread_mutex_unlock(queue->mutex);
+
+	log_copy(log, &entry.log, pool);
+	svn_pool_destroy(entry.pool);
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+
+/* Fetches the revision logs up to the given revision from the queue
+   and appends them to the list */
+char log_queue_fetch(log_queue_t *queue, svn_revnum_t end, list_t *list, apr_pool_t *pool)
+{
+	log_chunks_t chunks;
+	log_revision_t log;
+
+	log_chunks_init(&chunks, list, pool);
+	do {
+		if (log_queue_next(queue, &log, log_chunks_pool(&chunks))) {
+			log_chunks_close(&chunks);
+			return 1;
+		}
+		log_chunks_append(&chunks, &log);
+	} while (log.revision < end);
+
+	log_chunks_close(&chunks);
+	return 0;
+}
+
+
+/* Stops the log queue and discards all remaining revision logs */
+void log_queue_stop(log_queue_t *queue)
+{
+#if APR_HAS_THREADS
+	apr_status_t retval;
+
+	apr_thread_mutex_lock(queue->mutex);
+	queue->stop = 1;
+	apr_thread_cond_broadcast(queue->cond);
+	apr_thread_mutex_unlock(queue->mutex);
+	apr_thread_join(&retval, queue->thread);
+
+	while (queue->count > 0) {
+		svn_pool_destroy(queue->entries[queue->first].pool);
+		queue->first = (queue->first + 1) % LOG_QUEUE_SIZE;
+		--queue->count;
+	}
+	svn_error_clear(queue->err);
+	session_free(&queue->session);
+	svn_pool_destroy(queue->pool);
+#endif
+}
@@ -41,8 +41,12 @@ typedef struct {
 	const char		*date;
 	const char		*message;
 	apr_hash_t		*changed_paths;
+	apr_pool_t		*pool;    /* Released by log_free(), may be NULL */
 } log_revision_t;
 
+/* Revision logs that are fetched in the background */
+typedef struct log_queue_t log_queue_t;
+
 
 /* Determines the first and last revision of the session root */
 extern char log_get_range(session_t *session, svn_revnum_t *start, svn_revnum_t *end, int verbosity);
@@ -53,5 +57,29 @@ extern char log_fetch_single(session_t *session, svn_revnum_t rev, svn_revnum_t
 /* Fetches all revision logs for a given revision range */
 extern char log_fetch_all(session_t *session, svn_revnum_t start, svn_revnum_t end, list_t *list, int verbosity);
 
+/* Fetches all revision logs for a given revision range, using a persistent
+   cache in the given directory. Only revisions that haven't been cached
+   yet are requested from the repository */
+extern char log_fetch_cached(session_t *session, const char *cache_dir, const char *uuid, svn_revnum_t start, svn_revnum_t end, list_t *list, int verbosity);
+
+/* Releases a revision log of a list that has been filled by
+   log_fetch_all(), log_fetch_cached() or log_queue_fetch(). The logs
+   share pools and must be released in the order of the list */
+extern void log_free(log_revision_t *log);
+
+/* Starts fetching the revision logs of the given range in the background */
+extern char log_queue_start(log_queue_t **queue, session_t *session, svn_revnum_t start, svn_revnum_t end, apr_pool_t *pool);
+
+/* Fetches the next revision log from the queue, waiting for it if
+   neccessary */
+extern char log_queue_next(log_queue_t *queue, log_revision_t *log, apr_pool_t *pool);
+
+/* Fetches the revision logs up to the given revision from the queue
+   and appends them to the list */
+extern char log_queue_fetch(log_queue_t *queue, svn_revnum_t end, list_t *list, apr_pool_t *pool);
+
+/* Stops the log queue and discards all remaining revision logs */
+extern void log_queue_stop(log_queue_t *queue);
+
 
 #endif
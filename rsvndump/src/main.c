@@ -40,6 +40,8 @@
 
 #include "main.h"
 #include "dump.h"
+#include "output.h"
+#include "timing.h"
 #include "utils.h"
 
 
@@ -72,17 +74,40 @@ static void print_usage()
 	printf(_("    -u [--username] arg       username\n"));
 	printf(_("    -p [--password] arg       password\n"));
 	printf(_("    -r [--revision] arg       specify revision number (or X:Y range)\n"));
+	printf(_("    -o [--outfile] arg        write the dump to the given file instead of\n" \
+	         "                              stdout\n"));
+	printf(_("    --compress arg            gzip-compress the dump output using the given\n" \
+	         "                              level (1-9)\n"));
 	printf(_("    --deltas                  use deltas in dump output\n"));
 	printf(_("    --incremental             dump incrementally\n"));
 	printf(_("    --no-auth-cache           do not cache authentication tokens\n"));
 	printf(_("    --non-interactive         do no interactive prompting\n"));
 	printf(_("    --prefix arg              prepend arg to the path that is being dumped\n"));
+	printf(_("    --log-cache arg           keep the revision logs in the given directory\n" \
+	         "                              for later incremental dumps\n"));
+	printf(_("    --checkpoint arg          save the dumping state to the given directory\n" \
+	         "                              when finished\n"));
+	printf(_("    --resume arg              continue dumping from the state saved in the\n" \
+	         "                              given checkpoint directory\n"));
 	printf(_("    --keep-revnums            keep the dumped revision numbers in sync with\n" \
 	         "                              the repository by using empty revisions for\n" \
 	         "                              padding\n"));
 	printf(_("    --no-incremental-header   don't print the dumpfile header when dumping\n"));
 	printf(_("                              with --incremental and not starting at\n"));
 	printf(_("                              revision 0\n"));
+	printf(_("    --replay-window arg       replay windows of arg revisions at once when\n" \
+	         "                              dumping a repository root (default: 0,\n" \
+	         "                              i.e. one diff request per revision)\n"));
+	printf(_("    --jobs arg                number of additional connections used for\n" \
+	         "                              fetching revisions in advance, the\n" \
+	         "                              initial tree and copied directories\n" \
+	         "                              (default: 0)\n"));
+	printf(_("    --delta-jobs arg          number of threads used for generating deltas\n" \
+	         "                              (default: 0)\n"));
+#ifdef USE_TIMING
+	printf(_("    --timing arg              write timing information to the given file\n" \
+	         "                              instead of stderr\n"));
+#endif
 	printf("\n");
 	printf(_("Report bugs to <%s>\n"), PACKAGE_BUGREPORT);
 }
@@ -145,9 +170,14 @@ int main(int argc, char **argv)
 {
 	char ret = 1;
 	const char *tdir = NULL;
-	int i;
+	const char *outfile = NULL;
+#ifdef USE_TIMING
+	const char *timing_log = NULL;
+#endif
+	int i, compress = 0;
 	session_t session;
 	dump_options_t opts;
+	output_t *out;
 
 #if ENABLE_NLS
 	setlocale(LC_ALL, "");
@@ -173,6 +203,9 @@ int main(int argc, char **argv)
 	_setmode(_fileno(stdout), _O_BINARY);
 #endif /* !WIN32 */
 
+	/* All dump output is written through stdout, so use a large buffer */
+	setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+
 	session = session_create();
 	opts = dump_options_create();
 
@@ -228,6 +261,52 @@ int main(int argc, char **argv)
 				free(opts.prefix);
 			}
 			opts.prefix = apr_pstrdup(session.pool, argv[++i]);
+		} else if (i+1 < argc && !strcmp(argv[i], "--log-cache")) {
+			opts.log_cache = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (i+1 < argc && !strcmp(argv[i], "--checkpoint")) {
+			opts.checkpoint = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (i+1 < argc && !strcmp(argv[i], "--resume")) {
+			opts.resume = utils_canonicalize_pstrdup(session.pool, argv[++i]);
+		} else if (i+1 < argc && (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--outfile"))) {
+			outfile = apr_pstrdup(session.pool, argv[++i]);
+		} else if (i+1 < argc && !strcmp(argv[i], "--compress")) {
+			if (sscanf(argv[++i], "%d", &compress) != 1 || compress < 1 || compress > 9) {
+				fprintf(stderr, _("ERROR: invalid compression level '%s'.\n"), argv[i]);
+				session_free(&session);
+				dump_options_free(&opts);
+				return EXIT_FAILURE;
+			}
+			if (!output_can_compress()) {
+				fprintf(stderr, _("ERROR: Output compression is not supported by this build.\n"));
+				session_free(&session);
+				dump_options_free(&opts);
+				return EXIT_FAILURE;
+			}
+		} else if (i+1 < argc && !strcmp(argv[i], "--replay-window")) {
+			if (sscanf(argv[++i], "%d", &opts.replay_window) != 1 || opts.replay_window < 0) {
+				fprintf(stderr, _("ERROR: invalid replay window '%s'.\n"), argv[i]);
+				session_free(&session);
+				dump_options_free(&opts);
+				return EXIT_FAILURE;
+			}
+		} else if (i+1 < argc && !strcmp(argv[i], "--jobs")) {
+			if (sscanf(argv[++i], "%d", &opts.jobs) != 1 || opts.jobs < 0) {
+				fprintf(stderr, _("ERROR: invalid number of jobs '%s'.\n"), argv[i]);
+				session_free(&session);
+				dump_options_free(&opts);
+				return EXIT_FAILURE;
+			}
+		} else if (i+1 < argc && !strcmp(argv[i], "--delta-jobs")) {
+			if (sscanf(argv[++i], "%d", &opts.delta_jobs) != 1 || opts.delta_jobs < 0) {
+				fprintf(stderr, _("ERROR: invalid number of delta jobs '%s'.\n"), argv[i]);
+				session_free(&session);
+				dump_options_free(&opts);
+				return EXIT_FAILURE;
+			}
+#ifdef USE_TIMING
+		} else if (i+1 < argc && !strcmp(argv[i], "--timing")) {
+			timing_log = apr_pstrdup(session.pool, argv[++i]);
+#endif
 
 		/* Deprecated options */
 		} else if (i+1 < argc && !strcmp(argv[i], "--stop")) {
@@ -248,9 +327,6 @@ int main(int argc, char **argv)
 			++i;
 		} else if (!strcmp(argv[i], "--no-check-certificate")) {
 			fprintf(stderr, _("WARNING: the '%s' option is deprecated and will be IGNORED!.\n"), argv[i]);
-		} else if ((i+1 < argc && (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--outfile")))) {
-			fprintf(stderr, _("WARNING: the '%s' option is deprecated and will be IGNORED!.\n"), argv[i]);
-			++i;
 
 		/* An url */
 		} else if (svn_path_is_url(argv[i])) {
@@ -278,6 +354,14 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+#ifdef USE_TIMING
+	if (timing_initialize(timing_log, session.pool)) {
+		session_free(&session);
+		dump_options_free(&opts);
+		return EXIT_FAILURE;
+	}
+#endif
+
 	/* Generate temporary directory */
 #ifndef WIN32
 	tdir = getenv("TMPDIR");
@@ -313,10 +397,18 @@ int main(int argc, char **argv)
 #endif /* !WIN32 */
 
 	/* Do the real work */
-	if (session_open(&session) == 0) {
-		ret = dump(&session, &opts);
-		session_close(&session);
+	if (output_start(&out, outfile, compress, session.pool) == 0) {
+		if (session_open(&session) == 0) {
+			ret = dump(&session, &opts);
+			session_close(&session);
+		}
+		if (output_finish(out) != 0) {
+			ret = 1;
+		}
 	}
+#ifdef USE_TIMING
+	timing_finish();
+#endif
 
 	/* Clean up temporary directory */
 #ifndef DUMP_DEBUG
@@ -0,0 +1,248 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: output.c
+ *      desc: Redirection and compression of the dump output
+ *
+ *      All dump output is written to stdout. For compressed output, stdout
+ *      is redirected into a pipe that is read by a background thread which
+ *      compresses the data, so compression does not block the dumping
+ *      process.
+ */
+
+
+#ifndef WIN32
+ #include <errno.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <svn_pools.h>
+
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+
+#include "main.h"
+
+#include "output.h"
+
+#if defined(HAVE_ZLIB_H) && APR_HAS_THREADS && !defined(WIN32)
+ #include <zlib.h>
+ #define USE_COMPRESSION
+#endif
+
+
+/* Size of the stdout buffer and of the chunks read by the thread */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Output state */
+struct output_t {
+	apr_pool_t        *pool;
+#ifdef USE_COMPRESSION
+	apr_thread_t      *thread;
+	gzFile            gz;
+	int               fd;         /* Read end of the pipe */
+	int               stdout_fd;  /* Original stdout */
+	char              failed;
+#endif
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+#ifdef USE_COMPRESSION
+
+/* Thread function: compresses everything that is written to the pipe */
+static void * APR_THREAD_FUNC output_worker(apr_thread_t *thread, void *data)
+{
+	output_t *out = (output_t *)data;
+	char *buffer = malloc(OUTPUT_BUFFER_SIZE);
+	ssize_t n;
+
+	while ((n = read(out->fd, buffer, OUTPUT_BUFFER_SIZE)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			out->failed = 1;
+			break;
+		}
+		/* The pipe is drained even after an error to keep the writer going */
+		if (!out->failed && gzwrite(out->gz, buffer, (unsigned)n) != n) {
+			out->failed = 1;
+		}
+	}
+	if (gzclose(out->gz) != Z_OK) {
+		out->failed = 1;
+	}
+
+	free(buffer);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+/* Starts the compression thread */
+static char output_start_compression(output_t *out, const char *path, int level)
+{
+	int fds[2], fd;
+	apr_status_t status;
+
+	if (path != NULL) {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	} else {
+		fd = dup(STDOUT_FILENO);
+	}
+	if (fd < 0) {
+		fprintf(stderr, _("ERROR: Unable to open output file '%s'.\n"), path != NULL ? path : "stdout");
+		return 1;
+	}
+	if ((out->gz = gzdopen(fd, apr_psprintf(out->pool, "wb%d", level))) == NULL) {
+		fprintf(stderr, _("ERROR: Unable to initialize output compression.\n"));
+		close(fd);
+		return 1;
+	}
+
+	if (pipe(fds)) {
+		fprintf(stderr, _("ERROR: Unable to create output pipe.\n"));
+		gzclose(out->gz);
+		return 1;
+	}
+
+	fflush(stdout);
+	out->fd = fds[0];
+	out->stdout_fd = dup(STDOUT_FILENO);
+	dup2(fds[1], STDOUT_FILENO);
+	close(fds[1]);
+
+	if ((status = apr_thread_create(&out->thread, NULL, output_worker, out, out->pool))) {
+		char errbuf[512];
+		fprintf(stderr, _("ERROR: %s\n"), apr_strerror(status, errbuf, sizeof(errbuf)));
+		dup2(out->stdout_fd, STDOUT_FILENO);
+		close(out->stdout_fd);
+		close(out->fd);
+		gzclose(out->gz);
+		return 1;
+	}
+
+	DEBUG_MSG("output: compressing with level %d\n", level);
+	return 0;
+}
+
+
+/* Stops the compression thread after all pending output has been read */
+static char output_stop_compression(output_t *out)
+{
+	apr_status_t retval;
+
+	/* Restoring stdout closes the write end of the pipe */
+	fflush(stdout);
+	dup2(out->stdout_fd, STDOUT_FILENO);
+	close(out->stdout_fd);
+
+	apr_thread_join(&retval, out->thread);
+	close(out->fd);
+
+	if (out->failed) {
+		fprintf(stderr, _("ERROR: Unable to write compressed output.\n"));
+		return 1;
+	}
+	return 0;
+}
+
+#endif /* USE_COMPRESSION */
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Checks whether output compression is available */
+char output_can_compress()
+{
+#ifdef USE_COMPRESSION
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+/* Redirects stdout to the given file (or keeps writing to stdout if path
+   is NULL). If level is greater than 0, the output is gzip-compressed
+   using the given level on a background thread */
+char output_start(output_t **out, const char *path, int level, apr_pool_t *pool)
+{
+	output_t *o = apr_pcalloc(pool, sizeof(output_t));
+	o->pool = svn_pool_create(pool);
+
+	if (level > 0) {
+#ifdef USE_COMPRESSION
+		if (output_start_compression(o, path, level)) {
+			svn_pool_destroy(o->pool);
+			return 1;
+		}
+#else
+		fprintf(stderr, _("ERROR: Output compression is not supported by this build.\n"));
+		svn_pool_destroy(o->pool);
+		return 1;
+#endif
+	} else if (path != NULL) {
+		if (freopen(path, "wb", stdout) == NULL) {
+			fprintf(stderr, _("ERROR: Unable to open output file '%s'.\n"), path);
+			svn_pool_destroy(o->pool);
+			return 1;
+		}
+		setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+	}
+
+	*out = o;
+	return 0;
+}
+
+
+/* Flushes stdout and waits until all output has been written */
+char output_finish(output_t *out)
+{
+	char ret = 0;
+
+#ifdef USE_COMPRESSION
+	if (out->thread != NULL) {
+		ret = output_stop_compression(out);
+	} else
+#endif
+	if (fflush(stdout) != 0 || ferror(stdout)) {
+		fprintf(stderr, _("ERROR: Unable to write output.\n"));
+		ret = 1;
+	}
+
+	svn_pool_destroy(out->pool);
+	return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: output.h
+ *      desc: Redirection and compression of the dump output
+ */
+
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+
+#include <apr_pools.h>
+
+
+typedef struct output_t output_t;
+
+
+/* Checks whether output compression is available */
+extern char output_can_compress();
+
+/* Redirects stdout to the given file (or keeps writing to stdout if path
+   is NULL). If level is greater than 0, the output is gzip-compressed
+   using the given level on a background thread */
+extern char output_start(output_t **out, const char *path, int level, apr_pool_t *pool);
+
+/* Flushes stdout and waits until all output has been written */
+extern char output_finish(output_t *out);
+
+
+#endif
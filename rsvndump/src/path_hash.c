@@ -35,8 +35,19 @@
  *      actually kept in memory. Previous records are stored in
  *      files containing the snapshot itself and the following deltas.
  *
- *      Furthermore, there's a small full-tree cache to speed up
- *      repeated queries (quite common whenever a directory is copied).
+ *      These history files use a binary format that can be mapped into
+ *      memory directly. The header is followed by a table containing
+ *      the offsets of the snapshot and of every delta, so readers can
+ *      jump to any revision. Each record consists of the number of
+ *      deleted and added paths, followed by the paths. The paths are
+ *      sorted and stored as (shared prefix length, suffix length, suffix)
+ *      with respect to the previous path of the same list.
+ *
+ *      Furthermore, the lifetimes of all paths are kept in an index:
+ *      every path that ever existed has a sorted list of [added, deleted)
+ *      revision intervals. Checking if a path exists at a given revision
+ *      (quite common whenever a directory is copied) is thus a binary
+ *      search instead of a full tree reconstruction.
  */
 
 
@@ -45,12 +56,17 @@
 #include <svn_path.h>
 #include <svn_ra.h>
 
+#include <apr_file_info.h>
 #include <apr_hash.h>
+#include <apr_mmap.h>
 #include <apr_tables.h>
 
 #include "main.h"
 
+#include "checkpoint.h"
 #include "delta.h"
+#include "dirlist.h"
+#include "timing.h"
 #include "utils.h"
 
 #include "path_hash.h"
@@ -59,13 +75,15 @@
 /* Interval for taking snapshots of the full tree */
 #define SNAPSHOT_DIST 512
 
-/* Cache size for reconstructed repositories */
-#define CACHE_SIZE 4
+/* Identifier of history files */
+#define HISTORY_MAGIC "PHH1"
+#define HISTORY_MAGIC_LEN 4
+
+/* Number of records per history file: the snapshot and the following deltas */
+#define HISTORY_RECORDS (SNAPSHOT_DIST + 1)
 
-/* Codes for reading and writing the path history */
-#define REV_SEPERATOR "=="
-#define REV_ADD "+ "
-#define REV_DELETE "- "
+/* Size of the history file header, including the offset table */
+#define HISTORY_HEADER_SIZE (HISTORY_MAGIC_LEN + (HISTORY_RECORDS + 1) * sizeof(apr_uint64_t))
 
 
 /*---------------------------------------------------------------------------*/
@@ -85,14 +103,19 @@ typedef struct {
 } tree_delta_t;
 
 
-/* Full-tree cache structure */
+/* Lifetime of a path: the path is present in [added, deleted) */
 typedef struct {
-	apr_pool_t *pool;
-	svn_revnum_t revnum;
-	apr_hash_t *tree;
-} cached_tree_t;
+	svn_revnum_t added;
+	svn_revnum_t deleted; /* SVN_INVALID_REVNUM if still present */
+} lifetime_t;
 
 
+/* A node of the lifetime index */
+typedef struct {
+	apr_hash_t *children;
+	apr_array_header_t *lifetimes;
+} index_node_t;
+
 
 /*---------------------------------------------------------------------------*/
 /* Static variables                                                          */
@@ -120,9 +143,13 @@ static apr_array_header_t *ph_snapshots = NULL;
 /* History files */
 static apr_array_header_t *ph_files = NULL;
 
-/* Full-tree cache */
-static apr_array_header_t *ph_cache = NULL;
-static int ph_cache_pos = 0;
+/* Lifetime index */
+static index_node_t *ph_index = NULL;
+static svn_revnum_t ph_index_head = SVN_INVALID_REVNUM;
+
+/* Directory lister for trees that can't be copied from the hash */
+static dirlist_t *ph_lister = NULL;
+static int ph_jobs = 0;
 
 
 /*---------------------------------------------------------------------------*/
@@ -155,43 +182,14 @@ static apr_hash_t *path_hash_add(apr_hash_t *tree, const char *path, apr_pool_t
 }
 
 
-/* Fetches a tree from a repository and adds every path to the given hash, recursively */
-static char path_hash_add_tree_rec(session_t *session, apr_hash_t *tree, const char *path, svn_revnum_t revnum, apr_pool_t *pool)
+/* Adds an entry of a listed tree to the hash */
+static void path_hash_add_entry(void *baton, const char *path, svn_node_kind_t kind, apr_pool_t *pool)
 {
-	svn_error_t *err;
-	apr_hash_t *dirents;
-	apr_hash_index_t *hi;
-	apr_pool_t *subpool = svn_pool_create(pool);
-
-	if ((err = svn_ra_get_dir2(session->ra, &dirents, NULL, NULL, path, revnum, SVN_DIRENT_KIND, pool))) {
-		utils_handle_error(err, stderr, FALSE, "ERROR: ");
-		svn_error_clear(err);
-		return 1;
-	}
-
-	/* Iterate over entries and add them to the tree using their full paths */
-	for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi)) {
-		const char *entry;
-		char *subpath;
-		svn_dirent_t *dirent;
-		apr_hash_this(hi, (const void **)(void *)&entry, NULL, (void **)(void *)&dirent);
-
-		subpath = apr_psprintf(subpool, "%s/%s", path, entry);
-
-		if (dirent->kind == svn_node_file) {
-			DEBUG_MSG("path_hash: S++ ");
-			path_hash_add(tree, subpath, pool);
-			DEBUG_MSG("\n");
-		} else if (dirent->kind == svn_node_dir) {
-			DEBUG_MSG("path_hash: S++ ");
-			path_hash_add(tree, subpath, pool);
-			DEBUG_MSG("\n");
-			path_hash_add_tree_rec(session, tree, subpath, revnum, subpool);
-		}
+	if (kind == svn_node_file || kind == svn_node_dir) {
+		DEBUG_MSG("path_hash: S++ ");
+		path_hash_add((apr_hash_t *)baton, path, pool);
+		DEBUG_MSG("\n");
 	}
-
-	svn_pool_destroy(subpool);
-	return 0;
 }
 
 
@@ -205,7 +203,8 @@ static char path_hash_add_tree(session_t *session, apr_hash_t *tree, const char
 	 * Check the node type first. If it is a file, we can simply add it.
 	 * Otherwise, add the the directory contents recursively.
 	 */
-	if ((err = svn_ra_stat(session->ra, path, revnum, &dirent, pool))) {
+	TIMING_CALL(TM_RA_STAT, err = svn_ra_stat(session->ra, path, revnum, &dirent, pool));
+	if (err) {
 		utils_handle_error(err, stderr, FALSE, "ERROR: ");
 		svn_error_clear(err);
 		return 1;
@@ -218,7 +217,17 @@ static char path_hash_add_tree(session_t *session, apr_hash_t *tree, const char
 		return 0;
 	}
 
-	return path_hash_add_tree_rec(session, tree, path, revnum, pool);
+	/* The directory lister is kept around, so copies of the same tree
+	   don't need to be listed again */
+	if (ph_lister == NULL) {
+		ph_lister = dirlist_create(session, ph_jobs, ph_pool);
+	}
+	if ((err = dirlist_walk(ph_lister, path, revnum, path_hash_add_entry, tree, pool))) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return 1;
+	}
+	return 0;
 }
 
 
@@ -283,60 +292,141 @@ static void path_hash_copy_deep(apr_hash_t *dest, apr_hash_t *source, apr_pool_t
 }
 
 
+/* Decodes a list of prefix-compressed paths from a history record and
+   applies it to a tree. Returns the position after the list or NULL if the
+   record is corrupt */
+static const char *path_hash_read_paths(apr_hash_t *tree, const char *data, const char *end, char add, apr_pool_t *pool)
+{
+	apr_uint32_t i, num, prefix, suffix;
+	char *path = NULL;
+	apr_size_t path_size = 0;
+
+	if (data + sizeof(apr_uint32_t) > end) {
+		return NULL;
+	}
+	memcpy(&num, data, sizeof(apr_uint32_t));
+	data += sizeof(apr_uint32_t);
+
+	for (i = 0; i < num; i++) {
+		if (data + 2 * sizeof(apr_uint32_t) > end) {
+			return NULL;
+		}
+		memcpy(&prefix, data, sizeof(apr_uint32_t));
+		memcpy(&suffix, data + sizeof(apr_uint32_t), sizeof(apr_uint32_t));
+		data += 2 * sizeof(apr_uint32_t);
+		if (data + suffix > end || (i == 0 && prefix > 0)) {
+			return NULL;
+		}
+
+		/* The prefix is still in the buffer */
+		if (prefix + suffix + 1 > path_size) {
+			char *buffer;
+			path_size = 2 * (prefix + suffix + 1);
+			buffer = apr_palloc(pool, path_size);
+			if (path != NULL) {
+				memcpy(buffer, path, prefix);
+			}
+			path = buffer;
+		}
+		memcpy(path + prefix, data, suffix);
+		path[prefix + suffix] = '\0';
+		data += suffix;
+
+		if (add) {
+			path_hash_add(tree, path, pool);
+		} else {
+			path_hash_delete(tree, path, pool);
+		}
+	}
+	return data;
+}
+
+
 /* Reconstructs a revision from a file */
 static apr_hash_t *path_hash_reconstruct_file(svn_revnum_t rev, apr_pool_t *pool)
 {
 	apr_hash_t *tree;
 	apr_file_t *file = NULL;
+	apr_finfo_t finfo;
 	apr_status_t status;
-	apr_pool_t *temp_pool;
+	apr_pool_t *temp_pool, *record_pool;
+	const char *filename, *data;
+	apr_uint64_t offsets[2];
 	unsigned long i, filename_idx = (rev / SNAPSHOT_DIST);
-	int rev_add_len, rev_delete_len, rev_sep_len;
+#if APR_HAS_MMAP
+	apr_mmap_t *mmap = NULL;
+#endif
 
 	DEBUG_MSG("path_hash_test: reconstruct_file(%ld) started\n", rev);
 
-	if (ph_files->nelts < filename_idx) {
-		DEBUG_MSG("path_hash_reconstruct_file(%ld): file not available (%d < %d)\n", rev, ph_files->nelts, filename_idx);
+	if (ph_files->nelts <= filename_idx) {
+		DEBUG_MSG("path_hash_reconstruct_file(%ld): file not available (%d <= %d)\n", rev, ph_files->nelts, filename_idx);
 		return NULL;
 	}
+	filename = APR_ARRAY_IDX(ph_files, filename_idx, const char *);
 
-	/* Try to open the file */
+	/* Try to open the file and map it into memory */
 	temp_pool = svn_pool_create(pool);
-	status = apr_file_open(&file, APR_ARRAY_IDX(ph_files, filename_idx, const char *), APR_READ | APR_BINARY, APR_OS_DEFAULT, temp_pool);
-	if (status) {
-		fprintf(stderr, _("ERROR: Unable to open temporary file %s\n"), APR_ARRAY_IDX(ph_files, filename_idx, const char *));
+	status = apr_file_open(&file, filename, APR_READ | APR_BINARY, APR_OS_DEFAULT, temp_pool);
+	if (status == APR_SUCCESS) {
+		status = apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+	}
+	if (status == APR_SUCCESS && finfo.size < (apr_off_t)HISTORY_HEADER_SIZE) {
+		status = APR_EGENERAL;
+	}
+#if APR_HAS_MMAP
+	if (status == APR_SUCCESS) {
+		status = apr_mmap_create(&mmap, file, 0, (apr_size_t)finfo.size, APR_MMAP_READ, temp_pool);
+	}
+	data = (status == APR_SUCCESS ? mmap->mm : NULL);
+#else
+	if (status == APR_SUCCESS) {
+		char *buffer = apr_palloc(temp_pool, (apr_size_t)finfo.size);
+		status = apr_file_read_full(file, buffer, (apr_size_t)finfo.size, NULL);
+		data = buffer;
+	}
+#endif
+	if (status || memcmp(data, HISTORY_MAGIC, HISTORY_MAGIC_LEN)) {
+		fprintf(stderr, _("ERROR: Unable to read from temporary file %s\n"), filename);
+		if (file != NULL) {
+			apr_file_close(file);
+		}
 		svn_pool_destroy(temp_pool);
 		return NULL;
 	}
 
-	DEBUG_MSG("path_hash_test: reconstruct_file(%ld) using file %s\n", rev, APR_ARRAY_IDX(ph_files, filename_idx, const char *));
+	DEBUG_MSG("path_hash_test: reconstruct_file(%ld) using file %s\n", rev, filename);
+	TIMING_COUNT(TM_PH_RECONSTRUCT_FILE, 1);
 	tree = apr_hash_make(pool);
+	record_pool = svn_pool_create(temp_pool);
 
-	rev_add_len = strlen(REV_ADD);
-	rev_delete_len = strlen(REV_DELETE);
-	rev_sep_len = strlen(REV_SEPERATOR);
+	/* Apply the snapshot and all deltas up to the requested revision */
+	for (i = 0; i <= rev - filename_idx * SNAPSHOT_DIST; i++) {
+		const char *record, *end;
 
-	/* Read revisions */
-	i = filename_idx * SNAPSHOT_DIST;
-	while (i <= rev) {
-		char *buffer = utils_file_readln(temp_pool, file);
-		if (buffer == NULL) {
-			fprintf(stderr, _("ERROR: Unable to read from temporary file %s\n"), APR_ARRAY_IDX(ph_files, filename_idx, const char *));
+		memcpy(offsets, data + HISTORY_MAGIC_LEN + i * sizeof(apr_uint64_t), sizeof(offsets));
+		if (offsets[0] > offsets[1] || offsets[1] > (apr_uint64_t)finfo.size) {
+			record = NULL;
+		} else {
+			record = data + offsets[0];
+			end = data + offsets[1];
+			record = path_hash_read_paths(tree, record, end, 0, record_pool);
+			if (record != NULL) {
+				record = path_hash_read_paths(tree, record, end, 1, record_pool);
+			}
+		}
+		if (record == NULL) {
+			fprintf(stderr, _("ERROR: Corrupt temporary file %s\n"), filename);
 			apr_file_close(file);
 			svn_pool_destroy(temp_pool);
 			return NULL;
 		}
-
-		if (!strncmp(buffer, REV_ADD, rev_add_len)) {
-			DEBUG_MSG("path_hash_test: +++ %s\n", buffer + rev_add_len);
-			path_hash_add(tree, buffer + rev_add_len, temp_pool);
-		} else if (!strncmp(buffer, REV_DELETE, rev_delete_len)) {
-			path_hash_delete(tree, buffer + rev_delete_len, temp_pool);
-		} else if (!strncmp(buffer, REV_SEPERATOR, rev_sep_len)) {
-			++i;
-		}
+		svn_pool_clear(record_pool);
 	}
 
+#if APR_HAS_MMAP
+	apr_mmap_delete(mmap);
+#endif
 	apr_file_close(file);
 	svn_pool_destroy(temp_pool);
 	return tree;
@@ -367,6 +457,7 @@ static apr_hash_t *path_hash_reconstruct(svn_revnum_t rev, apr_pool_t *pool)
 		}
 	}
 
+	TIMING_COUNT(TM_PH_RECONSTRUCT, 1);
 	tree = apr_hash_make(pool);
 	temp_pool = svn_pool_create(pool);
 	stack = apr_array_make(temp_pool, 0, sizeof(apr_hash_t *));
@@ -470,8 +561,8 @@ static char path_hash_copy(apr_hash_t *tree, const char *path, const char *from,
 }
 
 
-/* Writes a series of tree deltas to the given file */
-static char path_hash_write(apr_hash_t *tree, apr_file_t *file, apr_pool_t *pool)
+/* Collects the paths of all leaves of a tree */
+static void path_hash_collect(apr_hash_t *tree, apr_array_header_t *paths, apr_pool_t *pool)
 {
 	apr_hash_index_t *hi;
 	apr_array_header_t *recon_stack = apr_array_make(pool, 0, sizeof(apr_hash_t *));
@@ -487,7 +578,7 @@ static char path_hash_write(apr_hash_t *tree, apr_file_t *file, apr_pool_t *pool
 		if (apr_hash_count(top_hash) == 0) {
 			if (strcmp(top_path, "/")) {
 				DEBUG_MSG("path_hash_write: +++ %s\n", top_path);
-				apr_file_printf(file, "%s%s\n", REV_ADD, top_path);
+				APR_ARRAY_PUSH(paths, const char *) = top_path;
 			}
 			continue;
 		}
@@ -501,7 +592,75 @@ static char path_hash_write(apr_hash_t *tree, apr_file_t *file, apr_pool_t *pool
 			APR_ARRAY_PUSH(recon_path, const char *) = svn_path_join(top_path, key, pool);
 		}
 	}
+}
+
+
+/* Comparison function for sorting paths */
+static int path_hash_compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
 
+
+/* Writes a sorted, prefix-compressed list of paths to the given file */
+static char path_hash_write_paths(apr_array_header_t *paths, apr_file_t *file)
+{
+	apr_uint32_t num = paths->nelts;
+	const char *prev = "";
+	int i;
+
+	qsort(paths->elts, paths->nelts, sizeof(const char *), path_hash_compare_paths);
+
+	if (apr_file_write_full(file, &num, sizeof(apr_uint32_t), NULL)) {
+		return 1;
+	}
+	for (i = 0; i < paths->nelts; i++) {
+		const char *path = APR_ARRAY_IDX(paths, i, const char *);
+		apr_uint32_t lens[2] = {0, 0};
+
+		while (prev[lens[0]] != '\0' && prev[lens[0]] == path[lens[0]]) {
+			++lens[0];
+		}
+		lens[1] = strlen(path) - lens[0];
+
+		if (apr_file_write_full(file, lens, sizeof(lens), NULL) || apr_file_write_full(file, path + lens[0], lens[1], NULL)) {
+			return 1;
+		}
+		prev = path;
+	}
+	return 0;
+}
+
+
+/* Writes a history record to the given file and stores its end offset */
+static char path_hash_write_record(apr_array_header_t *deleted, apr_hash_t *added, apr_file_t *file, apr_uint64_t *offset, apr_pool_t *pool)
+{
+	apr_array_header_t *paths = apr_array_make(pool, 0, sizeof(const char *));
+	apr_off_t pos = 0;
+
+	if (deleted != NULL) {
+		int j;
+		for (j = 0; j < deleted->nelts; j++) {
+			DEBUG_MSG("path_hash_write: --- %s\n", APR_ARRAY_IDX(deleted, j, const char *));
+			APR_ARRAY_PUSH(paths, const char *) = APR_ARRAY_IDX(deleted, j, const char *);
+		}
+	}
+	if (path_hash_write_paths(paths, file)) {
+		return 1;
+	}
+
+	apr_array_clear(paths);
+	if (added != NULL) {
+		path_hash_collect(added, paths, pool);
+	}
+	if (path_hash_write_paths(paths, file)) {
+		return 1;
+	}
+
+	if (apr_file_seek(file, APR_CUR, &pos)) {
+		return 1;
+	}
+	*offset = pos;
 	return 0;
 }
 
@@ -512,26 +671,39 @@ static char path_hash_write(apr_hash_t *tree, apr_file_t *file, apr_pool_t *pool
 static char *path_hash_write_deltas(apr_pool_t *pool)
 {
 	char *filename;
-	int index;
+	int index, record;
 	apr_status_t status;
 	apr_hash_t *tree;
 	apr_file_t *file = NULL;
+	apr_off_t offset = 0;
+	apr_uint64_t offsets[HISTORY_RECORDS + 1];
 	apr_pool_t *delta_pool = svn_pool_create(pool);
 
 	filename = apr_psprintf(pool, "%s/XXXXXX", ph_temp_dir);
-	status = apr_file_mktemp(&file, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY, pool);
+	status = apr_file_mktemp(&file, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED, pool);
 	DEBUG_MSG("path_hash: temp_file = %s : %d\n", filename, status);
 	if (status) {
 		fprintf(stderr, _("ERROR: Unable to create temporary file (%d)\n"), status);
 		return NULL;
 	}
+	TIMING_TEMP_FILE(NULL);
+
+	/* The offset table will be written once all records are known */
+	memset(offsets, 0, sizeof(offsets));
+	offsets[0] = HISTORY_HEADER_SIZE;
+	if (apr_file_write_full(file, HISTORY_MAGIC, HISTORY_MAGIC_LEN, NULL) || apr_file_write_full(file, offsets, sizeof(offsets), NULL)) {
+		fprintf(stderr, _("ERROR: Unable to write to temporary file %s\n"), filename);
+		apr_file_close(file);
+		return NULL;
+	}
 
 	/* Write the snapshot first */
 	index = 0;
 	while ((tree = APR_ARRAY_IDX(ph_snapshots, index, apr_hash_t *)) == NULL) {
 		++index;
 	}
-	if (path_hash_write(tree, file, delta_pool)) {
+	if (path_hash_write_record(NULL, tree, file, &offsets[1], delta_pool)) {
+		fprintf(stderr, _("ERROR: Unable to write to temporary file %s\n"), filename);
 		apr_file_close(file);
 		return NULL;
 	}
@@ -541,46 +713,289 @@ static char *path_hash_write_deltas(apr_pool_t *pool)
 
 	/* Write all deltas */
 	index *= SNAPSHOT_DIST;
-	index += 1;
-	do {
-		tree_delta_t *delta = APR_ARRAY_IDX(ph_revisions, index, tree_delta_t *);
-		int j;
+	for (record = 1; record < HISTORY_RECORDS; record++) {
+		tree_delta_t *delta = APR_ARRAY_IDX(ph_revisions, index + record, tree_delta_t *);
 
-		apr_file_printf(file, "%s\n", REV_SEPERATOR);
-
-		/* Skip padding revisions */
-		if (delta == NULL) {
-			++index;
-			continue;
-		}
-
-		/* Deletions */
-		for (j = 0; j < delta->deleted->nelts; j++) {
-			DEBUG_MSG("path_hash_write: --- %s\n", APR_ARRAY_IDX(delta->deleted, j, const char *));
-			apr_file_printf(file, "%s%s\n", REV_DELETE, APR_ARRAY_IDX(delta->deleted, j, const char *));
-		}
-
-		/* Additions */
+		/* Padding revisions result in empty records */
 		svn_pool_clear(delta_pool);
-		if (path_hash_write(delta->added, file, delta_pool)) {
+		if (path_hash_write_record((delta ? delta->deleted : NULL), (delta ? delta->added : NULL), file, &offsets[record+1], delta_pool)) {
+			fprintf(stderr, _("ERROR: Unable to write to temporary file %s\n"), filename);
 			apr_file_close(file);
 			return NULL;
 		}
 
 		DEBUG_MSG("path_hash_write: --------------------------------------------------------------\n");
 
-		svn_pool_destroy(delta->pool);
-		APR_ARRAY_IDX(ph_revisions, index, tree_delta_t *) = NULL;
-	} while ((index++ % SNAPSHOT_DIST) != 0);
+		if (delta != NULL) {
+			svn_pool_destroy(delta->pool);
+			APR_ARRAY_IDX(ph_revisions, index + record, tree_delta_t *) = NULL;
+		}
+	}
 
 	DEBUG_MSG("path_hash_write: ==============================================================\n");
 
+	/* Finally, write the offset table */
+	offset = HISTORY_MAGIC_LEN;
+	if (apr_file_seek(file, APR_SET, &offset) || apr_file_write_full(file, offsets, sizeof(offsets), NULL)) {
+		fprintf(stderr, _("ERROR: Unable to write to temporary file %s\n"), filename);
+		apr_file_close(file);
+		return NULL;
+	}
+
 	apr_file_close(file);
 	svn_pool_destroy(delta_pool);
+	TIMING_COUNT(TM_TEMP_BYTES, offsets[HISTORY_RECORDS]);
 	return filename;
 }
 
 
+/* Creates a new node of the lifetime index */
+static index_node_t *path_hash_index_create()
+{
+	index_node_t *node = apr_palloc(ph_pool, sizeof(index_node_t));
+	node->children = NULL;
+	node->lifetimes = apr_array_make(ph_pool, 1, sizeof(lifetime_t));
+	return node;
+}
+
+
+/* Returns the index node for the given path or NULL if the path never existed */
+static index_node_t *path_hash_index_lookup(const char *path)
+{
+	index_node_t *node = ph_index;
+
+	while (*path != '\0' && node != NULL) {
+		const char *end;
+
+		/* Skip leading slashes */
+		if (*path == '/') {
+			++path;
+			continue;
+		}
+
+		end = strchr(path, '/');
+		if (end == NULL) {
+			end = path + strlen(path);
+		}
+		node = (node->children ? apr_hash_get(node->children, path, end - path) : NULL);
+		path = end;
+	}
+	return node;
+}
+
+
+/* Checks if the path of an index node is present at the given revision */
+static char path_hash_index_present(index_node_t *node, svn_revnum_t revnum)
+{
+	lifetime_t *lifetimes = (lifetime_t *)node->lifetimes->elts;
+	int lo = 0, hi = node->lifetimes->nelts - 1;
+
+	/* Find the last lifetime that started at or before revnum */
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lifetimes[mid].added <= revnum) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	if (hi < 0) {
+		return 0;
+	}
+	return (lifetimes[hi].deleted == SVN_INVALID_REVNUM || revnum < lifetimes[hi].deleted);
+}
+
+
+/* Ends the lifetime of a node and all its present children */
+static void path_hash_index_delete(index_node_t *node, svn_revnum_t revnum, apr_pool_t *pool)
+{
+	lifetime_t *last;
+	apr_hash_index_t *hi;
+
+	if (node->lifetimes->nelts == 0) {
+		return;
+	}
+	last = &APR_ARRAY_IDX(node->lifetimes, node->lifetimes->nelts-1, lifetime_t);
+	if (last->deleted != SVN_INVALID_REVNUM) {
+		/* Children of deleted nodes are deleted, too */
+		return;
+	}
+
+	if (last->added == revnum) {
+		apr_array_pop(node->lifetimes);
+	} else {
+		last->deleted = revnum;
+	}
+
+	if (node->children == NULL) {
+		return;
+	}
+	for (hi = apr_hash_first(pool, node->children); hi; hi = apr_hash_next(hi)) {
+		index_node_t *child;
+		apr_hash_this(hi, NULL, NULL, (void **)(void *)&child);
+		path_hash_index_delete(child, revnum, pool);
+	}
+}
+
+
+/* Starts the lifetimes of all nodes in the given tree (if not present yet) */
+static void path_hash_index_add(index_node_t *node, apr_hash_t *tree, svn_revnum_t revnum, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	for (hi = apr_hash_first(pool, tree); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		apr_ssize_t klen;
+		apr_hash_t *subtree;
+		index_node_t *child = NULL;
+		apr_hash_this(hi, (const void **)(void *)&key, &klen, (void **)(void *)&subtree);
+
+		if (node->children == NULL) {
+			node->children = apr_hash_make(ph_pool);
+		} else {
+			child = apr_hash_get(node->children, key, klen);
+		}
+		if (child == NULL) {
+			child = path_hash_index_create();
+			apr_hash_set(node->children, apr_pstrmemdup(ph_pool, key, klen), klen, child);
+		}
+
+		if (child->lifetimes->nelts == 0 || APR_ARRAY_IDX(child->lifetimes, child->lifetimes->nelts-1, lifetime_t).deleted != SVN_INVALID_REVNUM) {
+			lifetime_t *lifetime = apr_array_push(child->lifetimes);
+			lifetime->added = revnum;
+			lifetime->deleted = SVN_INVALID_REVNUM;
+		}
+
+		path_hash_index_add(child, subtree, revnum, pool);
+	}
+}
+
+
+/* Applies a tree delta to the lifetime index. Just like in
+   path_hash_reconstruct(), deletions are applied first */
+static void path_hash_index_commit(tree_delta_t *delta, svn_revnum_t revnum, apr_pool_t *pool)
+{
+	int i;
+
+	if (delta != NULL) {
+		for (i = 0; i < delta->deleted->nelts; i++) {
+			index_node_t *node = path_hash_index_lookup(APR_ARRAY_IDX(delta->deleted, i, const char *));
+			if (node != NULL) {
+				path_hash_index_delete(node, revnum, pool);
+			}
+		}
+		if (delta->added != NULL) {
+			path_hash_index_add(ph_index, delta->added, revnum, pool);
+		}
+	}
+	ph_index_head = revnum;
+}
+
+
+/* Saves a tree (which may be NULL) to a checkpoint */
+static svn_error_t *path_hash_save_tree(checkpoint_t *cp, apr_hash_t *tree, apr_pool_t *pool)
+{
+	apr_array_header_t *paths;
+	int i;
+
+	if (tree == NULL) {
+		return checkpoint_write_int(cp, -1);
+	}
+
+	paths = apr_array_make(pool, 0, sizeof(const char *));
+	path_hash_collect(tree, paths, pool);
+	SVN_ERR(checkpoint_write_int(cp, paths->nelts));
+	for (i = 0; i < paths->nelts; i++) {
+		SVN_ERR(checkpoint_write_string(cp, APR_ARRAY_IDX(paths, i, const char *)));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Restores a tree from a checkpoint, using tree_pool for the tree itself */
+static svn_error_t *path_hash_load_tree(checkpoint_t *cp, apr_hash_t **tree, apr_pool_t *tree_pool, apr_pool_t *pool)
+{
+	apr_int64_t i, num;
+
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	if (num < 0) {
+		*tree = NULL;
+		return SVN_NO_ERROR;
+	}
+
+	*tree = apr_hash_make(tree_pool);
+	for (i = 0; i < num; i++) {
+		const char *path;
+		SVN_ERR(checkpoint_read_string(cp, &path, pool));
+		path_hash_add(*tree, path, pool);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Saves a node of the lifetime index and all its children to a checkpoint */
+static svn_error_t *path_hash_save_index(checkpoint_t *cp, index_node_t *node, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	int i;
+
+	SVN_ERR(checkpoint_write_int(cp, node->lifetimes->nelts));
+	for (i = 0; i < node->lifetimes->nelts; i++) {
+		lifetime_t *lifetime = &APR_ARRAY_IDX(node->lifetimes, i, lifetime_t);
+		SVN_ERR(checkpoint_write_int(cp, lifetime->added));
+		SVN_ERR(checkpoint_write_int(cp, lifetime->deleted));
+	}
+
+	SVN_ERR(checkpoint_write_int(cp, (node->children ? apr_hash_count(node->children) : 0)));
+	if (node->children == NULL) {
+		return SVN_NO_ERROR;
+	}
+	for (hi = apr_hash_first(pool, node->children); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		index_node_t *child;
+		apr_hash_this(hi, (const void **)(void *)&key, NULL, (void **)(void *)&child);
+
+		SVN_ERR(checkpoint_write_string(cp, key));
+		SVN_ERR(path_hash_save_index(cp, child, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Restores a node of the lifetime index and all its children from a checkpoint */
+static svn_error_t *path_hash_load_index(checkpoint_t *cp, index_node_t **node)
+{
+	apr_int64_t i, num;
+
+	*node = path_hash_index_create();
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		apr_int64_t added, deleted;
+		lifetime_t *lifetime;
+
+		SVN_ERR(checkpoint_read_int(cp, &added));
+		SVN_ERR(checkpoint_read_int(cp, &deleted));
+		lifetime = apr_array_push((*node)->lifetimes);
+		lifetime->added = (svn_revnum_t)added;
+		lifetime->deleted = (svn_revnum_t)deleted;
+	}
+
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	if (num > 0) {
+		(*node)->children = apr_hash_make(ph_pool);
+	}
+	for (i = 0; i < num; i++) {
+		const char *key;
+		index_node_t *child;
+
+		SVN_ERR(checkpoint_read_string(cp, &key, ph_pool));
+		SVN_ERR(path_hash_load_index(cp, &child));
+		apr_hash_set((*node)->children, key, APR_HASH_KEY_STRING, child);
+	}
+	return SVN_NO_ERROR;
+}
+
+
 #ifdef DEBUG
 
 /* Debugging */
@@ -629,12 +1044,12 @@ static void path_hash_dump(apr_hash_t *tree, apr_pool_t *pool)
 /*---------------------------------------------------------------------------*/
 
 
-/* Initializes the path hash using the given pool */
-void path_hash_initialize(const char *session_prefix, const char *temp_dir, apr_pool_t *parent_pool)
+/* Initializes the path hash using the given pool. Trees that need to be
+   fetched from the repository will be listed using up to jobs
+   additional sessions */
+void path_hash_initialize(const char *session_prefix, const char *temp_dir, int jobs, apr_pool_t *parent_pool)
 {
 	if (ph_pool == NULL) {
-		int i;
-
 		/* Allocate global storage */
 		ph_pool = svn_pool_create(parent_pool);
 		ph_revisions = apr_array_make(ph_pool, 0, sizeof(tree_delta_t *));
@@ -642,12 +1057,22 @@ void path_hash_initialize(const char *session_prefix, const char *temp_dir, apr_
 		ph_temp_dir = apr_pstrdup(ph_pool, temp_dir);
 		ph_snapshots = apr_array_make(ph_pool, 0, sizeof(apr_hash_t *));
 		ph_files = apr_array_make(ph_pool, 0, sizeof(const char *));
-		ph_cache = apr_array_make(ph_pool, CACHE_SIZE, sizeof(cached_tree_t));
+		ph_jobs = jobs;
 
-		/* Initialize cache */
-		for (i = 0; i < CACHE_SIZE; i++) {
-			APR_ARRAY_IDX(ph_cache, i, cached_tree_t).tree = NULL;
-		}
+		/* The root is always present */
+		ph_index = path_hash_index_create();
+		APR_ARRAY_PUSH(ph_index->lifetimes, lifetime_t).added = 0;
+		APR_ARRAY_IDX(ph_index->lifetimes, 0, lifetime_t).deleted = SVN_INVALID_REVNUM;
+	}
+}
+
+
+/* Cleans up global resources */
+void path_hash_cleanup()
+{
+	if (ph_lister != NULL) {
+		dirlist_free(ph_lister);
+		ph_lister = NULL;
 	}
 }
 
@@ -752,6 +1177,8 @@ char path_hash_commit(session_t *session, log_revision_t *log, svn_revnum_t revn
 		}
 	}
 
+	path_hash_index_commit(ph_head, revnum, pool);
+
 	/* Finally, add the new revision after possible padding */
 	while (ph_revisions->nelts < revnum-1) {
 		APR_ARRAY_PUSH(ph_revisions, tree_delta_t *) = NULL;
@@ -789,61 +1216,134 @@ char path_hash_commit(session_t *session, log_revision_t *log, svn_revnum_t revn
 }
 
 
-/* Checks the parent relation of two paths at a given revision */
-char path_hash_check_parent(const char *parent, const char *child, svn_revnum_t revnum, apr_pool_t *pool)
+/* Saves the path hash to a checkpoint. The history files are copied into
+   the checkpoint directory */
+svn_error_t *path_hash_save(checkpoint_t *cp, apr_pool_t *pool)
 {
-	int i;
-	apr_hash_t *recon = NULL, *subtree;
+	apr_pool_t *subpool = svn_pool_create(pool);
+	int i, j;
 
-	DEBUG_MSG("path_hash: check_parent(%s, %s, %ld): %ld revisions\n", parent, child, revnum, ph_revisions->nelts);
+	SVN_ERR(checkpoint_write_int(cp, ph_index_head));
 
-	/* Check the cache first */
-	for (i = 0; i < CACHE_SIZE; i++) {
-		cached_tree_t *entry = &APR_ARRAY_IDX(ph_cache, i, cached_tree_t);
-		if (entry->tree != NULL && entry->revnum == revnum) {
-			recon = entry->tree;
-			break;
+	/* Deltas that are still in memory */
+	SVN_ERR(checkpoint_write_int(cp, ph_revisions->nelts));
+	for (i = 0; i < ph_revisions->nelts; i++) {
+		tree_delta_t *delta = APR_ARRAY_IDX(ph_revisions, i, tree_delta_t *);
+
+		SVN_ERR(checkpoint_write_int(cp, (delta != NULL)));
+		if (delta == NULL) {
+			continue;
 		}
+		SVN_ERR(checkpoint_write_int(cp, delta->deleted->nelts));
+		for (j = 0; j < delta->deleted->nelts; j++) {
+			SVN_ERR(checkpoint_write_string(cp, APR_ARRAY_IDX(delta->deleted, j, const char *)));
+		}
+		SVN_ERR(path_hash_save_tree(cp, delta->added, subpool));
+		svn_pool_clear(subpool);
 	}
 
-	/* If it isn't cached, reconstruct the tree at the given revision */
-	if (recon == NULL) {
-		recon = path_hash_reconstruct(revnum, pool);
-		if (recon == NULL) {
-			DEBUG_MSG("path_hash: unable to reconstruct hash for revision %ld\n", revnum);
-			return 0;
-		} else {
-			/* Insert the tree into the cache */
-			cached_tree_t *entry = &APR_ARRAY_IDX(ph_cache, ph_cache_pos, cached_tree_t);
+	SVN_ERR(checkpoint_write_int(cp, ph_snapshots->nelts));
+	for (i = 0; i < ph_snapshots->nelts; i++) {
+		SVN_ERR(path_hash_save_tree(cp, APR_ARRAY_IDX(ph_snapshots, i, apr_hash_t *), subpool));
+		svn_pool_clear(subpool);
+	}
 
-			/* Clear old entry if neccessary */
-			if (entry->tree) {
-				svn_pool_destroy(entry->pool);
-			}
+	SVN_ERR(checkpoint_write_int(cp, ph_files->nelts));
+	for (i = 0; i < ph_files->nelts; i++) {
+		const char *name = apr_psprintf(subpool, "path_hash-%d", i);
+		const char *copy;
+		SVN_ERR(checkpoint_add_file(cp, APR_ARRAY_IDX(ph_files, i, const char *), name, &copy, subpool));
+		SVN_ERR(checkpoint_write_string(cp, name));
+		svn_pool_clear(subpool);
+	}
 
-			entry->revnum = revnum;
-			entry->pool = svn_pool_create(ph_pool);
-			entry->tree = apr_hash_make(entry->pool);
-			path_hash_copy_deep(entry->tree, recon, pool);
+	SVN_ERR(path_hash_save_index(cp, ph_index, subpool));
+	svn_pool_destroy(subpool);
+	return SVN_NO_ERROR;
+}
 
-			/* Move to next cache entry */
-			if (++ph_cache_pos >= CACHE_SIZE) {
-				ph_cache_pos = 0;
-			}
+
+/* Restores the path hash from a checkpoint. This must be called right after
+   path_hash_initialize() */
+svn_error_t *path_hash_load(checkpoint_t *cp, apr_pool_t *pool)
+{
+	apr_pool_t *subpool = svn_pool_create(pool);
+	apr_int64_t i, j, num, head;
+
+	SVN_ERR(checkpoint_read_int(cp, &head));
+
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		apr_int64_t present, ndeleted;
+		tree_delta_t *delta;
+
+		SVN_ERR(checkpoint_read_int(cp, &present));
+		if (!present) {
+			APR_ARRAY_PUSH(ph_revisions, tree_delta_t *) = NULL;
+			continue;
 		}
+
+		delta = apr_palloc(ph_pool, sizeof(tree_delta_t));
+		delta->pool = svn_pool_create(ph_pool);
+		delta->deleted = apr_array_make(delta->pool, 0, sizeof(const char *));
+		SVN_ERR(checkpoint_read_int(cp, &ndeleted));
+		for (j = 0; j < ndeleted; j++) {
+			const char *path;
+			SVN_ERR(checkpoint_read_string(cp, &path, delta->pool));
+			APR_ARRAY_PUSH(delta->deleted, const char *) = path;
+		}
+		SVN_ERR(path_hash_load_tree(cp, &delta->added, delta->pool, subpool));
+		APR_ARRAY_PUSH(ph_revisions, tree_delta_t *) = delta;
+		svn_pool_clear(subpool);
 	}
 
-	/* Find the subtree of the parent node */
-	subtree = path_hash_subtree(recon, parent, pool);
-	if (subtree == NULL) {
-		DEBUG_MSG("path_hash: subtree for %s in %ld not found:\n", parent, revnum);
-#if 0 && defined(DEBUG)
-		path_hash_dump(recon, pool);
-#endif
+	/* Every snapshot uses a pool of its own */
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		apr_pool_t *tree_pool = svn_pool_create(ph_pool);
+		apr_hash_t *tree;
+		SVN_ERR(path_hash_load_tree(cp, &tree, tree_pool, subpool));
+		if (tree == NULL) {
+			svn_pool_destroy(tree_pool);
+		}
+		APR_ARRAY_PUSH(ph_snapshots, apr_hash_t *) = tree;
+		svn_pool_clear(subpool);
+	}
+
+	/* History files are used directly from the checkpoint directory */
+	SVN_ERR(checkpoint_read_int(cp, &num));
+	for (i = 0; i < num; i++) {
+		const char *name;
+		SVN_ERR(checkpoint_read_string(cp, &name, subpool));
+		APR_ARRAY_PUSH(ph_files, const char *) = checkpoint_file_path(cp, name, ph_pool);
+	}
+
+	SVN_ERR(path_hash_load_index(cp, &ph_index));
+	ph_index_head = (svn_revnum_t)head;
+
+	DEBUG_MSG("path_hash: restored %d revisions, %d snapshots, %d files\n", ph_revisions->nelts, ph_snapshots->nelts, ph_files->nelts);
+	svn_pool_destroy(subpool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Checks the parent relation of two paths at a given revision */
+char path_hash_check_parent(const char *parent, const char *child, svn_revnum_t revnum, apr_pool_t *pool)
+{
+	index_node_t *node;
+
+	DEBUG_MSG("path_hash: check_parent(%s, %s, %ld): head = %ld\n", parent, child, revnum, ph_index_head);
+
+	if (ph_index_head == SVN_INVALID_REVNUM || revnum > ph_index_head) {
+		DEBUG_MSG("path_hash: revision %ld not available\n", revnum);
+		TIMING_COUNT(TM_PH_INDEX_MISS, 1);
+		return 0;
 	}
+	TIMING_COUNT(TM_PH_INDEX_HIT, 1);
 
-	/* Find the subtree of the child */
-	return (subtree && path_hash_subtree(subtree, child, pool) != NULL);
+	/* A child is only present if its parent is present, too */
+	node = path_hash_index_lookup(svn_path_join(parent, child, pool));
+	return (node != NULL && path_hash_index_present(node, revnum));
 }
 
 #ifdef DEBUG_PHASH
@@ -27,12 +27,18 @@
 
 #include <svn_pools.h>
 
+#include "checkpoint.h"
 #include "log.h"
 #include "session.h"
 
 
-/* Initializes the path hash using the given pool */
-extern void path_hash_initialize(const char *session_prefix, const char *temp_dir, apr_pool_t *parent_pool);
+/* Initializes the path hash using the given pool. Trees that need to be
+   fetched from the repository will be listed using up to jobs
+   additional sessions */
+extern void path_hash_initialize(const char *session_prefix, const char *temp_dir, int jobs, apr_pool_t *parent_pool);
+
+/* Cleans up global resources */
+extern void path_hash_cleanup();
 
 /* Manually adds a new path to the head revision (without committing it) */
 extern void path_hash_add_path(const char *path);
@@ -43,6 +49,14 @@ extern char path_hash_commit(session_t *session, log_revision_t *log, svn_revnum
 /* Checks the parent relation of two paths at a given revision */
 extern char path_hash_check_parent(const char *parent, const char *child, svn_revnum_t revision, apr_pool_t *pool);
 
+/* Saves the path hash to a checkpoint. The history files are copied into
+   the checkpoint directory */
+extern svn_error_t *path_hash_save(checkpoint_t *cp, apr_pool_t *pool);
+
+/* Restores the path hash from a checkpoint. This must be called right after
+   path_hash_initialize() */
+extern svn_error_t *path_hash_load(checkpoint_t *cp, apr_pool_t *pool);
+
 #ifdef DEBUG_PHASH
  extern void path_hash_test(session_t *session);
 #endif
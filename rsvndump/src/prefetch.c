@@ -0,0 +1,1145 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: prefetch.c
+ *      desc: Prefetching of revision diffs using additional sessions
+ *
+ *      Each worker thread owns a session of its own and runs the diffs of
+ *      upcoming revisions. The editor drives are recorded to temporary
+ *      files (text deltas are stored in svndiff format) and played back
+ *      in order on the main thread. The number of recorded revisions
+ *      waiting to be played back is bounded.
+ *
+ *      The complete tree of the first revision is fetched the same way,
+ *      with the top-level entries of the tree distributed among the
+ *      workers. The workers list directories and fetch files themselves
+ *      and record the editor drive that adds the respective subtree.
+ */
+
+
+#include <svn_delta.h>
+#include <svn_pools.h>
+#include <svn_ra.h>
+
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#if APR_HAS_THREADS
+ #include <apr_thread_cond.h>
+ #include <apr_thread_mutex.h>
+ #include <apr_thread_proc.h>
+#endif
+
+#include "main.h"
+#include "session.h"
+#include "timing.h"
+#include "utils.h"
+
+#include "prefetch.h"
+
+
+/* Number of recorded revisions per worker that may be waiting */
+#define SLOTS_PER_JOB 2
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Recorded editor operations */
+typedef enum {
+	PF_OPEN_ROOT,
+	PF_DELETE_ENTRY,
+	PF_ADD_DIRECTORY,
+	PF_OPEN_DIRECTORY,
+	PF_CHANGE_DIR_PROP,
+	PF_CLOSE_DIRECTORY,
+	PF_ABSENT_DIRECTORY,
+	PF_ADD_FILE,
+	PF_OPEN_FILE,
+	PF_APPLY_TEXTDELTA,
+	PF_TEXTDELTA_CHUNK,
+	PF_TEXTDELTA_END,
+	PF_CHANGE_FILE_PROP,
+	PF_CLOSE_FILE,
+	PF_ABSENT_FILE,
+	PF_CLOSE_EDIT
+} pf_op_t;
+
+
+/* Recording editor baton */
+typedef struct {
+	apr_file_t        *file;
+	apr_int64_t       next_id;
+} pf_recorder_t;
+
+
+/* Recording node baton */
+typedef struct {
+	pf_recorder_t     *rec;
+	apr_int64_t       id;
+} pf_node_t;
+
+
+/* A recorded revision */
+typedef struct {
+	apr_file_t        *file;
+	svn_error_t       *err;
+	char              ready;
+} pf_slot_t;
+
+
+/* Arguments of a worker thread */
+typedef struct {
+	prefetch_t        *pf;
+	session_t         session;
+} pf_worker_t;
+
+
+/* A recorded top-level subtree */
+typedef struct {
+	const char        *path;
+	svn_node_kind_t   kind;
+	svn_error_t       *err;
+	char              ready;
+} pf_subtree_t;
+
+
+/* State of a parallel tree fetch */
+typedef struct {
+#if APR_HAS_THREADS
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+#endif
+	svn_revnum_t      rev;
+	pf_subtree_t      *subtrees;
+	apr_file_t        **files;
+	int               num;
+	int               next;      /* Next subtree to be fetched */
+	int               consumed;  /* Number of subtrees played back */
+	char              stop;
+	int               depth;
+} pf_tree_t;
+
+
+/* Arguments of a tree worker thread */
+typedef struct {
+	pf_tree_t         *tree;
+	session_t         session;
+} pf_tree_worker_t;
+
+
+/* Prefetching state */
+struct prefetch_t {
+	apr_pool_t        *pool;
+	int               jobs;
+	pf_worker_t       *workers;
+#if APR_HAS_THREADS
+	apr_thread_t      **threads;
+	apr_thread_mutex_t *mutex;
+	apr_thread_cond_t *cond;
+#endif
+	svn_revnum_t      base;
+	svn_revnum_t      *revs;
+	int               num;
+	int               next;      /* Next revision to be fetched */
+	int               consumed;  /* Number of revisions played back */
+	char              stop;
+	pf_slot_t         *slots;
+	int               depth;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Writes raw data to a recording */
+static svn_error_t *pf_put(apr_file_t *file, const void *data, apr_size_t len)
+{
+	apr_status_t status;
+	if ((status = apr_file_write_full(file, data, len, NULL))) {
+		return utils_apr_error(status);
+	}
+	TIMING_COUNT(TM_TEMP_BYTES, len);
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes a number to a recording */
+static svn_error_t *pf_put_int(apr_file_t *file, apr_int64_t value)
+{
+	return pf_put(file, &value, sizeof(apr_int64_t));
+}
+
+
+/* Writes a string (which may be NULL) to a recording */
+static svn_error_t *pf_put_str(apr_file_t *file, const char *str, apr_size_t len)
+{
+	if (str == NULL) {
+		return pf_put_int(file, -1);
+	}
+	SVN_ERR(pf_put_int(file, len));
+	return pf_put(file, str, len);
+}
+
+
+/* Writes the header of an operation to a recording */
+static svn_error_t *pf_put_op(apr_file_t *file, pf_op_t op, apr_int64_t id)
+{
+	SVN_ERR(pf_put_int(file, op));
+	return pf_put_int(file, id);
+}
+
+
+/* Reads raw data from a recording */
+static svn_error_t *pf_get(apr_file_t *file, void *data, apr_size_t len)
+{
+	apr_status_t status;
+	if ((status = apr_file_read_full(file, data, len, NULL))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Reads a number from a recording */
+static svn_error_t *pf_get_int(apr_file_t *file, apr_int64_t *value)
+{
+	return pf_get(file, value, sizeof(apr_int64_t));
+}
+
+
+/* Reads a string (which may be NULL) from a recording */
+static svn_error_t *pf_get_str(apr_file_t *file, const char **str, apr_size_t *len, apr_pool_t *pool)
+{
+	apr_int64_t n;
+	char *buffer;
+
+	SVN_ERR(pf_get_int(file, &n));
+	if (n < 0) {
+		*str = NULL;
+		return SVN_NO_ERROR;
+	}
+	buffer = apr_palloc(pool, (apr_size_t)n + 1);
+	SVN_ERR(pf_get(file, buffer, (apr_size_t)n));
+	buffer[n] = '\0';
+	*str = buffer;
+	if (len) {
+		*len = (apr_size_t)n;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Creates a new recording node baton */
+static pf_node_t *pf_node_create(pf_recorder_t *rec, apr_pool_t *pool)
+{
+	pf_node_t *node = apr_palloc(pool, sizeof(pf_node_t));
+	node->rec = rec;
+	node->id = rec->next_id++;
+	return node;
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_open_root(void *edit_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **root_baton)
+{
+	pf_recorder_t *rec = (pf_recorder_t *)edit_baton;
+	pf_node_t *node = pf_node_create(rec, dir_pool);
+	SVN_ERR(pf_put_op(rec->file, PF_OPEN_ROOT, node->id));
+	SVN_ERR(pf_put_int(rec->file, base_revision));
+	*root_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
+{
+	pf_node_t *parent = (pf_node_t *)parent_baton;
+	SVN_ERR(pf_put_op(parent->rec->file, PF_DELETE_ENTRY, parent->id));
+	SVN_ERR(pf_put_str(parent->rec->file, path, strlen(path)));
+	return pf_put_int(parent->rec->file, revision);
+}
+
+
+/* Records the addition or opening of a node */
+static svn_error_t *pf_add_or_open(pf_op_t op, const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t revision, apr_pool_t *pool, void **child_baton)
+{
+	pf_node_t *parent = (pf_node_t *)parent_baton;
+	pf_node_t *node = pf_node_create(parent->rec, pool);
+	SVN_ERR(pf_put_op(parent->rec->file, op, parent->id));
+	SVN_ERR(pf_put_str(parent->rec->file, path, strlen(path)));
+	SVN_ERR(pf_put_str(parent->rec->file, copyfrom_path, copyfrom_path ? strlen(copyfrom_path) : 0));
+	SVN_ERR(pf_put_int(parent->rec->file, revision));
+	*child_baton = node;
+	return SVN_NO_ERROR;
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_add_directory(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	return pf_add_or_open(PF_ADD_DIRECTORY, path, parent_baton, copyfrom_path, copyfrom_revision, dir_pool, child_baton);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_open_directory(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	return pf_add_or_open(PF_OPEN_DIRECTORY, path, parent_baton, NULL, base_revision, dir_pool, child_baton);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	return pf_add_or_open(PF_ADD_FILE, path, parent_baton, copyfrom_path, copyfrom_revision, file_pool, file_baton);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	return pf_add_or_open(PF_OPEN_FILE, path, parent_baton, NULL, base_revision, file_pool, file_baton);
+}
+
+
+/* Records a property change */
+static svn_error_t *pf_change_prop(pf_op_t op, void *baton, const char *name, const svn_string_t *value)
+{
+	pf_node_t *node = (pf_node_t *)baton;
+	SVN_ERR(pf_put_op(node->rec->file, op, node->id));
+	SVN_ERR(pf_put_str(node->rec->file, name, strlen(name)));
+	return pf_put_str(node->rec->file, value ? value->data : NULL, value ? value->len : 0);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_change_dir_prop(void *dir_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	return pf_change_prop(PF_CHANGE_DIR_PROP, dir_baton, name, value);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	return pf_change_prop(PF_CHANGE_FILE_PROP, file_baton, name, value);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_close_directory(void *dir_baton, apr_pool_t *pool)
+{
+	pf_node_t *node = (pf_node_t *)dir_baton;
+	return pf_put_op(node->rec->file, PF_CLOSE_DIRECTORY, node->id);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
+{
+	pf_node_t *node = (pf_node_t *)file_baton;
+	SVN_ERR(pf_put_op(node->rec->file, PF_CLOSE_FILE, node->id));
+	return pf_put_str(node->rec->file, text_checksum, text_checksum ? strlen(text_checksum) : 0);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_absent_directory(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	pf_node_t *parent = (pf_node_t *)parent_baton;
+	SVN_ERR(pf_put_op(parent->rec->file, PF_ABSENT_DIRECTORY, parent->id));
+	return pf_put_str(parent->rec->file, path, strlen(path));
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_absent_file(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	pf_node_t *parent = (pf_node_t *)parent_baton;
+	SVN_ERR(pf_put_op(parent->rec->file, PF_ABSENT_FILE, parent->id));
+	return pf_put_str(parent->rec->file, path, strlen(path));
+}
+
+
+/* Stream callback: records a chunk of svndiff data */
+static svn_error_t *pf_svndiff_write(void *baton, const char *data, apr_size_t *len)
+{
+	pf_node_t *node = (pf_node_t *)baton;
+	SVN_ERR(pf_put_op(node->rec->file, PF_TEXTDELTA_CHUNK, node->id));
+	return pf_put_str(node->rec->file, data, *len);
+}
+
+
+/* Stream callback: records the end of a text delta */
+static svn_error_t *pf_svndiff_close(void *baton)
+{
+	pf_node_t *node = (pf_node_t *)baton;
+	return pf_put_op(node->rec->file, PF_TEXTDELTA_END, node->id);
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
+{
+	pf_node_t *node = (pf_node_t *)file_baton;
+	svn_stream_t *stream;
+
+	SVN_ERR(pf_put_op(node->rec->file, PF_APPLY_TEXTDELTA, node->id));
+	SVN_ERR(pf_put_str(node->rec->file, base_checksum, base_checksum ? strlen(base_checksum) : 0));
+
+	stream = svn_stream_create(node, pool);
+	svn_stream_set_write(stream, pf_svndiff_write);
+	svn_stream_set_close(stream, pf_svndiff_close);
+	svn_txdelta_to_svndiff2(handler, handler_baton, stream, 0, pool);
+	return SVN_NO_ERROR;
+}
+
+
+/* Recording editor callback */
+static svn_error_t *pf_close_edit(void *edit_baton, apr_pool_t *pool)
+{
+	pf_recorder_t *rec = (pf_recorder_t *)edit_baton;
+	return pf_put_op(rec->file, PF_CLOSE_EDIT, 0);
+}
+
+
+/* Creates an editor that records its drive to the given file */
+static void pf_setup_recorder(apr_file_t *file, svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool)
+{
+	pf_recorder_t *rec = apr_palloc(pool, sizeof(pf_recorder_t));
+	rec->file = file;
+	rec->next_id = 0;
+
+	*editor = svn_delta_default_editor(pool);
+	(*editor)->open_root = pf_open_root;
+	(*editor)->delete_entry = pf_delete_entry;
+	(*editor)->add_directory = pf_add_directory;
+	(*editor)->open_directory = pf_open_directory;
+	(*editor)->add_file = pf_add_file;
+	(*editor)->open_file = pf_open_file;
+	(*editor)->apply_textdelta = pf_apply_textdelta;
+	(*editor)->close_file = pf_close_file;
+	(*editor)->close_directory = pf_close_directory;
+	(*editor)->change_file_prop = pf_change_file_prop;
+	(*editor)->change_dir_prop = pf_change_dir_prop;
+	(*editor)->close_edit = pf_close_edit;
+	(*editor)->absent_directory = pf_absent_directory;
+	(*editor)->absent_file = pf_absent_file;
+	*edit_baton = rec;
+}
+
+
+/* Plays back a recorded editor drive. If root_baton is not NULL, the drive
+   is played back below this directory baton instead of opening and closing
+   an edit of its own */
+static svn_error_t *pf_playback(apr_file_t *file, const svn_delta_editor_t *editor, void *edit_baton, void *root_baton, apr_pool_t *pool)
+{
+	apr_array_header_t *batons = apr_array_make(pool, 16, sizeof(void *));
+	apr_array_header_t *streams = apr_array_make(pool, 16, sizeof(svn_stream_t *));
+	apr_pool_t *chunkpool = svn_pool_create(pool);
+
+	while (1) {
+		apr_int64_t op, id, rev;
+		const char *path, *str;
+		apr_size_t len;
+		void *baton = NULL, *child = NULL;
+		svn_string_t value;
+
+		SVN_ERR(pf_get_int(file, &op));
+		SVN_ERR(pf_get_int(file, &id));
+		if (op != PF_OPEN_ROOT && op != PF_CLOSE_EDIT) {
+			if (id < 0 || id >= batons->nelts) {
+				return svn_error_create(1, NULL, "Corrupt editor recording");
+			}
+			baton = APR_ARRAY_IDX(batons, id, void *);
+		}
+
+		switch (op) {
+			case PF_OPEN_ROOT:
+				SVN_ERR(pf_get_int(file, &rev));
+				if (root_baton != NULL) {
+					child = root_baton;
+				} else {
+					SVN_ERR(editor->open_root(edit_baton, (svn_revnum_t)rev, pool, &child));
+				}
+				break;
+
+			case PF_DELETE_ENTRY:
+				SVN_ERR(pf_get_str(file, &path, NULL, pool));
+				SVN_ERR(pf_get_int(file, &rev));
+				SVN_ERR(editor->delete_entry(path, (svn_revnum_t)rev, baton, pool));
+				break;
+
+			case PF_ADD_DIRECTORY:
+			case PF_OPEN_DIRECTORY:
+			case PF_ADD_FILE:
+			case PF_OPEN_FILE:
+				SVN_ERR(pf_get_str(file, &path, NULL, pool));
+				SVN_ERR(pf_get_str(file, &str, NULL, pool));
+				SVN_ERR(pf_get_int(file, &rev));
+				if (op == PF_ADD_DIRECTORY) {
+					SVN_ERR(editor->add_directory(path, baton, str, (svn_revnum_t)rev, pool, &child));
+				} else if (op == PF_OPEN_DIRECTORY) {
+					SVN_ERR(editor->open_directory(path, baton, (svn_revnum_t)rev, pool, &child));
+				} else if (op == PF_ADD_FILE) {
+					SVN_ERR(editor->add_file(path, baton, str, (svn_revnum_t)rev, pool, &child));
+				} else {
+					SVN_ERR(editor->open_file(path, baton, (svn_revnum_t)rev, pool, &child));
+				}
+				break;
+
+			case PF_CHANGE_DIR_PROP:
+			case PF_CHANGE_FILE_PROP:
+				SVN_ERR(pf_get_str(file, &path, NULL, pool));
+				SVN_ERR(pf_get_str(file, &value.data, &value.len, pool));
+				if (op == PF_CHANGE_DIR_PROP) {
+					SVN_ERR(editor->change_dir_prop(baton, path, (value.data ? &value : NULL), pool));
+				} else {
+					SVN_ERR(editor->change_file_prop(baton, path, (value.data ? &value : NULL), pool));
+				}
+				break;
+
+			case PF_CLOSE_DIRECTORY:
+				SVN_ERR(editor->close_directory(baton, pool));
+				break;
+
+			case PF_ABSENT_DIRECTORY:
+			case PF_ABSENT_FILE:
+				SVN_ERR(pf_get_str(file, &path, NULL, pool));
+				if (op == PF_ABSENT_DIRECTORY) {
+					SVN_ERR(editor->absent_directory(path, baton, pool));
+				} else {
+					SVN_ERR(editor->absent_file(path, baton, pool));
+				}
+				break;
+
+			case PF_APPLY_TEXTDELTA: {
+				svn_txdelta_window_handler_t handler;
+				void *handler_baton;
+				SVN_ERR(pf_get_str(file, &str, NULL, pool));
+				SVN_ERR(editor->apply_textdelta(baton, str, pool, &handler, &handler_baton));
+				APR_ARRAY_IDX(streams, id, svn_stream_t *) = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE, pool);
+				break;
+			}
+
+			case PF_TEXTDELTA_CHUNK:
+				SVN_ERR(pf_get_str(file, &str, &len, chunkpool));
+				SVN_ERR(svn_stream_write(APR_ARRAY_IDX(streams, id, svn_stream_t *), str, &len));
+				svn_pool_clear(chunkpool);
+				break;
+
+			case PF_TEXTDELTA_END:
+				SVN_ERR(svn_stream_close(APR_ARRAY_IDX(streams, id, svn_stream_t *)));
+				break;
+
+			case PF_CLOSE_FILE:
+				SVN_ERR(pf_get_str(file, &str, NULL, pool));
+				SVN_ERR(editor->close_file(baton, str, pool));
+				break;
+
+			case PF_CLOSE_EDIT:
+				svn_pool_destroy(chunkpool);
+				if (root_baton != NULL) {
+					return SVN_NO_ERROR;
+				}
+				return editor->close_edit(edit_baton, pool);
+
+			default:
+				return svn_error_create(1, NULL, "Corrupt editor recording");
+		}
+
+		/* Register new node batons */
+		if (op == PF_OPEN_ROOT || op == PF_ADD_DIRECTORY || op == PF_OPEN_DIRECTORY || op == PF_ADD_FILE || op == PF_OPEN_FILE) {
+			APR_ARRAY_PUSH(batons, void *) = child;
+			APR_ARRAY_PUSH(streams, svn_stream_t *) = NULL;
+		}
+	}
+}
+
+
+/* Compares two entry names for qsort() */
+static int pf_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+
+/* Returns the names of the given directory entries in sorted order */
+static apr_array_header_t *pf_sorted_names(apr_hash_t *dirents, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	apr_array_header_t *names = apr_array_make(pool, apr_hash_count(dirents), sizeof(const char *));
+
+	for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi)) {
+		const void *key;
+		apr_hash_this(hi, &key, NULL, NULL);
+		APR_ARRAY_PUSH(names, const char *) = key;
+	}
+	qsort(names->elts, names->nelts, names->elt_size, pf_compare_names);
+	return names;
+}
+
+
+/* Sends a set of properties to an editor callback */
+static svn_error_t *pf_send_props(apr_hash_t *props, svn_error_t *(*change_prop)(void *, const char *, const svn_string_t *, apr_pool_t *), void *baton, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+
+	for (hi = apr_hash_first(pool, props); hi; hi = apr_hash_next(hi)) {
+		const void *key;
+		void *value;
+		apr_hash_this(hi, &key, NULL, &value);
+		SVN_ERR(change_prop(baton, key, value, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+#if APR_HAS_THREADS
+
+/* Runs the diff of a revision, recording the editor drive to a file */
+static svn_error_t *pf_fetch(session_t *session, svn_revnum_t src, svn_revnum_t dest, apr_file_t *file, apr_pool_t *pool)
+{
+	const svn_ra_reporter2_t *reporter;
+	void *report_baton;
+	svn_delta_editor_t *editor;
+	void *edit_baton;
+	apr_off_t offset = 0;
+	apr_status_t status;
+	svn_error_t *err;
+
+	if ((status = apr_file_trunc(file, 0)) || (status = apr_file_seek(file, APR_SET, &offset))) {
+		return utils_apr_error(status);
+	}
+
+	DEBUG_MSG("prefetch: diffing %ld against %ld\n", dest, src);
+	pf_setup_recorder(file, &editor, &edit_baton, pool);
+	SVN_ERR(svn_ra_do_diff2(session->ra, &reporter, &report_baton, dest, "", TRUE, TRUE, TRUE, session->encoded_url, editor, edit_baton, pool));
+	SVN_ERR(reporter->set_path(report_baton, "", src, FALSE, NULL, pool));
+	TIMING_CALL(TM_RA_DIFF, err = reporter->finish_report(report_baton, pool));
+	SVN_ERR(err);
+
+	if ((status = apr_file_flush(file))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Thread function of a worker */
+static void * APR_THREAD_FUNC pf_worker(apr_thread_t *thread, void *data)
+{
+	pf_worker_t *worker = (pf_worker_t *)data;
+	prefetch_t *pf = worker->pf;
+	apr_pool_t *pool = svn_pool_create(worker->session.pool);
+
+	while (1) {
+		int i;
+		pf_slot_t *slot;
+		svn_error_t *err;
+
+		/* Claim the next revision once there's a free slot */
+		apr_thread_mutex_lock(pf->mutex);
+		while (!pf->stop && pf->next < pf->num && pf->next >= pf->consumed + pf->depth) {
+			apr_thread_cond_wait(pf->cond, pf->mutex);
+		}
+		if (pf->stop || pf->next >= pf->num) {
+			apr_thread_mutex_unlock(pf->mutex);
+			break;
+		}
+		i = pf->next++;
+		apr_thread_mutex_unlock(pf->mutex);
+
+		slot = &pf->slots[i % pf->depth];
+		err = pf_fetch(&worker->session, (i == 0 ? pf->base : pf->revs[i-1]), pf->revs[i], slot->file, pool);
+		svn_pool_clear(pool);
+
+		apr_thread_mutex_lock(pf->mutex);
+		slot->err = err;
+		slot->ready = 1;
+		apr_thread_cond_broadcast(pf->cond);
+		apr_thread_mutex_unlock(pf->mutex);
+	}
+
+	svn_pool_destroy(pool);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Drives an editor with the addition of the given node and, for
+   directories, all of its children */
+static svn_error_t *pf_add_node(session_t *session, const svn_delta_editor_t *editor, void *parent_baton, const char *path, svn_node_kind_t kind, svn_revnum_t rev, apr_pool_t *pool)
+{
+	apr_hash_t *props;
+	void *baton;
+	svn_error_t *err;
+
+	if (kind == svn_node_dir) {
+		int i;
+		apr_hash_t *dirents;
+		apr_array_header_t *names;
+		apr_pool_t *subpool;
+
+		TIMING_CALL(TM_RA_GET_DIR, err = svn_ra_get_dir2(session->ra, &dirents, NULL, &props, path, rev, SVN_DIRENT_KIND, pool));
+		SVN_ERR(err);
+		SVN_ERR(editor->add_directory(path, parent_baton, NULL, SVN_INVALID_REVNUM, pool, &baton));
+		SVN_ERR(pf_send_props(props, editor->change_dir_prop, baton, pool));
+
+		subpool = svn_pool_create(pool);
+		names = pf_sorted_names(dirents, pool);
+		for (i = 0; i < names->nelts; i++) {
+			const char *name = APR_ARRAY_IDX(names, i, const char *);
+			svn_dirent_t *dirent = apr_hash_get(dirents, name, APR_HASH_KEY_STRING);
+			SVN_ERR(pf_add_node(session, editor, baton, apr_psprintf(subpool, "%s/%s", path, name), dirent->kind, rev, subpool));
+			svn_pool_clear(subpool);
+		}
+		svn_pool_destroy(subpool);
+
+		SVN_ERR(editor->close_directory(baton, pool));
+	} else {
+		svn_txdelta_window_handler_t handler;
+		void *handler_baton;
+		svn_stream_t *stream;
+
+		SVN_ERR(editor->add_file(path, parent_baton, NULL, SVN_INVALID_REVNUM, pool, &baton));
+
+		/* The contents are turned into a delta against the empty file
+		   while being received */
+		SVN_ERR(editor->apply_textdelta(baton, NULL, pool, &handler, &handler_baton));
+		stream = svn_txdelta_target_push(handler, handler_baton, svn_stream_empty(pool), pool);
+		TIMING_CALL(TM_RA_GET_FILE, err = svn_ra_get_file(session->ra, path, rev, stream, NULL, &props, pool));
+		SVN_ERR(err);
+		SVN_ERR(svn_stream_close(stream));
+
+		SVN_ERR(pf_send_props(props, editor->change_file_prop, baton, pool));
+		SVN_ERR(editor->close_file(baton, NULL, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Fetches a subtree, recording the editor drive that adds it to a file */
+static svn_error_t *pf_fetch_subtree(session_t *session, const pf_subtree_t *subtree, svn_revnum_t rev, apr_file_t *file, apr_pool_t *pool)
+{
+	svn_delta_editor_t *editor;
+	void *edit_baton, *root_baton;
+	apr_off_t offset = 0;
+	apr_status_t status;
+
+	if ((status = apr_file_trunc(file, 0)) || (status = apr_file_seek(file, APR_SET, &offset))) {
+		return utils_apr_error(status);
+	}
+
+	DEBUG_MSG("prefetch: fetching %s@%ld\n", subtree->path, rev);
+	pf_setup_recorder(file, &editor, &edit_baton, pool);
+	SVN_ERR(editor->open_root(edit_baton, SVN_INVALID_REVNUM, pool, &root_baton));
+	SVN_ERR(pf_add_node(session, editor, root_baton, subtree->path, subtree->kind, rev, pool));
+	SVN_ERR(editor->close_edit(edit_baton, pool));
+
+	if ((status = apr_file_flush(file))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Thread function of a tree worker */
+static void * APR_THREAD_FUNC pf_tree_worker(apr_thread_t *thread, void *data)
+{
+	pf_tree_worker_t *worker = (pf_tree_worker_t *)data;
+	pf_tree_t *tree = worker->tree;
+	apr_pool_t *pool = svn_pool_create(worker->session.pool);
+
+	while (1) {
+		int i;
+		svn_error_t *err;
+
+		/* Claim the next subtree once there's a free file */
+		apr_thread_mutex_lock(tree->mutex);
+		while (!tree->stop && tree->next < tree->num && tree->next >= tree->consumed + tree->depth) {
+			apr_thread_cond_wait(tree->cond, tree->mutex);
+		}
+		if (tree->stop || tree->next >= tree->num) {
+			apr_thread_mutex_unlock(tree->mutex);
+			break;
+		}
+		i = tree->next++;
+		apr_thread_mutex_unlock(tree->mutex);
+
+		err = pf_fetch_subtree(&worker->session, &tree->subtrees[i], tree->rev, tree->files[i % tree->depth], pool);
+		svn_pool_clear(pool);
+
+		apr_thread_mutex_lock(tree->mutex);
+		tree->subtrees[i].err = err;
+		tree->subtrees[i].ready = 1;
+		apr_thread_cond_broadcast(tree->cond);
+		apr_thread_mutex_unlock(tree->mutex);
+	}
+
+	svn_pool_destroy(pool);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+
+/* Plays back the recorded subtrees in order below the given root baton */
+static svn_error_t *pf_tree_playback(pf_tree_t *tree, const svn_delta_editor_t *editor, void *edit_baton, void *root_baton, apr_pool_t *pool)
+{
+	int i;
+	svn_error_t *err = SVN_NO_ERROR;
+	apr_pool_t *subpool = svn_pool_create(pool);
+
+	for (i = 0; i < tree->num && err == SVN_NO_ERROR; i++) {
+		pf_subtree_t *subtree = &tree->subtrees[i];
+		apr_file_t *file = tree->files[i % tree->depth];
+		apr_off_t offset = 0;
+		apr_status_t status;
+
+		apr_thread_mutex_lock(tree->mutex);
+		while (!subtree->ready) {
+			apr_thread_cond_wait(tree->cond, tree->mutex);
+		}
+		apr_thread_mutex_unlock(tree->mutex);
+
+		if ((err = subtree->err) == SVN_NO_ERROR) {
+			subtree->err = NULL;
+			if ((status = apr_file_seek(file, APR_SET, &offset))) {
+				err = utils_apr_error(status);
+			} else {
+				err = pf_playback(file, editor, edit_baton, root_baton, subpool);
+			}
+		} else {
+			subtree->err = NULL;
+		}
+		svn_pool_clear(subpool);
+
+		/* Release the file */
+		apr_thread_mutex_lock(tree->mutex);
+		++tree->consumed;
+		apr_thread_cond_broadcast(tree->cond);
+		apr_thread_mutex_unlock(tree->mutex);
+	}
+
+	svn_pool_destroy(subpool);
+	return err;
+}
+
+#endif /* APR_HAS_THREADS */
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts fetching the diffs of the given revisions using jobs additional
+   sessions. Each revision is diffed against the previous one, the first
+   one against base */
+char prefetch_start(prefetch_t **pf, session_t *session, int jobs, svn_revnum_t base, const svn_revnum_t *revs, int num, const char *temp_dir, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	int i;
+	apr_status_t status;
+	prefetch_t *p = apr_pcalloc(pool, sizeof(prefetch_t));
+
+	p->pool = svn_pool_create(pool);
+	p->jobs = 0;
+	p->base = base;
+	p->revs = apr_pmemdup(p->pool, revs, num * sizeof(svn_revnum_t));
+	p->num = num;
+	p->depth = jobs * SLOTS_PER_JOB;
+	p->slots = apr_pcalloc(p->pool, p->depth * sizeof(pf_slot_t));
+	p->workers = apr_pcalloc(p->pool, jobs * sizeof(pf_worker_t));
+	p->threads = apr_pcalloc(p->pool, jobs * sizeof(apr_thread_t *));
+
+	for (i = 0; i < p->depth; i++) {
+		char *filename = apr_psprintf(p->pool, "%s/XXXXXX", temp_dir);
+		status = apr_file_mktemp(&p->slots[i].file, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED | APR_DELONCLOSE, p->pool);
+		if (status) {
+			svn_error_t *err = utils_apr_error(status);
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			svn_pool_destroy(p->pool);
+			return 1;
+		}
+		TIMING_TEMP_FILE(p->pool);
+	}
+
+	if ((status = apr_thread_mutex_create(&p->mutex, APR_THREAD_MUTEX_DEFAULT, p->pool)) || (status = apr_thread_cond_create(&p->cond, p->pool))) {
+		svn_error_t *err = utils_apr_error(status);
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(p->pool);
+		return 1;
+	}
+
+	/* The sessions are opened here, so authentication doesn't happen
+	   concurrently */
+	for (i = 0; i < jobs; i++) {
+		pf_worker_t *worker = &p->workers[i];
+		worker->pf = p;
+		worker->session = session_copy(session);
+		if (session_open(&worker->session)) {
+			session_free(&worker->session);
+			break;
+		}
+		if ((status = apr_thread_create(&p->threads[i], NULL, pf_worker, worker, p->pool))) {
+			svn_error_t *err = utils_apr_error(status);
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			session_free(&worker->session);
+			break;
+		}
+		++p->jobs;
+	}
+	DEBUG_MSG("prefetch: %d of %d workers started\n", p->jobs, jobs);
+	if (p->jobs == 0) {
+		svn_pool_destroy(p->pool);
+		return 1;
+	}
+
+	*pf = p;
+	return 0;
+#else
+	fprintf(stderr, _("ERROR: Prefetching is not supported on this platform.\n"));
+	return 1;
+#endif
+}
+
+
+/* Drives the given editor with the diff of the next revision, waiting for
+   it to be fetched if neccessary */
+char prefetch_next(prefetch_t *pf, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	pf_slot_t *slot;
+	svn_error_t *err;
+	apr_off_t offset = 0;
+	apr_status_t status;
+#ifdef USE_TIMING
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	if (pf->consumed >= pf->num) {
+		fprintf(stderr, _("ERROR: No more prefetched revisions.\n"));
+		return 1;
+	}
+	slot = &pf->slots[pf->consumed % pf->depth];
+
+	apr_thread_mutex_lock(pf->mutex);
+	while (!slot->ready) {
+		apr_thread_cond_wait(pf->cond, pf->mutex);
+	}
+	apr_thread_mutex_unlock(pf->mutex);
+#ifdef USE_TIMING
+	DEBUG_MSG("prefetch: waited %f seconds for revision %ld\n", stopwatch_elapsed(&watch), pf->revs[pf->consumed]);
+#endif
+
+	if ((err = slot->err) == SVN_NO_ERROR) {
+		if ((status = apr_file_seek(slot->file, APR_SET, &offset))) {
+			err = utils_apr_error(status);
+		} else {
+			err = pf_playback(slot->file, editor, edit_baton, NULL, pool);
+		}
+	}
+
+	/* Release the slot */
+	apr_thread_mutex_lock(pf->mutex);
+	slot->ready = 0;
+	slot->err = SVN_NO_ERROR;
+	++pf->consumed;
+	apr_thread_cond_broadcast(pf->cond);
+	apr_thread_mutex_unlock(pf->mutex);
+
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return 1;
+	}
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+
+/* Stops fetching and closes the additional sessions */
+void prefetch_stop(prefetch_t *pf)
+{
+#if APR_HAS_THREADS
+	int i;
+
+	apr_thread_mutex_lock(pf->mutex);
+	pf->stop = 1;
+	apr_thread_cond_broadcast(pf->cond);
+	apr_thread_mutex_unlock(pf->mutex);
+
+	for (i = 0; i < pf->jobs; i++) {
+		apr_status_t retval;
+		apr_thread_join(&retval, pf->threads[i]);
+		session_free(&pf->workers[i].session);
+	}
+	for (i = 0; i < pf->depth; i++) {
+		svn_error_clear(pf->slots[i].err);
+	}
+	svn_pool_destroy(pf->pool);
+#endif
+}
+
+
+/* Drives the given editor with the addition of the complete tree of the
+   given revision, like a diff against an empty tree. The top-level
+   entries are fetched by jobs additional sessions */
+char prefetch_tree(session_t *session, int jobs, svn_revnum_t rev, const char *temp_dir, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+	int i, started = 0;
+	apr_status_t status;
+	apr_hash_t *dirents, *props;
+	apr_array_header_t *names;
+	apr_thread_t **threads;
+	pf_tree_worker_t *workers;
+	pf_tree_t tree;
+	void *root_baton;
+	svn_error_t *err;
+	apr_pool_t *tpool = svn_pool_create(pool);
+#ifdef USE_TIMING
+	stopwatch_t watch = stopwatch_create();
+#endif
+
+	/* The top-level entries are listed on the main session */
+	TIMING_CALL(TM_RA_GET_DIR, err = svn_ra_get_dir2(session->ra, &dirents, NULL, &props, "", rev, SVN_DIRENT_KIND, tpool));
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(tpool);
+		return 1;
+	}
+	names = pf_sorted_names(dirents, tpool);
+
+	memset(&tree, 0, sizeof(pf_tree_t));
+	tree.rev = rev;
+	tree.num = names->nelts;
+	tree.depth = jobs * SLOTS_PER_JOB;
+	tree.subtrees = apr_pcalloc(tpool, (tree.num + 1) * sizeof(pf_subtree_t));
+	tree.files = apr_pcalloc(tpool, tree.depth * sizeof(apr_file_t *));
+	for (i = 0; i < tree.num; i++) {
+		tree.subtrees[i].path = APR_ARRAY_IDX(names, i, const char *);
+		tree.subtrees[i].kind = ((svn_dirent_t *)apr_hash_get(dirents, tree.subtrees[i].path, APR_HASH_KEY_STRING))->kind;
+	}
+	if (jobs > tree.num) {
+		jobs = tree.num;
+	}
+
+	for (i = 0; i < tree.depth; i++) {
+		char *filename = apr_psprintf(tpool, "%s/XXXXXX", temp_dir);
+		status = apr_file_mktemp(&tree.files[i], filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED | APR_DELONCLOSE, tpool);
+		if (status) {
+			err = utils_apr_error(status);
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			svn_pool_destroy(tpool);
+			return 1;
+		}
+		TIMING_TEMP_FILE(tpool);
+	}
+
+	if ((status = apr_thread_mutex_create(&tree.mutex, APR_THREAD_MUTEX_DEFAULT, tpool)) || (status = apr_thread_cond_create(&tree.cond, tpool))) {
+		err = utils_apr_error(status);
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		svn_pool_destroy(tpool);
+		return 1;
+	}
+
+	/* The sessions are opened here, so authentication doesn't happen
+	   concurrently */
+	workers = apr_pcalloc(tpool, (jobs + 1) * sizeof(pf_tree_worker_t));
+	threads = apr_pcalloc(tpool, (jobs + 1) * sizeof(apr_thread_t *));
+	for (i = 0; i < jobs; i++) {
+		pf_tree_worker_t *worker = &workers[started];
+		worker->tree = &tree;
+		worker->session = session_copy(session);
+		if (session_open(&worker->session)) {
+			session_free(&worker->session);
+			break;
+		}
+		if ((status = apr_thread_create(&threads[started], NULL, pf_tree_worker, worker, tpool))) {
+			err = utils_apr_error(status);
+			utils_handle_error(err, stderr, FALSE, "ERROR: ");
+			svn_error_clear(err);
+			session_free(&worker->session);
+			break;
+		}
+		++started;
+	}
+	DEBUG_MSG("prefetch: %d of %d tree workers started for %d entries\n", started, jobs, tree.num);
+	if (started == 0 && tree.num > 0) {
+		svn_pool_destroy(tpool);
+		return 1;
+	}
+
+	/* The root node is not part of the recordings */
+	err = editor->open_root(edit_baton, SVN_INVALID_REVNUM, tpool, &root_baton);
+	if (err == SVN_NO_ERROR) {
+		err = pf_send_props(props, editor->change_dir_prop, root_baton, tpool);
+	}
+	if (err == SVN_NO_ERROR) {
+		err = pf_tree_playback(&tree, editor, edit_baton, root_baton, tpool);
+	}
+	if (err == SVN_NO_ERROR) {
+		err = editor->close_directory(root_baton, tpool);
+	}
+	if (err == SVN_NO_ERROR) {
+		err = editor->close_edit(edit_baton, tpool);
+	}
+
+	apr_thread_mutex_lock(tree.mutex);
+	tree.stop = 1;
+	apr_thread_cond_broadcast(tree.cond);
+	apr_thread_mutex_unlock(tree.mutex);
+	for (i = 0; i < started; i++) {
+		apr_status_t retval;
+		apr_thread_join(&retval, threads[i]);
+		session_free(&workers[i].session);
+	}
+	for (i = 0; i < tree.num; i++) {
+		svn_error_clear(tree.subtrees[i].err);
+	}
+	svn_pool_destroy(tpool);
+
+	if (err) {
+		utils_handle_error(err, stderr, FALSE, "ERROR: ");
+		svn_error_clear(err);
+		return 1;
+	}
+#ifdef USE_TIMING
+	DEBUG_MSG("prefetch_tree done in %f seconds\n", stopwatch_elapsed(&watch));
+#endif
+	return 0;
+#else
+	fprintf(stderr, _("ERROR: Prefetching is not supported on this platform.\n"));
+	return 1;
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: prefetch.h
+ *      desc: Prefetching of revision diffs using additional sessions
+ */
+
+
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+
+#include <svn_delta.h>
+#include <svn_types.h>
+
+#include <apr_pools.h>
+
+#include "session.h"
+
+
+typedef struct prefetch_t prefetch_t;
+
+
+/* Starts fetching the diffs of the given revisions using jobs additional
+   sessions. Each revision is diffed against the previous one, the first
+   one against base */
+extern char prefetch_start(prefetch_t **pf, session_t *session, int jobs, svn_revnum_t base, const svn_revnum_t *revs, int num, const char *temp_dir, apr_pool_t *pool);
+
+/* Drives the given editor with the diff of the next revision, waiting for
+   it to be fetched if neccessary */
+extern char prefetch_next(prefetch_t *pf, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool);
+
+/* Stops fetching and closes the additional sessions */
+extern void prefetch_stop(prefetch_t *pf);
+
+/* Drives the given editor with the addition of the complete tree of the
+   given revision, like a diff against an empty tree. The top-level
+   entries are fetched by jobs additional sessions */
+extern char prefetch_tree(session_t *session, int jobs, svn_revnum_t rev, const char *temp_dir, const svn_delta_editor_t *editor, void *edit_baton, apr_pool_t *pool);
+
+
+#endif
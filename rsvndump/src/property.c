@@ -18,6 +18,13 @@
  *
  *      file: property.c
  *      desc: Convenience functions for dumping properties
+ *
+ *      Property sets of repository nodes are kept in memory as immutable,
+ *      reference-counted objects. Identical sets are shared, which is
+ *      quite common since most nodes only carry a few standard properties.
+ *      Sets are stored in a compact serialized form. If their total size
+ *      exceeds the memory budget, the oldest ones are moved to a temporary
+ *      spill file.
  */
 
 
@@ -30,11 +37,243 @@
 
 #include <apr_file_io.h>
 #include <apr_hash.h>
+#include <apr_md5.h>
 #include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "main.h"
+#include "timing.h"
+#include "utils.h"
 
 #include "property.h"
 
 
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* An interned property set */
+struct property_set_t {
+	unsigned char          digest[APR_MD5_DIGESTSIZE];
+	char                   *data;     /* NULL if spilled */
+	apr_size_t             size;
+	apr_off_t              offset;    /* Position in the spill file */
+	unsigned int           refcount;
+	struct property_set_t  *prev;     /* Sets in memory, oldest first */
+	struct property_set_t  *next;
+	struct property_set_t  *chain;    /* Other sets with the same digest */
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static variables                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Global pool */
+static apr_pool_t *ps_pool = NULL;
+
+/* Temporary directory for the spill file */
+static const char *ps_temp_dir = NULL;
+
+/* All property sets, indexed by digest and chained on collisions */
+static apr_hash_t *ps_sets = NULL;
+
+/* Sets that are currently in memory */
+static property_set_t *ps_first = NULL;
+static property_set_t *ps_last = NULL;
+static apr_size_t ps_memory = 0;
+static apr_size_t ps_budget = 0;
+
+/* Spill file, created on demand */
+static apr_file_t *ps_spill = NULL;
+static apr_off_t ps_spill_size = 0;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Compares two property names for qsort() */
+static int property_keycmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+
+/* Appends a length-prefixed string to a buffer */
+static char *property_put(char *dest, const char *data, apr_uint32_t len)
+{
+	memcpy(dest, &len, sizeof(apr_uint32_t));
+	memcpy(dest + sizeof(apr_uint32_t), data, len);
+	return dest + sizeof(apr_uint32_t) + len;
+}
+
+
+/* Reads a length-prefixed string from a buffer */
+static const char *property_get(const char *src, const char *end, const char **data, apr_uint32_t *len)
+{
+	if (end - src < (long)sizeof(apr_uint32_t)) {
+		return NULL;
+	}
+	memcpy(len, src, sizeof(apr_uint32_t));
+	src += sizeof(apr_uint32_t);
+	if (end - src < (long)*len) {
+		return NULL;
+	}
+	*data = src;
+	return src + *len;
+}
+
+
+/* Serializes a property hash. The keys are sorted so that equal
+   hashes result in equal data */
+static char *property_serialize(apr_hash_t *hash, apr_size_t *size, apr_pool_t *pool)
+{
+	apr_array_header_t *keys = apr_array_make(pool, apr_hash_count(hash), sizeof(const char *));
+	apr_hash_index_t *hi;
+	char *data, *ptr;
+	int i;
+
+	*size = 0;
+	for (hi = apr_hash_first(pool, hash); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		svn_string_t *value;
+		apr_hash_this(hi, (const void **)(void *)&key, NULL, (void **)(void *)&value);
+		APR_ARRAY_PUSH(keys, const char *) = key;
+		*size += 2 * sizeof(apr_uint32_t) + strlen(key) + (value ? value->len : 0);
+	}
+	qsort(keys->elts, keys->nelts, keys->elt_size, property_keycmp);
+
+	ptr = data = apr_palloc(pool, *size);
+	for (i = 0; i < keys->nelts; i++) {
+		const char *key = APR_ARRAY_IDX(keys, i, const char *);
+		svn_string_t *value = apr_hash_get(hash, key, APR_HASH_KEY_STRING);
+		ptr = property_put(ptr, key, strlen(key));
+		ptr = property_put(ptr, value ? value->data : "", value ? value->len : 0);
+	}
+	return data;
+}
+
+
+/* Deserializes a property set into a hash */
+static svn_error_t *property_deserialize(const char *data, apr_size_t size, apr_hash_t *hash, apr_pool_t *pool)
+{
+	const char *end = data + size;
+
+	while (data < end) {
+		const char *key, *value;
+		apr_uint32_t klen, vlen;
+		if ((data = property_get(data, end, &key, &klen)) == NULL || (data = property_get(data, end, &value, &vlen)) == NULL) {
+			return svn_error_create(1, NULL, "Corrupt property set");
+		}
+		apr_hash_set(hash, apr_pstrmemdup(pool, key, klen), klen, svn_string_ncreate(value, vlen, pool));
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Returns the serialized data of a set, reading it from the spill file
+   if neccessary */
+static svn_error_t *property_set_data(const property_set_t *set, const char **data, apr_pool_t *pool)
+{
+	apr_status_t status;
+	apr_off_t offset;
+	char *buffer;
+
+	if (set->data != NULL) {
+		*data = set->data;
+		return SVN_NO_ERROR;
+	}
+
+	offset = set->offset;
+	buffer = apr_palloc(pool, set->size);
+	if ((status = apr_file_seek(ps_spill, APR_SET, &offset)) || (status = apr_file_read_full(ps_spill, buffer, set->size, NULL))) {
+		return utils_apr_error(status);
+	}
+	*data = buffer;
+	return SVN_NO_ERROR;
+}
+
+
+/* Searches the sets with the given digest for one that contains exactly
+   the given data. A matching digest alone isn't trusted, as MD5
+   collisions can be crafted */
+static svn_error_t *property_set_find(property_set_t **set, const unsigned char *digest, const char *data, apr_size_t size, apr_pool_t *pool)
+{
+	property_set_t *candidate = apr_hash_get(ps_sets, digest, APR_MD5_DIGESTSIZE);
+
+	*set = NULL;
+	for (; candidate != NULL; candidate = candidate->chain) {
+		const char *cdata;
+		if (candidate->size != size) {
+			continue;
+		}
+		SVN_ERR(property_set_data(candidate, &cdata, pool));
+		if (!memcmp(cdata, data, size)) {
+			*set = candidate;
+			break;
+		}
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Removes a set from the list of sets in memory */
+static void property_unlink(property_set_t *set)
+{
+	if (set->prev) {
+		set->prev->next = set->next;
+	} else {
+		ps_first = set->next;
+	}
+	if (set->next) {
+		set->next->prev = set->prev;
+	} else {
+		ps_last = set->prev;
+	}
+	set->prev = set->next = NULL;
+}
+
+
+/* Moves the oldest sets to the spill file until the memory budget is met */
+static svn_error_t *property_spill()
+{
+	apr_status_t status;
+
+	while (ps_memory > ps_budget && ps_first != NULL) {
+		property_set_t *set = ps_first;
+		apr_off_t offset = ps_spill_size;
+
+		if (ps_spill == NULL) {
+			char *filename = apr_psprintf(ps_pool, "%s/XXXXXX", ps_temp_dir);
+			status = apr_file_mktemp(&ps_spill, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED | APR_DELONCLOSE, ps_pool);
+			if (status) {
+				ps_spill = NULL;
+				return utils_apr_error(status);
+			}
+			TIMING_TEMP_FILE(ps_pool);
+			DEBUG_MSG("property: created spill file %s\n", filename);
+		}
+
+		if ((status = apr_file_seek(ps_spill, APR_SET, &offset)) || (status = apr_file_write_full(ps_spill, set->data, set->size, NULL))) {
+			return utils_apr_error(status);
+		}
+		TIMING_COUNT(TM_TEMP_BYTES, set->size);
+		set->offset = ps_spill_size;
+		ps_spill_size += set->size;
+
+		property_unlink(set);
+		free(set->data);
+		set->data = NULL;
+		ps_memory -= set->size;
+	}
+	return SVN_NO_ERROR;
+}
+
+
 /*---------------------------------------------------------------------------*/
 /* Global functions                                                          */
 /*---------------------------------------------------------------------------*/
@@ -101,82 +340,147 @@ void property_del_dump(const char *key)
 }
 
 
-/* Writes a hash of properties to a given file */
-void property_hash_write(struct apr_hash_t *hash, struct apr_file_t *file, struct apr_pool_t *pool)
+/* Initializes the property set storage. Sets will be spilled to a file
+   in temp_dir if they occupy more than budget bytes */
+void property_sets_init(const char *temp_dir, apr_size_t budget, struct apr_pool_t *pool)
+{
+	ps_pool = svn_pool_create(pool);
+	ps_temp_dir = apr_pstrdup(ps_pool, temp_dir);
+	ps_sets = apr_hash_make(ps_pool);
+	ps_first = ps_last = NULL;
+	ps_memory = 0;
+	ps_budget = budget;
+	ps_spill = NULL;
+	ps_spill_size = 0;
+}
+
+
+/* Frees all property sets and removes the spill file */
+void property_sets_free()
 {
 	apr_hash_index_t *hi;
-	for (hi = apr_hash_first(pool, hash); hi; hi = apr_hash_next(hi)) {
-		const char *key;
-		svn_string_t *value;
-		apr_hash_this(hi, (const void **)(void *)&key, NULL, (void **)(void *)&value);
 
-		/* NOTE: This is the same as property_dump() */
-		if (key == NULL) {
-			return;
-		}
-		apr_file_printf(file, "K %lu\n", (unsigned long)strlen(key));
-		apr_file_printf(file, "%s\n", key);
-		if (value != NULL) {
-			apr_file_printf(file, "V %lu\n", (unsigned long)strlen(value->data));
-			apr_file_printf(file, "%s\n", value->data);
-		} else {
-			apr_file_printf(file, "V 0\n\n");
+	if (ps_pool == NULL) {
+		return;
+	}
+	for (hi = apr_hash_first(ps_pool, ps_sets); hi; hi = apr_hash_next(hi)) {
+		property_set_t *set;
+		apr_hash_this(hi, NULL, NULL, (void **)(void *)&set);
+		while (set != NULL) {
+			property_set_t *chain = set->chain;
+			free(set->data);
+			free(set);
+			set = chain;
 		}
 	}
+	/* This closes (and thus removes) the spill file, too */
+	svn_pool_destroy(ps_pool);
+	ps_pool = NULL;
+	ps_sets = NULL;
+	ps_first = ps_last = NULL;
+	ps_spill = NULL;
 }
 
 
-/* Loads a hash of properties from a given file, storing the properties using the given pool */
-char property_hash_load(struct apr_hash_t *hash, struct apr_file_t *file, struct apr_pool_t *pool)
+/* Returns a reference to the set containing the properties of the given
+   hash, or NULL if the hash is empty */
+struct svn_error_t *property_set_intern(property_set_t **set, struct apr_hash_t *hash, struct apr_pool_t *pool)
 {
-	apr_pool_t *subpool = svn_pool_create(pool);
-	apr_off_t skip = 1;
-	const int maxlen = 512;
-	char *buffer = apr_palloc(subpool, maxlen+1);
+	apr_pool_t *subpool;
+	unsigned char digest[APR_MD5_DIGESTSIZE];
+	apr_size_t size;
+	char *data;
+	property_set_t *head;
+	svn_error_t *err;
 
-	while (!APR_STATUS_IS_EOF(apr_file_eof(file))) {
-		unsigned long dlen;
-		char end; /* Used for EOL detection */
-		char *keybuffer, *valbuffer;
+	*set = NULL;
+	if (apr_hash_count(hash) == 0) {
+		return SVN_NO_ERROR;
+	}
 
-		/* Read key */
-		if (apr_file_gets(buffer, maxlen, file) != APR_SUCCESS) {
-			break;
-		}
-		if ((sscanf(buffer, "K %lu%c", &dlen, &end) != 2) || (end != '\n')) {
-			break;
-		}
-		keybuffer = apr_pcalloc(subpool, dlen+1);
-		if (apr_file_read(file, keybuffer, (apr_size_t *)&dlen) != APR_SUCCESS) {
-			break;
-		}
+	subpool = svn_pool_create(pool);
+	data = property_serialize(hash, &size, subpool);
+	apr_md5(digest, data, size);
 
-		/* Skip newline */
-		apr_file_seek(file, APR_CUR, &skip);
-		skip = 1;
+	if ((err = property_set_find(set, digest, data, size, subpool))) {
+		svn_pool_destroy(subpool);
+		return err;
+	}
+	if (*set != NULL) {
+		++(*set)->refcount;
+		svn_pool_destroy(subpool);
+		return SVN_NO_ERROR;
+	}
 
-		/* Read value */
-		if (apr_file_gets(buffer, maxlen, file) != APR_SUCCESS) {
-			break;
-		}
-		if ((sscanf(buffer, "V %lu%c", &dlen, &end) != 2) || (end != '\n')) {
-			break;
-		}
-		if (dlen == 0) {
-			apr_hash_set(hash, apr_pstrdup(pool, keybuffer), APR_HASH_KEY_STRING, svn_string_ncreate("", 0, pool));
-		} else {
-			valbuffer = apr_pcalloc(subpool, dlen+1);
-			if (apr_file_read(file, valbuffer, (apr_size_t *)&dlen) != APR_SUCCESS) {
-				break;
-			}
-			apr_hash_set(hash, apr_pstrdup(pool, keybuffer), APR_HASH_KEY_STRING, svn_string_create(valbuffer, pool));
-		}
+	*set = malloc(sizeof(property_set_t));
+	memcpy((*set)->digest, digest, APR_MD5_DIGESTSIZE);
+	(*set)->data = malloc(size);
+	memcpy((*set)->data, data, size);
+	(*set)->size = size;
+	(*set)->offset = -1;
+	(*set)->refcount = 1;
+	(*set)->prev = ps_last;
+	(*set)->next = NULL;
+	(*set)->chain = NULL;
+	if (ps_last) {
+		ps_last->next = *set;
+	} else {
+		ps_first = *set;
+	}
+	ps_last = *set;
+	ps_memory += size;
 
-		/* Skip newline */
-		apr_file_seek(file, APR_CUR, &skip);
-		skip = 1;
+	/* Colliding sets are appended, so the hash key stays valid */
+	if ((head = apr_hash_get(ps_sets, digest, APR_MD5_DIGESTSIZE)) != NULL) {
+		while (head->chain != NULL) {
+			head = head->chain;
+		}
+		head->chain = *set;
+	} else {
+		apr_hash_set(ps_sets, (*set)->digest, APR_MD5_DIGESTSIZE, *set);
 	}
 
 	svn_pool_destroy(subpool);
-	return !APR_STATUS_IS_EOF(apr_file_eof(file));
+	return property_spill();
+}
+
+
+/* Adds the properties of a set to a hash, storing them using the given pool */
+struct svn_error_t *property_set_load(const property_set_t *set, struct apr_hash_t *hash, struct apr_pool_t *pool)
+{
+	const char *data;
+
+	SVN_ERR(property_set_data(set, &data, pool));
+	return property_deserialize(data, set->size, hash, pool);
+}
+
+
+/* Drops a reference to a property set */
+void property_set_release(property_set_t *set)
+{
+	property_set_t *head;
+
+	if (set == NULL || --set->refcount > 0) {
+		return;
+	}
+
+	head = apr_hash_get(ps_sets, set->digest, APR_MD5_DIGESTSIZE);
+	if (head == set) {
+		/* The key is owned by the head of the chain */
+		apr_hash_set(ps_sets, set->digest, APR_MD5_DIGESTSIZE, NULL);
+		if (set->chain != NULL) {
+			apr_hash_set(ps_sets, set->chain->digest, APR_MD5_DIGESTSIZE, set->chain);
+		}
+	} else {
+		while (head->chain != set) {
+			head = head->chain;
+		}
+		head->chain = set->chain;
+	}
+	if (set->data) {
+		property_unlink(set);
+		ps_memory -= set->size;
+		free(set->data);
+	}
+	free(set);
 }
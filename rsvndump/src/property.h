@@ -25,6 +25,10 @@
 #define PROPERTY_H_
 
 
+/* An immutable, reference-counted set of properties */
+typedef struct property_set_t property_set_t;
+
+
 /* Returns the length of a property */
 extern size_t property_strlen(struct apr_pool_t *pool, const char *key, const char *value);
 
@@ -37,11 +41,22 @@ extern void property_dump(const char *key, const char *value);
 /* Dumps a property deletion to stdout */
 extern void property_del_dump(const char *key);
 
-/* Writes a hash of properties to a given file */
-extern void property_hash_write(struct apr_hash_t *hash, struct apr_file_t *file, struct apr_pool_t *pool);
+/* Initializes the property set storage. Sets will be spilled to a file
+   in temp_dir if they occupy more than budget bytes */
+extern void property_sets_init(const char *temp_dir, size_t budget, struct apr_pool_t *pool);
+
+/* Frees all property sets and removes the spill file */
+extern void property_sets_free();
+
+/* Returns a reference to the set containing the properties of the given
+   hash, or NULL if the hash is empty */
+extern struct svn_error_t *property_set_intern(property_set_t **set, struct apr_hash_t *hash, struct apr_pool_t *pool);
+
+/* Adds the properties of a set to a hash, storing them using the given pool */
+extern struct svn_error_t *property_set_load(const property_set_t *set, struct apr_hash_t *hash, struct apr_pool_t *pool);
 
-/* Loads a hash of properties from a given file, storing the properties using the givn pool */
-extern char property_hash_load(struct apr_hash_t *hash, struct apr_file_t *file, struct apr_pool_t *pool);
+/* Drops a reference to a property set */
+extern void property_set_release(property_set_t *set);
 
 
 #endif
@@ -17,182 +17,573 @@
  *
  *
  *      file: rhash.c
- *      desc: Interface for apr_hash_t with special memory handling
+ *      desc: Hash table for repository paths with fixed-size values
  *
- *      The idea behind this data structure is that there are hashes in delta.c
- *      that store data for which the pool allocation model is not suitable.
- *      Thus, this hash implements its own memory handling for both keys and
- *      values.
- *      However, this raises the need for manually clearing the hash contents
- *      (or calling rhash_clear()).
+ *      The hashes in delta.c store data for every path in the repository,
+ *      for which the pool allocation model is not suitable. Thus, this hash
+ *      implements its own memory handling for both keys and values.
  *
- *      The implementation uses an extra hash to store the pointers
- *      for the allocated key data.
+ *      Paths are split into their components, and every component is a node
+ *      in a tree. Nodes are kept in an array and found through an
+ *      open-addressing table that is indexed by the parent node and the
+ *      component name. Thus, common prefixes are stored only once, and all
+ *      entries below a path can be removed without scanning the whole hash.
+ *      Component names are stored in large blocks, and the values are stored
+ *      in an array parallel to the nodes.
+ *
+ *      Table slots carry a generation number, and slots of older generations
+ *      are empty. This way, the hash can be cleared without touching the
+ *      slots at all.
  */
 
 
 #include <stdlib.h>
+#include <string.h>
 
-#include <svn_error.h>
-
-#include <apr_strings.h>
+#include <apr_pools.h>
 
 #include "main.h"
 #include "rhash.h"
 
 
+/* Initial number of table slots (must be a power of two) */
+#define RH_INITIAL_SLOTS 64
+
+/* Size of the blocks that component names are stored in */
+#define RH_BLOCK_SIZE (64 * 1024)
+
+/* Marks missing node links */
+#define RH_NONE ((apr_uint32_t)-1)
+
+/* Marks table slots whose node has been removed */
+#define RH_DELETED ((apr_uint32_t)-2)
+
+
 /*---------------------------------------------------------------------------*/
 /* Local data structures                                                     */
 /*---------------------------------------------------------------------------*/
 
 
+/* A block of component names */
+typedef struct rh_block_t {
+	struct rh_block_t *next;
+	apr_size_t        used;
+	apr_size_t        size;
+} rh_block_t;
+
+
+/* A path component. Only nodes that have been set explicitly carry
+   a value; the others are parents of such nodes */
+typedef struct {
+	const char        *name;
+	apr_uint32_t      len;
+	apr_uint32_t      hash;
+	apr_uint32_t      parent;
+	apr_uint32_t      child;     /* First child */
+	apr_uint32_t      prev;      /* Siblings */
+	apr_uint32_t      next;      /* Siblings, or the next free node */
+	char              has_value;
+	char              used;
+} rh_node_t;
+
+
+/* A table slot */
+typedef struct {
+	apr_uint32_t      generation;
+	apr_uint32_t      node;
+} rh_slot_t;
+
+
 struct rhash_t {
-	apr_hash_t    *apr_hash;
-	apr_pool_t    *pool;
-	apr_hash_t    *key_pointers;
+	apr_size_t        vsize;
+	rh_slot_t         *slots;
+	apr_uint32_t      nslots;
+	apr_uint32_t      used_slots; /* Including deleted ones */
+	apr_uint32_t      generation;
+	rh_node_t         *nodes;
+	char              *values;
+	apr_uint32_t      nnodes;     /* Number of nodes that have been handed out */
+	apr_uint32_t      max_nodes;
+	apr_uint32_t      live_nodes;
+	apr_uint32_t      free_nodes;
+	unsigned int      count;
+	rh_block_t        *blocks;
+	apr_size_t        name_bytes;
+	apr_size_t        garbage;    /* Bytes of names of removed nodes */
+};
+
+
+struct rhash_index_t {
+	rhash_t           *ht;
+	apr_pool_t        *pool;
+	apr_uint32_t      node;
+	char              *key;
+	apr_size_t        keysize;
 };
 
 
 /*---------------------------------------------------------------------------*/
-/* Global functions                                                          */
+/* Static functions                                                          */
 /*---------------------------------------------------------------------------*/
 
 
-/* Creates a new rhash */
-rhash_t *rhash_make(apr_pool_t *pool)
+/* Hashes a component name (FNV-1a) */
+static apr_uint32_t rh_hash(apr_uint32_t parent, const char *name, apr_size_t len)
 {
-	rhash_t *hash = apr_palloc(pool, sizeof(rhash_t));
-	hash->apr_hash = apr_hash_make(pool);
-	hash->pool = pool;
-	hash->key_pointers = apr_hash_make(pool);
+	apr_uint32_t hash = (2166136261u ^ parent) * 16777619u;
+	apr_size_t i;
 
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
 	return hash;
 }
 
 
-/* Clears and frees an rhash */
-void rhash_clear(rhash_t *ht)
+/* Frees a list of name blocks */
+static void rh_free_blocks(rh_block_t *block)
 {
-	apr_hash_index_t *hi;
-	apr_hash_t *temp = apr_hash_make(ht->pool);
+	while (block != NULL) {
+		rh_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+}
 
-	/* Save all entries into a temporary hash */
-	for (hi = apr_hash_first(ht->pool, ht->apr_hash); hi; hi = apr_hash_next(hi)) {
-		const void *key;
-		apr_ssize_t klen;
-		void *value;
-		apr_hash_this(hi, &key, &klen, &value);
-		apr_hash_set(temp, key, klen, value);
+
+/* Copies a component name into the name blocks */
+static const char *rh_store_name(rhash_t *ht, const char *name, apr_size_t len)
+{
+	rh_block_t *block = ht->blocks;
+	char *copy;
+
+	if (block == NULL || block->used + len > block->size) {
+		apr_size_t size = (len > RH_BLOCK_SIZE ? len : RH_BLOCK_SIZE);
+		block = malloc(sizeof(rh_block_t) + size);
+		block->used = 0;
+		block->size = size;
+		block->next = ht->blocks;
+		ht->blocks = block;
 	}
 
-	/* Remove all entris */
-	for (hi = apr_hash_first(ht->pool, temp); hi; hi = apr_hash_next(hi)) {
-		const void *key;
-		apr_ssize_t klen;
-		void *value;
-		apr_hash_this(hi, &key, &klen, &value);
-		rhash_set(ht, key, klen, NULL, 0);
+	copy = (char *)(block + 1) + block->used;
+	memcpy(copy, name, len);
+	block->used += len;
+	ht->name_bytes += len;
+	return copy;
+}
+
+
+/* Copies the names of all nodes into new blocks, dropping the names of
+   removed nodes */
+static void rh_compact_names(rhash_t *ht)
+{
+	rh_block_t *old = ht->blocks;
+	apr_uint32_t i;
+
+	DEBUG_MSG("rhash: compacting names (%ld of %ld bytes unused)\n", (long)ht->garbage, (long)ht->name_bytes);
+
+	ht->blocks = NULL;
+	ht->name_bytes = 0;
+	ht->garbage = 0;
+	for (i = 0; i < ht->nnodes; i++) {
+		if (ht->nodes[i].used) {
+			ht->nodes[i].name = rh_store_name(ht, ht->nodes[i].name, ht->nodes[i].len);
+		}
 	}
+	rh_free_blocks(old);
 }
 
 
-/* Wrapper for apr_hash_set */
-void rhash_set(rhash_t *ht, const void *key, apr_ssize_t klen, const void *val, apr_ssize_t vlen)
+/* Returns the child of a node with the given name, or RH_NONE */
+static apr_uint32_t rh_find(rhash_t *ht, apr_uint32_t parent, const char *name, apr_size_t len, apr_uint32_t hash)
 {
-	if (val == NULL) {
-		/* The mapping should be removed, so free both key and value memory */
-		void *key_ptr = apr_hash_get(ht->key_pointers, key, klen);
-		void *val_ptr = apr_hash_get(ht->apr_hash, key, klen);
+	apr_uint32_t mask = ht->nslots - 1;
+	apr_uint32_t i = hash & mask;
+
+	while (ht->slots[i].generation == ht->generation) {
+		apr_uint32_t n = ht->slots[i].node;
+		if (n != RH_DELETED) {
+			rh_node_t *node = &ht->nodes[n];
+			if (node->hash == hash && node->parent == parent && node->len == len && !memcmp(node->name, name, len)) {
+				return n;
+			}
+		}
+		i = (i + 1) & mask;
+	}
+	return RH_NONE;
+}
+
 
-		if (val_ptr) {
-			apr_hash_set(ht->apr_hash, key, klen, NULL);
-			free(val_ptr);
+/* Adds a node to the table */
+static void rh_insert_slot(rhash_t *ht, apr_uint32_t n)
+{
+	apr_uint32_t mask = ht->nslots - 1;
+	apr_uint32_t i = ht->nodes[n].hash & mask;
+
+	while (ht->slots[i].generation == ht->generation && ht->slots[i].node != RH_DELETED) {
+		i = (i + 1) & mask;
+	}
+	if (ht->slots[i].generation != ht->generation) {
+		++ht->used_slots;
+	}
+	ht->slots[i].generation = ht->generation;
+	ht->slots[i].node = n;
+}
+
+
+/* Removes a node from the table */
+static void rh_remove_slot(rhash_t *ht, apr_uint32_t n)
+{
+	apr_uint32_t mask = ht->nslots - 1;
+	apr_uint32_t i = ht->nodes[n].hash & mask;
+
+	while (ht->slots[i].generation == ht->generation) {
+		if (ht->slots[i].node == n) {
+			ht->slots[i].node = RH_DELETED;
+			return;
 		}
-		if (key_ptr) {
-			apr_hash_set(ht->key_pointers, key, klen, NULL);
-			free(key_ptr);
+		i = (i + 1) & mask;
+	}
+}
+
+
+/* Rebuilds the table, growing it if neccessary */
+static void rh_rehash(rhash_t *ht)
+{
+	apr_uint32_t i, size = RH_INITIAL_SLOTS;
+
+	while ((ht->live_nodes + 1) * 2 > size) {
+		size *= 2;
+	}
+
+	free(ht->slots);
+	ht->slots = calloc(size, sizeof(rh_slot_t));
+	ht->nslots = size;
+	ht->used_slots = 0;
+	ht->generation = 1;
+
+	if (ht->garbage > ht->name_bytes / 2) {
+		rh_compact_names(ht);
+	}
+	for (i = 0; i < ht->nnodes; i++) {
+		if (ht->nodes[i].used) {
+			rh_insert_slot(ht, i);
 		}
-		return;
 	}
+}
 
-	if (apr_hash_get(ht->apr_hash, key, klen) != NULL) {
-		/* Replacement: Free the old value */
-		void *val_ptr = apr_hash_get(ht->apr_hash, key, klen);
-		void *val_dup;
 
-		if (vlen == -1) {
-			DEBUG_MSG("rhash_set(): replacing %s: %s -> %s (0x%X -> 0x%X)\n", (const char *)key, (const char *)val_ptr, (const char *)val, val_ptr, val);
+/* Creates a new child node */
+static apr_uint32_t rh_create_node(rhash_t *ht, apr_uint32_t parent, const char *name, apr_size_t len, apr_uint32_t hash)
+{
+	apr_uint32_t n;
+	rh_node_t *node;
+
+	/* Keep the load factor below 3/4, counting deleted slots */
+	if ((ht->used_slots + 1) * 4 > ht->nslots * 3) {
+		rh_rehash(ht);
+	}
+
+	if (ht->free_nodes != RH_NONE) {
+		n = ht->free_nodes;
+		ht->free_nodes = ht->nodes[n].next;
+	} else {
+		if (ht->nnodes == ht->max_nodes) {
+			ht->max_nodes = (ht->max_nodes == 0 ? RH_INITIAL_SLOTS : ht->max_nodes * 2);
+			ht->nodes = realloc(ht->nodes, ht->max_nodes * sizeof(rh_node_t));
+			ht->values = realloc(ht->values, ht->max_nodes * ht->vsize);
 		}
+		n = ht->nnodes++;
+	}
 
-		if (vlen == RHASH_VAL_STRING) {
-			val_dup = strdup(val);
-		} else {
-			val_dup = malloc(vlen);
-			memcpy(val_dup, val, vlen);
+	node = &ht->nodes[n];
+	node->name = rh_store_name(ht, name, len);
+	node->len = len;
+	node->hash = hash;
+	node->parent = parent;
+	node->child = RH_NONE;
+	node->prev = RH_NONE;
+	node->next = RH_NONE;
+	node->has_value = 0;
+	node->used = 1;
+
+	if (parent != RH_NONE) {
+		node->next = ht->nodes[parent].child;
+		if (node->next != RH_NONE) {
+			ht->nodes[node->next].prev = n;
 		}
+		ht->nodes[parent].child = n;
+	}
+
+	rh_insert_slot(ht, n);
+	++ht->live_nodes;
+	return n;
+}
+
+
+/* Removes a node without children and value */
+static void rh_free_node(rhash_t *ht, apr_uint32_t n)
+{
+	rh_node_t *node = &ht->nodes[n];
+
+	rh_remove_slot(ht, n);
+	if (node->prev != RH_NONE) {
+		ht->nodes[node->prev].next = node->next;
+	} else if (node->parent != RH_NONE) {
+		ht->nodes[node->parent].child = node->next;
+	}
+	if (node->next != RH_NONE) {
+		ht->nodes[node->next].prev = node->prev;
+	}
+
+	ht->garbage += node->len;
+	node->used = 0;
+	node->next = ht->free_nodes;
+	ht->free_nodes = n;
+	--ht->live_nodes;
+}
+
+
+/* Removes a node and its parents as long as they are neither carrying a
+   value nor having any children */
+static void rh_prune(rhash_t *ht, apr_uint32_t n)
+{
+	while (n != RH_NONE && !ht->nodes[n].has_value && ht->nodes[n].child == RH_NONE) {
+		apr_uint32_t parent = ht->nodes[n].parent;
+		rh_free_node(ht, n);
+		n = parent;
+	}
+}
 
-		apr_hash_set(ht->apr_hash, key, klen, val_dup);
-		if (val_ptr && val != val_ptr) {
-			DEBUG_MSG("freeing %X\n", (void *)val_ptr);
-			free(val_ptr);
+
+/* Removes all nodes below a given one */
+static void rh_remove_children(rhash_t *ht, apr_uint32_t n, rhash_release_fn_t release)
+{
+	while (ht->nodes[n].child != RH_NONE) {
+		apr_uint32_t child = ht->nodes[n].child;
+
+		rh_remove_children(ht, child, release);
+		if (ht->nodes[child].has_value) {
+			if (release != NULL) {
+				release(ht->values + (apr_size_t)child * ht->vsize);
+			}
+			ht->nodes[child].has_value = 0;
+			--ht->count;
 		}
-	} else {
-		/* Normal insert: Duplicate both key and value */
-		void *key_dup, *val_dup;
-
-		if (klen == APR_HASH_KEY_STRING) {
-			key_dup = strdup(key);
-		} else {
-			key_dup = malloc(klen);
-			memcpy(key_dup, key, klen);
+		rh_free_node(ht, child);
+	}
+}
+
+
+/* Returns the node for a path, optionally creating it along with its
+   parents. Returns RH_NONE if the node doesn't exist */
+static apr_uint32_t rh_lookup(rhash_t *ht, const char *key, char create)
+{
+	apr_uint32_t parent = RH_NONE;
+	const char *name = key;
+
+	while (1) {
+		const char *end = strchr(name, '/');
+		apr_size_t len = (end != NULL ? (apr_size_t)(end - name) : strlen(name));
+		apr_uint32_t hash = rh_hash(parent, name, len);
+		apr_uint32_t n = rh_find(ht, parent, name, len, hash);
+
+		if (n == RH_NONE) {
+			if (!create) {
+				return RH_NONE;
+			}
+			n = rh_create_node(ht, parent, name, len, hash);
 		}
-		if (vlen == RHASH_VAL_STRING) {
-			val_dup = strdup(val);
-		} else {
-			val_dup = malloc(vlen);
-			memcpy(val_dup, val, vlen);
+		if (end == NULL) {
+			return n;
 		}
+		parent = n;
+		name = end + 1;
+	}
+}
+
 
-		if (vlen == -1) {
-			DEBUG_MSG("rhash_set(): setting %s: %s (0x%X)\n", (const char *)key, (const char *)val_dup, val_dup);
+/* Advances an iterator to the next node with a value */
+static rhash_index_t *rh_seek(rhash_index_t *hi)
+{
+	rhash_t *ht = hi->ht;
+
+	while (hi->node < ht->nnodes && !(ht->nodes[hi->node].used && ht->nodes[hi->node].has_value)) {
+		++hi->node;
+	}
+	return (hi->node < ht->nnodes ? hi : NULL);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new rhash storing values of the given size */
+rhash_t *rhash_make(apr_pool_t *pool, apr_size_t vsize)
+{
+	rhash_t *hash = apr_pcalloc(pool, sizeof(rhash_t));
+
+	hash->vsize = vsize;
+	hash->nslots = RH_INITIAL_SLOTS;
+	hash->slots = calloc(hash->nslots, sizeof(rh_slot_t));
+	hash->generation = 1;
+	hash->free_nodes = RH_NONE;
+	return hash;
+}
+
+
+/* Removes all entries from an rhash */
+void rhash_clear(rhash_t *ht)
+{
+	/* All slots become empty by starting a new generation */
+	if (++ht->generation == 0) {
+		memset(ht->slots, 0x00, ht->nslots * sizeof(rh_slot_t));
+		ht->generation = 1;
+	}
+	ht->used_slots = 0;
+	ht->nnodes = 0;
+	ht->live_nodes = 0;
+	ht->free_nodes = RH_NONE;
+	ht->count = 0;
+
+	rh_free_blocks(ht->blocks);
+	ht->blocks = NULL;
+	ht->name_bytes = 0;
+	ht->garbage = 0;
+}
+
+
+/* Frees the memory of an rhash */
+void rhash_free(rhash_t *ht)
+{
+	rhash_clear(ht);
+	free(ht->slots);
+	free(ht->nodes);
+	free(ht->values);
+	ht->slots = NULL;
+	ht->nodes = NULL;
+	ht->values = NULL;
+	ht->nslots = 0;
+	ht->max_nodes = 0;
+}
+
+
+/* Sets the value of a path. The value is copied; passing NULL removes
+   the entry */
+void rhash_set(rhash_t *ht, const char *key, const void *val)
+{
+	apr_uint32_t n;
+
+	if (val == NULL) {
+		n = rh_lookup(ht, key, 0);
+		if (n != RH_NONE && ht->nodes[n].has_value) {
+			ht->nodes[n].has_value = 0;
+			--ht->count;
+			rh_prune(ht, n);
 		}
-		
-		apr_hash_set(ht->key_pointers, key_dup, klen, key_dup);
-		apr_hash_set(ht->apr_hash, key_dup, klen, val_dup);
+		return;
+	}
+
+	n = rh_lookup(ht, key, 1);
+	memcpy(ht->values + (apr_size_t)n * ht->vsize, val, ht->vsize);
+	if (!ht->nodes[n].has_value) {
+		ht->nodes[n].has_value = 1;
+		++ht->count;
 	}
 }
 
 
-/* Wrapper for apr_hash_get */
-void *rhash_get(rhash_t *ht, const void *key, apr_ssize_t klen)
+/* Returns the value of a path or NULL. The value may be modified in
+   place, but it will move once new paths are added */
+void *rhash_get(rhash_t *ht, const char *key)
 {
-	return apr_hash_get(ht->apr_hash, key, klen);
+	apr_uint32_t n = rh_lookup(ht, key, 0);
+
+	if (n == RH_NONE || !ht->nodes[n].has_value) {
+		return NULL;
+	}
+	return ht->values + (apr_size_t)n * ht->vsize;
+}
+
+
+/* Removes all entries below a path, calling release (if not NULL) for
+   each value that is being removed. The entry of the path itself is kept */
+void rhash_remove_children(rhash_t *ht, const char *key, rhash_release_fn_t release)
+{
+	apr_uint32_t n = rh_lookup(ht, key, 0);
+
+	if (n != RH_NONE) {
+		rh_remove_children(ht, n, release);
+		rh_prune(ht, n);
+	}
 }
 
 
-/* Wrapper for apr_hash_first */
-apr_hash_index_t *rhash_first(apr_pool_t *p, rhash_t *ht)
+/* Starts iterating over an rhash. The current entry may be removed
+   while iterating, but no entries may be added */
+rhash_index_t *rhash_first(apr_pool_t *p, rhash_t *ht)
 {
-	return apr_hash_first(p, ht->apr_hash);
+	rhash_index_t *hi = apr_palloc(p, sizeof(rhash_index_t));
+
+	hi->ht = ht;
+	hi->pool = p;
+	hi->node = 0;
+	hi->key = NULL;
+	hi->keysize = 0;
+	return rh_seek(hi);
 }
 
 
-/* Wrapper for apr_hash_next */
-apr_hash_index_t *rhash_next(apr_hash_index_t *hi)
+/* Continues iterating over an rhash */
+rhash_index_t *rhash_next(rhash_index_t *hi)
 {
-	return apr_hash_next(hi);
+	++hi->node;
+	return rh_seek(hi);
 }
 
 
-/* Wrapper for apr_hash_this */
-void rhash_this(apr_hash_index_t *hi, const void **key, apr_ssize_t *klen, void **val)
+/* Returns the path and value of the current entry. The path is valid
+   until the iterator is advanced */
+void rhash_this(rhash_index_t *hi, const char **key, void **val)
 {
-	apr_hash_this(hi, key, klen, val);
+	rhash_t *ht = hi->ht;
+
+	if (key != NULL) {
+		apr_size_t len = 0, pos;
+		apr_uint32_t n;
+
+		for (n = hi->node; n != RH_NONE; n = ht->nodes[n].parent) {
+			len += ht->nodes[n].len + 1;
+		}
+		if (len > hi->keysize) {
+			hi->keysize = (len > 2 * hi->keysize ? len : 2 * hi->keysize);
+			hi->key = apr_palloc(hi->pool, hi->keysize);
+		}
+
+		/* Assemble the path from the end */
+		pos = len - 1;
+		hi->key[pos] = '\0';
+		for (n = hi->node; n != RH_NONE; n = ht->nodes[n].parent) {
+			pos -= ht->nodes[n].len;
+			memcpy(hi->key + pos, ht->nodes[n].name, ht->nodes[n].len);
+			if (pos > 0) {
+				hi->key[--pos] = '/';
+			}
+		}
+		*key = hi->key;
+	}
+	if (val != NULL) {
+		*val = ht->values + (apr_size_t)hi->node * ht->vsize;
+	}
 }
 
 
-/* Wrapper for apr_hash_count */
+/* Returns the number of entries in an rhash */
 unsigned int rhash_count(rhash_t *ht)
 {
-	return apr_hash_count(ht->apr_hash);
+	return ht->count;
 }
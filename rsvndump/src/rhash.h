@@ -17,7 +17,7 @@
  *
  *
  *      file: rhash.h
- *      desc: Interface for apr_hash_t with special memory handling
+ *      desc: Hash table for repository paths with fixed-size values
  */
 
 
@@ -25,39 +25,50 @@
 #define RHASH_H_
 
 
-#include <apr_hash.h>
 #include <apr_pools.h>
 
 
-#define RHASH_VAL_STRING APR_HASH_KEY_STRING
-
-
 typedef struct rhash_t rhash_t;
+typedef struct rhash_index_t rhash_index_t;
+
+/* Callback for values that are being removed */
+typedef void (*rhash_release_fn_t)(void *val);
 
 
-/* Creates a new rhash */
-extern rhash_t *rhash_make(apr_pool_t *pool);
+/* Creates a new rhash storing values of the given size */
+extern rhash_t *rhash_make(apr_pool_t *pool, apr_size_t vsize);
 
-/* Clears and frees an rhash */
+/* Removes all entries from an rhash */
 extern void rhash_clear(rhash_t *ht);
 
-/* Wrapper for apr_hash_set */
-extern void rhash_set(rhash_t *ht, const void *key, apr_ssize_t klen, const void *val, apr_ssize_t vlen);
+/* Frees the memory of an rhash */
+extern void rhash_free(rhash_t *ht);
+
+/* Sets the value of a path. The value is copied; passing NULL removes
+   the entry */
+extern void rhash_set(rhash_t *ht, const char *key, const void *val);
+
+/* Returns the value of a path or NULL. The value may be modified in
+   place, but it will move once new paths are added */
+extern void *rhash_get(rhash_t *ht, const char *key);
 
-/* Wrapper for apr_hash_get */
-extern void *rhash_get(rhash_t *ht, const void *key, apr_ssize_t klen);
+/* Removes all entries below a path, calling release (if not NULL) for
+   each value that is being removed. The entry of the path itself is kept */
+extern void rhash_remove_children(rhash_t *ht, const char *key, rhash_release_fn_t release);
 
-/* Wrapper for apr_hash_first */
-extern apr_hash_index_t *rhash_first(apr_pool_t *p, rhash_t *ht);
+/* Starts iterating over an rhash. The current entry may be removed
+   while iterating, but no entries may be added */
+extern rhash_index_t *rhash_first(apr_pool_t *p, rhash_t *ht);
 
-/* Wrapper for apr_hash_next */
-extern apr_hash_index_t *rhash_next(apr_hash_index_t *hi);
+/* Continues iterating over an rhash */
+extern rhash_index_t *rhash_next(rhash_index_t *hi);
 
-/* Wrapper for apr_hash_this */
-extern void rhash_this(apr_hash_index_t *hi, const void **key, apr_ssize_t *klen, void **val);
+/* Returns the path and value of the current entry. The path is valid
+   until the iterator is advanced */
+extern void rhash_this(rhash_index_t *hi, const char **key, void **val);
 
-/* Wrapper for apr_hash_count */
-unsigned int rhash_count(rhash_t *ht);
+/* Returns the number of entries in an rhash */
+extern unsigned int rhash_count(rhash_t *ht);
 
 
 #endif
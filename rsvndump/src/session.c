@@ -65,6 +65,26 @@ session_t session_create()
 }
 
 
+/* Creates a new session_t object using the settings of an existing one */
+session_t session_copy(session_t *session)
+{
+	session_t copy = session_create();
+
+	if (session->url != NULL) {
+		copy.url = apr_pstrdup(copy.pool, session->url);
+	}
+	if (session->username != NULL) {
+		copy.username = apr_pstrdup(copy.pool, session->username);
+	}
+	if (session->password != NULL) {
+		copy.password = apr_pstrdup(copy.pool, session->password);
+	}
+	copy.flags = session->flags;
+
+	return copy;
+}
+
+
 /* Frees a session_t object */
 void session_free(session_t *session)
 {
@@ -57,6 +57,9 @@ typedef struct {
 /* Creates and initializes a new session_t object */
 extern session_t session_create();
 
+/* Creates a new session_t object using the settings of an existing one */
+extern session_t session_copy(session_t *session);
+
 /* Frees a session_t object */
 extern void session_free(session_t *session);
 
@@ -0,0 +1,476 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: store.c
+ *      desc: Packed storage for file contents
+ *
+ *      If the dump output is not using deltas, a local copy of every file
+ *      in the repository is needed. Instead of using a temporary file for
+ *      each of them, the contents are appended to a few large pack files
+ *      and referenced by (pack, offset, length) entries.
+ *
+ *      Space of replaced or deleted contents is only reclaimed when
+ *      a pack file is compacted, i.e. when the entries that are still in use
+ *      are copied to a new pack file.
+ *
+ *      Every stream that is currently writing needs a pack file of its own,
+ *      so usually there's only a single one.
+ *
+ *      On Linux, entries are written to the output using sendfile(), so
+ *      the data doesn't need to be copied to user space.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#ifdef __linux__
+ #include <sys/sendfile.h>
+#endif
+
+#include <svn_pools.h>
+
+#include <apr_portable.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "main.h"
+#include "timing.h"
+#include "utils.h"
+
+#include "store.h"
+
+
+/* Minimum amount of released space before a pack file will be compacted */
+#define COMPACT_MIN_FREE (64 * 1024 * 1024)
+
+/* Buffer size used for copying entries */
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* A single pack file */
+typedef struct {
+	apr_file_t   *file;
+	const char   *path;
+	apr_off_t    size;
+	apr_off_t    released;
+	char         writing;
+} store_pack_t;
+
+
+/* Baton for reading an entry */
+typedef struct {
+	int          pack;
+	apr_file_t   *file; /* Only set for private readers */
+	apr_off_t    offset;
+	apr_off_t    remaining;
+} store_reader_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static variables                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Global pool */
+static apr_pool_t *st_pool = NULL;
+
+/* Temporary directory */
+static const char *st_temp_dir = NULL;
+
+/* Array of pack files */
+static apr_array_header_t *st_packs = NULL;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Creates a new temporary pack file that will be removed once it's closed */
+static svn_error_t *store_create_file(apr_file_t **file, const char **path)
+{
+	apr_status_t status;
+	char *filename = apr_psprintf(st_pool, "%s/XXXXXX", st_temp_dir);
+
+	status = apr_file_mktemp(file, filename, APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY | APR_BUFFERED | APR_DELONCLOSE, st_pool);
+	if (status) {
+		return utils_apr_error(status);
+	}
+	TIMING_TEMP_FILE(NULL);
+	DEBUG_MSG("store: created pack file %s\n", filename);
+	*path = filename;
+	return SVN_NO_ERROR;
+}
+
+
+/* Copies len bytes from one file position to another */
+static svn_error_t *store_copy(apr_file_t *from, apr_off_t from_offset, apr_file_t *to, apr_off_t to_offset, apr_off_t len, char *buffer)
+{
+	apr_status_t status;
+
+	while (len > 0) {
+		apr_size_t n = (len > COPY_BUFFER_SIZE ? COPY_BUFFER_SIZE : (apr_size_t)len);
+		apr_off_t offset = from_offset;
+
+		if ((status = apr_file_seek(from, APR_SET, &offset)) || (status = apr_file_read_full(from, buffer, n, &n))) {
+			return utils_apr_error(status);
+		}
+		offset = to_offset;
+		if ((status = apr_file_seek(to, APR_SET, &offset)) || (status = apr_file_write_full(to, buffer, n, &n))) {
+			return utils_apr_error(status);
+		}
+		TIMING_COUNT(TM_TEMP_BYTES, n);
+		from_offset += n;
+		to_offset += n;
+		len -= n;
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback: appends data to the pack file of an entry */
+static svn_error_t *store_write_fn(void *baton, const char *data, apr_size_t *len)
+{
+	store_entry_t *entry = (store_entry_t *)baton;
+	store_pack_t *pack = APR_ARRAY_IDX(st_packs, entry->pack, store_pack_t *);
+	apr_off_t offset = pack->size;
+	apr_status_t status;
+
+	if ((status = apr_file_seek(pack->file, APR_SET, &offset)) || (status = apr_file_write_full(pack->file, data, *len, len))) {
+		return utils_apr_error(status);
+	}
+	pack->size += *len;
+	entry->length += *len;
+	TIMING_COUNT(TM_TEMP_BYTES, *len);
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback: finishes an entry */
+static svn_error_t *store_close_writer(void *baton)
+{
+	store_entry_t *entry = (store_entry_t *)baton;
+	APR_ARRAY_IDX(st_packs, entry->pack, store_pack_t *)->writing = 0;
+	return SVN_NO_ERROR;
+}
+
+
+/* Stream callback: reads data from an entry */
+static svn_error_t *store_read_fn(void *baton, char *buffer, apr_size_t *len)
+{
+	store_reader_t *reader = (store_reader_t *)baton;
+	apr_file_t *file = reader->file;
+	apr_off_t offset = reader->offset;
+	apr_status_t status;
+
+	if ((apr_off_t)*len > reader->remaining) {
+		*len = (apr_size_t)reader->remaining;
+	}
+	if (*len == 0) {
+		return SVN_NO_ERROR;
+	}
+
+	if (file == NULL) {
+		file = APR_ARRAY_IDX(st_packs, reader->pack, store_pack_t *)->file;
+	}
+	if ((status = apr_file_seek(file, APR_SET, &offset)) || (status = apr_file_read_full(file, buffer, *len, len))) {
+		return utils_apr_error(status);
+	}
+	reader->offset += *len;
+	reader->remaining -= *len;
+	return SVN_NO_ERROR;
+}
+
+
+#ifdef __linux__
+
+/* Writes an entry to a file descriptor using sendfile(). The number of
+   bytes written is stored in done, and -1 is returned if sendfile() can't
+   be used for the given file descriptor at all */
+static int store_sendfile(const store_entry_t *entry, int fd, apr_off_t *done)
+{
+	store_pack_t *pack = APR_ARRAY_IDX(st_packs, entry->pack, store_pack_t *);
+	apr_os_file_t pack_fd;
+	off_t offset = entry->offset;
+
+	*done = 0;
+	if (apr_file_flush(pack->file) || apr_os_file_get(&pack_fd, pack->file)) {
+		return -1;
+	}
+
+	while (*done < entry->length) {
+		apr_off_t remaining = entry->length - *done;
+		ssize_t n = sendfile(fd, pack_fd, &offset, (remaining > 0x40000000 ? 0x40000000 : (size_t)remaining));
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return ((errno == EINVAL || errno == ENOSYS) ? -1 : errno);
+		} else if (n == 0) {
+			return EIO;
+		}
+		*done += n;
+	}
+	return 0;
+}
+
+#endif
+
+
+/* Stream callback: closes a private reader */
+static svn_error_t *store_close_private_reader(void *baton)
+{
+	store_reader_t *reader = (store_reader_t *)baton;
+	apr_status_t status;
+
+	if ((status = apr_file_close(reader->file))) {
+		return utils_apr_error(status);
+	}
+	return SVN_NO_ERROR;
+}
+
+
+/* Rewrites a single pack file, keeping only the entries in the given index */
+static svn_error_t *store_compact_pack(int index, rhash_t *entries, apr_pool_t *pool)
+{
+	store_pack_t *pack = APR_ARRAY_IDX(st_packs, index, store_pack_t *);
+	apr_file_t *file = NULL;
+	const char *path;
+	apr_off_t size = 0;
+	rhash_index_t *hi;
+	char *buffer = apr_palloc(pool, COPY_BUFFER_SIZE);
+	svn_error_t *err;
+
+	DEBUG_MSG("store: compacting pack %d (%ld of %ld bytes free)\n", index, (long)pack->released, (long)pack->size);
+
+	if ((err = store_create_file(&file, &path))) {
+		return err;
+	}
+
+	for (hi = rhash_first(pool, entries); hi; hi = rhash_next(hi)) {
+		store_entry_t *entry;
+		rhash_this(hi, NULL, (void **)(void *)&entry);
+		if (entry->pack != index) {
+			continue;
+		}
+		if ((err = store_copy(pack->file, entry->offset, file, size, entry->length, buffer))) {
+			apr_file_close(file);
+			TIMING_COUNT(TM_TEMP_REMOVED, 1);
+			return err;
+		}
+		entry->offset = size;
+		size += entry->length;
+	}
+
+	/* The old file will be removed on closing */
+	apr_file_close(pack->file);
+	TIMING_COUNT(TM_TEMP_REMOVED, 1);
+	pack->file = file;
+	pack->path = path;
+	pack->size = size;
+	pack->released = 0;
+	return SVN_NO_ERROR;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Opens the content store, placing the pack files in temp_dir */
+void store_open(const char *temp_dir, apr_pool_t *pool)
+{
+	st_pool = svn_pool_create(pool);
+	st_temp_dir = apr_pstrdup(st_pool, temp_dir);
+	st_packs = apr_array_make(st_pool, 1, sizeof(store_pack_t *));
+}
+
+
+/* Closes the content store and removes all pack files */
+void store_close()
+{
+	if (st_pool == NULL) {
+		return;
+	}
+	/* This closes (and thus removes) the pack files, too */
+	TIMING_COUNT(TM_TEMP_REMOVED, st_packs->nelts);
+	svn_pool_destroy(st_pool);
+	st_pool = NULL;
+	st_packs = NULL;
+}
+
+
+/* Creates a stream for writing a new entry. The entry is complete once
+   the stream has been closed */
+svn_error_t *store_write_stream(svn_stream_t **stream, store_entry_t *entry, apr_pool_t *pool)
+{
+	store_pack_t *pack = NULL;
+	int i;
+
+	/* Use the first pack file that isn't being written to */
+	for (i = 0; i < st_packs->nelts; i++) {
+		if (!APR_ARRAY_IDX(st_packs, i, store_pack_t *)->writing) {
+			pack = APR_ARRAY_IDX(st_packs, i, store_pack_t *);
+			break;
+		}
+	}
+	if (pack == NULL) {
+		svn_error_t *err;
+		pack = apr_pcalloc(st_pool, sizeof(store_pack_t));
+		if ((err = store_create_file(&pack->file, &pack->path))) {
+			return err;
+		}
+		APR_ARRAY_PUSH(st_packs, store_pack_t *) = pack;
+	}
+
+	pack->writing = 1;
+	entry->pack = i;
+	entry->offset = pack->size;
+	entry->length = 0;
+
+	*stream = svn_stream_create(entry, pool);
+	svn_stream_set_write(*stream, store_write_fn);
+	svn_stream_set_close(*stream, store_close_writer);
+	return SVN_NO_ERROR;
+}
+
+
+/* Creates a stream for reading an entry */
+svn_stream_t *store_read_stream(const store_entry_t *entry, apr_pool_t *pool)
+{
+	svn_stream_t *stream;
+	store_reader_t *reader = apr_palloc(pool, sizeof(store_reader_t));
+	reader->pack = entry->pack;
+	reader->file = NULL;
+	reader->offset = entry->offset;
+	reader->remaining = entry->length;
+
+	stream = svn_stream_create(reader, pool);
+	svn_stream_set_read(stream, store_read_fn);
+	return stream;
+}
+
+
+/* Returns the path of the pack file containing an entry. Pending writes
+   are flushed, so the entry can be read using store_read_stream_private() */
+const char *store_pack_file(const store_entry_t *entry)
+{
+	store_pack_t *pack = APR_ARRAY_IDX(st_packs, entry->pack, store_pack_t *);
+	apr_file_flush(pack->file);
+	return pack->path;
+}
+
+
+/* Creates a stream for reading an entry using a file handle of its own.
+   Unlike the other functions, this may be used by other threads, as long
+   as the pack file isn't compacted */
+svn_error_t *store_read_stream_private(svn_stream_t **stream, const char *pack_file, const store_entry_t *entry, apr_pool_t *pool)
+{
+	apr_status_t status;
+	store_reader_t *reader = apr_palloc(pool, sizeof(store_reader_t));
+
+	if ((status = apr_file_open(&reader->file, pack_file, APR_READ | APR_BINARY | APR_BUFFERED, APR_OS_DEFAULT, pool))) {
+		return utils_apr_error(status);
+	}
+	reader->pack = entry->pack;
+	reader->offset = entry->offset;
+	reader->remaining = entry->length;
+
+	*stream = svn_stream_create(reader, pool);
+	svn_stream_set_read(*stream, store_read_fn);
+	svn_stream_set_close(*stream, store_close_private_reader);
+	return SVN_NO_ERROR;
+}
+
+
+/* Writes the contents of an entry to the given output. Pending output
+   is flushed before */
+svn_error_t *store_dump(const store_entry_t *entry, FILE *out, apr_pool_t *pool)
+{
+	store_entry_t rest = *entry;
+	svn_stream_t *stream;
+	char *buffer;
+	apr_size_t len;
+
+	fflush(out);
+
+#ifdef __linux__
+	{
+		apr_off_t done;
+		int status = store_sendfile(entry, fileno(out), &done);
+		if (status > 0) {
+			return utils_apr_error(status);
+		} else if (status == 0) {
+			return SVN_NO_ERROR;
+		}
+
+		/* Copy the rest manually */
+		rest.offset += done;
+		rest.length -= done;
+	}
+#endif
+
+	buffer = apr_palloc(pool, COPY_BUFFER_SIZE);
+	stream = store_read_stream(&rest, pool);
+	do {
+		len = COPY_BUFFER_SIZE;
+		SVN_ERR(svn_stream_read(stream, buffer, &len));
+		if (len > 0 && fwrite(buffer, 1, len, out) != len) {
+			return utils_apr_error(errno);
+		}
+	} while (len > 0);
+	return SVN_NO_ERROR;
+}
+
+
+/* Marks the space occupied by an entry as free */
+void store_release(const store_entry_t *entry)
+{
+	APR_ARRAY_IDX(st_packs, entry->pack, store_pack_t *)->released += entry->length;
+}
+
+
+/* Rewrites pack files that consist mostly of released space. The index
+   must map to all entries that are still in use */
+svn_error_t *store_compact(rhash_t *index, apr_pool_t *pool)
+{
+	int i;
+	svn_error_t *err;
+	apr_pool_t *compact_pool = svn_pool_create(pool);
+
+	for (i = 0; i < st_packs->nelts; i++) {
+		store_pack_t *pack = APR_ARRAY_IDX(st_packs, i, store_pack_t *);
+		if (pack->writing || pack->released < COMPACT_MIN_FREE || pack->released < pack->size / 2) {
+			continue;
+		}
+		if ((err = store_compact_pack(i, index, compact_pool))) {
+			svn_pool_destroy(compact_pool);
+			return err;
+		}
+		svn_pool_clear(compact_pool);
+	}
+
+	svn_pool_destroy(compact_pool);
+	return SVN_NO_ERROR;
+}
@@ -0,0 +1,79 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: store.h
+ *      desc: Packed storage for file contents
+ */
+
+
+#ifndef STORE_H_
+#define STORE_H_
+
+
+#include <stdio.h>
+
+#include <svn_io.h>
+
+#include <apr_file_io.h>
+
+#include "rhash.h"
+
+
+/* Location of a stored file content */
+typedef struct {
+	int          pack;
+	apr_off_t    offset;
+	apr_off_t    length;
+} store_entry_t;
+
+
+/* Opens the content store, placing the pack files in temp_dir */
+extern void store_open(const char *temp_dir, apr_pool_t *pool);
+
+/* Closes the content store and removes all pack files */
+extern void store_close();
+
+/* Creates a stream for writing a new entry. The entry is complete once
+   the stream has been closed */
+extern svn_error_t *store_write_stream(svn_stream_t **stream, store_entry_t *entry, apr_pool_t *pool);
+
+/* Creates a stream for reading an entry */
+extern svn_stream_t *store_read_stream(const store_entry_t *entry, apr_pool_t *pool);
+
+/* Returns the path of the pack file containing an entry. Pending writes
+   are flushed, so the entry can be read using store_read_stream_private() */
+extern const char *store_pack_file(const store_entry_t *entry);
+
+/* Creates a stream for reading an entry using a file handle of its own.
+   Unlike the other functions, this may be used by other threads, as long
+   as the pack file isn't compacted */
+extern svn_error_t *store_read_stream_private(svn_stream_t **stream, const char *pack_file, const store_entry_t *entry, apr_pool_t *pool);
+
+/* Writes the contents of an entry to the given output. Pending output
+   is flushed before */
+extern svn_error_t *store_dump(const store_entry_t *entry, FILE *out, apr_pool_t *pool);
+
+/* Marks the space occupied by an entry as free */
+extern void store_release(const store_entry_t *entry);
+
+/* Rewrites pack files that consist mostly of released space. The index
+   must map to all entries that are still in use */
+extern svn_error_t *store_compact(rhash_t *index, apr_pool_t *pool);
+
+
+#endif
@@ -0,0 +1,544 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: timing.c
+ *      desc: Collection of timing information and statistics
+ *
+ *      Timers record the number and the total duration of RA calls and
+ *      delta editor callbacks, along with a latency histogram. Since the
+ *      editor is driven from within the diff and replay calls, their
+ *      durations include the editor time. Calls of worker threads are
+ *      attributed to the revision during which they complete.
+ *
+ *      A line of JSON is written for every dumped revision, containing the
+ *      statistics that have been collected since the previous one. The
+ *      final line contains the totals and the histograms. Bucket i of a
+ *      histogram counts durations below TM_BUCKET_BASE << i microseconds,
+ *      except for the last bucket, which counts all remaining ones.
+ */
+
+
+#include <stdio.h>
+
+#include <svn_delta.h>
+#include <svn_pools.h>
+
+#if APR_HAS_THREADS
+ #include <apr_thread_mutex.h>
+#endif
+
+#include "main.h"
+
+#include "timing.h"
+
+
+#ifdef USE_TIMING
+
+
+/* Number of histogram buckets and upper bound of the first one (usecs) */
+#define TM_BUCKETS 16
+#define TM_BUCKET_BASE 256
+
+
+/*---------------------------------------------------------------------------*/
+/* Local data structures                                                     */
+/*---------------------------------------------------------------------------*/
+
+
+/* Accumulated durations of a timer */
+typedef struct {
+	apr_int64_t calls;
+	apr_time_t  time;
+} tm_timer_t;
+
+
+/* Baton of the timing editor, wrapping a baton of the actual editor */
+typedef struct {
+	const svn_delta_editor_t *editor;
+	void                     *baton;
+} tm_baton_t;
+
+
+/* Baton of a wrapped window handler */
+typedef struct {
+	svn_txdelta_window_handler_t handler;
+	void                         *baton;
+} tm_window_baton_t;
+
+
+/*---------------------------------------------------------------------------*/
+/* Static variables                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+static apr_pool_t *tm_pool = NULL;
+static FILE *tm_out = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *tm_mutex = NULL;
+#endif
+
+static apr_time_t tm_start_time, tm_rev_time;
+static tm_timer_t tm_rev_timers[TM_NUM_TIMERS], tm_total_timers[TM_NUM_TIMERS];
+static apr_int64_t tm_rev_counters[TM_NUM_COUNTERS], tm_total_counters[TM_NUM_COUNTERS];
+static apr_int64_t tm_histograms[TM_NUM_TIMERS][TM_BUCKETS];
+
+/* Names used in the output */
+static const char *tm_timer_names[TM_NUM_TIMERS] = {
+	"diff", "replay", "log", "get_dir", "get_file", "stat", "check_path",
+	"open_root", "delete_entry", "add_directory", "open_directory",
+	"change_dir_prop", "close_directory", "add_file", "open_file",
+	"apply_textdelta", "delta_window", "change_file_prop", "close_file",
+	"close_edit"
+};
+static const char *tm_counter_names[TM_NUM_COUNTERS] = {
+	"temp_created", "temp_removed", "temp_bytes",
+	"path_hash_reconstruct", "path_hash_reconstruct_file",
+	"path_hash_index_hit", "path_hash_index_miss", "output_bytes"
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Static functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Locks the statistics */
+static void tm_lock()
+{
+#if APR_HAS_THREADS
+	apr_thread_mutex_lock(tm_mutex);
+#endif
+}
+
+
+/* Unlocks the statistics */
+static void tm_unlock()
+{
+#if APR_HAS_THREADS
+	apr_thread_mutex_unlock(tm_mutex);
+#endif
+}
+
+
+/* Pool cleanup function counting the removal of a temporary file */
+static apr_status_t tm_temp_removed(void *data)
+{
+	timing_count(TM_TEMP_REMOVED, 1);
+	return APR_SUCCESS;
+}
+
+
+/* Writes timers and counters as JSON objects */
+static void tm_write_stats(tm_timer_t *timers, apr_int64_t *counters, char histograms)
+{
+	int i, j;
+	const char *sep = "";
+
+	fprintf(tm_out, "\"timers\":{");
+	for (i = 0; i < TM_NUM_TIMERS; i++) {
+		if (timers[i].calls == 0) {
+			continue;
+		}
+		fprintf(tm_out, "%s\"%s\":{\"calls\":%" APR_INT64_T_FMT ",\"seconds\":%.6f", sep, tm_timer_names[i], timers[i].calls, (double)timers[i].time / APR_USEC_PER_SEC);
+		if (histograms) {
+			fprintf(tm_out, ",\"histogram\":[");
+			for (j = 0; j < TM_BUCKETS; j++) {
+				fprintf(tm_out, "%s%" APR_INT64_T_FMT, (j ? "," : ""), tm_histograms[i][j]);
+			}
+			fprintf(tm_out, "]");
+		}
+		fprintf(tm_out, "}");
+		sep = ",";
+	}
+	fprintf(tm_out, "},\"counters\":{");
+	for (i = 0; i < TM_NUM_COUNTERS; i++) {
+		fprintf(tm_out, "%s\"%s\":%" APR_INT64_T_FMT, (i ? "," : ""), tm_counter_names[i], counters[i]);
+	}
+	fprintf(tm_out, "}");
+}
+
+
+/* Returns a new baton for the timing editor */
+static tm_baton_t *tm_wrap(const svn_delta_editor_t *editor, void *baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = apr_palloc(pool, sizeof(tm_baton_t));
+	b->editor = editor;
+	b->baton = baton;
+	return b;
+}
+
+
+/* Timing window handler */
+static svn_error_t *tm_window_handler(svn_txdelta_window_t *window, void *baton)
+{
+	tm_window_baton_t *b = (tm_window_baton_t *)baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_DELTA_WINDOW, err = b->handler(window, b->baton));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_set_target_revision(void *edit_baton, svn_revnum_t target_revision, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)edit_baton;
+	return b->editor->set_target_revision(b->baton, target_revision, pool);
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_open_root(void *edit_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **root_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)edit_baton;
+	svn_error_t *err;
+	void *baton = NULL;
+
+	TIMING_CALL(TM_ED_OPEN_ROOT, err = b->editor->open_root(b->baton, base_revision, dir_pool, &baton));
+	*root_baton = tm_wrap(b->editor, baton, dir_pool);
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_delete_entry(const char *path, svn_revnum_t revision, void *parent_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_DELETE_ENTRY, err = b->editor->delete_entry(path, revision, b->baton, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_add_directory(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_rev, apr_pool_t *dir_pool, void **child_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	svn_error_t *err;
+	void *baton = NULL;
+
+	TIMING_CALL(TM_ED_ADD_DIRECTORY, err = b->editor->add_directory(path, b->baton, copyfrom_path, copyfrom_rev, dir_pool, &baton));
+	*child_baton = tm_wrap(b->editor, baton, dir_pool);
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_open_directory(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *dir_pool, void **child_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	svn_error_t *err;
+	void *baton = NULL;
+
+	TIMING_CALL(TM_ED_OPEN_DIRECTORY, err = b->editor->open_directory(path, b->baton, base_revision, dir_pool, &baton));
+	*child_baton = tm_wrap(b->editor, baton, dir_pool);
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_change_dir_prop(void *dir_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)dir_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_CHANGE_DIR_PROP, err = b->editor->change_dir_prop(b->baton, name, value, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_close_directory(void *dir_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)dir_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_CLOSE_DIRECTORY, err = b->editor->close_directory(b->baton, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_absent_directory(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	return b->editor->absent_directory(path, b->baton, pool);
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_add_file(const char *path, void *parent_baton, const char *copyfrom_path, svn_revnum_t copyfrom_rev, apr_pool_t *file_pool, void **file_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	svn_error_t *err;
+	void *baton = NULL;
+
+	TIMING_CALL(TM_ED_ADD_FILE, err = b->editor->add_file(path, b->baton, copyfrom_path, copyfrom_rev, file_pool, &baton));
+	*file_baton = tm_wrap(b->editor, baton, file_pool);
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_open_file(const char *path, void *parent_baton, svn_revnum_t base_revision, apr_pool_t *file_pool, void **file_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	svn_error_t *err;
+	void *baton = NULL;
+
+	TIMING_CALL(TM_ED_OPEN_FILE, err = b->editor->open_file(path, b->baton, base_revision, file_pool, &baton));
+	*file_baton = tm_wrap(b->editor, baton, file_pool);
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_apply_textdelta(void *file_baton, const char *base_checksum, apr_pool_t *pool, svn_txdelta_window_handler_t *handler, void **handler_baton)
+{
+	tm_baton_t *b = (tm_baton_t *)file_baton;
+	tm_window_baton_t *wb = apr_palloc(pool, sizeof(tm_window_baton_t));
+	svn_error_t *err;
+
+	wb->handler = NULL;
+	wb->baton = NULL;
+	TIMING_CALL(TM_ED_APPLY_TEXTDELTA, err = b->editor->apply_textdelta(b->baton, base_checksum, pool, &wb->handler, &wb->baton));
+	if (err || wb->handler == NULL) {
+		*handler = wb->handler;
+		*handler_baton = wb->baton;
+		return err;
+	}
+	*handler = tm_window_handler;
+	*handler_baton = wb;
+	return SVN_NO_ERROR;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_change_file_prop(void *file_baton, const char *name, const svn_string_t *value, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)file_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_CHANGE_FILE_PROP, err = b->editor->change_file_prop(b->baton, name, value, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_close_file(void *file_baton, const char *text_checksum, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)file_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_CLOSE_FILE, err = b->editor->close_file(b->baton, text_checksum, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_absent_file(const char *path, void *parent_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)parent_baton;
+	return b->editor->absent_file(path, b->baton, pool);
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_close_edit(void *edit_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)edit_baton;
+	svn_error_t *err;
+
+	TIMING_CALL(TM_ED_CLOSE_EDIT, err = b->editor->close_edit(b->baton, pool));
+	return err;
+}
+
+
+/* Timing editor callback */
+static svn_error_t *tm_abort_edit(void *edit_baton, apr_pool_t *pool)
+{
+	tm_baton_t *b = (tm_baton_t *)edit_baton;
+	return b->editor->abort_edit(b->baton, pool);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Global functions                                                          */
+/*---------------------------------------------------------------------------*/
+
+
+/* Starts collecting statistics, which will be written to the given file
+   (or to stderr if path is NULL). Returns 1 if the file can't be opened */
+char timing_initialize(const char *path, apr_pool_t *pool)
+{
+	if (path != NULL) {
+		if ((tm_out = fopen(path, "w")) == NULL) {
+			fprintf(stderr, _("ERROR: Unable to open timing log %s\n"), path);
+			return 1;
+		}
+	} else {
+		tm_out = stderr;
+	}
+
+	tm_pool = svn_pool_create(pool);
+#if APR_HAS_THREADS
+	if (apr_thread_mutex_create(&tm_mutex, APR_THREAD_MUTEX_DEFAULT, tm_pool)) {
+		fprintf(stderr, _("ERROR: Unable to create mutex\n"));
+		svn_pool_destroy(tm_pool);
+		tm_pool = NULL;
+		return 1;
+	}
+#endif
+
+	memset(tm_rev_timers, 0, sizeof(tm_rev_timers));
+	memset(tm_total_timers, 0, sizeof(tm_total_timers));
+	memset(tm_rev_counters, 0, sizeof(tm_rev_counters));
+	memset(tm_total_counters, 0, sizeof(tm_total_counters));
+	memset(tm_histograms, 0, sizeof(tm_histograms));
+	tm_start_time = tm_rev_time = apr_time_now();
+	return 0;
+}
+
+
+/* Adds the time passed since start to the given timer */
+void timing_add(timing_timer_t timer, apr_time_t start)
+{
+	apr_time_t d = apr_time_now() - start;
+	int bucket = 0;
+
+	if (tm_pool == NULL) {
+		return;
+	}
+	while (bucket < TM_BUCKETS-1 && d >= ((apr_time_t)TM_BUCKET_BASE << bucket)) {
+		++bucket;
+	}
+
+	tm_lock();
+	++tm_rev_timers[timer].calls;
+	tm_rev_timers[timer].time += d;
+	++tm_total_timers[timer].calls;
+	tm_total_timers[timer].time += d;
+	++tm_histograms[timer][bucket];
+	tm_unlock();
+}
+
+
+/* Adds a value to the given counter */
+void timing_count(timing_counter_t counter, apr_int64_t value)
+{
+	if (tm_pool == NULL) {
+		return;
+	}
+	tm_lock();
+	tm_rev_counters[counter] += value;
+	tm_total_counters[counter] += value;
+	tm_unlock();
+}
+
+
+/* Counts a new temporary file that will be removed once pool is
+   destroyed. If pool is NULL, the removal needs to be counted manually */
+void timing_temp_file(apr_pool_t *pool)
+{
+	timing_count(TM_TEMP_CREATED, 1);
+	if (pool != NULL) {
+		apr_pool_cleanup_register(pool, NULL, tm_temp_removed, apr_pool_cleanup_null);
+	}
+}
+
+
+/* Wraps a delta editor, timing all of its callbacks */
+void timing_wrap_editor(svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool)
+{
+	svn_delta_editor_t *e;
+
+	if (tm_pool == NULL) {
+		return;
+	}
+
+	e = svn_delta_default_editor(pool);
+	e->set_target_revision = tm_set_target_revision;
+	e->open_root = tm_open_root;
+	e->delete_entry = tm_delete_entry;
+	e->add_directory = tm_add_directory;
+	e->open_directory = tm_open_directory;
+	e->change_dir_prop = tm_change_dir_prop;
+	e->close_directory = tm_close_directory;
+	e->absent_directory = tm_absent_directory;
+	e->add_file = tm_add_file;
+	e->open_file = tm_open_file;
+	e->apply_textdelta = tm_apply_textdelta;
+	e->change_file_prop = tm_change_file_prop;
+	e->close_file = tm_close_file;
+	e->absent_file = tm_absent_file;
+	e->close_edit = tm_close_edit;
+	e->abort_edit = tm_abort_edit;
+
+	*edit_baton = tm_wrap(*editor, *edit_baton, pool);
+	*editor = e;
+}
+
+
+/* Writes the statistics of a revision that has been dumped */
+void timing_revision(svn_revnum_t revnum)
+{
+	apr_time_t now = apr_time_now();
+
+	if (tm_pool == NULL) {
+		return;
+	}
+
+	tm_lock();
+	fprintf(tm_out, "{\"revision\":%ld,\"seconds\":%.6f,", revnum, (double)(now - tm_rev_time) / APR_USEC_PER_SEC);
+	tm_write_stats(tm_rev_timers, tm_rev_counters, 0);
+	fprintf(tm_out, "}\n");
+	memset(tm_rev_timers, 0, sizeof(tm_rev_timers));
+	memset(tm_rev_counters, 0, sizeof(tm_rev_counters));
+	tm_rev_time = now;
+	tm_unlock();
+}
+
+
+/* Writes the totals and latency histograms and stops collecting */
+void timing_finish()
+{
+	int i;
+
+	if (tm_pool == NULL) {
+		return;
+	}
+
+	fprintf(tm_out, "{\"total\":true,\"seconds\":%.6f,\"buckets_usec\":[", (double)(apr_time_now() - tm_start_time) / APR_USEC_PER_SEC);
+	for (i = 0; i < TM_BUCKETS-1; i++) {
+		fprintf(tm_out, "%s%d", (i ? "," : ""), TM_BUCKET_BASE << i);
+	}
+	fprintf(tm_out, "],");
+	tm_write_stats(tm_total_timers, tm_total_counters, 1);
+	fprintf(tm_out, "}\n");
+
+	if (tm_out != stderr) {
+		fclose(tm_out);
+	}
+	tm_out = NULL;
+	svn_pool_destroy(tm_pool);
+	tm_pool = NULL;
+}
+
+
+#endif /* USE_TIMING */
@@ -0,0 +1,121 @@
+/*
+ *      rsvndump - remote svn repository dump
+ *      Copyright (C) 2008-2010 Jonas Gehring
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *      file: timing.h
+ *      desc: Collection of timing information and statistics
+ */
+
+
+#ifndef TIMING_H_
+#define TIMING_H_
+
+
+#include <svn_delta.h>
+#include <svn_types.h>
+
+#include <apr_pools.h>
+#include <apr_time.h>
+
+#include "main.h"
+
+
+/* Timed operations */
+typedef enum {
+	/* RA calls */
+	TM_RA_DIFF = 0,
+	TM_RA_REPLAY,
+	TM_RA_LOG,
+	TM_RA_GET_DIR,
+	TM_RA_GET_FILE,
+	TM_RA_STAT,
+	TM_RA_CHECK_PATH,
+
+	/* Delta editor callbacks */
+	TM_ED_OPEN_ROOT,
+	TM_ED_DELETE_ENTRY,
+	TM_ED_ADD_DIRECTORY,
+	TM_ED_OPEN_DIRECTORY,
+	TM_ED_CHANGE_DIR_PROP,
+	TM_ED_CLOSE_DIRECTORY,
+	TM_ED_ADD_FILE,
+	TM_ED_OPEN_FILE,
+	TM_ED_APPLY_TEXTDELTA,
+	TM_ED_DELTA_WINDOW,
+	TM_ED_CHANGE_FILE_PROP,
+	TM_ED_CLOSE_FILE,
+	TM_ED_CLOSE_EDIT,
+
+	TM_NUM_TIMERS
+} timing_timer_t;
+
+
+/* Counted events */
+typedef enum {
+	TM_TEMP_CREATED = 0,
+	TM_TEMP_REMOVED,
+	TM_TEMP_BYTES,         /* Bytes written to temporary files */
+	TM_PH_RECONSTRUCT,     /* Trees reconstructed from memory */
+	TM_PH_RECONSTRUCT_FILE,/* Trees reconstructed from history files */
+	TM_PH_INDEX_HIT,       /* Parent checks answered by the index */
+	TM_PH_INDEX_MISS,
+	TM_OUTPUT_BYTES,       /* Property and text contents written to the dump */
+
+	TM_NUM_COUNTERS
+} timing_counter_t;
+
+
+#ifdef USE_TIMING
+
+/* Starts collecting statistics, which will be written to the given file
+   (or to stderr if path is NULL). Returns 1 if the file can't be opened */
+extern char timing_initialize(const char *path, apr_pool_t *pool);
+
+/* Adds the time passed since start to the given timer */
+extern void timing_add(timing_timer_t timer, apr_time_t start);
+
+/* Adds a value to the given counter */
+extern void timing_count(timing_counter_t counter, apr_int64_t value);
+
+/* Counts a new temporary file that will be removed once pool is
+   destroyed. If pool is NULL, the removal needs to be counted manually */
+extern void timing_temp_file(apr_pool_t *pool);
+
+/* Wraps a delta editor, timing all of its callbacks */
+extern void timing_wrap_editor(svn_delta_editor_t **editor, void **edit_baton, apr_pool_t *pool);
+
+/* Writes the statistics of a revision that has been dumped */
+extern void timing_revision(svn_revnum_t revnum);
+
+/* Writes the totals and latency histograms and stops collecting */
+extern void timing_finish();
+
+/* Runs a statement and adds its duration to the given timer */
+#define TIMING_CALL(timer, stmt) do { apr_time_t tm_start_ = apr_time_now(); stmt; timing_add((timer), tm_start_); } while (0)
+#define TIMING_COUNT(counter, value) timing_count((counter), (value))
+#define TIMING_TEMP_FILE(pool) timing_temp_file(pool)
+
+#else /* USE_TIMING */
+
+#define TIMING_CALL(timer, stmt) stmt
+#define TIMING_COUNT(counter, value)
+#define TIMING_TEMP_FILE(pool)
+
+#endif /* USE_TIMING */
+
+
+#endif
@@ -197,6 +197,14 @@ void utils_handle_error(svn_error_t *error, FILE *stream, svn_boolean_t fatal, c
 }
 
 
+/* Converts an APR status code to an svn_error_t */
+svn_error_t *utils_apr_error(apr_status_t status)
+{
+	char errbuf[512];
+	return svn_error_create(status, NULL, apr_strerror(status, errbuf, sizeof(errbuf)));
+}
+
+
 /* Reads a single line from a file, allocating it in pool */
 char *utils_file_readln(struct apr_pool_t *pool, struct apr_file_t *file)
 {
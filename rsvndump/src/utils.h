@@ -44,6 +44,9 @@ extern float stopwatch_elapsed(stopwatch_t *watch);
 
 #endif /* USE_TIMING */
 
+/* Converts an APR status code to an svn_error_t */
+extern svn_error_t *utils_apr_error(apr_status_t status);
+
 /* Returns a canonicalized path that has been allocated using strdup() */
 extern char *utils_canonicalize_pstrdup(struct apr_pool_t *pool, char *path);
 
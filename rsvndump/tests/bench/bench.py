@@ -0,0 +1,432 @@
+#!/usr/bin/env python
+#
+#	Performance benchmarks for rsvndump
+#
+#	Synthetic repositories are generated as dumpfiles and loaded with
+#	svnadmin. rsvndump is then run against them in different
+#	configurations, and the results are appended to a JSON history file.
+#
+
+
+import hashlib, json, os, random, shutil, signal, socket, subprocess, time
+from optparse import OptionParser
+
+
+# Globals
+repo_dir = "repos"
+work_dir = "work"
+default_history = "history.json"
+default_rsvndump = "../../src/rsvndump"
+configs = ["plain", "deltas", "incremental"]
+
+
+# Runs a external program
+def run(*args, **misc):
+	redirections = {}
+	input = misc.pop("input", None)
+	output = misc.pop("output", None)
+	if input:
+		redirections['stdin'] = open(input, "rb")
+	if output:
+		redirections['stdout'] = open(output, "w")
+	subprocess.check_call(args, **redirections)
+
+
+#
+# Repository generation
+#
+
+# Repository parameters and their defaults
+repo_params = [
+	("revisions", 200, "number of revisions"),
+	("width", 8, "number of directories and files per directory"),
+	("changes", 4, "number of files changed per revision"),
+	("copies", 2, "number of branches copied from trunk"),
+	("tags", 4, "number of tags copied from trunk"),
+	("binary_size", 65536, "size of the binary file in each directory"),
+	("prop_churn", 0.2, "fraction of revisions that change properties"),
+	("seed", 1, "random seed")
+]
+
+
+# Writes a property block
+def props_block(props):
+	data = b""
+	for key in sorted(props.keys()):
+		value = props[key]
+		data += ("K %d\n" % len(key)).encode("ascii") + key.encode("ascii") + b"\n"
+		data += ("V %d\n" % len(value)).encode("ascii") + value + b"\n"
+	return data + b"PROPS-END\n"
+
+
+# Writes a revision record
+def dump_revision(f, rev, msg):
+	props = props_block({
+		"svn:log": msg.encode("ascii"),
+		"svn:author": b"bench",
+		"svn:date": ("2010-01-01T00:%02d:%02d.000000Z" % ((rev // 60) % 60, rev % 60)).encode("ascii")
+	})
+	f.write(("Revision-number: %d\n" % rev).encode("ascii"))
+	f.write(("Prop-content-length: %d\n" % len(props)).encode("ascii"))
+	f.write(("Content-length: %d\n\n" % len(props)).encode("ascii"))
+	f.write(props + b"\n")
+
+
+# Writes a node record
+def dump_node(f, path, kind, action, text = None, props = None, copyfrom = None):
+	f.write(("Node-path: %s\n" % path).encode("ascii"))
+	if kind:
+		f.write(("Node-kind: %s\n" % kind).encode("ascii"))
+	f.write(("Node-action: %s\n" % action).encode("ascii"))
+	if copyfrom:
+		f.write(("Node-copyfrom-rev: %d\n" % copyfrom[1]).encode("ascii"))
+		f.write(("Node-copyfrom-path: %s\n" % copyfrom[0]).encode("ascii"))
+	length = 0
+	pdata = None
+	if props is not None:
+		pdata = props_block(props)
+		f.write(("Prop-content-length: %d\n" % len(pdata)).encode("ascii"))
+		length += len(pdata)
+	if text is not None:
+		f.write(("Text-content-length: %d\n" % len(text)).encode("ascii"))
+		f.write(("Text-content-md5: %s\n" % hashlib.md5(text).hexdigest()).encode("ascii"))
+		length += len(text)
+	if props is not None or text is not None:
+		f.write(("Content-length: %d\n" % length).encode("ascii"))
+	f.write(b"\n")
+	if pdata is not None:
+		f.write(pdata)
+	if text is not None:
+		f.write(text)
+	f.write(b"\n\n")
+
+
+# Returns random binary data
+def random_bytes(rnd, size):
+	return bytes(bytearray(rnd.getrandbits(8) for i in range(size)))
+
+
+# Generates a dumpfile for the given parameters
+def generate_dump(path, params):
+	rnd = random.Random(params["seed"])
+	width = params["width"]
+	revisions = params["revisions"]
+	files = {}	# Path -> contents
+	props = {}	# Path -> properties
+	branches = ["trunk"]
+
+	f = open(path, "wb")
+	f.write(b"SVN-fs-dump-format-version: 2\n\n")
+
+	# Initial layout
+	dump_revision(f, 1, "initial layout")
+	for d in ["trunk", "branches", "tags"]:
+		dump_node(f, d, "dir", "add", props = {})
+	for i in range(width):
+		d = "trunk/d%d" % i
+		dump_node(f, d, "dir", "add", props = {})
+		for j in range(width):
+			p = "%s/f%d.txt" % (d, j)
+			files[p] = ("%s line 0\n" % p).encode("ascii")
+			props[p] = {}
+			dump_node(f, p, "file", "add", text = files[p], props = props[p])
+		if params["binary_size"] > 0:
+			p = "%s/data.bin" % d
+			files[p] = random_bytes(rnd, params["binary_size"])
+			props[p] = {"svn:mime-type": b"application/octet-stream"}
+			dump_node(f, p, "file", "add", text = files[p], props = props[p])
+
+	# Revisions in which branches and tags are created
+	copy_revs = {}
+	for i in range(params["copies"]):
+		copy_revs[2 + (i + 1) * (revisions - 2) // (params["copies"] + 1)] = ("branches", "b%d" % i)
+	for i in range(params["tags"]):
+		copy_revs.setdefault(3 + (i + 1) * (revisions - 3) // (params["tags"] + 1), ("tags", "t%d" % i))
+
+	for rev in range(2, revisions + 1):
+		if rev in copy_revs:
+			base, name = copy_revs[rev]
+			dest = base + "/" + name
+			dump_revision(f, rev, "create " + dest)
+			dump_node(f, dest, "dir", "add", copyfrom = ("trunk", rev - 1))
+			for p in [p for p in files if p.startswith("trunk/")]:
+				files[dest + p[5:]] = files[p]
+				props[dest + p[5:]] = dict(props[p])
+			if base == "branches":
+				branches.append(dest)
+			continue
+
+		dump_revision(f, rev, "change %d" % rev)
+		branch = rnd.choice(branches)
+		candidates = sorted([p for p in files if p.startswith(branch + "/")])
+		for p in rnd.sample(candidates, min(params["changes"], len(candidates))):
+			if p.endswith(".bin"):
+				# Patch a small chunk of the binary file
+				data = files[p]
+				pos = rnd.randrange(len(data))
+				files[p] = data[:pos] + random_bytes(rnd, min(64, len(data) - pos)) + data[pos + 64:]
+			else:
+				files[p] += ("%s line %d\n" % (p, rev)).encode("ascii")
+			nprops = None
+			if rnd.random() < params["prop_churn"]:
+				props[p]["bench:rev"] = str(rev).encode("ascii")
+				nprops = props[p]
+			dump_node(f, p, "file", "change", text = files[p], props = nprops)
+
+	f.close()
+
+
+# Returns the path of a repository for the given parameters, generating
+# it if neccessary
+def setup_repos(params):
+	key = hashlib.sha1(json.dumps(params, sort_keys = True).encode("ascii")).hexdigest()[:12]
+	repos = os.path.abspath(repo_dir + "/" + key)
+	if os.path.exists(repos + "/format"):
+		return repos
+
+	try:
+		os.makedirs(repo_dir)
+	except OSError:
+		pass
+	dump = repos + ".dump"
+	print("Generating repository " + key + "...")
+	generate_dump(dump, params)
+	shutil.rmtree(repos, True)
+	run("svnadmin", "create", repos)
+	run("svnadmin", "load", "--quiet", repos, input = dump)
+	os.remove(dump)
+	return repos
+
+
+#
+# Measurements
+#
+
+# Wraps a svnserve instance that logs the requests of all runs
+class Server:
+	def __init__(self, repos):
+		s = socket.socket()
+		s.bind(("127.0.0.1", 0))
+		self.port = s.getsockname()[1]
+		s.close()
+		self.logfile = os.path.abspath(work_dir + "/svnserve.log")
+		open(self.logfile, "w").close()
+		self.proc = subprocess.Popen(["svnserve", "-d", "--foreground", "-r", os.path.dirname(repos), "--listen-host", "127.0.0.1", "--listen-port", str(self.port), "--log-file", self.logfile])
+		self.url = "svn://127.0.0.1:%d/%s" % (self.port, os.path.basename(repos))
+		time.sleep(0.5)
+
+	# Returns the number of logged requests
+	def requests(self):
+		f = open(self.logfile, "r")
+		n = len(f.readlines())
+		f.close()
+		return n
+
+	def stop(self):
+		os.kill(self.proc.pid, signal.SIGTERM)
+		self.proc.wait()
+
+
+# Counts the files in a directory tree
+def count_files(path):
+	n = 0
+	for root, dirs, files in os.walk(path):
+		n += len(files)
+	return n
+
+
+# Runs rsvndump once and measures it
+def measure(binary, url, args, output, server):
+	tmp = os.path.abspath(work_dir + "/tmp")
+	shutil.rmtree(tmp, True)
+	os.makedirs(tmp)
+	env = dict(os.environ)
+	env["TMPDIR"] = tmp
+
+	requests = server.requests() if server else None
+	out = open(output, "ab")
+	err = open(os.path.abspath(work_dir + "/stderr.log"), "ab")
+	start = time.time()
+	proc = subprocess.Popen([binary, url] + args, stdout = out, stderr = err, env = env)
+
+	# Poll the temporary directory while rsvndump is running
+	temp_files = 0
+	while True:
+		pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+		if pid != 0:
+			break
+		temp_files = max(temp_files, count_files(tmp))
+		time.sleep(0.05)
+	wall = time.time() - start
+	out.close()
+	err.close()
+	if status != 0:
+		raise RuntimeError("rsvndump " + " ".join(args) + " failed, see " + work_dir + "/stderr.log")
+
+	return {
+		"wall": wall,
+		"user": usage.ru_utime,
+		"sys": usage.ru_stime,
+		"peak_rss_kb": usage.ru_maxrss,
+		"temp_files": temp_files,
+		"ra_requests": (server.requests() - requests) if server else None
+	}
+
+
+# Adds up the measurements of several runs
+def accumulate(total, m):
+	if total is None:
+		return m
+	for key in ["wall", "user", "sys"]:
+		total[key] += m[key]
+	for key in ["peak_rss_kb", "temp_files"]:
+		total[key] = max(total[key], m[key])
+	if m["ra_requests"] is not None:
+		total["ra_requests"] += m["ra_requests"]
+	return total
+
+
+# Runs a benchmark configuration
+def run_config(config, binary, url, revisions, step, extra, server):
+	output = os.path.abspath(work_dir + "/" + config + ".dump")
+	if os.path.exists(output):
+		os.remove(output)
+
+	if config == "plain":
+		result = measure(binary, url, ["-q"] + extra, output, server)
+	elif config == "deltas":
+		result = measure(binary, url, ["-q", "--deltas"] + extra, output, server)
+	elif config == "incremental":
+		result = None
+		start = 0
+		while start <= revisions:
+			end = min(start + step - 1, revisions)
+			args = ["-q", "--incremental", "--no-incremental-header", "--revision", "%d:%d" % (start, end)]
+			result = accumulate(result, measure(binary, url, args + extra, output, server))
+			start = end + 1
+	result["bytes_written"] = os.path.getsize(output)
+	return result
+
+
+#
+# History
+#
+
+# Loads the history file
+def load_history(path):
+	try:
+		f = open(path, "r")
+		history = json.load(f)
+		f.close()
+		return history
+	except IOError:
+		return []
+
+
+# Returns the last history entry with the same repository parameters
+def previous_entry(history, params):
+	for entry in reversed(history):
+		if entry["repository"] == params:
+			return entry
+	return None
+
+
+# Returns the current revision of the source tree
+def source_revision():
+	try:
+		p = subprocess.Popen(["git", "describe", "--always", "--dirty"], stdout = subprocess.PIPE, stderr = open(os.devnull, "w"))
+		return p.communicate()[0].decode("ascii").strip() or None
+	except OSError:
+		return None
+
+
+# Prints the results of a run, compared to a previous one
+def print_results(entry, previous):
+	keys = ["wall", "peak_rss_kb", "temp_files", "bytes_written", "ra_requests"]
+	print("%-12s" % "config" + "".join(["%16s" % k for k in keys]))
+	for config in sorted(entry["results"].keys()):
+		r = entry["results"][config]
+		line = "%-12s" % config
+		for k in keys:
+			if r[k] is None:
+				line += "%16s" % "-"
+				continue
+			cell = ("%.2f" % r[k]) if isinstance(r[k], float) else str(r[k])
+			if previous and config in previous["results"] and previous["results"][config].get(k):
+				cell += " (%+.0f%%)" % ((r[k] - previous["results"][config][k]) * 100.0 / previous["results"][config][k])
+			line += "%16s" % cell
+		print(line)
+
+
+#
+# Main program
+#
+
+# Program entry point
+def main():
+	parser = OptionParser(usage = "%prog [options] [-- extra rsvndump arguments]")
+	for name, default, desc in repo_params:
+		parser.add_option("--" + name.replace("_", "-"), dest = name, type = type(default).__name__, default = default, help = desc + " (default: %default)")
+	parser.add_option("--rsvndump", default = default_rsvndump, help = "path to the rsvndump binary (default: %default)")
+	parser.add_option("--config", action = "append", choices = configs, help = "configuration to run: " + ", ".join(configs) + " (default: all)")
+	parser.add_option("--step", type = "int", default = 50, help = "revisions per incremental run (default: %default)")
+	parser.add_option("--svnserve", action = "store_true", default = False, help = "access the repository through a local svnserve and count its requests")
+	parser.add_option("--history", default = default_history, help = "history file (default: %default)")
+	parser.add_option("--note", default = None, help = "note to store with the results")
+	parser.add_option("--show", action = "store_true", default = False, help = "only print the history")
+	(options, extra) = parser.parse_args()
+
+	if options.show:
+		history = load_history(options.history)
+		for i in range(len(history)):
+			entry = history[i]
+			print("\n%s %s %s" % (entry["date"], entry["revision"] or "", entry["note"] or ""))
+			print_results(entry, previous_entry(history[:i], entry["repository"]))
+		return 0
+
+	params = {}
+	for name, default, desc in repo_params:
+		params[name] = getattr(options, name)
+
+	try:
+		os.makedirs(work_dir)
+	except OSError:
+		pass
+	repos = setup_repos(params)
+	binary = os.path.abspath(options.rsvndump)
+
+	server = None
+	url = "file://" + repos
+	if options.svnserve:
+		server = Server(repos)
+		url = server.url
+
+	entry = {
+		"date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+		"revision": source_revision(),
+		"note": options.note,
+		"repository": params,
+		"args": extra,
+		"results": {}
+	}
+	try:
+		for config in (options.config or configs):
+			print("Running " + config + "...")
+			entry["results"][config] = run_config(config, binary, url, params["revisions"], options.step, extra, server)
+	finally:
+		if server:
+			server.stop()
+
+	history = load_history(options.history)
+	print("")
+	print_results(entry, previous_entry(history, params))
+	history.append(entry)
+	f = open(options.history, "w")
+	json.dump(history, f, indent = 1, sort_keys = True)
+	f.close()
+	return 0
+
+
+if __name__ == "__main__":
+	ret = main()
+	raise SystemExit(ret)
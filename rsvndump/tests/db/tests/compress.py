@@ -0,0 +1,57 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import gzip
+import os
+
+import test_api
+
+
+def info():
+	return "Compression test, comparing --compress output to plain output"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		f = open("file2","wb")
+		print >>f, "hello2"
+		test_api.run("svn", "add", "dir1", "file2", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		for i in range(0, 1000):
+			print >>f, "line", i
+		test_api.run("svn", "propset", "bla", "blubb", "file2", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	pdump_path = test_api.dump_rsvndump(id, args)
+	odump_path = test_api.mktemp(id)
+	os.rename(pdump_path, odump_path)
+	cdump_path = test_api.dump_rsvndump(id, args + ["--compress", "6"])
+
+	# Decompress the dump for comparison
+	udump_path = test_api.mktemp(id)
+	f = gzip.open(cdump_path, "rb")
+	g = open(udump_path, "wb")
+	g.write(f.read())
+	g.close()
+	f.close()
+
+	return test_api.diff(id, odump_path, udump_path)
@@ -0,0 +1,67 @@
+#
+#	Test database for rsvndump
+#	written by Jonas Gehring
+#
+
+
+import os
+
+import test_api
+
+
+def info():
+	return "Replay test, comparing --replay-window output to diff output"
+
+
+def setup(step, log):
+	if step == 0:
+		os.mkdir("dir1")
+		os.mkdir("dir1/sdir1")
+		f = open("dir1/file1","wb")
+		print >>f, "hello1"
+		f = open("dir1/sdir1/file1","wb")
+		print >>f, "hello2"
+		test_api.run("svn", "add", "dir1", output = log)
+		return True
+	elif step == 1:
+		f = open("dir1/file1","ab")
+		print >>f, "modified"
+		test_api.run("svn", "propset", "bla", "blubb", "dir1/file1", output = log)
+		return True
+	elif step == 2:
+		test_api.run("svn", "cp", "dir1", "dir2", output = log)
+		f = open("dir2/sdir1/file1","ab")
+		print >>f, "copied and modified"
+		return True
+	elif step == 3:
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "rm", "dir1/sdir1", output = log)
+		f = open("dir2/file2","wb")
+		print >>f, "hello3"
+		test_api.run("svn", "add", "dir2/file2", output = log)
+		return True
+	elif step == 4:
+		test_api.run("svn", "up", output = log)
+		test_api.run("svn", "cp", "dir2/file2", "dir1/file2", output = log)
+		test_api.run("svn", "propdel", "bla", "dir1/file1", output = log)
+		return True
+	elif step == 5:
+		f = open("dir1/file2","ab")
+		print >>f, "modified copy"
+		return True
+	else:
+		return False
+
+
+# Runs the test
+def run(id, args = []):
+	# Set up the test repository
+	test_api.setup_repos(id, setup)
+
+	# The windows don't line up with the revisions on purpose
+	ddump_path = test_api.dump_rsvndump(id, args)
+	odump_path = test_api.mktemp(id)
+	os.rename(ddump_path, odump_path)
+	rdump_path = test_api.dump_rsvndump(id, args + ["--replay-window", "2"])
+
+	return test_api.diff(id, odump_path, rdump_path)
@@ -21,10 +21,17 @@
 #include <stdio.h>
 
 #include <svn_error.h>
+#include <svn_pools.h>
+#include <svn_string.h>
 #include <svn_types.h>
 
+#include <apr_general.h>
+#include <apr_hash.h>
+
 #include <main.h>
 #include <list.h>
+#include <property.h>
+#include <rhash.h>
 
 
 /* Check parse_revnum in main.c */
@@ -138,21 +145,218 @@ static char test_list()
 		fflush(stdout);
 	}
 
+	for (j = 0; j < 100; j++) {
+		list_append(&l, &j);
+	}
+	list_shift(&l, 40);
+	if (l.size != 60 || ((long *)l.elements)[0] != 40 || ((long *)l.elements)[59] != 99) {
+		printf("\n\tFAIL: shifting 40 of 100 elements failed\n");
+		list_free(&l);
+		return 1;
+	}
+	list_shift(&l, 100);
+	if (l.size != 0) {
+		printf("\n\tFAIL: List not empty after shifting all elements\n");
+		list_free(&l);
+		return 1;
+	}
+
 	printf("\n");
 	list_free(&l);
 	return 0;
 }
 
 
+static char test_property_sets()
+{
+	int i;
+	char ret = 0;
+	property_set_t *sets[8];
+	apr_pool_t *pool = svn_pool_create(NULL);
+
+	printf("Testing property sets: ");
+
+	/* A small budget makes sure that some sets are spilled */
+	property_sets_init("/tmp", 64, pool);
+
+	for (i = 0; i < 8; i++) {
+		apr_hash_t *hash = apr_hash_make(pool), *loaded = apr_hash_make(pool);
+		svn_string_t *value;
+		svn_error_t *err;
+
+		apr_hash_set(hash, "svn:eol-style", APR_HASH_KEY_STRING, svn_string_create("native", pool));
+		apr_hash_set(hash, "value", APR_HASH_KEY_STRING, svn_string_create(apr_psprintf(pool, "%d", i % 4), pool));
+
+		if ((err = property_set_intern(&sets[i], hash, pool)) || (err = property_set_load(sets[i], loaded, pool))) {
+			printf("\n\t%d: FAIL: %s\n", i, err->message);
+			svn_error_clear(err);
+			ret = 1;
+			break;
+		}
+		if (i >= 4 && sets[i] != sets[i - 4]) {
+			printf("\n\t%d: FAIL: equal sets are not shared\n", i);
+			ret = 1;
+			break;
+		}
+		value = apr_hash_get(loaded, "value", APR_HASH_KEY_STRING);
+		if (apr_hash_count(loaded) != 2 || value == NULL || atoi(value->data) != i % 4) {
+			printf("\n\t%d: FAIL: wrong properties after loading\n", i);
+			ret = 1;
+			break;
+		}
+
+		printf("%d ", i);
+		fflush(stdout);
+	}
+
+	while (--i >= 0) {
+		property_set_release(sets[i]);
+	}
+	property_sets_free();
+	svn_pool_destroy(pool);
+
+	printf("\n");
+	return ret;
+}
+
+
+/* Counts the entries of a reference hash that are below a path */
+static int count_children(apr_hash_t *hash, const char *path, apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	int num = 0, len = strlen(path);
+
+	for (hi = apr_hash_first(pool, hash); hi; hi = apr_hash_next(hi)) {
+		const char *key;
+		apr_hash_this(hi, (const void **)(void *)&key, NULL, NULL);
+		if (!strncmp(key, path, len) && key[len] == '/') {
+			++num;
+		}
+	}
+	return num;
+}
+
+static int released;
+
+static void count_release(void *val)
+{
+	++released;
+}
+
+static char test_rhash()
+{
+	int i, j;
+	char ret = 0;
+	apr_pool_t *pool = svn_pool_create(NULL);
+	rhash_t *hash = rhash_make(pool, sizeof(long));
+	apr_hash_t *ref = apr_hash_make(pool);
+	const char *dirs[] = {"trunk", "/trunk", "trunk/src", "trunk/src/a", "branches/b1", "trunk//x", ""};
+
+	printf("Testing path hash: ");
+
+	for (i = 0; i < 8 && !ret; i++) {
+		apr_hash_index_t *hi;
+		rhash_index_t *rhi;
+		const char *path;
+		long *val;
+		int num = 0;
+
+		/* Random insertions and removals */
+		for (j = 0; j < 2000; j++) {
+			long v = rand();
+			path = apr_psprintf(pool, "%s/%d", dirs[rand() % 7], rand() % 300);
+			if (rand() % 4 == 0) {
+				rhash_set(hash, path, NULL);
+				apr_hash_set(ref, path, APR_HASH_KEY_STRING, NULL);
+			} else {
+				rhash_set(hash, path, &v);
+				apr_hash_set(ref, path, APR_HASH_KEY_STRING, apr_pmemdup(pool, &v, sizeof(long)));
+			}
+		}
+
+		/* Remove a subtree */
+		path = dirs[i % 7];
+		released = 0;
+		j = count_children(ref, path, pool);
+		rhash_remove_children(hash, path, count_release);
+		if (released != j) {
+			printf("\n\t%d: FAIL: %d instead of %d entries removed below '%s'\n", i, released, j, path);
+			ret = 1;
+			break;
+		}
+		for (hi = apr_hash_first(pool, ref); hi; hi = apr_hash_next(hi)) {
+			const char *key;
+			int len = strlen(path);
+			apr_hash_this(hi, (const void **)(void *)&key, NULL, NULL);
+			if (!strncmp(key, path, len) && key[len] == '/') {
+				apr_hash_set(ref, key, APR_HASH_KEY_STRING, NULL);
+			}
+		}
+
+		/* Compare both hashes */
+		if (rhash_count(hash) != apr_hash_count(ref)) {
+			printf("\n\t%d: FAIL: %u entries instead of %u\n", i, rhash_count(hash), apr_hash_count(ref));
+			ret = 1;
+			break;
+		}
+		for (rhi = rhash_first(pool, hash); rhi; rhi = rhash_next(rhi)) {
+			long *expected;
+			rhash_this(rhi, &path, (void **)(void *)&val);
+			expected = apr_hash_get(ref, path, APR_HASH_KEY_STRING);
+			if (expected == NULL || *expected != *val || rhash_get(hash, path) != val) {
+				printf("\n\t%d: FAIL: wrong entry for '%s'\n", i, path);
+				ret = 1;
+				break;
+			}
+			++num;
+		}
+		if (!ret && num != apr_hash_count(ref)) {
+			printf("\n\t%d: FAIL: iterated over %d entries instead of %u\n", i, num, apr_hash_count(ref));
+			ret = 1;
+		}
+
+		/* Start over every other round */
+		if (i % 2 == 1) {
+			rhash_clear(hash);
+			ref = apr_hash_make(pool);
+		}
+
+		printf("%d ", i);
+		fflush(stdout);
+	}
+
+	if (!ret && rhash_get(hash, "trunk/src") != NULL) {
+		printf("\n\tFAIL: intermediate path has a value\n");
+		ret = 1;
+	}
+
+	rhash_free(hash);
+	svn_pool_destroy(pool);
+
+	printf("\n");
+	return ret;
+}
+
+
 /* Program entry point */
 int main(int argc, char **argv)
 {
+	if (apr_initialize() != APR_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
 	if (test_parse_revnum()) {
 		return EXIT_FAILURE;
 	}
 	if (test_list()) {
 		return EXIT_FAILURE;
 	}
+	if (test_property_sets()) {
+		return EXIT_FAILURE;
+	}
+	if (test_rhash()) {
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -4,6 +4,7 @@
  */
 
 #include "git-compat-util.h"
+#include "strbuf.h"
 
 #include "trp.h"
 #include "obj_pool.h"
@@ -13,13 +14,13 @@ typedef struct node_s node_t;
 static struct trp_root tree = { ~0 };
 
 struct node_s {
-	uint32_t offset;
+	obj_pool_large_t offset;
 	struct trp_node children;
 };
 
 /* Create two memory pools: one for node_t, and another for strings */
-obj_pool_gen(node, node_t, 4096);
-obj_pool_gen(string, char, 4096);
+obj_pool_gen(node, node_t, uint32_t, 4096);
+obj_pool_gen(string, char, obj_pool_large_t, 4096);
 
 static char *node_value(node_t *node)
 {
@@ -32,7 +33,7 @@ static int node_cmp(node_t *a, node_t *b)
 }
 
 /* Build a Treap from the node_s structure (a trp_node w/ offset) */
-trp_gen(static, tree_, node_t, children, node, node_cmp);
+trp_gen(static, tree_, struct trp_root, node_t, children, node, node_cmp);
 
 char *pool_fetch(uint32_t entry)
 {
@@ -67,13 +68,13 @@ uint32_t pool_tok_r(char *str, const char *delim, char **saveptr)
 	return token ? pool_intern(token) : ~0;
 }
 
-void pool_print_seq(uint32_t len, uint32_t *seq, char delim, FILE *stream)
+void pool_print_seq(uint32_t len, uint32_t *seq, char delim, struct strbuf *sb)
 {
 	uint32_t i;
 	for (i = 0; i < len && ~seq[i]; i++) {
-		fputs(pool_fetch(seq[i]), stream);
+		strbuf_addstr(sb, pool_fetch(seq[i]));
 		if (i < len - 1 && ~seq[i + 1])
-			fputc(delim, stream);
+			strbuf_addch(sb, delim);
 	}
 }
 
@@ -91,11 +92,10 @@ uint32_t pool_tok_seq(uint32_t max, uint32_t *seq, char *delim, char *str)
 	return length;
 }
 
-void pool_init(void)
+static void pool_index(void)
 {
 	uint32_t node;
-	uint32_t string = 0;
-	string_init();
+	obj_pool_large_t string = 0;
 	while (string < string_pool.size) {
 		node = node_alloc(1);
 		node_pointer(node)->offset = string;
@@ -104,6 +104,39 @@ void pool_init(void)
 	}
 }
 
+void pool_init(void)
+{
+	string_init();
+	pool_index();
+}
+
+uint32_t pool_count(void)
+{
+	return node_pool.size;
+}
+
+/* Drop entries whose map value is zero; map receives the new entries. */
+int pool_compact(uint32_t *map)
+{
+	uint32_t i, count = 0;
+	obj_pool_large_t len, string = 0;
+	for (i = 0; i < node_pool.size; i++) {
+		if (!map[i]) {
+			map[i] = ~0;
+			continue;
+		}
+		len = strlen(node_value(node_pointer(i))) + 1;
+		memmove(string_pointer(string), node_value(node_pointer(i)), len);
+		string += len;
+		map[i] = count++;
+	}
+	string_pool.size = string;
+	node_pool.size = 0;
+	tree.trp_root = ~0;
+	pool_index();
+	return string_rewrite();
+}
+
 void pool_commit(void)
 {
 	string_commit();
@@ -111,6 +144,7 @@ void pool_commit(void)
 
 void pool_reset(void)
 {
+	tree.trp_root = ~0;
 	node_reset();
 	string_reset();
 }
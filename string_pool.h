@@ -3,12 +3,16 @@
 
 #include "git-compat-util.h"
 
+struct strbuf;
+
 uint32_t pool_intern(char *key);
 char *pool_fetch(uint32_t entry);
 uint32_t pool_tok_r(char *str, const char *delim, char **saveptr);
-void pool_print_seq(uint32_t len, uint32_t *seq, char delim, FILE *stream);
+void pool_print_seq(uint32_t len, uint32_t *seq, char delim, struct strbuf *sb);
 uint32_t pool_tok_seq(uint32_t max, uint32_t *seq, char *delim, char *str);
 void pool_init(void);
+uint32_t pool_count(void);
+int pool_compact(uint32_t *map);
 void pool_commit(void);
 void pool_reset(void);
 
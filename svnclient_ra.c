@@ -3,11 +3,18 @@
 #include "svn_client.h"
 #include "svn_ra.h"
 
+#include "svn_time.h"
+
 #include "delta_editor.h"
+#include "repo_tree.h"
+#include "string_pool.h"
 
 static apr_pool_t *pool = NULL;
 static svn_client_ctx_t *ctx = NULL;
 static svn_ra_session_t *session = NULL;
+/* Base texts are fetched while the replay session is busy */
+static svn_ra_session_t *base_session = NULL;
+static uint32_t repo_uuid = 0, repo_url = 0;
 
 static svn_error_t *setup_delta_editor(svn_delta_editor_t **editor)
 {
@@ -38,6 +45,9 @@ static svn_error_t *replay_revstart(svn_revnum_t revision,
                                     apr_hash_t *rev_props,
                                     apr_pool_t *pool)
 {
+	*editor = replay_baton;
+	*edit_baton = NULL;
+	delta_editor_start(revision);
 	return SVN_NO_ERROR;
 }
 
@@ -48,7 +58,30 @@ static svn_error_t *replay_revend(svn_revnum_t revision,
                                   apr_hash_t *rev_props,
                                   apr_pool_t *pool)
 {
+	svn_string_t *value;
+	uint32_t author = ~0;
+	char *log = "";
+	apr_time_t timestamp = 0;
+
 	SVN_ERR(editor->close_edit(edit_baton, pool));
+	if (!revision)
+		return SVN_NO_ERROR;
+
+	value = apr_hash_get(rev_props, SVN_PROP_REVISION_AUTHOR,
+	                     APR_HASH_KEY_STRING);
+	if (value)
+		author = pool_intern(apr_pstrdup(pool, value->data));
+	value = apr_hash_get(rev_props, SVN_PROP_REVISION_LOG,
+	                     APR_HASH_KEY_STRING);
+	if (value)
+		log = apr_pstrdup(pool, value->data);
+	value = apr_hash_get(rev_props, SVN_PROP_REVISION_DATE,
+	                     APR_HASH_KEY_STRING);
+	if (value)
+		SVN_ERR(svn_time_from_cstring(&timestamp, value->data, pool));
+
+	repo_commit(revision, author, log, repo_uuid, repo_url,
+	            apr_time_sec(timestamp));
 	return SVN_NO_ERROR;
 }
 
@@ -84,6 +117,8 @@ svn_error_t *populate_context()
 
 svn_error_t *open_connection(const char *url)
 {
+	const char *uuid;
+
 	SVN_ERR(svn_config_ensure (NULL, pool));
 	SVN_ERR(svn_client_create_context (&ctx, pool));
 	SVN_ERR(svn_ra_initialize(pool));
@@ -96,6 +131,11 @@ svn_error_t *open_connection(const char *url)
 	SVN_ERR(populate_context());
 	SVN_ERR(build_auth_baton());
 	SVN_ERR(svn_client_open_ra_session(&session, url, ctx, pool));
+	SVN_ERR(svn_client_open_ra_session(&base_session, url, ctx, pool));
+	SVN_ERR(svn_ra_get_uuid2(session, &uuid, pool));
+	repo_uuid = pool_intern(apr_pstrdup(pool, uuid));
+	repo_url = pool_intern(apr_pstrdup(pool, url));
+	delta_editor_init(base_session);
 	return SVN_NO_ERROR;
 }
 
@@ -104,10 +144,12 @@ svn_error_t *replay_range(svn_revnum_t start_revision, svn_revnum_t end_revision
 	svn_revnum_t latest_revision;
 	svn_delta_editor_t *editor;
 	SVN_ERR(svn_ra_get_latest_revnum(session, &latest_revision, pool));
-	printf("%ld\n", latest_revision);
+	if (!SVN_IS_VALID_REVNUM(end_revision) || end_revision > latest_revision)
+		end_revision = latest_revision;
 	SVN_ERR(setup_delta_editor(&editor));
 	SVN_ERR(svn_ra_replay_range(session, start_revision, end_revision,
-	                            0, TRUE, replay_revstart, replay_revend, NULL, pool));
+	                            0, TRUE, replay_revstart, replay_revend,
+	                            editor, pool));
 	return SVN_NO_ERROR;
 }
 
@@ -116,15 +158,32 @@ void close_connection()
 	svn_pool_destroy(pool);
 }
 
-int main()
+int main(int argc, char **argv)
 {
-	const char url[] = "http://svn.apache.org/repos/asf/subversion/trunk";
-	svn_revnum_t start_revision = 0, end_revision = 5;
+	svn_revnum_t start_revision = 1, end_revision = SVN_INVALID_REVNUM;
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: svnclient_ra <repository root url> "
+		        "[start [end]]\n");
+		return 1;
+	}
+	if (argc > 2)
+		start_revision = strtol(argv[2], NULL, 10);
+	if (argc > 3)
+		end_revision = strtol(argv[3], NULL, 10);
+	/* Revisions are committed under their own number, so the import
+	 * has to start with an empty history */
+	if (start_revision < 0 || start_revision > 1) {
+		fprintf(stderr, "svnclient_ra: start revision %ld is not "
+		        "supported, imports start at revision 0 or 1\n",
+		        start_revision);
+		return 1;
+	}
 	if (svn_cmdline_init ("svnclient_ra", stderr) != EXIT_SUCCESS)
 		return EXIT_FAILURE;
 	pool = svn_pool_create(NULL);
+	repo_init();
 
-	if(open_connection(url) != SVN_NO_ERROR)
+	if(open_connection(argv[1]) != SVN_NO_ERROR)
 		return 1;
 	if(replay_range(start_revision, end_revision) != SVN_NO_ERROR)
 		return 1;
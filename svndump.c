@@ -30,7 +30,7 @@
 #define DATE_RFC2822_LEN 31
 
 /* Create memory pool for log messages */
-obj_pool_gen(log, char, 4096);
+obj_pool_gen(log, char, obj_pool_large_t, 4096);
 
 static char* log_copy(uint32_t length, char *log)
 {
@@ -42,7 +42,8 @@ static char* log_copy(uint32_t length, char *log)
 }
 
 static struct {
-	uint32_t action, propLength, textLength, srcRev, srcMode, mark, type;
+	uint32_t action, srcRev, srcMode, mark, type;
+	uint64_t propLength, textLength;
 	uint32_t src[REPO_MAX_PATH_DEPTH], dst[REPO_MAX_PATH_DEPTH];
 } node_ctx;
 
@@ -79,7 +80,7 @@ static void reset_node_ctx(char *fname)
 static void reset_rev_ctx(uint32_t revision)
 {
 	rev_ctx.revision = revision;
-	rev_ctx.timestamp = "";
+	rev_ctx.timestamp = 0;
 	rev_ctx.log = NULL;
 	rev_ctx.author = ~0;
 }
@@ -208,7 +209,7 @@ void svndump_read(uint32_t url)
 	char *val;
 	char *t;
 	uint32_t active_ctx = DUMP_CTX;
-	uint32_t len;
+	uint64_t len;
 	uint32_t key;
 
 	reset_dump_ctx(url);
@@ -257,11 +258,11 @@ void svndump_read(uint32_t url)
 		} else if (key == keys.node_copyfrom_rev) {
 			node_ctx.srcRev = atoi(val);
 		} else if (key == keys.text_content_length) {
-			node_ctx.textLength = atoi(val);
+			node_ctx.textLength = strtoull(val, NULL, 10);
 		} else if (key == keys.prop_content_length) {
-			node_ctx.propLength = atoi(val);
+			node_ctx.propLength = strtoull(val, NULL, 10);
 		} else if (key == keys.content_length) {
-			len = atoi(val);
+			len = strtoull(val, NULL, 10);
 			buffer_read_line();
 			if (active_ctx == REV_CTX) {
 				read_props();
@@ -269,7 +270,8 @@ void svndump_read(uint32_t url)
 				handle_node();
 				active_ctx = REV_CTX;
 			} else {
-				fprintf(stderr, "Unexpected content length header: %d\n", len);
+				fprintf(stderr, "Unexpected content length header: %"PRIu64"\n",
+				        len);
 				buffer_skip_bytes(len);
 			}
 		}
@@ -278,7 +280,42 @@ void svndump_read(uint32_t url)
 	if (active_ctx != DUMP_CTX) handle_revision();
 }
 
-static void svndump_init(void)
+/*
+ * Compact the repository state before importing a dump, keeping the
+ * trees of the revisions it copies from.  Only the headers are scanned;
+ * content is skipped by length.
+ */
+int svndump_compact(void)
+{
+	char *val;
+	char *t;
+	uint32_t nr = 0, alloc = 0, *revs = NULL;
+	uint64_t len;
+	int ret;
+
+	while ((t = buffer_read_line())) {
+		val = strstr(t, ": ");
+		if (!val) continue;
+		*val++ = '\0';
+		*val++ = '\0';
+		if (!strcmp(t, "Node-copyfrom-rev")) {
+			if (nr == alloc) {
+				alloc = alloc ? 2 * alloc : 64;
+				revs = xrealloc(revs, alloc * sizeof(*revs));
+			}
+			revs[nr++] = atoi(val);
+		} else if (!strcmp(t, "Content-length")) {
+			len = strtoull(val, NULL, 10);
+			buffer_read_line();
+			buffer_skip_bytes(len);
+		}
+	}
+	ret = repo_compact(nr, revs);
+	free(revs);
+	return ret;
+}
+
+void svndump_init(void)
 {
 	repo_init();
 	reset_dump_ctx(~0);
@@ -1,7 +1,11 @@
 #ifndef SVNDUMP_H_
 #define SVNDUMP_H_
 
-void svndump_read(char *url);
+#include <stdint.h>
+
+void svndump_init(void);
+void svndump_read(uint32_t url);
 void svndump_reset(void);
+int svndump_compact(void);
 
 #endif
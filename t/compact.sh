@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Import compact-2.dump on top of compact-1.dump twice, once compacting
+# the repository state in between.  Compaction must keep every tree the
+# second dump copies from, so both imports have to produce the same
+# fast-import stream.
+#
+# Run from the top of the tree after building test-svn-fe.
+
+fe="$PWD/test-svn-fe"
+dumps="$PWD/t"
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+import () {
+	mkdir "$tmp/$1" &&
+	(
+		cd "$tmp/$1" &&
+		"$fe" "$dumps/compact-1.dump" >first.fi &&
+		if test "$1" = compacted
+		then
+			"$fe" --compact "$dumps/compact-2.dump"
+		fi &&
+		"$fe" "$dumps/compact-2.dump" >second.fi
+	)
+}
+
+import plain || { echo "FAIL: plain import"; exit 1; }
+import compacted || { echo "FAIL: compacted import"; exit 1; }
+if ! test -s "$tmp/plain/second.fi"
+then
+	echo "FAIL: empty import"
+	exit 1
+fi
+if ! cmp "$tmp/plain/second.fi" "$tmp/compacted/second.fi"
+then
+	echo "FAIL: compaction changed the import"
+	exit 1
+fi
+echo "ok: compaction keeps copy sources"
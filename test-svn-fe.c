@@ -0,0 +1,46 @@
+/*
+ * test-svn-fe: import a dump into the repo_tree state in the current
+ * directory, writing a fast-import stream to stdout, or compact that
+ * state ahead of importing the given dump.
+ *
+ * Licensed under a two-clause BSD-style license.
+ * See LICENSE for details.
+ */
+
+#include "git-compat-util.h"
+#include "line_buffer.h"
+#include "repo_tree.h"
+#include "svndump.h"
+
+static const char test_svn_fe_usage[] =
+	"test-svn-fe [--compact] [--threads=<n>] <dumpfile>";
+
+int main(int argc, char **argv)
+{
+	int compact = 0, threads = 1;
+
+	for (argv++; *argv && **argv == '-'; argv++) {
+		if (!strcmp(*argv, "--compact"))
+			compact = 1;
+		else if (!strncmp(*argv, "--threads=", 10))
+			threads = atoi(*argv + 10);
+		else
+			die("usage: %s", test_svn_fe_usage);
+	}
+	if (!*argv || argv[1])
+		die("usage: %s", test_svn_fe_usage);
+	if (buffer_init(*argv))
+		die_errno("cannot open %s", *argv);
+
+	if (compact) {
+		if (svndump_compact())
+			die("cannot compact the repository state");
+	} else {
+		svndump_init();
+		repo_set_diff_threads(threads);
+		svndump_read(~0);
+		svndump_reset();
+	}
+	buffer_deinit();
+	return 0;
+}
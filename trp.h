@@ -2,8 +2,8 @@
  * cpp macro implementation of treaps.
  *
  * Usage:
- *   #include <stdint.h>
- *   #include <trp.h>
+ *   #include "git-compat-util.h"
+ *   #include "trp.h"
  *   trp_gen(...)
  *
  * Licensed under a two-clause BSD-style license.
@@ -30,7 +30,7 @@ struct trp_root {
 #define trpn_modify(a_base, a_offset) \
 	do { \
 		if ((a_offset) < a_base##_pool.committed) { \
-			uint32_t old_offset = (a_offset);\
+			a_base##_off_t old_offset = (a_offset);\
 			(a_offset) = a_base##_alloc(1); \
 			*trpn_pointer(a_base, a_offset) = \
 				*trpn_pointer(a_base, old_offset); \
@@ -61,6 +61,14 @@ struct trp_root {
 	trp_left_set(a_base, a_field, (a_node), ~0); \
 	trp_right_set(a_base, a_field, (a_node), ~0)
 
+/*
+ * Iterator stack size.  Treaps are balanced in expectation, so this is
+ * plenty; iterators over deeper treaps fall back to searching from the
+ * root for each step.
+ */
+#define TRP_ITER_DEPTH 64
+#define TRP_ITER_SEARCH (TRP_ITER_DEPTH + 1)
+
 /* Internal utility macros. */
 #define trpn_first(a_base, a_field, a_root, r_node) \
 	do { \
@@ -83,21 +91,27 @@ struct trp_root {
 		trp_right_get(a_base, a_field, (r_node))); \
 	trp_right_set(a_base, a_field, (r_node), (a_node)); } while(0)
 
-#define trp_gen(a_attr, a_pre, a_type, a_field, a_base, a_cmp) \
-a_attr a_type *a_pre##first(struct trp_root *treap) \
+#define trp_gen(a_attr, a_pre, a_t_type, a_type, a_field, a_base, a_cmp) \
+struct a_pre##iter { \
+	a_t_type *treap; \
+	a_base##_off_t cur; \
+	unsigned int depth; \
+	a_base##_off_t stack[TRP_ITER_DEPTH]; \
+}; \
+a_attr MAYBE_UNUSED a_type *a_pre##first(a_t_type *treap) \
 { \
-	uint32_t ret; \
+	a_base##_off_t ret; \
 	trpn_first(a_base, a_field, treap->trp_root, ret); \
 	return trpn_pointer(a_base, ret); \
 } \
-a_attr a_type *a_pre##next(struct trp_root *treap, a_type *node) { \
-	uint32_t ret; \
-	uint32_t offset = trpn_offset(a_base, node); \
+a_attr MAYBE_UNUSED a_type *a_pre##next(a_t_type *treap, a_type *node) { \
+	a_base##_off_t ret; \
+	a_base##_off_t offset = trpn_offset(a_base, node); \
 	if (~trp_right_get(a_base, a_field, offset)) { \
 		trpn_first(a_base, a_field, \
 			trp_right_get(a_base, a_field, offset), ret); \
 	} else { \
-		uint32_t tnode = treap->trp_root; \
+		a_base##_off_t tnode = treap->trp_root; \
 		ret = ~0; \
 		while (1) { \
 			int cmp = (a_cmp)(trpn_pointer(a_base, offset), \
@@ -114,10 +128,10 @@ a_attr a_type *a_pre##next(struct trp_root *treap, a_type *node) { \
 	} \
 	return trpn_pointer(a_base, ret); \
 } \
-a_attr a_type *a_pre##search(struct trp_root *treap, a_type *key) \
+a_attr MAYBE_UNUSED a_type *a_pre##search(a_t_type *treap, a_type *key) \
 { \
 	int cmp; \
-	uint32_t ret = treap->trp_root; \
+	a_base##_off_t ret = treap->trp_root; \
 	while (~ret && (cmp = (a_cmp)(key, trpn_pointer(a_base,ret)))) \
 		if (cmp < 0) \
 			ret = trp_left_get(a_base, a_field, ret); \
@@ -125,16 +139,16 @@ a_attr a_type *a_pre##search(struct trp_root *treap, a_type *key) \
 			ret = trp_right_get(a_base, a_field, ret); \
 	return trpn_pointer(a_base, ret); \
 } \
-a_attr uint32_t a_pre##insert_recurse(uint32_t cur_node, uint32_t ins_node) \
+a_attr MAYBE_UNUSED a_base##_off_t a_pre##insert_recurse(a_base##_off_t cur_node, a_base##_off_t ins_node) \
 { \
 	if (cur_node == ~0) \
 		return (ins_node); \
 	else { \
-		uint32_t ret; \
+		a_base##_off_t ret; \
 		int cmp = (a_cmp)(trpn_pointer(a_base, ins_node), \
 					trpn_pointer(a_base, cur_node)); \
 		if (cmp < 0) { \
-			uint32_t left = a_pre##insert_recurse( \
+			a_base##_off_t left = a_pre##insert_recurse( \
 				trp_left_get(a_base, a_field, cur_node), ins_node); \
 			trp_left_set(a_base, a_field, cur_node, left); \
 			if (trp_prio_get(left) < trp_prio_get(cur_node)) \
@@ -142,7 +156,7 @@ a_attr uint32_t a_pre##insert_recurse(uint32_t cur_node, uint32_t ins_node) \
 			else \
 				ret = cur_node; \
 		} else { \
-			uint32_t right = a_pre##insert_recurse( \
+			a_base##_off_t right = a_pre##insert_recurse( \
 				trp_right_get(a_base, a_field, cur_node), ins_node); \
 			trp_right_set(a_base, a_field, cur_node, right); \
 			if (trp_prio_get(right) < trp_prio_get(cur_node)) \
@@ -153,20 +167,20 @@ a_attr uint32_t a_pre##insert_recurse(uint32_t cur_node, uint32_t ins_node) \
 		return (ret); \
 	} \
 } \
-a_attr void a_pre##insert(struct trp_root *treap, a_type *node) \
+a_attr MAYBE_UNUSED void a_pre##insert(a_t_type *treap, a_type *node) \
 { \
-	uint32_t offset = trpn_offset(a_base, node); \
+	a_base##_off_t offset = trpn_offset(a_base, node); \
 	trp_node_new(a_base, a_field, offset); \
 	treap->trp_root = a_pre##insert_recurse( treap->trp_root, offset); \
 } \
-a_attr uint32_t a_pre##remove_recurse(uint32_t cur_node, uint32_t rem_node) \
+a_attr MAYBE_UNUSED a_base##_off_t a_pre##remove_recurse(a_base##_off_t cur_node, a_base##_off_t rem_node) \
 { \
 	int cmp = a_cmp(trpn_pointer(a_base, rem_node), \
 			trpn_pointer(a_base, cur_node)); \
 	if (cmp == 0) { \
-		uint32_t ret; \
-		uint32_t left = trp_left_get(a_base, a_field, cur_node); \
-		uint32_t right = trp_right_get(a_base, a_field, cur_node); \
+		a_base##_off_t ret; \
+		a_base##_off_t left = trp_left_get(a_base, a_field, cur_node); \
+		a_base##_off_t right = trp_right_get(a_base, a_field, cur_node); \
 		if (left == ~0) { \
 			if (right == ~0) \
 				return (~0); \
@@ -181,21 +195,84 @@ a_attr uint32_t a_pre##remove_recurse(uint32_t cur_node, uint32_t rem_node) \
 		trp_left_set(a_base, a_field, ret, left); \
 		return (ret); \
 	} else if (cmp < 0) { \
-		uint32_t left = a_pre##remove_recurse( \
+		a_base##_off_t left = a_pre##remove_recurse( \
 			trp_left_get(a_base, a_field, cur_node), rem_node); \
 		trp_left_set(a_base, a_field, cur_node, left); \
 		return (cur_node); \
 	} else { \
-		uint32_t right = a_pre##remove_recurse( \
+		a_base##_off_t right = a_pre##remove_recurse( \
 			trp_right_get(a_base, a_field, cur_node), rem_node); \
 		trp_right_set(a_base, a_field, cur_node, right); \
 		return (cur_node); \
 	} \
 } \
-a_attr void a_pre##remove(struct trp_root *treap, a_type *node) \
+a_attr MAYBE_UNUSED void a_pre##remove(a_t_type *treap, a_type *node) \
 { \
 	treap->trp_root = a_pre##remove_recurse(treap->trp_root, \
 		trpn_offset(a_base, node)); \
 } \
+a_attr MAYBE_UNUSED a_type *a_pre##iter_descend(struct a_pre##iter *it, \
+				a_base##_off_t node) \
+{ \
+	while (~node) { \
+		if (it->depth == TRP_ITER_DEPTH) { \
+			it->depth = TRP_ITER_SEARCH; \
+			while (~trp_left_get(a_base, a_field, node)) \
+				node = trp_left_get(a_base, a_field, node); \
+			it->cur = node; \
+			return trpn_pointer(a_base, node); \
+		} \
+		it->stack[it->depth++] = node; \
+		node = trp_left_get(a_base, a_field, node); \
+	} \
+	it->cur = it->depth ? it->stack[it->depth - 1] : ~0; \
+	return trpn_pointer(a_base, it->cur); \
+} \
+a_attr MAYBE_UNUSED a_type *a_pre##iter_first(struct a_pre##iter *it, a_t_type *treap) \
+{ \
+	it->treap = treap; \
+	it->depth = 0; \
+	return a_pre##iter_descend(it, treap->trp_root); \
+} \
+a_attr MAYBE_UNUSED a_type *a_pre##iter_seek(struct a_pre##iter *it, a_t_type *treap, \
+				a_type *key) \
+{ \
+	int cmp; \
+	a_base##_off_t node = treap->trp_root; \
+	it->treap = treap; \
+	it->cur = ~0; \
+	it->depth = 0; \
+	while (~node) { \
+		cmp = (a_cmp)(key, trpn_pointer(a_base, node)); \
+		if (cmp > 0) { \
+			node = trp_right_get(a_base, a_field, node); \
+			continue; \
+		} \
+		it->cur = node; \
+		if (it->depth < TRP_ITER_DEPTH) \
+			it->stack[it->depth++] = node; \
+		else \
+			it->depth = TRP_ITER_SEARCH; \
+		if (!cmp) \
+			break; \
+		node = trp_left_get(a_base, a_field, node); \
+	} \
+	return trpn_pointer(a_base, it->cur); \
+} \
+a_attr MAYBE_UNUSED a_type *a_pre##iter_next(struct a_pre##iter *it) \
+{ \
+	a_type *node; \
+	if (it->depth == TRP_ITER_SEARCH) { \
+		if (!~it->cur) \
+			return NULL; \
+		node = a_pre##next(it->treap, trpn_pointer(a_base, it->cur)); \
+		it->cur = trpn_offset(a_base, node); \
+		return node; \
+	} \
+	if (!it->depth) \
+		return NULL; \
+	return a_pre##iter_descend(it, trp_right_get(a_base, a_field, \
+					it->stack[--it->depth])); \
+} \
 
 #endif